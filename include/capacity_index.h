@@ -0,0 +1,107 @@
+#ifndef CAPACITY_INDEX_H
+#define CAPACITY_INDEX_H
+
+#include "../include/material.h"
+
+#define CAPACITY_BLOCK 64 // most wagons in one block, scanned together at the bottom of the trees
+
+struct Train;
+struct Wagon;
+struct WagonClass;
+
+// Up to CAPACITY_BLOCK consecutive wagons of a train. A wagon knows its block and its slot
+// there, and its ID is the number of wagons in the blocks ahead plus slot + 1, so blocks move
+// between trains, and wagons come or go ahead of them, without touching the other wagons
+typedef struct WagonBlock {
+    struct Train *train;
+    int number;                   // place in the train's blocks
+    int count;                    // 0 once every wagon left, until the next rebuild
+    struct Wagon *wagons[CAPACITY_BLOCK];
+    int class_of[CAPACITY_BLOCK]; // class ID by slot, 0 when the wagon has none
+    float free[DIMENSION_COUNT][CAPACITY_BLOCK]; // free capacity by slot, FLT_MAX where unlimited
+    float *max_free;              // leaf of the block in every tree, tree_count * DIMENSION_COUNT
+    int tree_count;
+
+    // Load by slot for the weight distribution queries, see weight_distribution.c
+    double weight[CAPACITY_BLOCK];
+    double weight_sum;            // of the block
+    double moment_sum;            // of (slot + 1) * weight
+    unsigned char lightest[CAPACITY_BLOCK];  // min-heap of slots by weight, ties to the head
+    unsigned char heap_slot[CAPACITY_BLOCK]; // place of each slot in lightest
+    int top_slot;                 // place in the index's heap of blocks, -1 when not in it
+} WagonBlock;
+
+// Free capacity of the wagons in blocks, with max-trees over the blocks (one tree per
+// dimension for every wagon and for each wagon class) for logarithmic "first wagon with
+// room" queries
+typedef struct CapacityIndex {
+    WagonBlock **blocks;          // in train order
+    int block_count, block_capacity;
+    int count;                    // wagons
+    int leaves;                   // leaves of the trees, power of two
+    int class_count;
+    float *block_max;             // (class_count + 1) * DIMENSION_COUNT trees of 2 * leaves nodes
+    int *count_sum;               // Fenwick tree of the block wagon counts, 1-based
+
+    // Load for the weight distribution queries, see weight_distribution.c
+    double *weight_sum;           // Fenwick tree of the block loads, 1-based
+    double moment;                // sum of (position + 1) * weight over the train
+    int window;                   // k of the heaviest-window tree, 0 when there is none
+    int window_leaves;
+    double *window_max;           // max-tree with range add over the loads of k consecutive wagons
+    double *window_add;
+    WagonBlock **lightest;        // min-heap of the blocks by their lightest wagon
+    int heap_count;
+    float weight_limit;           // largest max_weight, ends walks at wagons too heavy for any room
+} CapacityIndex;
+
+// A slot of a block's heap of wagons
+typedef struct LightestEntry {
+    WagonBlock *block;
+    int heap_slot;
+} LightestEntry;
+
+// Walk over the wagons from the lightest up, see weight_distribution.c. The loads
+// must not change until the walk ends
+typedef struct LightestWagons {
+    CapacityIndex *index;
+    LightestEntry *frontier;      // min-heap of the heap slots still to visit
+    int count, capacity;
+} LightestWagons;
+
+void capacity_index_append(struct Train *train, struct Wagon *wagon);
+void capacity_index_insert(struct Train *train, struct Wagon *wagon);
+void capacity_index_remove(struct Train *train, struct Wagon *wagon);
+void capacity_index_rebuild(struct Train *train);
+void capacity_index_split(struct Train *train, int position, struct Train *rest);
+void capacity_index_couple(struct Train *front, struct Train *back);
+void capacity_index_update(struct Wagon *wagon);
+void free_capacity_index(struct Train *train);
+CapacityIndex *get_capacity_index(struct Train *train);
+
+WagonBlock *block_at_position(const CapacityIndex *index, int position, int *slot);
+int block_first_position(const CapacityIndex *index, const WagonBlock *block);
+struct Wagon *wagon_at_position(struct Train *train, int position);
+struct Wagon *find_first_wagon_with_room(struct Train *train, const struct WagonClass *wagon_class,
+                                         const float demand[DIMENSION_COUNT]);
+struct Wagon *find_next_wagon_with_room(struct Train *train, const struct WagonClass *wagon_class,
+                                        const float demand[DIMENSION_COUNT], int position);
+int find_next_position_with_room(struct Train *train, const struct WagonClass *wagon_class,
+                                 const float demand[DIMENSION_COUNT], int position);
+struct Wagon *find_smallest_wagon_that_fits(struct Train *train, const float demand[DIMENSION_COUNT]);
+
+// Kept up to date by capacity_index.c, implemented in weight_distribution.c
+void weight_index_allocate(CapacityIndex *index);
+void weight_index_free(CapacityIndex *index);
+void weight_block_build(WagonBlock *block);
+void weight_index_build(CapacityIndex *index);
+void weight_index_set(CapacityIndex *index, WagonBlock *block, int slot, double weight);
+void weight_index_inserted(CapacityIndex *index, WagonBlock *block, int slot);
+void weight_index_removed(CapacityIndex *index, WagonBlock *block, int slot, double weight);
+
+void start_lightest_wagons(LightestWagons *walk, struct Train *train);
+struct Wagon *next_lightest_wagon(LightestWagons *walk, const struct WagonClass *wagon_class,
+                                  const float demand[DIMENSION_COUNT]);
+void end_lightest_wagons(LightestWagons *walk);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "../include/material.h"
+
+#define CATALOG_FILE "materials.txt"
+
+// Material catalog: materials by ID, a hash table by name and the set of materials in use
+typedef struct MaterialCatalog {
+    MaterialType **materials; // materials[id - 1]
+    int count, capacity;
+    int *buckets;             // open addressing on the name, index into materials or -1
+    int bucket_count;         // power of two
+    int *in_use;              // IDs of the materials with loaded > 0
+    int in_use_count;
+} MaterialCatalog;
+
+MaterialCatalog *create_catalog(void);
+MaterialCatalog *load_catalog_from_file(const char *filename);
+MaterialCatalog *create_default_catalog(void);
+void destroy_catalog(MaterialCatalog *catalog);
+
+MaterialType *add_material(MaterialCatalog *catalog, const char *name, float weight, int quantity);
+MaterialType *find_material(MaterialCatalog *catalog, const char *name);
+MaterialType *get_material(MaterialCatalog *catalog, int id);
+MaterialType *select_material(MaterialCatalog *catalog, const char *prompt);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stddef.h>
+#include "../include/train.h"
+
+// Non-interactive form of the menu operations, used by server mode
+typedef enum CommandType {
+    CMD_PING,
+    CMD_RELOAD,          // 1. Load train status from file
+    CMD_LOAD_HEAD,       // 2. Load material from head of the train
+    CMD_LOAD_WAGON,      // 3. Load material to specific wagon
+    CMD_LOAD_CLASS,      //    Load material into wagons of one class or best fit
+    CMD_UNLOAD_TAIL,     // 4. Unload material from tail of the train
+    CMD_UNLOAD_WAGON,    // 5. Unload material from specific wagon
+    CMD_TRAIN_STATUS,    // 6. Train summary
+    CMD_WAGON_STATUS,    //    Single wagon
+    CMD_WEIGHT_DISTRIBUTION, // 18. Weight distribution
+    CMD_MATERIAL_STATUS, // 7. Materials status
+    CMD_MATERIALS_IN_USE, //   Materials on the train
+    CMD_WAGON_CLASSES,   //    Wagon classes
+    CMD_EMPTY_TRAIN,     // 8. Empty train
+    CMD_EMPTY_WAGON,     //    Empty specific wagon
+    CMD_COMPACT,         // 19. Compact the train
+    CMD_RESERVE,         // 20. Reserve an order
+    CMD_COMMIT,          //    Commit a reservation
+    CMD_ROLLBACK,        //    Roll back a reservation
+    CMD_ESTIMATE,        // 21. Estimate a load
+    CMD_EXPORT,          // 22. Export train status
+    CMD_EVENTS,          // 24. Changes since a cursor
+    CMD_LOAD_STATION,    // 27. Load material for a station
+    CMD_STATION_STOP,    // 28. Station stop
+    CMD_STRATEGY,        // 29. Select loading strategy
+    CMD_SAVE,            // 9. Save train status to file
+    CMD_UNDO,            // 11. Undo last operation
+    CMD_REDO,            // 12. Redo last undone operation
+    CMD_METRICS,         // 14. Dump operation metrics to file
+    CMD_QUIT,
+    CMD_TYPE_COUNT
+} CommandType;
+
+typedef struct Command {
+    CommandType type;
+    int material;  // catalog ID
+    int first_wagon_id; // start of a wagon range, wagon_id is its end
+    int wagon_id;
+    int wagon_class; // class ID, 0 = best fit
+    int quantity; // also the window size of BALANCE and the budget of COMPACT
+    unsigned long cursor; // event sequence EVENTS reads from, see events.h
+    int reservation; // reservation ID, 0 = open a new one
+    int export_kind, export_format; // 1-based, see export.h
+    int station;   // destination station, see station.h
+    int strategy;  // 1-based LoadStrategy, see train.h
+} Command;
+
+#define MAX_COMMAND_ARGUMENTS 3
+
+void build_command(Command *command, CommandType type, const int arguments[MAX_COMMAND_ARGUMENTS]);
+int parse_command(const char *line, Command *command);
+int command_arguments(const Command *command, int arguments[MAX_COMMAND_ARGUMENTS]);
+const char *command_name(CommandType type);
+int command_argument_count(CommandType type);
+int execute_command(Train *train, MaterialCatalog *catalog, const char *filename,
+                    const Command *command, char *reply, size_t reply_size);
+
+#endif
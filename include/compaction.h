@@ -0,0 +1,11 @@
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include "../include/train.h"
+
+#define DEFAULT_COMPACTION_BUDGET 100 // units moved per pass from the menu
+
+int compact_train(Train *train, int budget, int *units_moved);
+void compact_train_main(Train *train);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef COUPLING_H
+#define COUPLING_H
+
+#include "../include/train.h"
+
+int split_train(Train *train, int wagon_id, Train *rest);
+int couple_trains(Train *front, Train *back);
+void coupling_main(Train *train, Train *siding);
+
+#endif
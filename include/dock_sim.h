@@ -0,0 +1,56 @@
+#ifndef DOCK_SIM_H
+#define DOCK_SIM_H
+
+#include "../include/wagon_class.h"
+#include "../include/catalog.h"
+
+#define DEFAULT_SIM_REPLICATIONS 200
+#define DEFAULT_SIM_WORKERS 4
+#define DEFAULT_SIM_HOURS 24.0
+#define DEFAULT_SIM_ORDERS_PER_HOUR 12.0
+#define DEFAULT_SIM_ORDER_UNITS 8            // mean units per order
+#define DEFAULT_SIM_UNITS_PER_MINUTE 1.0     // loading rate of one worker
+#define DEFAULT_SIM_SETUP_MINUTES 5.0        // per order, before the first unit
+#define DEFAULT_SIM_DEPARTURE_MINUTES 120.0  // a train leaves this often
+#define DEFAULT_SIM_MAX_WAGONS 60            // per train
+#define DEFAULT_SIM_STATIONS 5
+#define DEFAULT_SIM_SEED 1
+
+// One simulated staffing level, or a range of them from min_workers to max_workers
+typedef struct SimConfig {
+    int replications;
+    int threads; // 0 = one per core
+    int min_workers, max_workers;
+    double hours;
+    double orders_per_hour;
+    int order_units;
+    double units_per_minute;
+    double setup_minutes;
+    double departure_minutes;
+    int max_wagons;
+    int stations;
+    unsigned long long seed;
+    int show_metrics; // engine operation metrics of all threads after the report
+} SimConfig;
+
+// Outcome of one replication
+typedef struct SimResult {
+    double units_per_hour;   // units that left on trains
+    double orders_per_hour;  // orders loaded
+    double mean_wait;        // minutes from arrival to the start of loading
+    double p95_wait;
+    double mean_wagons;      // per departure
+    int max_wagons;
+    double utilization;      // share of worker time spent loading
+    double mean_departure_delay; // minutes a train waited for loading in progress
+    int orders_waiting;      // still queued at the end
+    int mismatches;          // units a station stop did not find where they were loaded for
+} SimResult;
+
+void init_sim_config(SimConfig *config);
+int simulate_replication(const SimConfig *config, int workers, int replication, WagonClassTable *wagon_classes,
+                         const MaterialCatalog *materials, SimResult *result);
+int run_dock_simulation(const SimConfig *config, WagonClassTable *wagon_classes, const MaterialCatalog *materials);
+int dock_sim_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "../include/train.h"
+
+// Units of one material that would go into one existing wagon, or into a run of new wagons
+typedef struct Placement {
+    MaterialType *material;
+    int first_wagon_id;
+    int wagon_count; // 1 for an existing wagon
+    int units;
+} Placement;
+
+// What a wagon would carry, weight and volume summed batch by batch as the loader sums them
+typedef struct WagonLoad {
+    float weight;
+    float volume;
+    int slots;
+} WagonLoad;
+
+// Consecutive new wagons of one class with the same load each
+typedef struct NewWagonRun {
+    WagonClass *wagon_class;
+    int count;
+    WagonLoad load;
+} NewWagonRun;
+
+// Load of an existing wagon after the earlier lines of the estimate
+typedef struct EstimateSlot {
+    Wagon *wagon;
+    WagonLoad load;
+} EstimateSlot;
+
+// Result of a dry run of one or more order lines. Reset and reuse it to estimate many orders
+typedef struct LoadEstimate {
+    int units_placed;
+    int units_unplaced;   // units that fit in no wagon of the requested class
+    int existing_wagons;  // existing wagons that would take units
+    int new_wagons;
+    Placement *placements;
+    int placement_count, placement_capacity;
+    NewWagonRun *runs;
+    int run_count, run_capacity;
+    EstimateSlot *slots;  // open addressing by wagon, slot_mask + 1 entries
+    int slot_mask, slot_count;
+} LoadEstimate;
+
+void init_load_estimate(LoadEstimate *estimate);
+void reset_load_estimate(LoadEstimate *estimate);
+void free_load_estimate(LoadEstimate *estimate);
+int estimate_load(Train *train, LoadEstimate *estimate, MaterialType *material, int quantity, WagonClass *wagon_class);
+void display_load_estimate(const LoadEstimate *estimate);
+void estimate_load_main(Train *train, MaterialCatalog *catalog);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stddef.h>
+#include "../include/wagon.h"
+
+#define EVENT_RING_SIZE 4096     // events kept for readers, power of two
+#define MAX_EVENT_SUBSCRIBERS 8
+
+// One change to the train. Positions are wagon IDs, which renumbering keeps equal to positions
+typedef enum TrainEventType {
+    EVENT_WAGON_CREATED,     // a wagon was inserted at position wagon_id, the ones behind moved back
+    EVENT_WAGON_DELETED,     // the wagon at position wagon_id was removed, the ones behind moved up
+    EVENT_UNITS_ADDED,       // count units of material_id were added to wagon wagon_id
+    EVENT_UNITS_REMOVED,     // count units of material_id were removed from wagon wagon_id
+    EVENT_WAGONS_RENUMBERED, // the count wagons from position wagon_id on got new IDs
+    EVENT_TRAIN_RELOADED,    // the train was rebuilt from a file, views start over
+    EVENT_WAGONS_DETACHED,   // the count wagons from position wagon_id on went to another train
+    EVENT_WAGONS_ATTACHED    // count wagons with their units came from another train to position wagon_id on
+} TrainEventType;
+
+typedef struct TrainEvent {
+    unsigned long sequence; // 0 for the first event of the train
+    TrainEventType type;
+    int wagon_id;
+    int material_id; // units events only, catalog ID
+    int count;
+} TrainEvent;
+
+typedef void (*TrainEventCallback)(const TrainEvent *event, void *context);
+
+typedef struct EventSubscriber {
+    TrainEventCallback callback;
+    void *context;
+} EventSubscriber;
+
+typedef struct EventFeed {
+    TrainEvent ring[EVENT_RING_SIZE]; // the last EVENT_RING_SIZE events
+    unsigned long next_sequence;
+    EventSubscriber subscribers[MAX_EVENT_SUBSCRIBERS];
+    int subscriber_count;
+} EventFeed;
+
+void enable_events(Train *train);
+void free_events(Train *train);
+
+// Callbacks run synchronously, in the middle of the operation that causes the event
+int subscribe_events(Train *train, TrainEventCallback callback, void *context);
+void unsubscribe_events(Train *train, TrainEventCallback callback, void *context);
+
+// Ring readers keep their own cursor, the sequence of the next event they want
+unsigned long current_event_sequence(Train *train);
+int read_events(Train *train, unsigned long *cursor, TrainEvent *events, int max_events);
+
+// Called by the wagon functions for every mutation
+void event_units_changed(Wagon *wagon, MaterialType *material, int count);
+void event_wagon_created(Train *train, int wagon_id);
+void event_wagon_deleted(Train *train, int wagon_id);
+void event_wagons_renumbered(Train *train, int first_wagon_id, int count);
+void event_train_reloaded(Train *train);
+void event_wagons_moved(Train *train, TrainEventType type, int first_wagon_id, int count);
+
+int format_event(const TrainEvent *event, MaterialCatalog *catalog, char *text, size_t text_size);
+void display_changes_main(Train *train, MaterialCatalog *catalog);
+
+#endif
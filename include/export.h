@@ -0,0 +1,29 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+#include "../include/train.h"
+
+#define EXPORT_BUFFER_SIZE (1 << 20) // bytes collected before each write
+#define EXPORT_ROW_MAX 512           // longest row, names included
+
+typedef enum ExportKind {
+    EXPORT_WAGONS,          // one row per wagon
+    EXPORT_WAGON_MATERIALS, // one row per wagon and material on it
+    EXPORT_MATERIALS,       // one row per catalog material
+    EXPORT_KIND_COUNT
+} ExportKind;
+
+typedef enum ExportFormat {
+    EXPORT_CSV,
+    EXPORT_JSON_LINES,
+    EXPORT_FORMAT_COUNT
+} ExportFormat;
+
+const char *export_file_name(ExportKind kind, ExportFormat format);
+long export_train(Train *train, MaterialCatalog *catalog, ExportKind kind, ExportFormat format, FILE *out);
+long export_train_to_file(Train *train, MaterialCatalog *catalog, ExportKind kind, ExportFormat format,
+                          const char *filename);
+void export_train_main(Train *train, MaterialCatalog *catalog);
+
+#endif
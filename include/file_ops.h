@@ -5,9 +5,16 @@
 #include "../include/train.h"
 #include "../include/utils.h"
 #include "../include/material.h"
+#include "../include/catalog.h"
 #include "../include/wagon.h"
 
-void load_train_status_from_file(Train *train, const char *filename);
+#define FILE_MAX_THREADS 16     // ranges a manifest is loaded or saved in at most
+#define FILE_RANGE_WAGONS 2048  // fewest wagons worth a range of their own
+
+extern int file_threads;      // 0 = one per core
+extern int file_range_wagons;
+
+void load_train_status_from_file(Train *train, const char *filename, MaterialCatalog *catalog);
 void save_train_status_to_file(Train *train, const char *filename);
 
 
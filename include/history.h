@@ -0,0 +1,56 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "../include/wagon.h"
+
+#define HISTORY_DEPTH 100 // operations kept for undo
+
+// One elementary change inside an operation, together with what is needed to invert it
+typedef enum ChangeType {
+    CHANGE_UNITS_ADDED,
+    CHANGE_UNITS_REMOVED,
+    CHANGE_WAGON_CREATED,
+    CHANGE_WAGON_DELETED
+} ChangeType;
+
+typedef struct Change {
+    ChangeType type;
+    Wagon *wagon;
+    Wagon *prev;            // wagon before it when it was linked or unlinked (NULL = head)
+    MaterialType *material; // units only
+    int count;              // units only
+    int destination;        // units only, station the units are for
+    int position;           // units only, place of the first unit in the wagon from the top
+} Change;
+
+typedef struct Operation {
+    char label[40];
+    Change *changes;
+    int change_count, change_capacity;
+} Operation;
+
+typedef struct History {
+    Operation *undo[HISTORY_DEPTH];
+    int undo_count;
+    Operation *redo[HISTORY_DEPTH];
+    int redo_count;
+    Operation *current; // operation being recorded
+    int nesting;        // nested begin_operation() calls join the outer operation
+    int replaying;      // set while undoing/redoing so nothing is recorded
+} History;
+
+void enable_history(Train *train);
+void free_history(Train *train);
+void clear_history(Train *train);
+void begin_operation(Train *train, const char *label);
+void end_operation(Train *train);
+
+// Called by the wagon functions for every mutation
+void history_record_units(Wagon *wagon, MaterialType *material, int count, int destination, int position);
+void history_record_wagon_created(Wagon *wagon);
+int history_record_wagon_deleted(Train *train, Wagon *wagon, Wagon *prev);
+
+int undo_last_operation(Train *train);
+int redo_last_operation(Train *train);
+
+#endif
@@ -3,19 +3,49 @@
 
 struct Train;         
 struct Wagon;     
+struct MaterialCatalog;
+struct WagonCargo;
+
+// Capacity a unit takes and a wagon offers. A wagon limit of 0 means unlimited
+typedef enum CapacityDimension {
+    DIM_WEIGHT, // kg
+    DIM_VOLUME, // m3
+    DIM_SLOTS,  // pallet slots
+    DIMENSION_COUNT
+} CapacityDimension;
 
 typedef struct MaterialType {
     char name[50];
     float weight;
+    float volume; // m3 per unit
+    int slots;    // pallet slots per unit
     int quantity; // Total available
     int loaded;   // Currently on train
+    int reserved; // Held by open reservations
+    int id;       // 1-based catalog ID, 0 when not in a catalog
+    struct MaterialCatalog *catalog;
+    int in_use_slot; // position in catalog->in_use while loaded > 0
+    struct WagonCargo *carriers; // wagons holding units of it, in no particular order
+    int carrier_count;
 } MaterialType;
 
+// Units of one material in one wagon, linked into the material's carriers and the wagon's cargo
+typedef struct WagonCargo {
+    struct Wagon *wagon;
+    struct MaterialType *material;
+    int units;
+    struct WagonCargo *prev_carrier, *next_carrier;
+    struct WagonCargo *next_in_wagon;
+} WagonCargo;
+
 typedef struct LoadedMaterial {
     struct MaterialType *type;
+    int destination; // station the unit is for, 0 = none
     struct LoadedMaterial *next, *prev;
 } LoadedMaterial;
 
-void display_material_status(MaterialType *materials, int material_count, struct Train *train);
+void adjust_loaded_quantity(MaterialType *material, int delta);
+void adjust_wagon_cargo(struct Wagon *wagon, MaterialType *material, int units);
+void display_material_status(struct MaterialCatalog *catalog, int only_in_use);
 
 #endif 
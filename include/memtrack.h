@@ -0,0 +1,42 @@
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <stddef.h>
+
+// Object types whose allocations are accounted. Add new types here and in memory_type_names
+typedef enum MemoryType {
+    MEM_TRAIN,
+    MEM_WAGON,
+    MEM_LOADED_MATERIAL,
+    MEM_MATERIAL_TYPE,
+    MEM_HISTORY,
+    MEM_WAGON_CLASS,
+    MEM_CAPACITY_INDEX,
+    MEM_RESERVATION,
+    MEM_EVENT_FEED,
+    MEM_STATION_INDEX,
+    MEM_WAGON_CARGO,
+    MEM_TYPE_COUNT
+} MemoryType;
+
+typedef struct MemoryStats {
+    long live_objects;
+    long live_bytes;
+    long peak_objects;
+    long peak_bytes;
+    long allocations; // total since start
+    long frees;
+} MemoryStats;
+
+void *tracked_malloc(MemoryType type, size_t size);
+void *tracked_calloc(MemoryType type, size_t count, size_t size);
+void *tracked_realloc(MemoryType type, void *ptr, size_t old_size, size_t new_size);
+void tracked_free(MemoryType type, void *ptr, size_t size);
+
+const MemoryStats *get_memory_stats(MemoryType type);
+void copy_memory_stats(MemoryStats stats[MEM_TYPE_COUNT]);
+void merge_memory_stats(const MemoryStats stats[MEM_TYPE_COUNT]);
+void display_memory_report(void);
+void report_memory_at_exit(void);
+
+#endif
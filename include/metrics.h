@@ -0,0 +1,66 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#define METRIC_BUCKETS 32 // bucket i counts durations in [2^(i-1), 2^i) ns, the last one everything above
+#define METRICS_FILE "metrics.prom"
+
+typedef enum MetricId {
+    // Operations dispatched from the menu
+    METRIC_LOAD_FROM_FILE,
+    METRIC_LOAD_FROM_HEAD,
+    METRIC_LOAD_TO_WAGON,
+    METRIC_UNLOAD_FROM_TAIL,
+    METRIC_UNLOAD_FROM_WAGON,
+    METRIC_DISPLAY_TRAIN,
+    METRIC_DISPLAY_MATERIALS,
+    METRIC_EMPTY_TRAIN,
+    METRIC_EMPTY_WAGON,
+    METRIC_SAVE_TO_FILE,
+    METRIC_UNDO,
+    METRIC_REDO,
+    METRIC_WEIGHT_DISTRIBUTION,
+    METRIC_COMPACT,
+    METRIC_RESERVE,
+    METRIC_COMMIT_RESERVATION,
+    METRIC_ESTIMATE,
+    METRIC_EXPORT,
+    METRIC_TRAIN_VIEW,
+    METRIC_SPLIT,
+    METRIC_COUPLE,
+    METRIC_STATION_STOP,
+    METRIC_LOAD_BALANCED,
+    METRIC_LOAD_BEST_FIT,
+    // Internal hot spots
+    METRIC_WAGON_LOOKUP,
+    METRIC_CAPACITY_SEARCH,
+    METRIC_LIGHTEST_SEARCH,
+    METRIC_LIST_INSERT,
+    METRIC_DELETE_EMPTY_WAGONS,
+    METRIC_FILE_PARSE,
+    METRIC_FILE_WRITE,
+    METRIC_COUNT
+} MetricId;
+
+typedef struct Metric {
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long buckets[METRIC_BUCKETS];
+} Metric;
+
+unsigned long long metrics_now(void);
+void metrics_record(MetricId id, unsigned long long elapsed_ns);
+const Metric *get_metric(MetricId id);
+const char *metric_name(MetricId id);
+void reset_metrics(void);
+void copy_metrics(Metric table[METRIC_COUNT]);
+void merge_metrics(const Metric table[METRIC_COUNT]);
+
+void display_metrics(void);
+int dump_metrics_to_file(const char *filename);
+
+// Time a block: METRIC_START(t); ... METRIC_STOP(METRIC_X, t);
+#define METRIC_START(timer) unsigned long long timer = metrics_now()
+#define METRIC_STOP(id, timer) metrics_record((id), metrics_now() - (timer))
+
+#endif
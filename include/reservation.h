@@ -0,0 +1,39 @@
+#ifndef RESERVATION_H
+#define RESERVATION_H
+
+#include "../include/train.h"
+
+// Units of one material held in one wagon
+typedef struct ReservedUnits {
+    Wagon *wagon;          // NULL when the units go into a wagon added on commit
+    int new_wagon;         // index into new_wagons when wagon is NULL
+    MaterialType *material;
+    int count;
+} ReservedUnits;
+
+// Wagon the reservation adds to the tail on commit
+typedef struct PlannedWagon {
+    WagonClass *wagon_class;
+    float free[DIMENSION_COUNT];
+} PlannedWagon;
+
+typedef struct Reservation {
+    int id;
+    Train *train;
+    ReservedUnits *entries;
+    int entry_count, entry_capacity;
+    PlannedWagon *new_wagons;
+    int new_wagon_count, new_wagon_capacity;
+    int units;
+    struct Reservation *next; // next open reservation of the train
+} Reservation;
+
+Reservation *open_reservation(Train *train);
+Reservation *find_reservation(Train *train, int id);
+int reserve_material(Reservation *reservation, MaterialType *material, int quantity, WagonClass *wagon_class);
+int commit_reservation(Reservation *reservation);
+int rollback_reservation(Reservation *reservation);
+void rollback_all_reservations(Train *train);
+void reserve_order_main(Train *train, MaterialCatalog *catalog);
+
+#endif
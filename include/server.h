@@ -0,0 +1,14 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "../include/train.h"
+#include "../include/trace.h"
+
+// Address is a Unix socket path, or "tcp:<port>" for 127.0.0.1
+#define DEFAULT_SERVER_ADDRESS "train.sock"
+
+// trace, when not NULL, records every executed command
+int run_server(Train *train, MaterialCatalog *catalog, const char *filename, const char *address,
+               TraceWriter *trace);
+
+#endif
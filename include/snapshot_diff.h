@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT_DIFF_H
+#define SNAPSHOT_DIFF_H
+
+#include <stdio.h>
+#include "../include/catalog.h"
+
+#define DIFF_WINDOW 16 // wagons of the old train looked ahead for one that was kept
+
+// Units of one material in a wagon, the material by its ID in SnapshotReader.names
+typedef struct MaterialCount {
+    int material;
+    int count;
+} MaterialCount;
+
+// One wagon of a snapshot, reduced to what the diff compares
+typedef struct WagonSnapshot {
+    int wagon_id;
+    char class_name[32];
+    float max_weight, current_weight;
+    int units;
+    MaterialCount *materials; // distinct materials in stack order
+    int material_count, material_capacity;
+} WagonSnapshot;
+
+// Reads a snapshot one wagon at a time. next_wagon returns 0 after the last wagon;
+// other file formats plug in their own next_wagon
+typedef struct SnapshotReader {
+    FILE *file;
+    char line[256];
+    int has_line;              // line holds a read but unprocessed line
+    char train_id[20];
+    int total_wagons;          // as declared in the header
+    MaterialCatalog *names;    // material names seen, shared by both readers of a diff
+    int (*next_wagon)(struct SnapshotReader *reader, WagonSnapshot *wagon);
+} SnapshotReader;
+
+int open_snapshot(SnapshotReader *reader, const char *filename, MaterialCatalog *names);
+void close_snapshot(SnapshotReader *reader);
+int diff_snapshots(const char *before_file, const char *after_file, FILE *out);
+void diff_snapshots_main(void);
+
+#endif
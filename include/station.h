@@ -0,0 +1,41 @@
+#ifndef STATION_H
+#define STATION_H
+
+#include "../include/train.h"
+
+#define MAX_STATION_ID 9999 // stations are numbered 1..MAX_STATION_ID, 0 = no destination
+
+// Units of one wagon for one station, linked into the station's list and the wagon's list
+typedef struct WagonStop {
+    Wagon *wagon;
+    int station;
+    int units;
+    struct WagonStop *prev_at_station, *next_at_station;
+    struct WagonStop *next_in_wagon;
+} WagonStop;
+
+typedef struct Station {
+    WagonStop *wagons; // wagons with units for the station, in no particular order
+    int wagon_count;
+    long units;
+} Station;
+
+// Per-train index of which wagons hold units for which station
+typedef struct StationIndex {
+    Station *stations; // stations[id], grown on demand
+    int capacity;
+} StationIndex;
+
+// Called by the wagon functions for every unit with a destination that comes or goes
+void station_index_add(Wagon *wagon, int station, int units);
+void station_index_move_wagons(Train *from, Train *to);
+void free_station_index(Train *train);
+
+long station_units(Train *train, int station);
+int load_material_for_station(Train *train, MaterialType *material, int quantity, int station);
+int station_stop(Train *train, int station, int *wagons_touched);
+void display_stations(Train *train);
+void load_material_for_station_main(Train *train, MaterialCatalog *catalog);
+void station_stop_main(Train *train);
+
+#endif
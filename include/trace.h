@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include "../include/command.h"
+
+#define TRACE_MAGIC "FTLTRACE"
+#define TRACE_VERSION 3 // 2: STRATEGY added, command types after it renumbered. 3: whole EVENTS cursors
+#define TRACE_START_SUFFIX ".start" // train status when the trace was opened, next to the trace
+
+typedef struct TraceWriter {
+    FILE *file;
+    unsigned long long opened_ns, last_start_ns;
+    long records;
+} TraceWriter;
+
+typedef struct TraceReader {
+    FILE *file;
+    unsigned long long last_start_ns;
+    long records;
+} TraceReader;
+
+typedef struct TraceRecord {
+    Command command;
+    int ok; // what execute_command() returned
+    unsigned long long start_ns; // since the trace was opened
+    unsigned long long duration_ns;
+} TraceRecord;
+
+TraceWriter *open_trace(const char *filename, Train *train);
+void trace_command(TraceWriter *trace, const Command *command, unsigned long long start_ns,
+                   unsigned long long duration_ns, int ok);
+void close_trace(TraceWriter *trace);
+
+int open_trace_reader(TraceReader *reader, const char *filename);
+int read_trace_record(TraceReader *reader, TraceRecord *record);
+void close_trace_reader(TraceReader *reader);
+
+#endif
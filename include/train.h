@@ -3,23 +3,54 @@
 
 #include "../include/wagon.h"
 
+struct History;
+struct CapacityIndex;
+struct Reservation;
+struct EventFeed;
+struct StationIndex;
+
+// Where load_specified_material_to_train() and load_material_to_class() put the units
+typedef enum LoadStrategy {
+    LOAD_HEAD_FIRST, // fill wagons from the head
+    LOAD_BALANCED,   // spread over the least-loaded wagons with room
+    LOAD_STRATEGY_COUNT
+} LoadStrategy;
+
 // Train structure
 typedef struct Train {
     char train_id[20];  // Train identifier
     Wagon *first_wagon; // Pointer to the first wagon
+    Wagon *last_wagon;  // Pointer to the last wagon
     int wagon_count;    // Total wagons
+    struct History *history; // Undo/redo log, NULL when not recorded
+    WagonClassTable *wagon_classes;       // Classes new wagons are built from, not owned
+    struct CapacityIndex *capacity_index; // Free weight by position, see capacity_index.h
+    struct Reservation *reservations;     // Open reservations, see reservation.h
+    int next_reservation_id;
+    struct EventFeed *events;             // Change-event feed, NULL when not published, see events.h
+    struct StationIndex *stations;        // Wagons by destination, NULL until units are loaded for a station
+    int load_destination;                 // Station new units are loaded for, 0 = none
+    LoadStrategy load_strategy;
 } Train;
 
 // Train management functions
-Train *create_train();
+Train *create_train(WagonClassTable *wagon_classes);
+void destroy_train(Train *train);
 void display_train_status(Train *train);
 
 // Material loading/unloading functions
 void load_material_to_train(Train *train, MaterialType *material);
-void load_specified_material_to_train(Train *train, MaterialType *material, int quantity);
-void unload_material_from_tail(Train *train, MaterialType *materials, int material_count);
-void load_specified_material_to_train_main(Train *train, MaterialType *materials, int material_count);
+int load_specified_material_to_train(Train *train, MaterialType *material, int quantity);
+int load_material_to_class(Train *train, MaterialType *material, int quantity, WagonClass *wagon_class);
+int load_order_best_fit(Train *train, MaterialType *material, int quantity);
+const char *load_strategy_name(LoadStrategy strategy);
+void select_load_strategy_main(Train *train);
+void unload_material_from_tail(Train *train, MaterialCatalog *catalog);
+int unload_material_quantity_from_tail(Train *train, MaterialType *material, int quantity);
+void load_specified_material_to_train_main(Train *train, MaterialCatalog *catalog);
 void empty_train_or_wagon(Train *train);
+void empty_entire_train(Train *train);
+int empty_wagon_by_id(Train *train, int wagon_id);
 
 
 #endif 
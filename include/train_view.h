@@ -0,0 +1,18 @@
+#ifndef TRAIN_VIEW_H
+#define TRAIN_VIEW_H
+
+#include "../include/train.h"
+
+#define VIEW_PAGE_SIZE 20 // wagons per page of the interactive views
+
+void display_wagon_summary(Wagon *wagon);
+int display_wagon_range(Train *train, int first_wagon_id, int last_wagon_id);
+
+// Print up to max_wagons matching wagons from first_wagon_id on.
+// Returns the wagon ID to continue from, 0 once the tail is reached
+int display_wagons_with_material(Train *train, MaterialType *material, int first_wagon_id, int max_wagons);
+int display_wagons_with_room(Train *train, int max_fill_percent, int first_wagon_id, int max_wagons);
+
+void display_train_view_main(Train *train, MaterialCatalog *catalog);
+
+#endif
@@ -5,8 +5,24 @@ struct Train;
 struct MaterialType;  
 struct Wagon;       
 
+#include "../include/material.h"
+
+// Slack of the fit checks, in kg and m3: sums of unit weights and volumes that are not binary
+// fractions may round a little past a capacity the units fill exactly
+#define FIT_EPSILON 1e-3
+
+// When set, log_message() output is suppressed (server mode, tools). Set per thread
+extern _Thread_local int quiet_output;
+
+int available_quantity(const struct MaterialType *material);
 int check_material_availability(struct MaterialType *material, int quantity);
 int check_wagon_space(struct Wagon *wagon, struct MaterialType *material);
+float sum_after_units(float sum, float per_unit, int count);
+void wagon_free_capacity(const struct Wagon *wagon, float free[DIMENSION_COUNT]);
+void material_demand(const struct MaterialType *material, float demand[DIMENSION_COUNT]);
+int max_units_that_fit(const float free[DIMENSION_COUNT], const float demand[DIMENSION_COUNT]);
+int wagon_units_that_fit(const struct Wagon *wagon, const struct MaterialType *material);
 void clear_stdin();
+void log_message(const char *format, ...);
 
 #endif 
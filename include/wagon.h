@@ -2,30 +2,60 @@
 #define WAGON_H
 
 #include "../include/material.h"
+#include "../include/catalog.h"
+#include "../include/wagon_class.h"
 
 typedef struct Train Train;
+struct WagonStop;
+struct WagonBlock;
+
+#define ANY_DESTINATION -1
 
 
 typedef struct Wagon {
-    int wagon_id;                     // Unique ID for the wagon
     float max_weight;                 // Maximum weight capacity
     float current_weight;             // Current weight of the wagon
+    float max_volume, current_volume; // m3, max_volume 0 = no volume limit
+    int max_slots, used_slots;        // pallet slots, max_slots 0 = no slot limit
     LoadedMaterial *loaded_materials; // List of loaded materials
     struct Wagon *next, *prev;        // Pointers for the doubly linked list
+    struct WagonBlock *block;         // Block of the train's capacity index, NULL when in no train
+    int slot;                         // in the block, see get_wagon_id()
+    WagonClass *wagon_class;          // Class the wagon was built as
+    float reserved_weight, reserved_volume; // held by open reservations, see reservation.h
+    int reserved_slots, reserved_units;
+    struct WagonStop *stops;          // stations the units are for, see station.h
+    struct WagonCargo *cargo;         // units by material, see material.h
 } Wagon;
 
 // Wagon management functions
 Wagon *create_new_wagon(Train *train);
+Wagon *create_wagon_of_class(Train *train, WagonClass *wagon_class);
+Wagon *find_wagon_by_id(Train *train, int wagon_id);
 void delete_empty_wagons(Train *train);
 void empty_specific_wagon(Wagon *wagon);
+void link_wagon_after(Train *train, Wagon *wagon, Wagon *prev);
+void unlink_wagon(Train *train, Wagon *wagon);
+
+// Derived from the wagon's place in the capacity index, see capacity_index.c
+int get_wagon_id(const Wagon *wagon);
+Train *get_wagon_train(const Wagon *wagon);
+int wagon_ahead_of(const Wagon *wagon, const Wagon *other);
 
 // Material handling functions
 void insert_material_into_wagon(Wagon *wagon, MaterialType *material);
-void load_material_to_wagon(Train *train, MaterialType *material, int wagon_id, int quantity);
+void add_materials_to_wagon(Wagon *wagon, MaterialType *material, int count);
+void add_materials_for_destination(Wagon *wagon, MaterialType *material, int count, int destination);
+void add_materials_at(Wagon *wagon, MaterialType *material, int count, int destination, int position);
+int remove_materials_from_wagon(Wagon *wagon, MaterialType *material, int count);
+int remove_materials_for_destination(Wagon *wagon, MaterialType *material, int count, int destination);
+int remove_materials_at(Wagon *wagon, int count, int position);
+int remove_all_materials_from_wagon(Wagon *wagon);
+int load_material_to_wagon(Train *train, MaterialType *material, int wagon_id, int quantity);
 void display_wagon_status(Wagon *wagon);
-void load_material_to_wagon_main(Train *train, MaterialType *materials, int material_count);
-void unload_material_from_wagon_main(Train *train, MaterialType *materials, int material_count);
-void unload_material_from_wagon(Wagon *wagon, MaterialType *material, int quantity);
+void load_material_to_wagon_main(Train *train, MaterialCatalog *catalog);
+void unload_material_from_wagon_main(Train *train, MaterialCatalog *catalog);
+int unload_material_from_wagon(Wagon *wagon, MaterialType *material, int quantity);
 Wagon *delete_empty_wagon_if_needed(Train *train, Wagon *wagon);
 
 #endif 
@@ -0,0 +1,40 @@
+#ifndef WAGON_CLASS_H
+#define WAGON_CLASS_H
+
+#include "../include/material.h"
+
+#define WAGON_CLASS_FILE "wagon_classes.txt"
+#define DEFAULT_WAGON_CLASS "Standard"
+#define DEFAULT_WAGON_CAPACITY 1000.0
+
+// A kind of wagon in the fleet. Every wagon of a class gets its capacity
+typedef struct WagonClass {
+    int id; // 1-based, in file order
+    char name[32];
+    float max_weight;
+    float max_volume; // 0 = no limit
+    int max_slots;    // 0 = no limit
+} WagonClass;
+
+// Wagon classes by ID, plus the IDs ordered by capacity for best-fit selection
+typedef struct WagonClassTable {
+    WagonClass **classes; // classes[id - 1], the first one is the default class
+    int *by_capacity;     // IDs sorted by max_weight, then by ID
+    int count, capacity;
+} WagonClassTable;
+
+WagonClassTable *create_wagon_class_table(void);
+WagonClassTable *load_wagon_classes_from_file(const char *filename);
+WagonClassTable *create_default_wagon_classes(void);
+void destroy_wagon_class_table(WagonClassTable *table);
+
+WagonClass *add_wagon_class(WagonClassTable *table, const char *name, float max_weight);
+WagonClass *find_wagon_class(WagonClassTable *table, const char *name);
+WagonClass *get_wagon_class(WagonClassTable *table, int id);
+WagonClass *default_wagon_class(WagonClassTable *table);
+WagonClass *smallest_class_that_fits(WagonClassTable *table, const float demand[DIMENSION_COUNT]);
+void wagon_class_capacity(const WagonClass *wagon_class, float capacity[DIMENSION_COUNT]);
+WagonClass *select_wagon_class(WagonClassTable *table, const char *prompt, int *canceled);
+void display_wagon_classes(WagonClassTable *table);
+
+#endif
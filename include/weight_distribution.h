@@ -0,0 +1,12 @@
+#ifndef WEIGHT_DISTRIBUTION_H
+#define WEIGHT_DISTRIBUTION_H
+
+#include "../include/train.h"
+
+double range_weight(Train *train, int first_wagon_id, int last_wagon_id);
+int centre_of_mass(Train *train, double *position);
+int heaviest_window(Train *train, int window, int *first_wagon_id, double *weight);
+void display_weight_distribution(Train *train, int first_wagon_id, int last_wagon_id, int window);
+void display_weight_distribution_main(Train *train);
+
+#endif
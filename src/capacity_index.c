@@ -0,0 +1,727 @@
+// capacity_index.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "../include/capacity_index.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/wagon_class.h"
+#include "../include/utils.h"
+#include "../include/memtrack.h"
+
+/*
+ * The wagons of a train are kept in blocks of up to CAPACITY_BLOCK
+ * consecutive wagons, each with packed per-dimension arrays of their free
+ * capacity. For every dimension there is an implicit binary max-tree over
+ * the blocks: node 1 is the root, node i has children 2i and 2i+1, and
+ * leaf 'leaves + b' holds the largest free capacity in block b. Tree 0
+ * covers every wagon, tree k only the wagons of class k.
+ *
+ * A query walks down the trees, skipping subtrees where some dimension has
+ * no wagon with enough room, and scans the blocks it reaches. The scan
+ * compares the packed arrays of a whole block at once, without branches,
+ * so the compiler can vectorize it. The per-dimension maxima of a block
+ * may come from different wagons, so a scan can come up empty and the
+ * walk then backtracks to the next candidate block.
+ *
+ * Wagons do not store their ID. A wagon points to its block and its slot
+ * there, and a Fenwick tree over the block wagon counts turns that into a
+ * position in O(log n), or a position into a wagon. So no wagon changes
+ * when wagons come or go ahead of it, or when its block moves to another
+ * train: splitting a train cuts one block in two and hands the blocks
+ * behind the cut to the other train, coupling hands over the blocks of
+ * the back train, and both then only lay out the trees over the blocks
+ * again, from each block's cached maxima.
+ *
+ * Loads and unloads refresh one slot and its block on the way up. A wagon
+ * linked or unlinked anywhere in the train moves the slots behind it in
+ * its block and updates the block's leaves and count, in
+ * O(CAPACITY_BLOCK + log n). A full block is split in two first, which
+ * lays the trees out again, at most once per CAPACITY_BLOCK / 2 wagons
+ * linked into it. A block whose wagons all left stays, empty, until the
+ * index is rebuilt from the list.
+ *
+ * The blocks also carry the load of their wagons for weight_distribution.c.
+ */
+
+#define NO_WAGON (-FLT_MAX)
+
+static float *tree_of(CapacityIndex *index, int tree, int dimension)
+{
+    return index->block_max + ((size_t)tree * DIMENSION_COUNT + dimension) * 2 * index->leaves;
+}
+
+static size_t tree_nodes(const CapacityIndex *index)
+{
+    return (size_t)(index->class_count + 1) * DIMENSION_COUNT * 2 * index->leaves;
+}
+
+static int class_id_of(const Wagon *wagon)
+{
+    return wagon->wagon_class ? wagon->wagon_class->id : 0;
+}
+
+static void set_leaf(float *tree, int leaves, int block, float value)
+{
+    int node = leaves + block;
+    tree[node] = value;
+    for (node /= 2; node > 0; node /= 2)
+    {
+        float left = tree[2 * node], right = tree[2 * node + 1];
+        float max = left > right ? left : right;
+        if (tree[node] == max)
+            break;
+        tree[node] = max;
+    }
+}
+
+static void count_add(CapacityIndex *index, int number, int delta)
+{
+    for (int i = number + 1; i <= index->leaves; i += i & (-i))
+        index->count_sum[i] += delta;
+}
+
+// Wagons in the blocks ahead of block 'number'
+static int count_before(const CapacityIndex *index, int number)
+{
+    int count = 0;
+    for (int i = number; i > 0; i -= i & (-i))
+        count += index->count_sum[i];
+    return count;
+}
+
+int block_first_position(const CapacityIndex *index, const WagonBlock *block)
+{
+    return count_before(index, block->number);
+}
+
+// Block holding the 0-based position, which must be in the train, and the slot there
+WagonBlock *block_at_position(const CapacityIndex *index, int position, int *slot)
+{
+    int number = 0;
+    for (int step = index->leaves; step > 0; step /= 2)
+    {
+        if (number + step <= index->leaves && index->count_sum[number + step] <= position)
+        {
+            number += step;
+            position -= index->count_sum[number];
+        }
+    }
+    *slot = position;
+    return index->blocks[number];
+}
+
+int get_wagon_id(const Wagon *wagon)
+{
+    if (!wagon->block)
+        return 0;
+    return count_before(wagon->block->train->capacity_index, wagon->block->number) + wagon->slot + 1;
+}
+
+Train *get_wagon_train(const Wagon *wagon)
+{
+    return wagon->block ? wagon->block->train : NULL;
+}
+
+// Whether the wagon is nearer the head than the other one of the same train
+int wagon_ahead_of(const Wagon *wagon, const Wagon *other)
+{
+    if (wagon->block != other->block)
+        return wagon->block->number < other->block->number;
+    return wagon->slot < other->slot;
+}
+
+static WagonBlock *new_block(void)
+{
+    WagonBlock *block = (WagonBlock *)tracked_calloc(MEM_CAPACITY_INDEX, 1, sizeof(WagonBlock));
+    block->top_slot = -1;
+    return block;
+}
+
+static void free_block(WagonBlock *block)
+{
+    tracked_free(MEM_CAPACITY_INDEX, block->max_free, sizeof(float) * block->tree_count * DIMENSION_COUNT);
+    tracked_free(MEM_CAPACITY_INDEX, block, sizeof(WagonBlock));
+}
+
+// Capacity of the wagon into a slot, its load is set by the caller
+static void store_slot(WagonBlock *block, int slot, Wagon *wagon)
+{
+    float free[DIMENSION_COUNT];
+    wagon_free_capacity(wagon, free);
+
+    block->wagons[slot] = wagon;
+    block->class_of[slot] = class_id_of(wagon);
+    for (int d = 0; d < DIMENSION_COUNT; d++)
+        block->free[d][slot] = free[d];
+    wagon->block = block;
+    wagon->slot = slot;
+}
+
+static void copy_slot(WagonBlock *to, int to_slot, const WagonBlock *from, int from_slot)
+{
+    Wagon *wagon = from->wagons[from_slot];
+
+    to->wagons[to_slot] = wagon;
+    to->class_of[to_slot] = from->class_of[from_slot];
+    for (int d = 0; d < DIMENSION_COUNT; d++)
+        to->free[d][to_slot] = from->free[d][from_slot];
+    to->weight[to_slot] = from->weight[from_slot];
+    wagon->block = to;
+    wagon->slot = to_slot;
+}
+
+// Largest free capacity in one dimension over the wagons of a block, only of one class unless wagon_class is 0
+static float block_max_free(const WagonBlock *block, int dimension, int wagon_class)
+{
+    const float *free = block->free[dimension];
+    float max = NO_WAGON;
+
+    for (int slot = 0; slot < block->count; slot++)
+    {
+        float value = (wagon_class == 0 || block->class_of[slot] == wagon_class) ? free[slot] : NO_WAGON;
+        max = value > max ? value : max;
+    }
+    return max;
+}
+
+// Cached leaves of the block for every tree
+static void compute_max_free(WagonBlock *block, int tree_count)
+{
+    if (block->tree_count != tree_count)
+    {
+        block->max_free = (float *)tracked_realloc(MEM_CAPACITY_INDEX, block->max_free,
+                                                   sizeof(float) * block->tree_count * DIMENSION_COUNT,
+                                                   sizeof(float) * tree_count * DIMENSION_COUNT);
+        block->tree_count = tree_count;
+    }
+    for (int tree = 0; tree < tree_count; tree++)
+    {
+        for (int d = 0; d < DIMENSION_COUNT; d++)
+            block->max_free[tree * DIMENSION_COUNT + d] = block_max_free(block, d, tree);
+    }
+}
+
+static void refresh_tree(CapacityIndex *index, WagonBlock *block, int tree)
+{
+    for (int d = 0; d < DIMENSION_COUNT; d++)
+    {
+        float max = block_max_free(block, d, tree);
+        block->max_free[tree * DIMENSION_COUNT + d] = max;
+        set_leaf(tree_of(index, tree, d), index->leaves, block->number, max);
+    }
+}
+
+// The wagons of the class, and so every wagon, changed in the block
+static void refresh_block(CapacityIndex *index, WagonBlock *block, int wagon_class)
+{
+    refresh_tree(index, block, 0);
+    if (wagon_class > 0 && wagon_class <= index->class_count)
+        refresh_tree(index, block, wagon_class);
+}
+
+static void free_trees(CapacityIndex *index)
+{
+    tracked_free(MEM_CAPACITY_INDEX, index->block_max, sizeof(float) * tree_nodes(index));
+    tracked_free(MEM_CAPACITY_INDEX, index->count_sum, sizeof(int) * (index->leaves + 1));
+    weight_index_free(index);
+    index->block_max = NULL;
+}
+
+// Lay the trees out over the blocks again, after blocks came or went or the wagon classes changed.
+// Costs O(blocks * trees), the wagons are only read for blocks without cached leaves
+static void layout_trees(Train *train)
+{
+    CapacityIndex *index = train->capacity_index;
+    int class_count = train->wagon_classes ? train->wagon_classes->count : 0;
+    int leaves = 1;
+    while (leaves < index->block_count)
+        leaves *= 2;
+
+    if (!index->block_max || leaves != index->leaves || class_count != index->class_count)
+    {
+        if (index->block_max)
+            free_trees(index);
+        index->leaves = leaves;
+        index->class_count = class_count;
+        index->block_max = (float *)tracked_malloc(MEM_CAPACITY_INDEX, sizeof(float) * tree_nodes(index));
+        index->count_sum = (int *)tracked_malloc(MEM_CAPACITY_INDEX, sizeof(int) * (leaves + 1));
+        weight_index_allocate(index);
+    }
+
+    for (int b = 0; b < index->block_count; b++)
+    {
+        WagonBlock *block = index->blocks[b];
+        block->number = b;
+        block->train = train;
+        if (block->tree_count != class_count + 1)
+            compute_max_free(block, class_count + 1);
+    }
+
+    for (int tree = 0; tree <= class_count; tree++)
+    {
+        for (int d = 0; d < DIMENSION_COUNT; d++)
+        {
+            float *nodes = tree_of(index, tree, d);
+            for (int b = 0; b < leaves; b++)
+                nodes[leaves + b] = b < index->block_count ? index->blocks[b]->max_free[tree * DIMENSION_COUNT + d]
+                                                            : NO_WAGON;
+            for (int node = leaves - 1; node > 0; node--)
+                nodes[node] = nodes[2 * node] > nodes[2 * node + 1] ? nodes[2 * node] : nodes[2 * node + 1];
+        }
+    }
+
+    // Fenwick tree of the counts in O(blocks)
+    index->count_sum[0] = 0;
+    for (int i = 1; i <= leaves; i++)
+        index->count_sum[i] = i <= index->block_count ? index->blocks[i - 1]->count : 0;
+    for (int i = 1; i <= leaves; i++)
+    {
+        int parent = i + (i & (-i));
+        if (parent <= leaves)
+            index->count_sum[parent] += index->count_sum[i];
+    }
+    weight_index_build(index);
+}
+
+static void reserve_blocks(CapacityIndex *index, int block_count)
+{
+    if (block_count <= index->block_capacity)
+        return;
+
+    int capacity = index->block_capacity ? index->block_capacity : 16;
+    while (capacity < block_count)
+        capacity *= 2;
+    index->blocks = (WagonBlock **)tracked_realloc(MEM_CAPACITY_INDEX, index->blocks,
+                                                   sizeof(WagonBlock *) * index->block_capacity,
+                                                   sizeof(WagonBlock *) * capacity);
+    index->block_capacity = capacity;
+}
+
+static void free_blocks(CapacityIndex *index)
+{
+    for (int b = 0; b < index->block_count; b++)
+        free_block(index->blocks[b]);
+    index->block_count = 0;
+    index->count = 0;
+}
+
+// Index of the train, created empty if needed
+CapacityIndex *get_capacity_index(Train *train)
+{
+    if (!train->capacity_index)
+    {
+        train->capacity_index = (CapacityIndex *)tracked_calloc(MEM_CAPACITY_INDEX, 1, sizeof(CapacityIndex));
+        layout_trees(train);
+    }
+    else if (train->capacity_index->class_count != (train->wagon_classes ? train->wagon_classes->count : 0))
+        layout_trees(train); // a class was added
+    return train->capacity_index;
+}
+
+// Index the wagons of the list from scratch in full blocks, reusing the blocks there are
+void capacity_index_rebuild(Train *train)
+{
+    CapacityIndex *index = get_capacity_index(train);
+    int old_count = index->block_count;
+    WagonBlock *block = NULL;
+
+    index->block_count = 0;
+    index->count = 0;
+    index->weight_limit = 0;
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next)
+    {
+        if (!block || block->count == CAPACITY_BLOCK)
+        {
+            if (index->block_count == old_count)
+            {
+                reserve_blocks(index, ++old_count);
+                index->blocks[index->block_count] = new_block();
+            }
+            block = index->blocks[index->block_count++];
+            block->count = 0;
+        }
+        store_slot(block, block->count, wagon);
+        block->weight[block->count++] = wagon->current_weight;
+        index->count++;
+        if (wagon->max_weight > index->weight_limit)
+            index->weight_limit = wagon->max_weight;
+    }
+    for (int b = index->block_count; b < old_count; b++)
+        free_block(index->blocks[b]);
+
+    for (int b = 0; b < index->block_count; b++)
+    {
+        weight_block_build(index->blocks[b]);
+        compute_max_free(index->blocks[b], index->class_count + 1);
+    }
+    layout_trees(train);
+}
+
+// Put the wagon into a slot of the block that is not full, the slots from there on move back one
+static void insert_at(CapacityIndex *index, WagonBlock *block, int slot, Wagon *wagon)
+{
+    for (int s = block->count; s > slot; s--)
+        copy_slot(block, s, block, s - 1);
+    store_slot(block, slot, wagon);
+    block->weight[slot] = wagon->current_weight;
+    block->count++;
+    index->count++;
+    count_add(index, block->number, 1);
+    refresh_block(index, block, block->class_of[slot]);
+    weight_index_inserted(index, block, slot);
+}
+
+// A new empty block behind the last one
+static WagonBlock *append_block(Train *train)
+{
+    CapacityIndex *index = train->capacity_index;
+    WagonBlock *block = new_block();
+
+    reserve_blocks(index, index->block_count + 1);
+    index->blocks[index->block_count++] = block;
+    if (index->block_count > index->leaves)
+    {
+        layout_trees(train);
+        return block;
+    }
+
+    // Its leaves are still empty from the last layout
+    block->number = index->block_count - 1;
+    block->train = train;
+    compute_max_free(block, index->class_count + 1);
+    return block;
+}
+
+// A wagon was added at the tail
+void capacity_index_append(Train *train, Wagon *wagon)
+{
+    CapacityIndex *index = get_capacity_index(train);
+    WagonBlock *block = index->block_count > 0 ? index->blocks[index->block_count - 1] : NULL;
+
+    if (!block || block->count == CAPACITY_BLOCK)
+        block = append_block(train);
+    insert_at(index, block, block->count, wagon);
+}
+
+// Move the back half of a full block into a new block behind it
+static void split_block(Train *train, WagonBlock *block)
+{
+    CapacityIndex *index = train->capacity_index;
+    WagonBlock *back = new_block();
+    int half = CAPACITY_BLOCK / 2;
+
+    for (int s = half; s < block->count; s++)
+        copy_slot(back, s - half, block, s);
+    back->count = block->count - half;
+    block->count = half;
+    weight_block_build(block);
+    weight_block_build(back);
+    compute_max_free(block, block->tree_count);
+    compute_max_free(back, block->tree_count);
+
+    reserve_blocks(index, index->block_count + 1);
+    memmove(index->blocks + block->number + 2, index->blocks + block->number + 1,
+            sizeof(WagonBlock *) * (index->block_count - block->number - 1));
+    index->blocks[block->number + 1] = back;
+    index->block_count++;
+    layout_trees(train);
+}
+
+// A wagon was linked into the list behind wagon->prev (the head when NULL)
+void capacity_index_insert(Train *train, Wagon *wagon)
+{
+    CapacityIndex *index = get_capacity_index(train);
+    if (!wagon->prev || index->block_count == 0)
+    {
+        if (index->block_count == 0)
+            append_block(train);
+        if (index->blocks[0]->count == CAPACITY_BLOCK)
+            split_block(train, index->blocks[0]);
+        insert_at(index, index->blocks[0], 0, wagon);
+        return;
+    }
+
+    Wagon *prev = wagon->prev;
+    if (prev->block->count == CAPACITY_BLOCK)
+        split_block(train, prev->block);
+    insert_at(index, prev->block, prev->slot + 1, wagon);
+}
+
+// A wagon was unlinked from the list: the slots behind it in its block move up one
+void capacity_index_remove(Train *train, Wagon *wagon)
+{
+    CapacityIndex *index = train->capacity_index;
+    WagonBlock *block = wagon->block;
+    int slot = wagon->slot;
+    double weight = block->weight[slot];
+
+    for (int s = slot + 1; s < block->count; s++)
+        copy_slot(block, s - 1, block, s);
+    block->count--;
+    index->count--;
+    count_add(index, block->number, -1);
+    refresh_block(index, block, class_id_of(wagon));
+    weight_index_removed(index, block, slot, weight);
+    wagon->block = NULL;
+}
+
+// Move the wagons from the 0-based position to the tail to the empty train 'rest'
+void capacity_index_split(Train *train, int position, Train *rest)
+{
+    CapacityIndex *index = train->capacity_index;
+    CapacityIndex *rest_index = get_capacity_index(rest);
+    int slot;
+    WagonBlock *block = block_at_position(index, position, &slot);
+    int first_moved = block->number;
+
+    free_blocks(rest_index);
+    if (slot > 0)
+    {
+        // Cut the block, the wagons from the slot on go into a new one
+        WagonBlock *tail = new_block();
+        for (int s = slot; s < block->count; s++)
+            copy_slot(tail, s - slot, block, s);
+        tail->count = block->count - slot;
+        block->count = slot;
+        weight_block_build(block);
+        weight_block_build(tail);
+        compute_max_free(block, block->tree_count);
+        compute_max_free(tail, block->tree_count);
+
+        reserve_blocks(rest_index, 1);
+        rest_index->blocks[rest_index->block_count++] = tail;
+        first_moved++;
+    }
+
+    int moved = index->block_count - first_moved;
+    reserve_blocks(rest_index, rest_index->block_count + moved);
+    memcpy(rest_index->blocks + rest_index->block_count, index->blocks + first_moved, sizeof(WagonBlock *) * moved);
+    rest_index->block_count += moved;
+    index->block_count = first_moved;
+
+    rest_index->count = index->count - position;
+    index->count = position;
+    rest_index->weight_limit = index->weight_limit;
+    layout_trees(train);
+    layout_trees(rest);
+}
+
+// Move every wagon of 'back' behind the tail of 'front'
+void capacity_index_couple(Train *front, Train *back)
+{
+    CapacityIndex *index = get_capacity_index(front);
+    CapacityIndex *back_index = get_capacity_index(back);
+    int first_moved = 0;
+
+    // Merge the blocks at the joint when they fit in one
+    if (index->block_count > 0 && back_index->block_count > 0)
+    {
+        WagonBlock *last = index->blocks[index->block_count - 1];
+        WagonBlock *first = back_index->blocks[0];
+        if (last->count + first->count <= CAPACITY_BLOCK)
+        {
+            for (int s = 0; s < first->count; s++)
+                copy_slot(last, last->count + s, first, s);
+            last->count += first->count;
+            weight_block_build(last);
+            compute_max_free(last, last->tree_count);
+            free_block(first);
+            first_moved = 1;
+        }
+    }
+
+    int moved = back_index->block_count - first_moved;
+    reserve_blocks(index, index->block_count + moved);
+    memcpy(index->blocks + index->block_count, back_index->blocks + first_moved, sizeof(WagonBlock *) * moved);
+    index->block_count += moved;
+    back_index->block_count = 0;
+
+    index->count += back_index->count;
+    back_index->count = 0;
+    if (back_index->weight_limit > index->weight_limit)
+        index->weight_limit = back_index->weight_limit;
+    layout_trees(front);
+    layout_trees(back);
+}
+
+// The load of a wagon changed
+void capacity_index_update(Wagon *wagon)
+{
+    WagonBlock *block = wagon->block;
+    if (!block)
+        return;
+
+    CapacityIndex *index = block->train->capacity_index;
+    store_slot(block, wagon->slot, wagon);
+    refresh_block(index, block, block->class_of[wagon->slot]);
+    weight_index_set(index, block, wagon->slot, wagon->current_weight);
+}
+
+void free_capacity_index(Train *train)
+{
+    CapacityIndex *index = train->capacity_index;
+    if (!index)
+        return;
+
+    free_blocks(index);
+    tracked_free(MEM_CAPACITY_INDEX, index->blocks, sizeof(WagonBlock *) * index->block_capacity);
+    free_trees(index);
+    tracked_free(MEM_CAPACITY_INDEX, index, sizeof(CapacityIndex));
+    train->capacity_index = NULL;
+}
+
+// Wagon at a 0-based position from the head, NULL past the tail
+Wagon *wagon_at_position(Train *train, int position)
+{
+    CapacityIndex *index = get_capacity_index(train);
+    if (position < 0 || position >= index->count)
+        return NULL;
+
+    int slot;
+    WagonBlock *block = block_at_position(index, position, &slot);
+    return block->wagons[slot];
+}
+
+// First slot from 'from' on in the block with room for the demand in every dimension, -1 if none
+static int scan_block(const WagonBlock *block, int wagon_class, const float demand[DIMENSION_COUNT], int from)
+{
+    int length = block->count;
+    unsigned char fits[CAPACITY_BLOCK];
+
+    // One branch-free pass per dimension over the packed arrays
+    for (int i = 0; i < length; i++)
+        fits[i] = (wagon_class == 0 || block->class_of[i] == wagon_class) && i >= from;
+    for (int d = 0; d < DIMENSION_COUNT; d++)
+    {
+        const float *free = block->free[d];
+        float need = demand[d];
+        for (int i = 0; i < length; i++)
+            fits[i] &= free[i] >= need;
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        if (fits[i])
+            return i;
+    }
+    return -1;
+}
+
+static int node_has_room(CapacityIndex *index, int tree, int node, const float demand[DIMENSION_COUNT])
+{
+    for (int d = 0; d < DIMENSION_COUNT; d++)
+    {
+        if (!(tree_of(index, tree, d)[node] >= demand[d]))
+            return 0;
+    }
+    return 1;
+}
+
+static Wagon *find_in_tree(CapacityIndex *index, int tree, int node, const float demand[DIMENSION_COUNT])
+{
+    if (!node_has_room(index, tree, node, demand))
+        return NULL;
+    if (node >= index->leaves)
+    {
+        const WagonBlock *block = index->blocks[node - index->leaves];
+        int slot = scan_block(block, tree, demand, 0);
+        return slot < 0 ? NULL : block->wagons[slot];
+    }
+
+    Wagon *wagon = find_in_tree(index, tree, 2 * node, demand);
+    if (!wagon)
+        wagon = find_in_tree(index, tree, 2 * node + 1, demand);
+    return wagon;
+}
+
+// Same, only from the slot of block 'from' on. The node covers the blocks first..first + width - 1
+static Wagon *find_in_tree_from(CapacityIndex *index, int tree, int node, int first, int width,
+                                const float demand[DIMENSION_COUNT], int from, int from_slot)
+{
+    if (first + width <= from)
+        return NULL;
+    if (first > from)
+        return find_in_tree(index, tree, node, demand);
+    if (!node_has_room(index, tree, node, demand))
+        return NULL;
+    if (node >= index->leaves)
+    {
+        const WagonBlock *block = index->blocks[first];
+        int slot = scan_block(block, tree, demand, from_slot);
+        return slot < 0 ? NULL : block->wagons[slot];
+    }
+
+    int half = width / 2;
+    Wagon *wagon = find_in_tree_from(index, tree, 2 * node, first, half, demand, from, from_slot);
+    if (!wagon)
+        wagon = find_in_tree_from(index, tree, 2 * node + 1, first + half, half, demand, from, from_slot);
+    return wagon;
+}
+
+static Wagon *first_fit(CapacityIndex *index, int tree, const float demand[DIMENSION_COUNT])
+{
+    if (index->count == 0)
+        return NULL;
+    return find_in_tree(index, tree, 1, demand);
+}
+
+// Tree of the class, -1 if the index has none for it
+static int tree_for(const CapacityIndex *index, const WagonClass *wagon_class)
+{
+    if (!wagon_class)
+        return 0;
+    return wagon_class->id > index->class_count ? -1 : wagon_class->id;
+}
+
+// First wagon from the head with room for the demand, optionally only of one class
+Wagon *find_first_wagon_with_room(Train *train, const WagonClass *wagon_class, const float demand[DIMENSION_COUNT])
+{
+    CapacityIndex *index = get_capacity_index(train);
+    int tree = tree_for(index, wagon_class);
+    return tree < 0 ? NULL : first_fit(index, tree, demand);
+}
+
+// First wagon at or behind the 0-based position with room for the demand, optionally only of one class
+Wagon *find_next_wagon_with_room(Train *train, const WagonClass *wagon_class, const float demand[DIMENSION_COUNT],
+                                 int position)
+{
+    CapacityIndex *index = get_capacity_index(train);
+    int tree = tree_for(index, wagon_class);
+    if (tree < 0 || position >= index->count)
+        return NULL;
+
+    int slot;
+    WagonBlock *block = block_at_position(index, position < 0 ? 0 : position, &slot);
+    return find_in_tree_from(index, tree, 1, 0, index->leaves, demand, block->number, slot);
+}
+
+// First 0-based position at or behind the given one with room for the demand, optionally only of one class.
+// -1 if there is none
+int find_next_position_with_room(Train *train, const WagonClass *wagon_class, const float demand[DIMENSION_COUNT],
+                                 int position)
+{
+    Wagon *wagon = find_next_wagon_with_room(train, wagon_class, demand, position);
+    return wagon ? get_wagon_id(wagon) - 1 : -1;
+}
+
+// Wagon of the smallest class with room for the demand, first from the head within the class
+Wagon *find_smallest_wagon_that_fits(Train *train, const float demand[DIMENSION_COUNT])
+{
+    CapacityIndex *index = get_capacity_index(train);
+    WagonClassTable *table = train->wagon_classes;
+    if (!table)
+        return first_fit(index, 0, demand);
+
+    for (int i = 0; i < table->count; i++)
+    {
+        int tree = table->by_capacity[i];
+        if (tree > index->class_count)
+            continue;
+        Wagon *wagon = first_fit(index, tree, demand);
+        if (wagon)
+            return wagon;
+    }
+    return NULL;
+}
@@ -0,0 +1,237 @@
+// catalog.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/catalog.h"
+#include "../include/material.h"
+#include "../include/memtrack.h"
+#include "../include/utils.h"
+
+#define CATALOG_LIST_LIMIT 20 // menus list the catalog only when it is this small
+
+/*
+ * Catalog file format, one material per line, '#' starts a comment:
+ *
+ *   Large Box;200;50;1.2;0
+ *   <name>;<weight in kg>;<total quantity>[;<volume in m3>;<pallet slots>]
+ *
+ * IDs are assigned in file order starting at 1. MaterialTypes are allocated
+ * one by one so pointers held by loaded units stay valid as the catalog grows.
+ */
+
+static unsigned int hash_name(const char *name)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void grow_buckets(MaterialCatalog *catalog)
+{
+    int bucket_count = catalog->bucket_count ? catalog->bucket_count * 2 : 64;
+    int *buckets = (int *)malloc(sizeof(int) * bucket_count);
+    if (!buckets)
+    {
+        printf("\n==========\nError: Memory allocation failed for catalog.\n==========\n\n");
+        exit(1);
+    }
+    for (int i = 0; i < bucket_count; i++)
+        buckets[i] = -1;
+
+    for (int i = 0; i < catalog->count; i++)
+    {
+        unsigned int slot = hash_name(catalog->materials[i]->name) & (bucket_count - 1);
+        while (buckets[slot] != -1)
+            slot = (slot + 1) & (bucket_count - 1);
+        buckets[slot] = i;
+    }
+
+    free(catalog->buckets);
+    catalog->buckets = buckets;
+    catalog->bucket_count = bucket_count;
+}
+
+MaterialCatalog *create_catalog(void)
+{
+    MaterialCatalog *catalog = (MaterialCatalog *)calloc(1, sizeof(MaterialCatalog));
+    if (!catalog)
+    {
+        printf("\n==========\nError: Memory allocation failed for catalog.\n==========\n\n");
+        exit(1);
+    }
+    grow_buckets(catalog);
+    return catalog;
+}
+
+void destroy_catalog(MaterialCatalog *catalog)
+{
+    if (!catalog)
+        return;
+
+    for (int i = 0; i < catalog->count; i++)
+        tracked_free(MEM_MATERIAL_TYPE, catalog->materials[i], sizeof(MaterialType));
+    free(catalog->materials);
+    free(catalog->buckets);
+    free(catalog->in_use);
+    free(catalog);
+}
+
+MaterialType *find_material(MaterialCatalog *catalog, const char *name)
+{
+    unsigned int slot = hash_name(name) & (catalog->bucket_count - 1);
+
+    while (catalog->buckets[slot] != -1)
+    {
+        MaterialType *material = catalog->materials[catalog->buckets[slot]];
+        if (strcmp(material->name, name) == 0)
+            return material;
+        slot = (slot + 1) & (catalog->bucket_count - 1);
+    }
+    return NULL;
+}
+
+MaterialType *get_material(MaterialCatalog *catalog, int id)
+{
+    if (id < 1 || id > catalog->count)
+        return NULL;
+    return catalog->materials[id - 1];
+}
+
+// Add a material, or return the existing one with that name
+MaterialType *add_material(MaterialCatalog *catalog, const char *name, float weight, int quantity)
+{
+    MaterialType *material = find_material(catalog, name);
+    if (material)
+        return material;
+
+    if (catalog->count == catalog->capacity)
+    {
+        int capacity = catalog->capacity ? catalog->capacity * 2 : 16;
+        MaterialType **materials = (MaterialType **)realloc(catalog->materials, sizeof(MaterialType *) * capacity);
+        int *in_use = (int *)realloc(catalog->in_use, sizeof(int) * capacity);
+        if (!materials || !in_use)
+        {
+            printf("\n==========\nError: Memory allocation failed for catalog.\n==========\n\n");
+            exit(1);
+        }
+        catalog->materials = materials;
+        catalog->in_use = in_use;
+        catalog->capacity = capacity;
+    }
+    if ((catalog->count + 1) * 2 > catalog->bucket_count)
+        grow_buckets(catalog);
+
+    material = (MaterialType *)tracked_malloc(MEM_MATERIAL_TYPE, sizeof(MaterialType));
+    snprintf(material->name, sizeof(material->name), "%s", name);
+    material->weight = weight;
+    material->volume = 0;
+    material->slots = 0;
+    material->quantity = quantity;
+    material->loaded = 0;
+    material->reserved = 0;
+    material->id = catalog->count + 1;
+    material->catalog = catalog;
+    material->in_use_slot = -1;
+    material->carriers = NULL;
+    material->carrier_count = 0;
+
+    unsigned int slot = hash_name(name) & (catalog->bucket_count - 1);
+    while (catalog->buckets[slot] != -1)
+        slot = (slot + 1) & (catalog->bucket_count - 1);
+    catalog->buckets[slot] = catalog->count;
+    catalog->materials[catalog->count++] = material;
+    return material;
+}
+
+// The three materials the program always had, used when there is no catalog file
+MaterialCatalog *create_default_catalog(void)
+{
+    MaterialCatalog *catalog = create_catalog();
+    add_material(catalog, "Large Box", 200.0, 50);
+    add_material(catalog, "Medium Box", 150.0, 50);
+    add_material(catalog, "Small Box", 100.0, 50);
+    return catalog;
+}
+
+// Returns NULL if the file cannot be opened
+MaterialCatalog *load_catalog_from_file(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    MaterialCatalog *catalog = create_catalog();
+    char line[256];
+    int line_number = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        char name[50];
+        float weight, volume = 0;
+        int quantity, slots = 0;
+
+        line_number++;
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+
+        int fields = sscanf(line, " %49[^;];%f;%d;%f;%d", name, &weight, &quantity, &volume, &slots);
+        if ((fields != 3 && fields != 5) || weight <= 0 || quantity < 0 || volume < 0 || slots < 0)
+        {
+            log_message("\nWarning: %s line %d ignored: %s\n", filename, line_number, line);
+            continue;
+        }
+        MaterialType *material = add_material(catalog, name, weight, quantity);
+        material->volume = volume;
+        material->slots = slots;
+    }
+
+    fclose(file);
+    log_message("\n==========\nMaterial catalog loaded from file: %s (%d materials)\n==========\n\n", filename,
+                catalog->count);
+    return catalog;
+}
+
+// Ask for a material by ID or name. Returns NULL at end of input
+MaterialType *select_material(MaterialCatalog *catalog, const char *prompt)
+{
+    char input[80];
+
+    printf("%s\n", prompt);
+    if (catalog->count <= CATALOG_LIST_LIMIT)
+    {
+        for (int i = 0; i < catalog->count; i++)
+            printf("%d. %s\n", i + 1, catalog->materials[i]->name);
+    }
+    else
+    {
+        printf("(%d materials in the catalog, enter an ID or a name)\n", catalog->count);
+    }
+
+    while (1)
+    {
+        printf("Enter your choice: ");
+        if (!fgets(input, sizeof(input), stdin))
+            return NULL;
+        input[strcspn(input, "\r\n")] = 0;
+
+        int id;
+        char extra;
+        MaterialType *material;
+        if (sscanf(input, "%d %c", &id, &extra) == 1)
+            material = get_material(catalog, id);
+        else
+            material = find_material(catalog, input);
+
+        if (material)
+            return material;
+        printf("\n==========\nInvalid material choice. \n==========\n\n");
+    }
+}
@@ -0,0 +1,810 @@
+// command.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "../include/command.h"
+#include "../include/wagon.h"
+#include "../include/train.h"
+#include "../include/material.h"
+#include "../include/catalog.h"
+#include "../include/file_ops.h"
+#include "../include/utils.h"
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/weight_distribution.h"
+#include "../include/compaction.h"
+#include "../include/reservation.h"
+#include "../include/estimate.h"
+#include "../include/export.h"
+#include "../include/events.h"
+#include "../include/station.h"
+
+/*
+ * Line protocol, one request per line, one reply line per request:
+ *
+ *   PING
+ *   RELOAD                                  load train status from file
+ *   LOAD <material> <quantity>              load from head of the train
+ *   LOADW <wagon> <material> <quantity>     load into a specific wagon
+ *   LOADC <class> <material> <quantity>     load into wagons of one class, 0 = best fit
+ *   UNLOAD <material> <quantity>            unload from tail of the train
+ *   UNLOADW <wagon> <material> <quantity>   unload from a specific wagon
+ *   STATUS                                  train summary
+ *   WAGON <wagon>                           one wagon
+ *   BALANCE <first> <last> <k>              weight of wagons first..last, centre of
+ *                                           mass and heaviest run of k wagons
+ *   MATERIALS                               materials status
+ *   INUSE                                   status of materials on the train
+ *   CLASSES                                 wagon classes
+ *   EMPTY                                   empty the train
+ *   EMPTYW <wagon>                          empty a specific wagon
+ *   COMPACT <budget>                        move at most budget units to free wagons
+ *   RESERVE <reservation> <material> <qty>  hold stock and capacity, 0 = new reservation
+ *   COMMIT <reservation>                    load everything the reservation holds
+ *   ROLLBACK <reservation>                  release everything the reservation holds
+ *   ESTIMATE <class> <material> <quantity>  where a load would go, without loading, 0 = any class
+ *   EXPORT <kind> <format>                  write wagons (1), materials per wagon (2) or
+ *                                           material totals (3) as CSV (1) or JSON Lines (2)
+ *   EVENTS <cursor>                         changes from event <cursor> on, see below
+ *   LOADS <station> <material> <quantity>   load from head of the train for a station
+ *   STOP <station>                          unload every unit for the station
+ *   STRATEGY <strategy>                     load from the head (1) or balanced (2) from now on
+ *   SAVE                                    save train status to file
+ *   UNDO                                    undo last operation
+ *   REDO                                    redo last undone operation
+ *   METRICS                                 dump operation metrics to file
+ *   QUIT                                    close the connection
+ *
+ * <material> is the catalog ID shown by the menu. Replies start with
+ * "OK" or "ERR".
+ *
+ * EVENTS replies "OK next=<cursor> events=<n>" and one token per event:
+ * c<wagon> created, d<wagon> deleted, a<wagon>:<material>=<n> units added,
+ * r<wagon>:<material>=<n> units removed, n<first>-<last> renumbered,
+ * l<wagons> reloaded, u<first>-<last> uncoupled and j<first>-<last>
+ * coupled. The next request passes the returned cursor, an unsigned long.
+ * "OK lost next=<cursor>" means events were dropped: read the train again
+ * first.
+ */
+
+typedef struct CommandSyntax {
+    const char *name;
+    CommandType type;
+    int argument_count;
+} CommandSyntax;
+
+static const CommandSyntax command_syntax[] = {
+    {"PING", CMD_PING, 0},
+    {"RELOAD", CMD_RELOAD, 0},
+    {"LOAD", CMD_LOAD_HEAD, 2},
+    {"LOADW", CMD_LOAD_WAGON, 3},
+    {"LOADC", CMD_LOAD_CLASS, 3},
+    {"UNLOAD", CMD_UNLOAD_TAIL, 2},
+    {"UNLOADW", CMD_UNLOAD_WAGON, 3},
+    {"STATUS", CMD_TRAIN_STATUS, 0},
+    {"WAGON", CMD_WAGON_STATUS, 1},
+    {"BALANCE", CMD_WEIGHT_DISTRIBUTION, 3},
+    {"MATERIALS", CMD_MATERIAL_STATUS, 0},
+    {"INUSE", CMD_MATERIALS_IN_USE, 0},
+    {"CLASSES", CMD_WAGON_CLASSES, 0},
+    {"EMPTY", CMD_EMPTY_TRAIN, 0},
+    {"EMPTYW", CMD_EMPTY_WAGON, 1},
+    {"COMPACT", CMD_COMPACT, 1},
+    {"RESERVE", CMD_RESERVE, 3},
+    {"COMMIT", CMD_COMMIT, 1},
+    {"ROLLBACK", CMD_ROLLBACK, 1},
+    {"ESTIMATE", CMD_ESTIMATE, 3},
+    {"EXPORT", CMD_EXPORT, 2},
+    {"EVENTS", CMD_EVENTS, 1},
+    {"LOADS", CMD_LOAD_STATION, 3},
+    {"STOP", CMD_STATION_STOP, 1},
+    {"STRATEGY", CMD_STRATEGY, 1},
+    {"SAVE", CMD_SAVE, 0},
+    {"UNDO", CMD_UNDO, 0},
+    {"REDO", CMD_REDO, 0},
+    {"METRICS", CMD_METRICS, 0},
+    {"QUIT", CMD_QUIT, 0}};
+
+// Fill in a command from its type and protocol arguments, the fields it has no argument for are 0
+void build_command(Command *command, CommandType type, const int arguments[MAX_COMMAND_ARGUMENTS])
+{
+    command->type = type;
+    command->material = 0;
+    command->wagon_id = 0;
+    command->wagon_class = 0;
+    command->first_wagon_id = 0;
+    command->quantity = 0;
+    command->cursor = 0;
+    command->reservation = 0;
+    command->export_kind = 0;
+    command->export_format = 0;
+    command->station = 0;
+    command->strategy = 0;
+
+    switch (command->type)
+    {
+    case CMD_LOAD_HEAD:
+    case CMD_UNLOAD_TAIL:
+        command->material = arguments[0];
+        command->quantity = arguments[1];
+        break;
+    case CMD_LOAD_WAGON:
+    case CMD_UNLOAD_WAGON:
+        command->wagon_id = arguments[0];
+        command->material = arguments[1];
+        command->quantity = arguments[2];
+        break;
+    case CMD_COMPACT:
+        command->quantity = arguments[0];
+        break;
+    case CMD_EVENTS:
+        command->cursor = (unsigned int)arguments[0];
+        break;
+    case CMD_RESERVE:
+        command->reservation = arguments[0];
+        command->material = arguments[1];
+        command->quantity = arguments[2];
+        break;
+    case CMD_COMMIT:
+    case CMD_ROLLBACK:
+        command->reservation = arguments[0];
+        break;
+    case CMD_EXPORT:
+        command->export_kind = arguments[0];
+        command->export_format = arguments[1];
+        break;
+    case CMD_WEIGHT_DISTRIBUTION:
+        command->first_wagon_id = arguments[0];
+        command->wagon_id = arguments[1];
+        command->quantity = arguments[2];
+        break;
+    case CMD_LOAD_CLASS:
+    case CMD_ESTIMATE:
+        command->wagon_class = arguments[0];
+        command->material = arguments[1];
+        command->quantity = arguments[2];
+        break;
+    case CMD_WAGON_STATUS:
+    case CMD_EMPTY_WAGON:
+        command->wagon_id = arguments[0];
+        break;
+    case CMD_LOAD_STATION:
+        command->station = arguments[0];
+        command->material = arguments[1];
+        command->quantity = arguments[2];
+        break;
+    case CMD_STATION_STOP:
+        command->station = arguments[0];
+        break;
+    case CMD_STRATEGY:
+        command->strategy = arguments[0];
+        break;
+    default:
+        break;
+    }
+}
+
+// The cursor argument of EVENTS, read with strtoul() as it outgrows an int.
+// Returns 0 if it is not an unsigned long
+static int parse_cursor(const char *line, unsigned long *cursor)
+{
+    char name[16];
+    int offset = 0;
+    if (sscanf(line, "%15s %n", name, &offset) < 1 || !isdigit((unsigned char)line[offset]))
+        return 0;
+
+    char *end;
+    errno = 0;
+    *cursor = strtoul(line + offset, &end, 10);
+    while (isspace((unsigned char)*end))
+        end++;
+    return errno == 0 && *end == '\0';
+}
+
+// Parse one protocol line, returns 0 if the line is not a valid command
+int parse_command(const char *line, Command *command)
+{
+    char name[16];
+    int arguments[MAX_COMMAND_ARGUMENTS] = {0, 0, 0};
+    char extra;
+
+    int fields = sscanf(line, "%15s %d %d %d %c", name, &arguments[0], &arguments[1], &arguments[2], &extra);
+    if (fields < 1)
+        return 0;
+
+    for (size_t i = 0; i < sizeof(command_syntax) / sizeof(command_syntax[0]); i++)
+    {
+        if (strcmp(name, command_syntax[i].name) != 0)
+            continue;
+        if (fields - 1 != command_syntax[i].argument_count)
+            return 0;
+
+        build_command(command, command_syntax[i].type, arguments);
+        if (command->type == CMD_EVENTS && !parse_cursor(line, &command->cursor))
+            return 0;
+        return 1;
+    }
+    return 0;
+}
+
+static const CommandSyntax *find_syntax(CommandType type)
+{
+    for (size_t i = 0; i < sizeof(command_syntax) / sizeof(command_syntax[0]); i++)
+    {
+        if (command_syntax[i].type == type)
+            return &command_syntax[i];
+    }
+    return NULL;
+}
+
+// Protocol name of the command type, NULL if there is none
+const char *command_name(CommandType type)
+{
+    const CommandSyntax *syntax = find_syntax(type);
+    return syntax ? syntax->name : NULL;
+}
+
+// Number of protocol arguments of the command type, -1 if it has no protocol name
+int command_argument_count(CommandType type)
+{
+    const CommandSyntax *syntax = find_syntax(type);
+    return syntax ? syntax->argument_count : -1;
+}
+
+// The protocol arguments of a command in order, the inverse of build_command().
+// Returns their number, -1 if the type has no protocol name
+int command_arguments(const Command *command, int arguments[MAX_COMMAND_ARGUMENTS])
+{
+    int count = command_argument_count(command->type);
+    if (count < 0)
+        return -1;
+
+    arguments[0] = arguments[1] = arguments[2] = 0;
+    switch (command->type)
+    {
+    case CMD_LOAD_HEAD:
+    case CMD_UNLOAD_TAIL:
+        arguments[0] = command->material;
+        arguments[1] = command->quantity;
+        break;
+    case CMD_LOAD_WAGON:
+    case CMD_UNLOAD_WAGON:
+        arguments[0] = command->wagon_id;
+        arguments[1] = command->material;
+        arguments[2] = command->quantity;
+        break;
+    case CMD_COMPACT:
+        arguments[0] = command->quantity;
+        break;
+    case CMD_EVENTS:
+        arguments[0] = (int)command->cursor; // whole in trace_command()
+        break;
+    case CMD_RESERVE:
+        arguments[0] = command->reservation;
+        arguments[1] = command->material;
+        arguments[2] = command->quantity;
+        break;
+    case CMD_COMMIT:
+    case CMD_ROLLBACK:
+        arguments[0] = command->reservation;
+        break;
+    case CMD_EXPORT:
+        arguments[0] = command->export_kind;
+        arguments[1] = command->export_format;
+        break;
+    case CMD_WEIGHT_DISTRIBUTION:
+        arguments[0] = command->first_wagon_id;
+        arguments[1] = command->wagon_id;
+        arguments[2] = command->quantity;
+        break;
+    case CMD_LOAD_CLASS:
+    case CMD_ESTIMATE:
+        arguments[0] = command->wagon_class;
+        arguments[1] = command->material;
+        arguments[2] = command->quantity;
+        break;
+    case CMD_WAGON_STATUS:
+    case CMD_EMPTY_WAGON:
+        arguments[0] = command->wagon_id;
+        break;
+    case CMD_LOAD_STATION:
+        arguments[0] = command->station;
+        arguments[1] = command->material;
+        arguments[2] = command->quantity;
+        break;
+    case CMD_STATION_STOP:
+        arguments[0] = command->station;
+        break;
+    case CMD_STRATEGY:
+        arguments[0] = command->strategy;
+        break;
+    default:
+        break;
+    }
+    return count;
+}
+
+#define REPLY_TOKENS_SIZE 4096 // event tokens of one EVENTS reply
+
+// Append " id:name=loaded/quantity" for one material, returns the new length
+static size_t append_material(char *reply, size_t used, size_t reply_size, const MaterialType *material)
+{
+    if (used >= reply_size)
+        return used;
+    return used + snprintf(reply + used, reply_size - used, " %d:%s=%d/%d", material->id, material->name,
+                           material->loaded, material->quantity);
+}
+
+// Execute a command against the train and write a one-line reply. Returns 1 on success
+int execute_command(Train *train, MaterialCatalog *catalog, const char *filename,
+                    const Command *command, char *reply, size_t reply_size)
+{
+    MaterialType *material = NULL;
+    Wagon *wagon = NULL;
+    int count;
+
+    switch (command->type)
+    {
+    case CMD_LOAD_HEAD:
+    case CMD_LOAD_WAGON:
+    case CMD_LOAD_CLASS:
+    case CMD_UNLOAD_TAIL:
+    case CMD_UNLOAD_WAGON:
+    case CMD_RESERVE:
+    case CMD_ESTIMATE:
+    case CMD_LOAD_STATION:
+        material = get_material(catalog, command->material);
+        if (!material)
+        {
+            snprintf(reply, reply_size, "ERR invalid material %d", command->material);
+            return 0;
+        }
+        if (command->quantity <= 0)
+        {
+            snprintf(reply, reply_size, "ERR invalid quantity %d", command->quantity);
+            return 0;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if ((command->type == CMD_LOAD_STATION || command->type == CMD_STATION_STOP) &&
+        (command->station < 1 || command->station > MAX_STATION_ID))
+    {
+        snprintf(reply, reply_size, "ERR invalid station %d", command->station);
+        return 0;
+    }
+
+    switch (command->type)
+    {
+    case CMD_PING:
+        snprintf(reply, reply_size, "OK PONG");
+        return 1;
+
+    case CMD_RELOAD:
+        load_train_status_from_file(train, filename, catalog);
+        snprintf(reply, reply_size, "OK wagons=%d", train->wagon_count);
+        return 1;
+
+    case CMD_LOAD_HEAD:
+        if (!check_material_availability(material, command->quantity))
+        {
+            snprintf(reply, reply_size, "ERR available=%d", available_quantity(material));
+            return 0;
+        }
+        count = load_specified_material_to_train(train, material, command->quantity);
+        snprintf(reply, reply_size, "OK loaded=%d wagons=%d", count, train->wagon_count);
+        return 1;
+
+    case CMD_LOAD_WAGON:
+        if (!find_wagon_by_id(train, command->wagon_id))
+        {
+            snprintf(reply, reply_size, "ERR no wagon %d", command->wagon_id);
+            return 0;
+        }
+        count = load_material_to_wagon(train, material, command->wagon_id, command->quantity);
+        snprintf(reply, reply_size, "OK loaded=%d", count);
+        return 1;
+
+    case CMD_LOAD_CLASS:
+    {
+        WagonClass *wagon_class = NULL;
+        if (command->wagon_class != 0)
+        {
+            wagon_class = get_wagon_class(train->wagon_classes, command->wagon_class);
+            if (!wagon_class)
+            {
+                snprintf(reply, reply_size, "ERR invalid wagon class %d", command->wagon_class);
+                return 0;
+            }
+        }
+        if (!check_material_availability(material, command->quantity))
+        {
+            snprintf(reply, reply_size, "ERR available=%d", available_quantity(material));
+            return 0;
+        }
+        if (wagon_class)
+            count = load_material_to_class(train, material, command->quantity, wagon_class);
+        else
+            count = load_order_best_fit(train, material, command->quantity);
+        snprintf(reply, reply_size, "OK loaded=%d wagons=%d", count, train->wagon_count);
+        return 1;
+    }
+
+    case CMD_UNLOAD_TAIL:
+        if (!train->first_wagon)
+        {
+            snprintf(reply, reply_size, "ERR train is empty");
+            return 0;
+        }
+        count = unload_material_quantity_from_tail(train, material, command->quantity);
+        snprintf(reply, reply_size, "OK unloaded=%d wagons=%d", count, train->wagon_count);
+        return 1;
+
+    case CMD_UNLOAD_WAGON:
+        wagon = find_wagon_by_id(train, command->wagon_id);
+        if (!wagon)
+        {
+            snprintf(reply, reply_size, "ERR no wagon %d", command->wagon_id);
+            return 0;
+        }
+        begin_operation(train, "Unload material from wagon");
+        count = unload_material_from_wagon(wagon, material, command->quantity);
+        delete_empty_wagons(train);
+        end_operation(train);
+        snprintf(reply, reply_size, "OK unloaded=%d wagons=%d", count, train->wagon_count);
+        return 1;
+
+    case CMD_TRAIN_STATUS:
+    {
+        float total_weight = 0;
+        int unit_count = 0;
+        for (wagon = train->first_wagon; wagon; wagon = wagon->next)
+        {
+            total_weight += wagon->current_weight;
+            for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+                unit_count++;
+        }
+        snprintf(reply, reply_size, "OK train=%s wagons=%d units=%d weight=%.2f",
+                 train->train_id, train->wagon_count, unit_count, total_weight);
+        return 1;
+    }
+
+    case CMD_WAGON_STATUS:
+        wagon = find_wagon_by_id(train, command->wagon_id);
+        if (!wagon)
+        {
+            snprintf(reply, reply_size, "ERR no wagon %d", command->wagon_id);
+            return 0;
+        }
+        count = 0;
+        for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+            count++;
+        snprintf(reply, reply_size, "OK wagon=%d max=%.2f current=%.2f units=%d class=%s volume=%.2f/%.2f slots=%d/%d",
+                 get_wagon_id(wagon), wagon->max_weight, wagon->current_weight, count,
+                 wagon->wagon_class ? wagon->wagon_class->name : DEFAULT_WAGON_CLASS,
+                 wagon->current_volume, wagon->max_volume, wagon->used_slots, wagon->max_slots);
+        return 1;
+
+    case CMD_MATERIAL_STATUS:
+    {
+        size_t used = snprintf(reply, reply_size, "OK");
+        for (int i = 0; i < catalog->count; i++)
+            used = append_material(reply, used, reply_size, catalog->materials[i]);
+        return 1;
+    }
+
+    case CMD_MATERIALS_IN_USE:
+    {
+        size_t used = snprintf(reply, reply_size, "OK");
+        for (int i = 0; i < catalog->in_use_count; i++)
+            used = append_material(reply, used, reply_size, get_material(catalog, catalog->in_use[i]));
+        return 1;
+    }
+
+    case CMD_WEIGHT_DISTRIBUTION:
+    {
+        double centre = 0, heaviest = 0;
+        int first = 0;
+        if (command->first_wagon_id > command->wagon_id || command->quantity < 1)
+        {
+            snprintf(reply, reply_size, "ERR invalid range");
+            return 0;
+        }
+        METRIC_START(timer);
+        double weight = range_weight(train, command->first_wagon_id, command->wagon_id);
+        int has_centre = centre_of_mass(train, &centre);
+        int has_window = heaviest_window(train, command->quantity, &first, &heaviest);
+        METRIC_STOP(METRIC_WEIGHT_DISTRIBUTION, timer);
+
+        size_t used = snprintf(reply, reply_size, "OK range=%.2f", weight);
+        if (has_centre && used < reply_size)
+            used += snprintf(reply + used, reply_size - used, " centre=%.2f", centre);
+        if (has_window && used < reply_size)
+            snprintf(reply + used, reply_size - used, " heaviest=%d-%d:%.2f", first, first + command->quantity - 1,
+                     heaviest);
+        return 1;
+    }
+
+    case CMD_WAGON_CLASSES:
+    {
+        size_t used = snprintf(reply, reply_size, "OK");
+        for (int i = 0; i < train->wagon_classes->count && used < reply_size; i++)
+        {
+            WagonClass *wagon_class = train->wagon_classes->classes[i];
+            used += snprintf(reply + used, reply_size - used, " %d:%s=%.2f", wagon_class->id, wagon_class->name,
+                             wagon_class->max_weight);
+        }
+        return 1;
+    }
+
+    case CMD_EMPTY_TRAIN:
+        empty_entire_train(train);
+        snprintf(reply, reply_size, "OK wagons=0");
+        return 1;
+
+    case CMD_COMPACT:
+    {
+        if (command->quantity <= 0)
+        {
+            snprintf(reply, reply_size, "ERR invalid budget %d", command->quantity);
+            return 0;
+        }
+        int units_moved;
+        count = compact_train(train, command->quantity, &units_moved);
+        snprintf(reply, reply_size, "OK saved=%d moved=%d wagons=%d", count, units_moved, train->wagon_count);
+        return 1;
+    }
+
+    case CMD_RESERVE:
+    {
+        Reservation *reservation = command->reservation ? find_reservation(train, command->reservation)
+                                                        : open_reservation(train);
+        if (!reservation)
+        {
+            snprintf(reply, reply_size, "ERR no reservation %d", command->reservation);
+            return 0;
+        }
+        if (!reserve_material(reservation, material, command->quantity, NULL))
+        {
+            snprintf(reply, reply_size, "ERR reservation=%d available=%d", reservation->id, available_quantity(material));
+            if (reservation->units == 0)
+                rollback_reservation(reservation);
+            return 0;
+        }
+        snprintf(reply, reply_size, "OK reservation=%d units=%d new_wagons=%d", reservation->id, reservation->units,
+                 reservation->new_wagon_count);
+        return 1;
+    }
+
+    case CMD_COMMIT:
+    case CMD_ROLLBACK:
+    {
+        Reservation *reservation = find_reservation(train, command->reservation);
+        if (!reservation)
+        {
+            snprintf(reply, reply_size, "ERR no reservation %d", command->reservation);
+            return 0;
+        }
+        if (command->type == CMD_COMMIT)
+        {
+            count = commit_reservation(reservation);
+            snprintf(reply, reply_size, "OK loaded=%d wagons=%d", count, train->wagon_count);
+        }
+        else
+        {
+            count = rollback_reservation(reservation);
+            snprintf(reply, reply_size, "OK released=%d", count);
+        }
+        return 1;
+    }
+
+    case CMD_ESTIMATE:
+    {
+        // Kept between requests so that estimating does not allocate once warmed up
+        static LoadEstimate estimate;
+        WagonClass *wagon_class = NULL;
+
+        if (command->wagon_class != 0)
+        {
+            wagon_class = get_wagon_class(train->wagon_classes, command->wagon_class);
+            if (!wagon_class)
+            {
+                snprintf(reply, reply_size, "ERR invalid wagon class %d", command->wagon_class);
+                return 0;
+            }
+        }
+        reset_load_estimate(&estimate);
+        if (!estimate_load(train, &estimate, material, command->quantity, wagon_class))
+        {
+            snprintf(reply, reply_size, "ERR available=%d", available_quantity(material));
+            return 0;
+        }
+
+        size_t used = snprintf(reply, reply_size, "OK placed=%d unplaced=%d existing=%d new=%d", estimate.units_placed,
+                               estimate.units_unplaced, estimate.existing_wagons, estimate.new_wagons);
+        for (int i = 0; i < estimate.placement_count && used < reply_size; i++)
+        {
+            const Placement *placement = &estimate.placements[i];
+            if (placement->wagon_count == 1)
+                used += snprintf(reply + used, reply_size - used, " %d:%d", placement->first_wagon_id, placement->units);
+            else
+                used += snprintf(reply + used, reply_size - used, " %d-%d:%d", placement->first_wagon_id,
+                                 placement->first_wagon_id + placement->wagon_count - 1, placement->units);
+        }
+        return 1;
+    }
+
+    case CMD_EXPORT:
+    {
+        if (command->export_kind < 1 || command->export_kind > EXPORT_KIND_COUNT ||
+            command->export_format < 1 || command->export_format > EXPORT_FORMAT_COUNT)
+        {
+            snprintf(reply, reply_size, "ERR invalid export %d %d", command->export_kind, command->export_format);
+            return 0;
+        }
+        ExportKind kind = (ExportKind)(command->export_kind - 1);
+        ExportFormat format = (ExportFormat)(command->export_format - 1);
+        const char *export_file = export_file_name(kind, format);
+        long rows = export_train_to_file(train, catalog, kind, format, export_file);
+        if (rows < 0)
+        {
+            snprintf(reply, reply_size, "ERR cannot write %s", export_file);
+            return 0;
+        }
+        snprintf(reply, reply_size, "OK rows=%ld file=%s", rows, export_file);
+        return 1;
+    }
+
+    case CMD_EVENTS:
+    {
+        unsigned long cursor = command->cursor;
+        TrainEvent events[128];
+        int event_count = read_events(train, &cursor, events, 128);
+        if (event_count < 0)
+        {
+            snprintf(reply, reply_size, "OK lost next=%lu", cursor);
+            return 1;
+        }
+
+        // The header is written last, once it is known how many events fit
+        char tokens[REPLY_TOKENS_SIZE];
+        size_t used = 0;
+        int shown = 0;
+        for (; shown < event_count; shown++)
+        {
+            const TrainEvent *event = &events[shown];
+            char token[48];
+            switch (event->type)
+            {
+            case EVENT_WAGON_CREATED:
+                snprintf(token, sizeof(token), " c%d", event->wagon_id);
+                break;
+            case EVENT_WAGON_DELETED:
+                snprintf(token, sizeof(token), " d%d", event->wagon_id);
+                break;
+            case EVENT_UNITS_ADDED:
+            case EVENT_UNITS_REMOVED:
+                snprintf(token, sizeof(token), " %c%d:%d=%d", event->type == EVENT_UNITS_ADDED ? 'a' : 'r',
+                         event->wagon_id, event->material_id, event->count);
+                break;
+            case EVENT_WAGONS_RENUMBERED:
+                snprintf(token, sizeof(token), " n%d-%d", event->wagon_id, event->wagon_id + event->count - 1);
+                break;
+            case EVENT_TRAIN_RELOADED:
+                snprintf(token, sizeof(token), " l%d", event->count);
+                break;
+            case EVENT_WAGONS_DETACHED:
+            case EVENT_WAGONS_ATTACHED:
+                snprintf(token, sizeof(token), " %c%d-%d", event->type == EVENT_WAGONS_DETACHED ? 'u' : 'j',
+                         event->wagon_id, event->wagon_id + event->count - 1);
+                break;
+            }
+            size_t length = strlen(token);
+            if (used + length + 64 > reply_size || used + length >= sizeof(tokens))
+                break;
+            memcpy(tokens + used, token, length);
+            used += length;
+        }
+        tokens[used] = '\0';
+
+        // Events that did not fit are returned by the next request
+        if (shown < event_count)
+            cursor = events[shown].sequence;
+        snprintf(reply, reply_size, "OK next=%lu events=%d%s", cursor, shown, tokens);
+        return 1;
+    }
+
+    case CMD_LOAD_STATION:
+        if (!check_material_availability(material, command->quantity))
+        {
+            snprintf(reply, reply_size, "ERR available=%d", available_quantity(material));
+            return 0;
+        }
+        count = load_material_for_station(train, material, command->quantity, command->station);
+        snprintf(reply, reply_size, "OK loaded=%d wagons=%d", count, train->wagon_count);
+        return 1;
+
+    case CMD_STATION_STOP:
+    {
+        int wagons_touched;
+        count = station_stop(train, command->station, &wagons_touched);
+        snprintf(reply, reply_size, "OK unloaded=%d wagons=%d", count, wagons_touched);
+        return 1;
+    }
+
+    case CMD_STRATEGY:
+        if (command->strategy < 1 || command->strategy > LOAD_STRATEGY_COUNT)
+        {
+            snprintf(reply, reply_size, "ERR invalid strategy %d", command->strategy);
+            return 0;
+        }
+        train->load_strategy = (LoadStrategy)(command->strategy - 1);
+        snprintf(reply, reply_size, "OK strategy=%s", load_strategy_name(train->load_strategy));
+        return 1;
+
+    case CMD_EMPTY_WAGON:
+        if (!empty_wagon_by_id(train, command->wagon_id))
+        {
+            snprintf(reply, reply_size, "ERR no wagon %d", command->wagon_id);
+            return 0;
+        }
+        snprintf(reply, reply_size, "OK wagons=%d", train->wagon_count);
+        return 1;
+
+    case CMD_SAVE:
+        save_train_status_to_file(train, filename);
+        snprintf(reply, reply_size, "OK saved=%s", filename);
+        return 1;
+
+    case CMD_UNDO:
+        if (train->reservations)
+        {
+            snprintf(reply, reply_size, "ERR reservations open");
+            return 0;
+        }
+        if (!undo_last_operation(train))
+        {
+            snprintf(reply, reply_size, "ERR nothing to undo");
+            return 0;
+        }
+        snprintf(reply, reply_size, "OK wagons=%d", train->wagon_count);
+        return 1;
+
+    case CMD_REDO:
+        if (train->reservations)
+        {
+            snprintf(reply, reply_size, "ERR reservations open");
+            return 0;
+        }
+        if (!redo_last_operation(train))
+        {
+            snprintf(reply, reply_size, "ERR nothing to redo");
+            return 0;
+        }
+        snprintf(reply, reply_size, "OK wagons=%d", train->wagon_count);
+        return 1;
+
+    case CMD_METRICS:
+        if (!dump_metrics_to_file(METRICS_FILE))
+        {
+            snprintf(reply, reply_size, "ERR cannot write %s", METRICS_FILE);
+            return 0;
+        }
+        snprintf(reply, reply_size, "OK saved=%s", METRICS_FILE);
+        return 1;
+
+    case CMD_QUIT:
+        snprintf(reply, reply_size, "OK BYE");
+        return 1;
+
+    case CMD_TYPE_COUNT:
+        break;
+    }
+
+    snprintf(reply, reply_size, "ERR unknown command");
+    return 0;
+}
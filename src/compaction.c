@@ -0,0 +1,194 @@
+// compaction.c
+#include <stdio.h>
+#include <stdlib.h>
+#include "../include/compaction.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/capacity_index.h"
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+/*
+ * Compaction empties wagons by moving their units into gaps nearer the
+ * head, then deletes the emptied wagons. Wagons are tried from the tail.
+ * Every unit of a wagon goes to the first wagon ahead of it with room, taken
+ * from the top of the stack and inserted with the usual stacking order.
+ *
+ * A wagon is emptied completely or not at all. If some unit finds no room,
+ * the units already moved from that wagon go back, so the train never ends
+ * up with units shuffled around without saving a wagon. The budget caps
+ * the units moved per pass, and a wagon is only tried if all of its units
+ * fit in what is left of the budget. Several small passes between
+ * operations therefore compact the train step by step. Units keep their
+ * destination station when they move.
+ */
+
+typedef struct UnitGroup {
+    MaterialType *material;
+    int destination;
+    int count;
+} UnitGroup;
+
+typedef struct Move {
+    Wagon *target;
+    MaterialType *material;
+    int destination;
+    int count;
+} Move;
+
+// Units of the wagon grouped by material and destination, in stack order. Returns the number of groups
+static int group_units(const Wagon *wagon, UnitGroup **groups, int *units)
+{
+    int group_count = 0, capacity = 0;
+
+    *groups = NULL;
+    *units = 0;
+    for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+    {
+        (*units)++;
+        if (group_count > 0 && (*groups)[group_count - 1].material == unit->type &&
+            (*groups)[group_count - 1].destination == unit->destination)
+        {
+            (*groups)[group_count - 1].count++;
+            continue;
+        }
+        if (group_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4;
+            *groups = (UnitGroup *)realloc(*groups, sizeof(UnitGroup) * capacity);
+            if (!*groups)
+            {
+                log_message("\n==========\nError: Memory allocation failed for compaction.\n==========\n\n");
+                exit(1);
+            }
+        }
+        (*groups)[group_count].material = unit->type;
+        (*groups)[group_count].destination = unit->destination;
+        (*groups)[group_count].count = 1;
+        group_count++;
+    }
+    return group_count;
+}
+
+// Move every unit of the wagon to wagons ahead of it, or none. Returns 1 if the wagon is now empty
+static int empty_into_gaps(Train *train, Wagon *wagon, UnitGroup *groups, int group_count, Move *moves)
+{
+    int move_count = 0;
+
+    for (int g = 0; g < group_count; g++)
+    {
+        float demand[DIMENSION_COUNT];
+        material_demand(groups[g].material, demand);
+
+        int remaining = groups[g].count;
+        while (remaining > 0)
+        {
+            Wagon *target = find_first_wagon_with_room(train, NULL, demand);
+            if (!target || !wagon_ahead_of(target, wagon))
+            {
+                // No room ahead: put back what was moved from this wagon
+                for (int m = move_count - 1; m >= 0; m--)
+                {
+                    remove_materials_for_destination(moves[m].target, moves[m].material, moves[m].count,
+                                                     moves[m].destination);
+                    add_materials_for_destination(wagon, moves[m].material, moves[m].count, moves[m].destination);
+                }
+                return 0;
+            }
+
+            int count = wagon_units_that_fit(target, groups[g].material);
+            if (count > remaining)
+                count = remaining;
+
+            remove_materials_for_destination(wagon, groups[g].material, count, groups[g].destination);
+            add_materials_for_destination(target, groups[g].material, count, groups[g].destination);
+            moves[move_count].target = target;
+            moves[move_count].material = groups[g].material;
+            moves[move_count].destination = groups[g].destination;
+            moves[move_count].count = count;
+            move_count++;
+            remaining -= count;
+        }
+    }
+    return 1;
+}
+
+// Empty under-filled wagons into gaps nearer the head, moving at most budget units.
+// Returns the number of wagons saved
+int compact_train(Train *train, int budget, int *units_moved)
+{
+    *units_moved = 0;
+    if (!train || !train->first_wagon || budget <= 0)
+        return 0;
+
+    METRIC_START(timer);
+    begin_operation(train, "Compact train");
+
+    int wagons_before = train->wagon_count;
+    int emptied = 0;
+
+    Wagon *wagon = train->first_wagon;
+    while (wagon->next)
+        wagon = wagon->next;
+
+    for (; wagon && *units_moved < budget; wagon = wagon->prev)
+    {
+        UnitGroup *groups;
+        int units;
+        int group_count = group_units(wagon, &groups, &units);
+
+        if (wagon->reserved_units > 0)
+        {
+            // An open reservation keeps the wagon
+        }
+        else if (units == 0)
+        {
+            emptied++;
+        }
+        else if (units <= budget - *units_moved)
+        {
+            // A wagon needs at most one move per unit
+            Move *moves = (Move *)malloc(sizeof(Move) * units);
+            if (!moves)
+            {
+                log_message("\n==========\nError: Memory allocation failed for compaction.\n==========\n\n");
+                exit(1);
+            }
+            if (empty_into_gaps(train, wagon, groups, group_count, moves))
+            {
+                *units_moved += units;
+                emptied++;
+            }
+            free(moves);
+        }
+        free(groups);
+    }
+
+    if (emptied > 0)
+        delete_empty_wagons(train);
+
+    end_operation(train);
+    METRIC_STOP(METRIC_COMPACT, timer);
+
+    int saved = wagons_before - train->wagon_count;
+    log_message("\n==========\nCompaction moved %d units and saved %d wagons.\n==========\n\n", *units_moved, saved);
+    return saved;
+}
+
+void compact_train_main(Train *train)
+{
+    char input[50];
+    int budget = DEFAULT_COMPACTION_BUDGET;
+    int units_moved;
+
+    printf("Enter the maximum number of units to move (Enter for %d): ", DEFAULT_COMPACTION_BUDGET);
+    fgets(input, sizeof(input), stdin);
+    if (input[0] != '\n' && (sscanf(input, "%d", &budget) != 1 || budget <= 0))
+    {
+        printf("\n==========\nInvalid number of units. \n==========\n\n");
+        return;
+    }
+
+    compact_train(train, budget, &units_moved);
+}
@@ -0,0 +1,165 @@
+// coupling.c
+#include <stdio.h>
+#include <stdlib.h>
+#include "../include/coupling.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/capacity_index.h"
+#include "../include/history.h"
+#include "../include/events.h"
+#include "../include/station.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+/*
+ * Splitting and coupling splice the wagon list between two trains. The
+ * units stay in their wagons, and the material totals belong to the
+ * catalog both trains share, so neither changes. The wagons themselves
+ * are not touched either: their train and ID follow from the block of the
+ * capacity index they are in, and the blocks are handed over as a whole,
+ * see capacity_index.c. Wagons carrying units for a station take their
+ * entries to the station index of their new train.
+ *
+ * Neither operation can be undone. Both clear the history of both trains,
+ * since earlier operations may refer to wagons that changed trains. Both
+ * are refused while a reservation is open on either train.
+ */
+
+static int reservations_open(Train *a, Train *b)
+{
+    if (!a->reservations && !b->reservations)
+        return 0;
+    log_message("\n==========\nCommit or roll back the open reservations first.\n==========\n\n");
+    return 1;
+}
+
+// Move the wagons from wagon_id to the tail to the empty train 'rest'.
+// Returns the number of wagons moved, -1 if nothing was split
+int split_train(Train *train, int wagon_id, Train *rest)
+{
+    if (rest->first_wagon)
+    {
+        log_message("\n==========\nThe train to split into is not empty.\n==========\n\n");
+        return -1;
+    }
+    if (reservations_open(train, rest))
+        return -1;
+
+    Wagon *first = find_wagon_by_id(train, wagon_id);
+    if (!first)
+    {
+        log_message("\n==========\nError: Wagon ID %d does not exist.\n==========\n\n", wagon_id);
+        return -1;
+    }
+
+    METRIC_START(timer);
+    clear_history(train);
+    clear_history(rest);
+
+    Wagon *last_kept = first->prev;
+    if (last_kept)
+        last_kept->next = NULL;
+    else
+        train->first_wagon = NULL;
+    first->prev = NULL;
+
+    rest->first_wagon = first;
+    rest->last_wagon = train->last_wagon;
+    train->last_wagon = last_kept;
+
+    int moved = train->wagon_count - wagon_id + 1;
+    rest->wagon_count = moved;
+    train->wagon_count -= moved;
+
+    capacity_index_split(train, wagon_id - 1, rest);
+    station_index_move_wagons(train, rest);
+    event_wagons_moved(train, EVENT_WAGONS_DETACHED, wagon_id, moved);
+    event_wagons_moved(rest, EVENT_WAGONS_ATTACHED, 1, moved);
+    METRIC_STOP(METRIC_SPLIT, timer);
+
+    log_message("\n==========\nWagons %d-%d uncoupled, %d wagons left.\n==========\n\n", wagon_id,
+                wagon_id + moved - 1, train->wagon_count);
+    return moved;
+}
+
+// Move every wagon of 'back' behind the tail of 'front'. Returns the number of wagons moved, -1 if refused
+int couple_trains(Train *front, Train *back)
+{
+    if (front == back || reservations_open(front, back))
+        return -1;
+    if (!back->first_wagon)
+        return 0;
+
+    METRIC_START(timer);
+    clear_history(front);
+    clear_history(back);
+
+    int first_wagon_id = front->wagon_count + 1;
+    if (front->last_wagon)
+        front->last_wagon->next = back->first_wagon;
+    else
+        front->first_wagon = back->first_wagon;
+    back->first_wagon->prev = front->last_wagon;
+    front->last_wagon = back->last_wagon;
+
+    int moved = back->wagon_count;
+    front->wagon_count += moved;
+    back->first_wagon = NULL;
+    back->last_wagon = NULL;
+    back->wagon_count = 0;
+
+    capacity_index_couple(front, back);
+    station_index_move_wagons(back, front);
+    event_wagons_moved(back, EVENT_WAGONS_DETACHED, 1, moved);
+    event_wagons_moved(front, EVENT_WAGONS_ATTACHED, first_wagon_id, moved);
+    METRIC_STOP(METRIC_COUPLE, timer);
+
+    log_message("\n==========\n%d wagons coupled, the train has %d wagons.\n==========\n\n", moved,
+                front->wagon_count);
+    return moved;
+}
+
+// The menu works with one siding: the split-off wagons wait there until they are coupled back
+void coupling_main(Train *train, Train *siding)
+{
+    char input[50];
+    int choice, wagon_id;
+
+    printf("\nSiding: %d wagons\n1. Split the train at a wagon, the rest goes to the siding\n"
+           "2. Couple the siding behind the train\n3. Display the siding\nEnter your choice: ",
+           siding->wagon_count);
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &choice) != 1)
+    {
+        printf("\n==========\nInvalid input. Operation canceled.\n==========\n\n");
+        return;
+    }
+
+    switch (choice)
+    {
+    case 1:
+        if (siding->first_wagon)
+        {
+            printf("\n==========\nCouple the wagons on the siding back first.\n==========\n\n");
+            break;
+        }
+        printf("Enter the ID of the first wagon to uncouple: ");
+        fgets(input, sizeof(input), stdin);
+        if (sscanf(input, "%d", &wagon_id) != 1)
+        {
+            printf("\n==========\nInvalid wagon ID.\n==========\n\n");
+            break;
+        }
+        split_train(train, wagon_id, siding);
+        break;
+    case 2:
+        if (couple_trains(train, siding) == 0)
+            printf("\n==========\nThe siding is empty.\n==========\n\n");
+        break;
+    case 3:
+        display_train_status(siding);
+        break;
+    default:
+        printf("\n==========\nOption unavailable.\n==========\n\n");
+    }
+}
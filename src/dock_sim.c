@@ -0,0 +1,603 @@
+// dock_sim.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../include/dock_sim.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/station.h"
+#include "../include/estimate.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/utils.h"
+
+/*
+ * Discrete-event simulation of the loading dock, for sizing its staff.
+ * Orders arrive at random for random stations and wait in one queue.
+ * A free worker takes the order at the head, loads it onto the train with
+ * the real loading code and stays busy for the setup and loading time.
+ * Trains leave on a fixed timetable. A train that is due waits for the
+ * loading in progress, then runs its stations with station_stop() and
+ * is replaced by an empty one. An order the train has no room for, going
+ * by estimate_load(), waits for the next train and so does every order
+ * behind it.
+ *
+ * Every replication builds its own train and catalog, so replications run
+ * in parallel with no locking. Replication r always gets the same random
+ * streams whatever thread runs it, and the arrivals do not depend on the
+ * number of workers, so staffing levels are compared on the same days.
+ * The threads' results are reduced to distributions at the end.
+ */
+
+#define SIM_STOCK (INT_MAX / 2) // stock is not simulated
+
+typedef enum SimEventType {
+    SIM_ORDER_ARRIVAL,
+    SIM_LOADING_DONE,
+    SIM_DEPARTURE_DUE
+} SimEventType;
+
+typedef struct SimEvent {
+    double time; // minutes
+    unsigned long sequence; // events at the same time happen in the order they were scheduled
+    SimEventType type;
+} SimEvent;
+
+typedef struct Order {
+    MaterialType *material;
+    int quantity;
+    int station;
+    double arrival;
+} Order;
+
+typedef struct Dock {
+    const SimConfig *config;
+    int workers, busy_workers;
+    unsigned long long arrival_random, service_random;
+    double now, end;
+
+    SimEvent *events; // binary heap on time, then sequence
+    int event_count, event_capacity;
+    unsigned long next_sequence;
+
+    Order *queue; // ring buffer
+    int queue_head, queue_count, queue_capacity;
+
+    Train *train;
+    MaterialCatalog *catalog;
+    LoadEstimate estimate;
+    int boarding_closed;
+    double departure_due;
+    long units_on_train;
+
+    double *waits;
+    int wait_count, wait_capacity;
+    double busy_minutes, departure_delay;
+    long units_departed, wagons_departed;
+    int orders_loaded, departures, max_wagons, mismatches;
+} Dock;
+
+static void *grow(void *array, int *capacity, size_t element_size)
+{
+    *capacity = *capacity ? *capacity * 2 : 64;
+    array = realloc(array, element_size * *capacity);
+    if (!array)
+    {
+        log_message("\n==========\nError: Memory allocation failed for the simulation.\n==========\n\n");
+        exit(1);
+    }
+    return array;
+}
+
+// splitmix64: one 64-bit state per stream, good enough for Monte Carlo and cheap to seed
+static unsigned long long next_random(unsigned long long *state)
+{
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1]
+static double random_unit(unsigned long long *state)
+{
+    return ((next_random(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static int random_between(unsigned long long *state, int low, int high)
+{
+    return low + (int)(next_random(state) % (unsigned long long)(high - low + 1));
+}
+
+static int event_before(const SimEvent *a, const SimEvent *b)
+{
+    return a->time < b->time || (a->time == b->time && a->sequence < b->sequence);
+}
+
+static void schedule(Dock *dock, double time, SimEventType type)
+{
+    if (dock->event_count == dock->event_capacity)
+        dock->events = (SimEvent *)grow(dock->events, &dock->event_capacity, sizeof(SimEvent));
+
+    SimEvent event = {time, dock->next_sequence++, type};
+    int i = dock->event_count++;
+    while (i > 0 && event_before(&event, &dock->events[(i - 1) / 2]))
+    {
+        dock->events[i] = dock->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    dock->events[i] = event;
+}
+
+static SimEvent next_event(Dock *dock)
+{
+    SimEvent first = dock->events[0];
+    SimEvent last = dock->events[--dock->event_count];
+    int i = 0;
+
+    while (1)
+    {
+        int child = 2 * i + 1;
+        if (child >= dock->event_count)
+            break;
+        if (child + 1 < dock->event_count && event_before(&dock->events[child + 1], &dock->events[child]))
+            child++;
+        if (!event_before(&dock->events[child], &last))
+            break;
+        dock->events[i] = dock->events[child];
+        i = child;
+    }
+    if (dock->event_count > 0)
+        dock->events[i] = last;
+    return first;
+}
+
+static void record_wait(Dock *dock, double wait)
+{
+    if (dock->wait_count == dock->wait_capacity)
+        dock->waits = (double *)grow(dock->waits, &dock->wait_capacity, sizeof(double));
+    dock->waits[dock->wait_count++] = wait;
+}
+
+static void order_arrives(Dock *dock)
+{
+    const SimConfig *config = dock->config;
+
+    if (dock->queue_count == dock->queue_capacity)
+    {
+        // Unwrap the ring into the larger buffer
+        int old_capacity = dock->queue_capacity;
+        Order *queue = (Order *)malloc(sizeof(Order) * (old_capacity ? old_capacity * 2 : 64));
+        if (!queue)
+        {
+            log_message("\n==========\nError: Memory allocation failed for the simulation.\n==========\n\n");
+            exit(1);
+        }
+        for (int i = 0; i < dock->queue_count; i++)
+            queue[i] = dock->queue[(dock->queue_head + i) % old_capacity];
+        free(dock->queue);
+        dock->queue = queue;
+        dock->queue_head = 0;
+        dock->queue_capacity = old_capacity ? old_capacity * 2 : 64;
+    }
+
+    Order *order = &dock->queue[(dock->queue_head + dock->queue_count++) % dock->queue_capacity];
+    order->material = get_material(dock->catalog, random_between(&dock->arrival_random, 1, dock->catalog->count));
+    order->quantity = random_between(&dock->arrival_random, 1, 2 * config->order_units - 1);
+    order->station = random_between(&dock->arrival_random, 1, config->stations);
+    order->arrival = dock->now;
+
+    schedule(dock, dock->now - log(random_unit(&dock->arrival_random)) * 60.0 / config->orders_per_hour,
+             SIM_ORDER_ARRIVAL);
+}
+
+// Give orders from the head of the queue to free workers while the train takes them
+static void start_loading(Dock *dock)
+{
+    const SimConfig *config = dock->config;
+
+    while (!dock->boarding_closed && dock->busy_workers < dock->workers && dock->queue_count > 0)
+    {
+        Order *order = &dock->queue[dock->queue_head];
+
+        // An order too large for an empty train goes anyway, it would wait forever
+        reset_load_estimate(&dock->estimate);
+        estimate_load(dock->train, &dock->estimate, order->material, order->quantity, NULL);
+        if (dock->train->wagon_count > 0 &&
+            dock->train->wagon_count + dock->estimate.new_wagons > config->max_wagons)
+            return;
+
+        dock->units_on_train +=
+            load_material_for_station(dock->train, order->material, order->quantity, order->station);
+        dock->orders_loaded++;
+        record_wait(dock, dock->now - order->arrival);
+
+        double minutes = config->setup_minutes + order->quantity / config->units_per_minute *
+                                                     (0.75 + 0.5 * random_unit(&dock->service_random));
+        dock->busy_minutes += dock->now + minutes < dock->end ? minutes : dock->end - dock->now;
+        dock->busy_workers++;
+        schedule(dock, dock->now + minutes, SIM_LOADING_DONE);
+
+        dock->queue_head = (dock->queue_head + 1) % dock->queue_capacity;
+        dock->queue_count--;
+    }
+}
+
+// The train runs its stations and an empty one takes its place
+static void depart(Dock *dock)
+{
+    Train *train = dock->train;
+    long unloaded = 0;
+    int wagons_touched;
+
+    dock->departures++;
+    dock->wagons_departed += train->wagon_count;
+    if (train->wagon_count > dock->max_wagons)
+        dock->max_wagons = train->wagon_count;
+    dock->departure_delay += dock->now - dock->departure_due;
+
+    for (int station = 1; station <= dock->config->stations; station++)
+        unloaded += station_stop(train, station, &wagons_touched);
+    dock->mismatches += (int)labs(dock->units_on_train - unloaded);
+    dock->units_departed += unloaded;
+
+    // Only wagons emptied at the stations are left
+    empty_entire_train(train);
+    dock->units_on_train = 0;
+    dock->boarding_closed = 0;
+    schedule(dock, dock->departure_due + dock->config->departure_minutes, SIM_DEPARTURE_DUE);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const double *sorted, int count, double p)
+{
+    if (count == 0)
+        return 0;
+    int rank = (int)ceil(p * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Run one replication with its own train and catalog. Returns 1 if every unit was unloaded where it was loaded for
+int simulate_replication(const SimConfig *config, int workers, int replication, WagonClassTable *wagon_classes,
+                         const MaterialCatalog *materials, SimResult *result)
+{
+    Dock dock;
+    memset(&dock, 0, sizeof(dock));
+    dock.config = config;
+    dock.workers = workers;
+    dock.end = config->hours * 60.0;
+    dock.arrival_random = config->seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)replication * 2;
+    dock.service_random = config->seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)replication * 2 + 1;
+
+    dock.catalog = create_catalog();
+    for (int i = 0; i < materials->count; i++)
+    {
+        const MaterialType *source = materials->materials[i];
+        MaterialType *material = add_material(dock.catalog, source->name, source->weight, SIM_STOCK);
+        material->volume = source->volume;
+        material->slots = source->slots;
+    }
+    dock.train = create_train(wagon_classes);
+    init_load_estimate(&dock.estimate);
+
+    dock.departure_due = config->departure_minutes;
+    schedule(&dock, config->departure_minutes, SIM_DEPARTURE_DUE);
+    schedule(&dock, -log(random_unit(&dock.arrival_random)) * 60.0 / config->orders_per_hour, SIM_ORDER_ARRIVAL);
+
+    while (dock.event_count > 0 && dock.events[0].time <= dock.end)
+    {
+        SimEvent event = next_event(&dock);
+        dock.now = event.time;
+
+        switch (event.type)
+        {
+        case SIM_ORDER_ARRIVAL:
+            order_arrives(&dock);
+            break;
+        case SIM_LOADING_DONE:
+            dock.busy_workers--;
+            if (dock.boarding_closed && dock.busy_workers == 0)
+                depart(&dock);
+            break;
+        case SIM_DEPARTURE_DUE:
+            dock.boarding_closed = 1;
+            dock.departure_due = dock.now;
+            if (dock.busy_workers == 0)
+                depart(&dock);
+            break;
+        }
+        start_loading(&dock);
+    }
+
+    // Orders still queued count with their wait so far
+    for (int i = 0; i < dock.queue_count; i++)
+        record_wait(&dock, dock.end - dock.queue[(dock.queue_head + i) % dock.queue_capacity].arrival);
+    qsort(dock.waits, dock.wait_count, sizeof(double), compare_doubles);
+
+    double total_wait = 0;
+    for (int i = 0; i < dock.wait_count; i++)
+        total_wait += dock.waits[i];
+
+    result->units_per_hour = dock.units_departed / config->hours;
+    result->orders_per_hour = dock.orders_loaded / config->hours;
+    result->mean_wait = dock.wait_count ? total_wait / dock.wait_count : 0;
+    result->p95_wait = percentile(dock.waits, dock.wait_count, 0.95);
+    result->mean_wagons = dock.departures ? (double)dock.wagons_departed / dock.departures : 0;
+    result->max_wagons = dock.max_wagons;
+    result->utilization = dock.busy_minutes / (workers * dock.end);
+    result->mean_departure_delay = dock.departures ? dock.departure_delay / dock.departures : 0;
+    result->orders_waiting = dock.queue_count;
+    result->mismatches = dock.mismatches;
+
+    destroy_train(dock.train);
+    destroy_catalog(dock.catalog);
+    free_load_estimate(&dock.estimate);
+    free(dock.events);
+    free(dock.queue);
+    free(dock.waits);
+    return dock.mismatches == 0;
+}
+
+typedef struct SimThread {
+    pthread_t thread;
+    int index, thread_count;
+    const SimConfig *config;
+    int workers;
+    WagonClassTable *wagon_classes;
+    const MaterialCatalog *materials;
+    SimResult *results;
+    Metric metrics[METRIC_COUNT];
+    MemoryStats memory[MEM_TYPE_COUNT];
+} SimThread;
+
+// Replications index, index + thread_count, ... Each result has its own slot
+static void *simulation_thread(void *argument)
+{
+    SimThread *thread = (SimThread *)argument;
+
+    quiet_output = 1;
+    for (int r = thread->index; r < thread->config->replications; r += thread->thread_count)
+        simulate_replication(thread->config, thread->workers, r, thread->wagon_classes, thread->materials,
+                             &thread->results[r]);
+
+    // The thread's own counts go with it, hand them over
+    copy_metrics(thread->metrics);
+    copy_memory_stats(thread->memory);
+    return NULL;
+}
+
+static void print_distribution(const char *label, double *values, int count, double scale)
+{
+    double mean = 0, variance = 0;
+
+    for (int i = 0; i < count; i++)
+        mean += values[i] * scale;
+    mean /= count;
+    for (int i = 0; i < count; i++)
+        variance += (values[i] * scale - mean) * (values[i] * scale - mean);
+    variance = count > 1 ? variance / (count - 1) : 0;
+
+    qsort(values, count, sizeof(double), compare_doubles);
+    printf("%-26s %10.2f %10.2f %10.2f %10.2f %10.2f\n", label, mean, sqrt(variance),
+           percentile(values, count, 0.05) * scale, percentile(values, count, 0.50) * scale,
+           percentile(values, count, 0.95) * scale);
+}
+
+// Runs the replications of one staffing level on all threads and prints the distributions
+static int simulate_staffing(const SimConfig *config, int workers, int thread_count, WagonClassTable *wagon_classes,
+                             const MaterialCatalog *materials)
+{
+    SimResult *results = (SimResult *)calloc(config->replications, sizeof(SimResult));
+    SimThread *threads = (SimThread *)calloc(thread_count, sizeof(SimThread));
+    double *values = (double *)malloc(sizeof(double) * config->replications);
+    if (!results || !threads || !values)
+    {
+        log_message("\n==========\nError: Memory allocation failed for the simulation.\n==========\n\n");
+        exit(1);
+    }
+
+    unsigned long long start = metrics_now();
+    for (int t = 0; t < thread_count; t++)
+    {
+        SimThread *thread = &threads[t];
+        thread->index = t;
+        thread->thread_count = thread_count;
+        thread->config = config;
+        thread->workers = workers;
+        thread->wagon_classes = wagon_classes;
+        thread->materials = materials;
+        thread->results = results;
+    }
+    // Share 0, and the shares of threads that could not be started, run on the calling thread
+    int started = 1;
+    while (started < thread_count &&
+           pthread_create(&threads[started].thread, NULL, simulation_thread, &threads[started]) == 0)
+        started++;
+    int was_quiet = quiet_output;
+    simulation_thread(&threads[0]);
+    for (int t = started; t < thread_count; t++)
+        simulation_thread(&threads[t]);
+    quiet_output = was_quiet;
+    for (int t = 1; t < started; t++)
+        pthread_join(threads[t].thread, NULL);
+    double seconds = (metrics_now() - start) / 1e9;
+
+    // The calling thread recorded into its own tables already
+    for (int t = 1; t < started; t++)
+    {
+        merge_metrics(threads[t].metrics);
+        merge_memory_stats(threads[t].memory);
+    }
+
+    int count = config->replications, mismatches = 0;
+    printf("\n==========\nDock simulation: %d workers, %d replications of %.1f h on %d thread%s\n==========\n",
+           workers, count, config->hours, thread_count, thread_count == 1 ? "" : "s");
+    printf("%-26s %10s %10s %10s %10s %10s\n", "", "mean", "sd", "p5", "p50", "p95");
+
+#define SIM_FIELD(field)                   \
+    for (int i = 0; i < count; i++)        \
+        values[i] = results[i].field;
+    SIM_FIELD(units_per_hour)
+    print_distribution("Throughput units/h", values, count, 1);
+    SIM_FIELD(orders_per_hour)
+    print_distribution("Orders loaded/h", values, count, 1);
+    SIM_FIELD(mean_wait)
+    print_distribution("Queueing delay min", values, count, 1);
+    SIM_FIELD(p95_wait)
+    print_distribution("Queueing delay p95 min", values, count, 1);
+    SIM_FIELD(mean_wagons)
+    print_distribution("Wagons per departure", values, count, 1);
+    SIM_FIELD(max_wagons)
+    print_distribution("Most wagons on a train", values, count, 1);
+    SIM_FIELD(utilization)
+    print_distribution("Worker utilization %", values, count, 100);
+    SIM_FIELD(mean_departure_delay)
+    print_distribution("Departure delay min", values, count, 1);
+    SIM_FIELD(orders_waiting)
+    print_distribution("Orders waiting at end", values, count, 1);
+#undef SIM_FIELD
+
+    for (int i = 0; i < count; i++)
+        mismatches += results[i].mismatches;
+    printf("Simulated in %.2f s, %.1f replications/s", seconds, seconds > 0 ? count / seconds : 0.0);
+    if (mismatches)
+        printf(", %d units not unloaded where they were loaded for", mismatches);
+    printf("\n\n");
+
+    free(results);
+    free(threads);
+    free(values);
+    return mismatches == 0;
+}
+
+void init_sim_config(SimConfig *config)
+{
+    config->replications = DEFAULT_SIM_REPLICATIONS;
+    config->threads = 0;
+    config->min_workers = config->max_workers = DEFAULT_SIM_WORKERS;
+    config->hours = DEFAULT_SIM_HOURS;
+    config->orders_per_hour = DEFAULT_SIM_ORDERS_PER_HOUR;
+    config->order_units = DEFAULT_SIM_ORDER_UNITS;
+    config->units_per_minute = DEFAULT_SIM_UNITS_PER_MINUTE;
+    config->setup_minutes = DEFAULT_SIM_SETUP_MINUTES;
+    config->departure_minutes = DEFAULT_SIM_DEPARTURE_MINUTES;
+    config->max_wagons = DEFAULT_SIM_MAX_WAGONS;
+    config->stations = DEFAULT_SIM_STATIONS;
+    config->seed = DEFAULT_SIM_SEED;
+    config->show_metrics = 0;
+}
+
+// Every staffing level in turn. Returns 1 if every replication unloaded every unit at its station
+int run_dock_simulation(const SimConfig *config, WagonClassTable *wagon_classes, const MaterialCatalog *materials)
+{
+    int thread_count = config->threads;
+    if (thread_count <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cores > 0 ? (int)cores : 1;
+    }
+    if (thread_count > config->replications)
+        thread_count = config->replications;
+
+    int ok = 1;
+    for (int workers = config->min_workers; workers <= config->max_workers; workers++)
+        ok &= simulate_staffing(config, workers, thread_count, wagon_classes, materials);
+
+    if (config->show_metrics)
+        display_metrics();
+    return ok;
+}
+
+static void print_sim_usage(const char *program)
+{
+    printf("usage: %s --simulate [--workers N | --workers MIN-MAX] [--replications N] [--threads N]\n"
+           "       [--hours H] [--orders-per-hour R] [--order-units N] [--units-per-minute R]\n"
+           "       [--setup-minutes M] [--departure-minutes M] [--max-wagons N] [--stations N]\n"
+           "       [--seed N] [--metrics]\n",
+           program);
+}
+
+// program --simulate [options]: exit status 0 done, 1 units went astray, 2 bad options
+int dock_sim_main(int argc, char *argv[])
+{
+    SimConfig config;
+    init_sim_config(&config);
+
+    for (int i = 2; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int valid = 1;
+
+        if (strcmp(option, "--metrics") == 0)
+        {
+            config.show_metrics = 1;
+            continue;
+        }
+        if (!value)
+            valid = 0;
+        else if (strcmp(option, "--workers") == 0)
+        {
+            int fields = sscanf(value, "%d-%d", &config.min_workers, &config.max_workers);
+            if (fields == 1)
+                config.max_workers = config.min_workers;
+            valid = fields >= 1 && config.min_workers > 0 && config.max_workers >= config.min_workers;
+        }
+        else if (strcmp(option, "--replications") == 0)
+            valid = sscanf(value, "%d", &config.replications) == 1 && config.replications > 0;
+        else if (strcmp(option, "--threads") == 0)
+            valid = sscanf(value, "%d", &config.threads) == 1 && config.threads >= 0;
+        else if (strcmp(option, "--hours") == 0)
+            valid = sscanf(value, "%lf", &config.hours) == 1 && config.hours > 0;
+        else if (strcmp(option, "--orders-per-hour") == 0)
+            valid = sscanf(value, "%lf", &config.orders_per_hour) == 1 && config.orders_per_hour > 0;
+        else if (strcmp(option, "--order-units") == 0)
+            valid = sscanf(value, "%d", &config.order_units) == 1 && config.order_units > 0;
+        else if (strcmp(option, "--units-per-minute") == 0)
+            valid = sscanf(value, "%lf", &config.units_per_minute) == 1 && config.units_per_minute > 0;
+        else if (strcmp(option, "--setup-minutes") == 0)
+            valid = sscanf(value, "%lf", &config.setup_minutes) == 1 && config.setup_minutes >= 0;
+        else if (strcmp(option, "--departure-minutes") == 0)
+            valid = sscanf(value, "%lf", &config.departure_minutes) == 1 && config.departure_minutes > 0;
+        else if (strcmp(option, "--max-wagons") == 0)
+            valid = sscanf(value, "%d", &config.max_wagons) == 1 && config.max_wagons > 0;
+        else if (strcmp(option, "--stations") == 0)
+            valid = sscanf(value, "%d", &config.stations) == 1 && config.stations > 0 &&
+                    config.stations <= MAX_STATION_ID;
+        else if (strcmp(option, "--seed") == 0)
+            valid = sscanf(value, "%llu", &config.seed) == 1;
+        else
+            valid = 0;
+
+        if (!valid)
+        {
+            print_sim_usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+
+    WagonClassTable *wagon_classes = load_wagon_classes_from_file(WAGON_CLASS_FILE);
+    if (!wagon_classes)
+        wagon_classes = create_default_wagon_classes();
+    MaterialCatalog *materials = load_catalog_from_file(CATALOG_FILE);
+    if (!materials)
+        materials = create_default_catalog();
+
+    int ok = materials->count > 0 ? run_dock_simulation(&config, wagon_classes, materials) : 0;
+
+    destroy_catalog(materials);
+    destroy_wagon_class_table(wagon_classes);
+    return ok ? 0 : 1;
+}
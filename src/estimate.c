@@ -0,0 +1,375 @@
+// estimate.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/estimate.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/catalog.h"
+#include "../include/capacity_index.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+/*
+ * Dry run of load_material_to_class()/load_specified_material_to_train():
+ * the same first-fit rules, played on the capacity index without touching
+ * the train. Each existing wagon that would take units costs one index
+ * query. What earlier lines of the same estimate put into an existing
+ * wagon is kept in a small hash table next to the index. Loads add up
+ * batch by batch, and wagon_units_that_fit() counts the units a wagon takes,
+ * so every wagon takes exactly the units the loader would put into it. Under
+ * the balanced strategy the units spread over other existing wagons, but
+ * the order still fills every one with room first, so the wagons it adds
+ * are the same.
+ *
+ * New wagons are kept as runs of identical wagons. When the rest of an
+ * order fills whole wagons of the same class, a single run stands for all
+ * of them, so an order costs O(1) once the train is full, whatever its
+ * size.
+ */
+
+static void *grow_array(void *array, int *capacity, size_t element_size)
+{
+    int new_capacity = *capacity ? *capacity * 2 : 8;
+    array = realloc(array, element_size * new_capacity);
+    if (!array)
+    {
+        log_message("\n==========\nError: Memory allocation failed for the estimate.\n==========\n\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+static unsigned int hash_wagon(const Wagon *wagon)
+{
+    uintptr_t key = (uintptr_t)wagon;
+    key ^= key >> 17;
+    key *= 0x9E3779B1u;
+    return (unsigned int)(key ^ (key >> 15));
+}
+
+// Slot of the wagon, created empty if the wagon has none yet
+static EstimateSlot *slot_of(LoadEstimate *estimate, Wagon *wagon, int create)
+{
+    if (create && 2 * (estimate->slot_count + 1) > estimate->slot_mask + 1)
+    {
+        // Keep the table at most half full
+        EstimateSlot *old_slots = estimate->slots;
+        int old_size = old_slots ? estimate->slot_mask + 1 : 0;
+        int size = old_size ? old_size * 2 : 64;
+
+        estimate->slots = (EstimateSlot *)calloc(size, sizeof(EstimateSlot));
+        if (!estimate->slots)
+        {
+            log_message("\n==========\nError: Memory allocation failed for the estimate.\n==========\n\n");
+            exit(1);
+        }
+        estimate->slot_mask = size - 1;
+        for (int i = 0; i < old_size; i++)
+        {
+            if (!old_slots[i].wagon)
+                continue;
+            unsigned int j = hash_wagon(old_slots[i].wagon) & estimate->slot_mask;
+            while (estimate->slots[j].wagon)
+                j = (j + 1) & estimate->slot_mask;
+            estimate->slots[j] = old_slots[i];
+        }
+        free(old_slots);
+    }
+    if (!estimate->slots)
+        return NULL;
+
+    unsigned int i = hash_wagon(wagon) & estimate->slot_mask;
+    while (estimate->slots[i].wagon)
+    {
+        if (estimate->slots[i].wagon == wagon)
+            return &estimate->slots[i];
+        i = (i + 1) & estimate->slot_mask;
+    }
+    if (!create)
+        return NULL;
+
+    estimate->slots[i].wagon = wagon;
+    estimate->slots[i].load.weight = wagon->current_weight;
+    estimate->slots[i].load.volume = wagon->current_volume;
+    estimate->slots[i].load.slots = wagon->used_slots;
+    estimate->slot_count++;
+    return &estimate->slots[i];
+}
+
+static void add_placement(LoadEstimate *estimate, MaterialType *material, int first_wagon_id, int wagon_count, int units)
+{
+    if (estimate->placement_count == estimate->placement_capacity)
+        estimate->placements = (Placement *)grow_array(estimate->placements, &estimate->placement_capacity, sizeof(Placement));
+
+    Placement *placement = &estimate->placements[estimate->placement_count++];
+    placement->material = material;
+    placement->first_wagon_id = first_wagon_id;
+    placement->wagon_count = wagon_count;
+    placement->units = units;
+}
+
+// Add units to a load in one batch, as add_materials_for_destination() does
+static void add_to_load(WagonLoad *load, const MaterialType *material, int units)
+{
+    load->weight = sum_after_units(load->weight, material->weight, units);
+    load->volume = sum_after_units(load->volume, material->volume, units);
+    load->slots += units * material->slots;
+}
+
+// Units the wagon would take with the load instead of its own
+static int units_that_fit_with_load(const Wagon *wagon, const WagonLoad *load, const MaterialType *material)
+{
+    Wagon planned = *wagon;
+    planned.current_weight = load->weight;
+    planned.current_volume = load->volume;
+    planned.used_slots = load->slots;
+    return wagon_units_that_fit(&planned, material);
+}
+
+// Units a new wagon of the class would take with the load, as set up by create_wagon_of_class()
+static int class_units_that_fit(const WagonClass *wagon_class, const WagonLoad *load, const MaterialType *material)
+{
+    Wagon planned;
+    memset(&planned, 0, sizeof(planned));
+    planned.max_weight = wagon_class->max_weight;
+    planned.max_volume = wagon_class->max_volume;
+    planned.max_slots = wagon_class->max_slots;
+    return units_that_fit_with_load(&planned, load, material);
+}
+
+static NewWagonRun *append_run(LoadEstimate *estimate, WagonClass *wagon_class, int count)
+{
+    if (estimate->run_count == estimate->run_capacity)
+        estimate->runs = (NewWagonRun *)grow_array(estimate->runs, &estimate->run_capacity, sizeof(NewWagonRun));
+
+    NewWagonRun *run = &estimate->runs[estimate->run_count++];
+    run->wagon_class = wagon_class;
+    run->count = count;
+    memset(&run->load, 0, sizeof(run->load));
+    return run;
+}
+
+// Split run r after its first 'count' wagons
+static void split_run(LoadEstimate *estimate, int r, int count)
+{
+    if (estimate->run_count == estimate->run_capacity)
+        estimate->runs = (NewWagonRun *)grow_array(estimate->runs, &estimate->run_capacity, sizeof(NewWagonRun));
+
+    memmove(&estimate->runs[r + 1], &estimate->runs[r], sizeof(NewWagonRun) * (estimate->run_count - r));
+    estimate->run_count++;
+    estimate->runs[r].count = count;
+    estimate->runs[r + 1].count -= count;
+}
+
+// Take units into existing wagons from the head, as the loader does. Returns the units left
+static int fill_existing_wagons(Train *train, LoadEstimate *estimate, MaterialType *material, int remaining,
+                                WagonClass *wagon_class, const float demand[DIMENSION_COUNT])
+{
+    int position = 0;
+
+    while (remaining > 0)
+    {
+        Wagon *wagon = find_next_wagon_with_room(train, wagon_class, demand, position);
+        if (!wagon)
+            break;
+        position = get_wagon_id(wagon); // the next query starts behind this wagon
+
+        // As the loader, load the wagon again until it has no room left
+        EstimateSlot *slot = slot_of(estimate, wagon, 0);
+        while (remaining > 0)
+        {
+            int units = slot ? units_that_fit_with_load(wagon, &slot->load, material) : wagon_units_that_fit(wagon, material);
+            if (units == 0)
+                break; // full, or an earlier line took the room
+            if (units > remaining)
+                units = remaining;
+
+            if (!slot)
+            {
+                slot = slot_of(estimate, wagon, 1);
+                estimate->existing_wagons++;
+            }
+            add_to_load(&slot->load, material, units);
+            add_placement(estimate, material, get_wagon_id(wagon), 1, units);
+            remaining -= units;
+        }
+    }
+    return remaining;
+}
+
+// Take units into the new wagons earlier lines added, wagon by wagon. Returns the units left
+static int fill_new_wagons(Train *train, LoadEstimate *estimate, MaterialType *material, int remaining,
+                           WagonClass *wagon_class)
+{
+    int wagon_id = train->wagon_count + 1;
+
+    for (int r = 0; r < estimate->run_count && remaining > 0; r++)
+    {
+        NewWagonRun *run = &estimate->runs[r];
+        int per_wagon = class_units_that_fit(run->wagon_class, &run->load, material);
+        int first_wagon_id = wagon_id;
+        wagon_id += run->count;
+
+        if (per_wagon == 0 || (wagon_class && run->wagon_class != wagon_class))
+            continue;
+
+        if (remaining / per_wagon >= run->count)
+        {
+            // Every wagon of the run fills up
+            add_to_load(&run->load, material, per_wagon);
+            add_placement(estimate, material, first_wagon_id, run->count, per_wagon * run->count);
+            remaining -= per_wagon * run->count;
+            continue;
+        }
+
+        // The order ends in this run: whole wagons, then one partly filled wagon
+        int full = remaining / per_wagon;
+        int partial = remaining - full * per_wagon;
+        if (full > 0)
+        {
+            split_run(estimate, r, full);
+            add_to_load(&estimate->runs[r].load, material, per_wagon);
+            r++;
+        }
+        if (partial > 0)
+        {
+            if (estimate->runs[r].count > 1)
+                split_run(estimate, r, 1);
+            add_to_load(&estimate->runs[r].load, material, partial);
+        }
+        add_placement(estimate, material, first_wagon_id, full + (partial > 0), remaining);
+        remaining = 0;
+    }
+    return remaining;
+}
+
+// Add wagons for the rest of the line as add_wagon_for_order() does, whole runs at a time.
+// Returns the units that fit in no wagon
+static int add_new_wagons(Train *train, LoadEstimate *estimate, MaterialType *material, int remaining,
+                          WagonClass *wagon_class)
+{
+    WagonLoad empty = {0, 0, 0};
+    WagonClass *new_class = wagon_class ? wagon_class : default_wagon_class(train->wagon_classes);
+
+    while (remaining > 0)
+    {
+        int per_wagon = class_units_that_fit(new_class, &empty, material);
+        if (per_wagon == 0)
+            return remaining;
+
+        // Every wagon but the last one fills up
+        int count = 1;
+        if (per_wagon < remaining)
+            count = (remaining - 1) / per_wagon;
+
+        int units = per_wagon < remaining ? per_wagon : remaining;
+        NewWagonRun *run = append_run(estimate, new_class, count);
+        add_to_load(&run->load, material, units);
+
+        int first_wagon_id = train->wagon_count + estimate->new_wagons + 1;
+        add_placement(estimate, material, first_wagon_id, count, units * count);
+        estimate->new_wagons += count;
+        remaining -= units * count;
+    }
+    return 0;
+}
+
+void init_load_estimate(LoadEstimate *estimate)
+{
+    memset(estimate, 0, sizeof(LoadEstimate));
+}
+
+// Forget the lines estimated so far, keeping the buffers for the next order
+void reset_load_estimate(LoadEstimate *estimate)
+{
+    if (estimate->slot_count > 0)
+        memset(estimate->slots, 0, sizeof(EstimateSlot) * (estimate->slot_mask + 1));
+    estimate->slot_count = 0;
+    estimate->units_placed = 0;
+    estimate->units_unplaced = 0;
+    estimate->existing_wagons = 0;
+    estimate->new_wagons = 0;
+    estimate->placement_count = 0;
+    estimate->run_count = 0;
+}
+
+void free_load_estimate(LoadEstimate *estimate)
+{
+    free(estimate->placements);
+    free(estimate->runs);
+    free(estimate->slots);
+    init_load_estimate(estimate);
+}
+
+// Where quantity units would go if loaded now, after the lines already in the estimate.
+// Only reads the train. Returns the units placed, 0 if the stock is short
+int estimate_load(Train *train, LoadEstimate *estimate, MaterialType *material, int quantity, WagonClass *wagon_class)
+{
+    if (!check_material_availability(material, quantity))
+    {
+        log_message("\n==========\nInvalid quantity. Available quantity: %d\n==========\n\n", available_quantity(material));
+        return 0;
+    }
+
+    METRIC_START(timer);
+    float demand[DIMENSION_COUNT];
+    material_demand(material, demand);
+
+    int remaining = fill_existing_wagons(train, estimate, material, quantity, wagon_class, demand);
+    remaining = fill_new_wagons(train, estimate, material, remaining, wagon_class);
+    remaining = add_new_wagons(train, estimate, material, remaining, wagon_class);
+
+    estimate->units_placed += quantity - remaining;
+    estimate->units_unplaced += remaining;
+    METRIC_STOP(METRIC_ESTIMATE, timer);
+    return quantity - remaining;
+}
+
+void display_load_estimate(const LoadEstimate *estimate)
+{
+    printf("\n==========\nEstimate: %d units placed, %d existing wagons used, %d new wagons.\n",
+           estimate->units_placed, estimate->existing_wagons, estimate->new_wagons);
+    if (estimate->units_unplaced > 0)
+        printf("%d units fit in no wagon.\n", estimate->units_unplaced);
+
+    for (int i = 0; i < estimate->placement_count; i++)
+    {
+        const Placement *placement = &estimate->placements[i];
+        if (placement->wagon_count == 1)
+            printf("  %d %s -> Wagon %d\n", placement->units, placement->material->name, placement->first_wagon_id);
+        else
+            printf("  %d %s -> Wagons %d-%d\n", placement->units, placement->material->name,
+                   placement->first_wagon_id, placement->first_wagon_id + placement->wagon_count - 1);
+    }
+    printf("==========\n\n");
+}
+
+void estimate_load_main(Train *train, MaterialCatalog *catalog)
+{
+    char input[50];
+    int quantity;
+    LoadEstimate estimate;
+
+    init_load_estimate(&estimate);
+    do
+    {
+        MaterialType *material = select_material(catalog, "\nSelect material to estimate:");
+        if (!material)
+            break;
+
+        printf("Enter the quantity: ");
+        fgets(input, sizeof(input), stdin);
+        if (sscanf(input, "%d", &quantity) != 1 || quantity <= 0)
+            printf("\n==========\nInvalid quantity. \n==========\n\n");
+        else
+            estimate_load(train, &estimate, material, quantity, NULL);
+
+        printf("Add another material to the order? (y/n): ");
+    } while (fgets(input, sizeof(input), stdin) && (input[0] == 'y' || input[0] == 'Y'));
+
+    display_load_estimate(&estimate);
+    free_load_estimate(&estimate);
+}
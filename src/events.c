@@ -0,0 +1,220 @@
+// events.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/events.h"
+#include "../include/train.h"
+#include "../include/catalog.h"
+#include "../include/utils.h"
+#include "../include/memtrack.h"
+
+/*
+ * Change-event feed. The wagon functions report every change to the
+ * train here: wagons created or deleted, units added or removed per wagon
+ * and material, renumbering, and whole reloads. Each event is handed to
+ * the subscribed callbacks and kept in a ring of the last EVENT_RING_SIZE
+ * events, so views update in the number of changes instead of rescanning
+ * the train.
+ *
+ * Ring readers keep their own cursor. A reader that falls more than a
+ * ring behind is told so, moved to the present, and must redraw from the
+ * train once. A train without a feed pays one pointer test per change.
+ */
+
+void enable_events(Train *train)
+{
+    if (train->events)
+        return;
+    train->events = (EventFeed *)tracked_calloc(MEM_EVENT_FEED, 1, sizeof(EventFeed));
+}
+
+void free_events(Train *train)
+{
+    if (!train->events)
+        return;
+    tracked_free(MEM_EVENT_FEED, train->events, sizeof(EventFeed));
+    train->events = NULL;
+}
+
+// Returns 0 if the train has no feed or every subscriber slot is taken
+int subscribe_events(Train *train, TrainEventCallback callback, void *context)
+{
+    EventFeed *feed = train->events;
+    if (!feed || feed->subscriber_count == MAX_EVENT_SUBSCRIBERS)
+        return 0;
+
+    feed->subscribers[feed->subscriber_count].callback = callback;
+    feed->subscribers[feed->subscriber_count].context = context;
+    feed->subscriber_count++;
+    return 1;
+}
+
+void unsubscribe_events(Train *train, TrainEventCallback callback, void *context)
+{
+    EventFeed *feed = train->events;
+    if (!feed)
+        return;
+
+    for (int i = 0; i < feed->subscriber_count; i++)
+    {
+        if (feed->subscribers[i].callback == callback && feed->subscribers[i].context == context)
+        {
+            memmove(&feed->subscribers[i], &feed->subscribers[i + 1],
+                    sizeof(EventSubscriber) * (feed->subscriber_count - i - 1));
+            feed->subscriber_count--;
+            return;
+        }
+    }
+}
+
+// Sequence the next event will get, where a new reader starts
+unsigned long current_event_sequence(Train *train)
+{
+    return train->events ? train->events->next_sequence : 0;
+}
+
+// Copy up to max_events events from *cursor on and advance the cursor past them.
+// Returns the number copied, or -1 if events were lost or the cursor is in the future,
+// and the cursor then moves to the present
+int read_events(Train *train, unsigned long *cursor, TrainEvent *events, int max_events)
+{
+    EventFeed *feed = train->events;
+    if (!feed)
+        return 0;
+
+    if (*cursor > feed->next_sequence || feed->next_sequence - *cursor > EVENT_RING_SIZE)
+    {
+        *cursor = feed->next_sequence;
+        return -1;
+    }
+
+    int count = 0;
+    while (*cursor != feed->next_sequence && count < max_events)
+    {
+        events[count++] = feed->ring[*cursor % EVENT_RING_SIZE];
+        (*cursor)++;
+    }
+    return count;
+}
+
+static void emit_event(EventFeed *feed, TrainEventType type, int wagon_id, int material_id, int count)
+{
+    TrainEvent *event = &feed->ring[feed->next_sequence % EVENT_RING_SIZE];
+
+    event->sequence = feed->next_sequence++;
+    event->type = type;
+    event->wagon_id = wagon_id;
+    event->material_id = material_id;
+    event->count = count;
+
+    for (int i = 0; i < feed->subscriber_count; i++)
+        feed->subscribers[i].callback(event, feed->subscribers[i].context);
+}
+
+// count > 0 units were added, count < 0 units were removed
+void event_units_changed(Wagon *wagon, MaterialType *material, int count)
+{
+    EventFeed *feed = get_wagon_train(wagon)->events;
+    if (!feed || count == 0)
+        return;
+    emit_event(feed, count > 0 ? EVENT_UNITS_ADDED : EVENT_UNITS_REMOVED, get_wagon_id(wagon), material->id, abs(count));
+}
+
+void event_wagon_created(Train *train, int wagon_id)
+{
+    if (train->events)
+        emit_event(train->events, EVENT_WAGON_CREATED, wagon_id, 0, 0);
+}
+
+void event_wagon_deleted(Train *train, int wagon_id)
+{
+    if (train->events)
+        emit_event(train->events, EVENT_WAGON_DELETED, wagon_id, 0, 0);
+}
+
+void event_wagons_renumbered(Train *train, int first_wagon_id, int count)
+{
+    if (train->events && count > 0)
+        emit_event(train->events, EVENT_WAGONS_RENUMBERED, first_wagon_id, 0, count);
+}
+
+void event_train_reloaded(Train *train)
+{
+    if (train->events)
+        emit_event(train->events, EVENT_TRAIN_RELOADED, 0, 0, train->wagon_count);
+}
+
+// EVENT_WAGONS_DETACHED or EVENT_WAGONS_ATTACHED
+void event_wagons_moved(Train *train, TrainEventType type, int first_wagon_id, int count)
+{
+    if (train->events && count > 0)
+        emit_event(train->events, type, first_wagon_id, 0, count);
+}
+
+// One line of text for the event, returns its length like snprintf
+int format_event(const TrainEvent *event, MaterialCatalog *catalog, char *text, size_t text_size)
+{
+    MaterialType *material;
+
+    switch (event->type)
+    {
+    case EVENT_WAGON_CREATED:
+        return snprintf(text, text_size, "Wagon %d added", event->wagon_id);
+    case EVENT_WAGON_DELETED:
+        return snprintf(text, text_size, "Wagon %d removed", event->wagon_id);
+    case EVENT_UNITS_ADDED:
+    case EVENT_UNITS_REMOVED:
+        material = get_material(catalog, event->material_id);
+        return snprintf(text, text_size, "Wagon %d: %c%d %s", event->wagon_id,
+                        event->type == EVENT_UNITS_ADDED ? '+' : '-', event->count,
+                        material ? material->name : "unknown material");
+    case EVENT_WAGONS_RENUMBERED:
+        if (event->count == 1)
+            return snprintf(text, text_size, "Wagon %d renumbered", event->wagon_id);
+        return snprintf(text, text_size, "Wagons %d-%d renumbered", event->wagon_id,
+                        event->wagon_id + event->count - 1);
+    case EVENT_TRAIN_RELOADED:
+        return snprintf(text, text_size, "Train reloaded from file, %d wagons", event->count);
+    case EVENT_WAGONS_DETACHED:
+        return snprintf(text, text_size, "Wagons %d-%d uncoupled", event->wagon_id, event->wagon_id + event->count - 1);
+    case EVENT_WAGONS_ATTACHED:
+        return snprintf(text, text_size, "Wagons %d-%d coupled", event->wagon_id, event->wagon_id + event->count - 1);
+    }
+    return snprintf(text, text_size, "Unknown event");
+}
+
+// Print what changed since the last time this view was shown
+void display_changes_main(Train *train, MaterialCatalog *catalog)
+{
+    static unsigned long cursor = 0;
+    TrainEvent events[256];
+    char text[128];
+    int shown = 0, count;
+
+    if (!train->events)
+    {
+        printf("\n==========\nChange events are not recorded for this train.\n==========\n\n");
+        return;
+    }
+
+    printf("\n==========\nChanges since the last view:\n");
+    while ((count = read_events(train, &cursor, events, 256)) != 0)
+    {
+        if (count < 0)
+        {
+            printf("More than %d changes, showing the whole train instead.\n==========\n\n", EVENT_RING_SIZE);
+            display_train_status(train);
+            return;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            format_event(&events[i], catalog, text, sizeof(text));
+            printf("%s\n", text);
+        }
+        shown += count;
+    }
+
+    if (shown == 0)
+        printf("No changes.\n");
+    printf("==========\n\n");
+}
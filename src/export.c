@@ -0,0 +1,400 @@
+// export.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "../include/export.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/catalog.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+/*
+ * Machine-readable status for analytics, as CSV with a header row or as
+ * JSON Lines. Rows are formatted straight into one large buffer that is
+ * reused by every export and written out whenever it could not take
+ * another row, so memory stays constant whatever the size of the train.
+ * Numbers are formatted by hand (the same text as "%d" and "%.2f"), which
+ * is several times faster than printf for row-sized output.
+ *
+ * Per-wagon material counts come from one pass over the units of each
+ * wagon, counted by catalog ID, so a million units cost a million list
+ * steps and one row per wagon and material.
+ */
+
+static const char *kind_names[EXPORT_KIND_COUNT] = {"wagons", "wagon_materials", "materials"};
+static const char *format_extensions[EXPORT_FORMAT_COUNT] = {"csv", "jsonl"};
+
+static const char *csv_headers[EXPORT_KIND_COUNT] = {
+    "wagon_id,class,max_weight,current_weight,max_volume,current_volume,max_slots,used_slots,units\n",
+    "wagon_id,material_id,material,units,weight\n",
+    "material_id,material,unit_weight,unit_volume,unit_slots,quantity,loaded,reserved,available\n"};
+
+static char export_buffer[EXPORT_BUFFER_SIZE];
+
+typedef struct ExportStream {
+    FILE *out;
+    size_t used;
+    int failed;
+} ExportStream;
+
+static void flush_stream(ExportStream *stream)
+{
+    if (stream->used > 0 && fwrite(export_buffer, 1, stream->used, stream->out) != stream->used)
+        stream->failed = 1;
+    stream->used = 0;
+}
+
+// Make room for one more row
+static void row_start(ExportStream *stream)
+{
+    if (EXPORT_BUFFER_SIZE - stream->used < EXPORT_ROW_MAX)
+        flush_stream(stream);
+}
+
+static void append_text(ExportStream *stream, const char *text)
+{
+    size_t length = strlen(text);
+    memcpy(export_buffer + stream->used, text, length);
+    stream->used += length;
+}
+
+static void append_format(ExportStream *stream, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    stream->used += vsnprintf(export_buffer + stream->used, EXPORT_BUFFER_SIZE - stream->used, format, args);
+    va_end(args);
+}
+
+static void append_char(ExportStream *stream, char c)
+{
+    export_buffer[stream->used++] = c;
+}
+
+static void append_int(ExportStream *stream, long value)
+{
+    char digits[24];
+    int length = 0;
+    unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+    do
+    {
+        digits[length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0)
+        append_char(stream, '-');
+    while (length > 0)
+        append_char(stream, digits[--length]);
+}
+
+// Same text as "%.2f". Values a whole number of hundredths away from a rounding tie are
+// written directly, the rest go through printf
+static void append_fixed2(ExportStream *stream, double value)
+{
+    double hundredths = value * 100.0;
+    double rounded = hundredths < 0 ? (double)(long)(hundredths - 0.5) : (double)(long)(hundredths + 0.5);
+    double error = hundredths - rounded;
+
+    if (hundredths > -1e15 && hundredths < 1e15 && error > -1e-6 && error < 1e-6)
+    {
+        long cents = (long)rounded;
+        if (cents < 0)
+        {
+            append_char(stream, '-');
+            cents = -cents;
+        }
+        append_int(stream, cents / 100);
+        append_char(stream, '.');
+        append_char(stream, (char)('0' + cents / 10 % 10));
+        append_char(stream, (char)('0' + cents % 10));
+        return;
+    }
+    append_format(stream, "%.2f", value);
+}
+
+// A name as a CSV field, quoted only when it has to be
+static void append_csv_string(ExportStream *stream, const char *text)
+{
+    if (!strpbrk(text, ",\"\r\n"))
+    {
+        append_text(stream, text);
+        return;
+    }
+    append_char(stream, '"');
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '"')
+            append_char(stream, '"');
+        append_char(stream, *c);
+    }
+    append_char(stream, '"');
+}
+
+static void append_json_string(ExportStream *stream, const char *text)
+{
+    append_char(stream, '"');
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            append_char(stream, '\\');
+            append_char(stream, (char)*c);
+        }
+        else if (*c < 0x20)
+        {
+            append_format(stream, "\\u%04x", *c);
+        }
+        else
+        {
+            append_char(stream, (char)*c);
+        }
+    }
+    append_char(stream, '"');
+}
+
+static void append_string(ExportStream *stream, ExportFormat format, const char *text)
+{
+    if (format == EXPORT_CSV)
+        append_csv_string(stream, text);
+    else
+        append_json_string(stream, text);
+}
+
+// One field: its JSON key and value separator, or the CSV comma
+static void append_key(ExportStream *stream, ExportFormat format, const char *key, int first)
+{
+    if (format == EXPORT_CSV)
+    {
+        if (!first)
+            append_char(stream, ',');
+        return;
+    }
+    append_text(stream, first ? "{\"" : ",\"");
+    append_text(stream, key);
+    append_text(stream, "\":");
+}
+
+static void end_row(ExportStream *stream, ExportFormat format)
+{
+    if (format == EXPORT_JSON_LINES)
+        append_char(stream, '}');
+    append_char(stream, '\n');
+}
+
+static long export_wagons(Train *train, ExportFormat format, ExportStream *stream)
+{
+    long rows = 0;
+
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next)
+    {
+        int units = 0;
+        for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+            units++;
+
+        row_start(stream);
+        append_key(stream, format, "wagon_id", 1);
+        append_int(stream, get_wagon_id(wagon));
+        append_key(stream, format, "class", 0);
+        append_string(stream, format, wagon->wagon_class ? wagon->wagon_class->name : DEFAULT_WAGON_CLASS);
+        append_key(stream, format, "max_weight", 0);
+        append_fixed2(stream, wagon->max_weight);
+        append_key(stream, format, "current_weight", 0);
+        append_fixed2(stream, wagon->current_weight);
+        append_key(stream, format, "max_volume", 0);
+        append_fixed2(stream, wagon->max_volume);
+        append_key(stream, format, "current_volume", 0);
+        append_fixed2(stream, wagon->current_volume);
+        append_key(stream, format, "max_slots", 0);
+        append_int(stream, wagon->max_slots);
+        append_key(stream, format, "used_slots", 0);
+        append_int(stream, wagon->used_slots);
+        append_key(stream, format, "units", 0);
+        append_int(stream, units);
+        end_row(stream, format);
+        rows++;
+    }
+    return rows;
+}
+
+static long export_wagon_materials(Train *train, MaterialCatalog *catalog, ExportFormat format, ExportStream *stream)
+{
+    // Units per catalog ID, and the IDs seen in the current wagon in stack order
+    int *counts = (int *)calloc(catalog->count + 1, sizeof(int));
+    int *seen = (int *)malloc(sizeof(int) * (catalog->count + 1));
+    long rows = 0;
+
+    if (!counts || !seen)
+    {
+        log_message("\n==========\nError: Memory allocation failed for the export.\n==========\n\n");
+        exit(1);
+    }
+
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next)
+    {
+        int seen_count = 0;
+        for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+        {
+            int id = unit->type->id;
+            if (id < 1 || id > catalog->count)
+                continue;
+            if (counts[id]++ == 0)
+                seen[seen_count++] = id;
+        }
+
+        for (int i = 0; i < seen_count; i++)
+        {
+            MaterialType *material = catalog->materials[seen[i] - 1];
+            int units = counts[seen[i]];
+            counts[seen[i]] = 0;
+
+            row_start(stream);
+            append_key(stream, format, "wagon_id", 1);
+            append_int(stream, get_wagon_id(wagon));
+            append_key(stream, format, "material_id", 0);
+            append_int(stream, material->id);
+            append_key(stream, format, "material", 0);
+            append_string(stream, format, material->name);
+            append_key(stream, format, "units", 0);
+            append_int(stream, units);
+            append_key(stream, format, "weight", 0);
+            append_fixed2(stream, units * material->weight);
+            end_row(stream, format);
+            rows++;
+        }
+    }
+
+    free(counts);
+    free(seen);
+    return rows;
+}
+
+static long export_materials(MaterialCatalog *catalog, ExportFormat format, ExportStream *stream)
+{
+    for (int i = 0; i < catalog->count; i++)
+    {
+        MaterialType *material = catalog->materials[i];
+
+        row_start(stream);
+        append_key(stream, format, "material_id", 1);
+        append_int(stream, material->id);
+        append_key(stream, format, "material", 0);
+        append_string(stream, format, material->name);
+        append_key(stream, format, "unit_weight", 0);
+        append_fixed2(stream, material->weight);
+        append_key(stream, format, "unit_volume", 0);
+        append_fixed2(stream, material->volume);
+        append_key(stream, format, "unit_slots", 0);
+        append_int(stream, material->slots);
+        append_key(stream, format, "quantity", 0);
+        append_int(stream, material->quantity);
+        append_key(stream, format, "loaded", 0);
+        append_int(stream, material->loaded);
+        append_key(stream, format, "reserved", 0);
+        append_int(stream, material->reserved);
+        append_key(stream, format, "available", 0);
+        append_int(stream, available_quantity(material));
+        end_row(stream, format);
+    }
+    return catalog->count;
+}
+
+// Default file name of an export, e.g. "wagons.csv"
+const char *export_file_name(ExportKind kind, ExportFormat format)
+{
+    static char name[32];
+    snprintf(name, sizeof(name), "%s.%s", kind_names[kind], format_extensions[format]);
+    return name;
+}
+
+// Write one export to an open stream. Returns the number of rows, -1 if writing failed
+long export_train(Train *train, MaterialCatalog *catalog, ExportKind kind, ExportFormat format, FILE *out)
+{
+    ExportStream stream = {out, 0, 0};
+    long rows = 0;
+
+    METRIC_START(timer);
+    if (format == EXPORT_CSV)
+        append_text(&stream, csv_headers[kind]);
+
+    switch (kind)
+    {
+    case EXPORT_WAGONS:
+        rows = export_wagons(train, format, &stream);
+        break;
+    case EXPORT_WAGON_MATERIALS:
+        rows = export_wagon_materials(train, catalog, format, &stream);
+        break;
+    case EXPORT_MATERIALS:
+        rows = export_materials(catalog, format, &stream);
+        break;
+    default:
+        break;
+    }
+
+    flush_stream(&stream);
+    if (fflush(out) != 0)
+        stream.failed = 1;
+    METRIC_STOP(METRIC_EXPORT, timer);
+    return stream.failed ? -1 : rows;
+}
+
+// Export to a file, "-" for stdout. Returns the number of rows, -1 on error
+long export_train_to_file(Train *train, MaterialCatalog *catalog, ExportKind kind, ExportFormat format,
+                          const char *filename)
+{
+    if (strcmp(filename, "-") == 0)
+        return export_train(train, catalog, kind, format, stdout);
+
+    FILE *file = fopen(filename, "w");
+    if (!file)
+    {
+        log_message("\n==========\nError: Unable to open file %s for writing.\n==========\n\n", filename);
+        return -1;
+    }
+
+    // The rows arrive in large blocks already, stdio needs no buffer of its own
+    setvbuf(file, NULL, _IONBF, 0);
+    long rows = export_train(train, catalog, kind, format, file);
+    if (fclose(file) != 0)
+        rows = -1;
+
+    if (rows < 0)
+        log_message("\n==========\nError: Writing %s failed.\n==========\n\n", filename);
+    else
+        log_message("\n==========\n%ld rows exported to %s\n==========\n\n", rows, filename);
+    return rows;
+}
+
+void export_train_main(Train *train, MaterialCatalog *catalog)
+{
+    char input[256];
+    int kind, format;
+
+    printf("\nExport:\n1. Wagons\n2. Materials per wagon\n3. Material totals\nEnter your choice: ");
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &kind) != 1 || kind < 1 || kind > EXPORT_KIND_COUNT)
+    {
+        printf("\n==========\nInvalid choice. Operation canceled.\n==========\n\n");
+        return;
+    }
+
+    printf("Format:\n1. CSV\n2. JSON Lines\nEnter your choice: ");
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &format) != 1 || format < 1 || format > EXPORT_FORMAT_COUNT)
+    {
+        printf("\n==========\nInvalid choice. Operation canceled.\n==========\n\n");
+        return;
+    }
+
+    const char *default_name = export_file_name((ExportKind)(kind - 1), (ExportFormat)(format - 1));
+    printf("Enter the file name, - for the screen (Enter for %s): ", default_name);
+    fgets(input, sizeof(input), stdin);
+    input[strcspn(input, "\r\n")] = 0;
+
+    export_train_to_file(train, catalog, (ExportKind)(kind - 1), (ExportFormat)(format - 1),
+                         input[0] ? input : default_name);
+}
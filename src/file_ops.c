@@ -2,25 +2,536 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "../include/wagon.h"
 #include "../include/train.h"
 #include "../include/material.h"
+#include "../include/catalog.h"
 #include "../include/file_ops.h"
 #include "../include/utils.h"
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/capacity_index.h"
+#include "../include/reservation.h"
+#include "../include/events.h"
+#include "../include/station.h"
 
+/*
+ * Manifests are loaded and saved in ranges of whole wagons, one range per
+ * thread for large manifests.
+ *
+ * Loading reads the file into memory and cuts it at "Wagon ID:" lines.
+ * Every range is parsed line by line exactly as fgets() with a 256-byte
+ * buffer used to read it, into wagons and units allocated by its own
+ * thread, so they come from that thread's malloc arena. While the ranges
+ * are parsed, the catalog, the wagon classes and the train are only read:
+ * each range counts its units per material in the order the materials
+ * first appear, and keeps the names the catalog or the class table does
+ * not have yet, the Train ID and Total Wagons lines, and the wagons with
+ * units for a station. The ranges are then merged in file order: the
+ * wagon lists are stitched together, new materials and classes are added
+ * and loaded quantities, material carriers and the station index updated,
+ * so the catalog and its in-use order come out as if the file had been
+ * read line by line.
+ *
+ * Saving formats the ranges concurrently, each with fprintf() into a
+ * memory stream of its own, then writes every buffer at its offset in the
+ * file with pwrite(), again one thread per range.
+ */
 
+#define FILE_LINE_SIZE 256   // as the manifest was read with fgets()
+#define FILE_WAGON_BYTES 128 // rough size of a saved wagon with a few units, to size the load ranges
 
+int file_threads = 0;
+int file_range_wagons = FILE_RANGE_WAGONS;
+
+// Look up a unit's material by name. Materials missing from the catalog are
+// added with no stock so every unit of a name shares one MaterialType
+static MaterialType *resolve_material(MaterialCatalog *catalog, const char *name, float weight)
+{
+    MaterialType *material_type = find_material(catalog, name);
+    if (material_type == NULL)
+    {
+        material_type = add_material(catalog, name, weight, 0);
+    }
+    return material_type;
+}
+
+// Class of a wagon saved without a Class line: the first class of its capacity, else the default class
+static WagonClass *class_for_capacity(WagonClassTable *table, float max_weight)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        if (table->classes[i]->max_weight == max_weight)
+            return table->classes[i];
+    }
+    return default_wagon_class(table);
+}
+
+
+// A material as the units of one range use it
+typedef struct RangeMaterial {
+    MaterialType *material; // NULL for a name the catalog does not have yet
+    char name[50];
+    float weight;           // of its first unit, for the new catalog entry
+    int units;
+} RangeMaterial;
+
+// A unit of a material the catalog does not have yet
+typedef struct PendingUnit {
+    Wagon *wagon;
+    LoadedMaterial *unit;
+    int material; // in the range's materials
+} PendingUnit;
+
+// A wagon of a class the class table does not have yet
+typedef struct PendingClass {
+    Wagon *wagon;
+    char name[32];
+    float max_weight;
+    int assign; // 0 once a later Class line of the wagon replaced it
+} PendingClass;
+
+typedef struct LoadRange {
+    const char *start, *end;
+    Train *train;
+    MaterialCatalog *catalog;
+    Wagon *first_wagon, *last_wagon;
+    LoadedMaterial *last_unit; // of last_wagon
+    char train_id[20];
+    int has_train_id;
+    int total_wagons, has_total_wagons;
+    int *material_index; // by catalog ID - 1, -1 until the range has a unit of it
+    RangeMaterial *materials;
+    int material_count, material_capacity;
+    PendingUnit *pending_units;
+    int pending_unit_count, pending_unit_capacity;
+    PendingClass *pending_classes;
+    int pending_class_count, pending_class_capacity;
+    Wagon **station_wagons; // wagons with units for a station
+    int station_wagon_count, station_wagon_capacity;
+    MemoryStats memory[MEM_TYPE_COUNT];
+} LoadRange;
+
+typedef struct SaveRange {
+    Wagon *first_wagon, *end; // wagons from first_wagon up to end, end excluded
+    FILE *stream;             // formats into text
+    char *text;
+    size_t length;
+    int file;
+    off_t offset;
+    int failed;
+} SaveRange;
+
+static void *grow_array(void *array, int *capacity, size_t element_size)
+{
+    *capacity = *capacity ? *capacity * 2 : 16;
+    array = realloc(array, element_size * *capacity);
+    if (!array)
+    {
+        log_message("\n==========\nError: Memory allocation failed while reading the train file.\n==========\n\n");
+        exit(1);
+    }
+    return array;
+}
+
+// Ranges for a manifest of about wagon_count wagons
+static int range_count_for(long wagon_count)
+{
+    int threads = file_threads;
+    if (threads <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    if (threads > FILE_MAX_THREADS)
+        threads = FILE_MAX_THREADS;
+    long ranges = file_range_wagons > 0 ? wagon_count / file_range_wagons : wagon_count;
+    if (ranges < threads)
+        threads = ranges > 1 ? (int)ranges : 1;
+    return threads;
+}
+
+// Range 0, and the ranges of threads that could not be started, run on the calling thread.
+// Returns the number of threads started: ranges 1 up to that number ran on them
+static int run_ranges(void *(*work)(void *), void *ranges, size_t range_size, int count, pthread_t threads[])
+{
+    char *range = (char *)ranges;
+    int started = 1;
+    while (started < count && pthread_create(&threads[started], NULL, work, range + started * range_size) == 0)
+        started++;
+    work(range);
+    for (int i = started; i < count; i++)
+        work(range + i * range_size);
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+    return started;
+}
+
+// Index of name in the range's materials, adding it the first time
+static int range_material(LoadRange *range, const char *name, float weight)
+{
+    MaterialType *material = find_material(range->catalog, name);
+    if (material && range->material_index[material->id - 1] >= 0)
+        return range->material_index[material->id - 1];
+    if (!material)
+    {
+        for (int i = 0; i < range->material_count; i++)
+        {
+            if (!range->materials[i].material && strcmp(range->materials[i].name, name) == 0)
+                return i;
+        }
+    }
+
+    if (range->material_count == range->material_capacity)
+        range->materials = grow_array(range->materials, &range->material_capacity, sizeof(RangeMaterial));
+    RangeMaterial *entry = &range->materials[range->material_count];
+    entry->material = material;
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    entry->weight = weight;
+    entry->units = 0;
+    if (material)
+        range->material_index[material->id - 1] = range->material_count;
+    return range->material_count++;
+}
+
+static void parse_line(LoadRange *range, const char *line)
+{
+    Wagon *wagon = range->last_wagon;
+
+    if (strncmp(line, "Train ID:", 9) == 0)
+    {
+        if (sscanf(line, "Train ID: %19s", range->train_id) == 1)
+            range->has_train_id = 1;
+    }
+    else if (strncmp(line, "Total Wagons:", 13) == 0)
+    {
+        if (sscanf(line, "Total Wagons: %d", &range->total_wagons) == 1)
+            range->has_total_wagons = 1;
+    }
+    else if (strncmp(line, "Wagon ID:", 9) == 0)
+    {
+        // Allocate a new wagon
+        Wagon *new_wagon = (Wagon *)tracked_malloc(MEM_WAGON, sizeof(Wagon));
+        new_wagon->next = NULL; // IDs are positions, given when the wagons are indexed
+        new_wagon->prev = wagon;
+        new_wagon->loaded_materials = NULL;
+        new_wagon->block = NULL;
+        new_wagon->wagon_class = NULL;
+        new_wagon->max_weight = DEFAULT_WAGON_CAPACITY;
+        new_wagon->current_weight = 0;
+        new_wagon->max_volume = -1; // until read, else taken from the class
+        new_wagon->current_volume = 0;
+        new_wagon->max_slots = -1;
+        new_wagon->used_slots = 0;
+        new_wagon->reserved_weight = 0;
+        new_wagon->reserved_volume = 0;
+        new_wagon->reserved_slots = 0;
+        new_wagon->reserved_units = 0;
+        new_wagon->stops = NULL;
+        new_wagon->cargo = NULL;
+        if (wagon != NULL)
+            wagon->next = new_wagon;
+        else
+            range->first_wagon = new_wagon;
+        range->last_wagon = new_wagon;
+        range->last_unit = NULL;
+    }
+    else if (wagon == NULL)
+    {
+        // Wagon lines before the first wagon
+    }
+    else if (strncmp(line, "  Max Weight:", 13) == 0)
+    {
+        sscanf(line, "  Max Weight: %f kg", &wagon->max_weight);
+    }
+    else if (strncmp(line, "  Max Volume:", 13) == 0)
+    {
+        sscanf(line, "  Max Volume: %f m3", &wagon->max_volume);
+    }
+    else if (strncmp(line, "  Max Slots:", 12) == 0)
+    {
+        sscanf(line, "  Max Slots: %d", &wagon->max_slots);
+    }
+    else if (strncmp(line, "  Class:", 8) == 0)
+    {
+        // Classes missing from the class file are added with the wagon's capacity when the range is merged
+        char class_name[32];
+        if (sscanf(line, "  Class: %31[^\n]", class_name) == 1)
+        {
+            wagon->wagon_class = find_wagon_class(range->train->wagon_classes, class_name);
+            // The last Class line of a wagon wins, but the classes of the others are added all the same
+            if (range->pending_class_count > 0 && range->pending_classes[range->pending_class_count - 1].wagon == wagon)
+                range->pending_classes[range->pending_class_count - 1].assign = 0;
+            if (wagon->wagon_class == NULL)
+            {
+                if (range->pending_class_count == range->pending_class_capacity)
+                    range->pending_classes = grow_array(range->pending_classes, &range->pending_class_capacity,
+                                                        sizeof(PendingClass));
+                PendingClass *pending = &range->pending_classes[range->pending_class_count++];
+                pending->wagon = wagon;
+                snprintf(pending->name, sizeof(pending->name), "%s", class_name);
+                pending->max_weight = wagon->max_weight;
+                pending->assign = 1;
+            }
+        }
+    }
+    else if (strncmp(line, "  Current Weight:", 17) == 0)
+    {
+        sscanf(line, "  Current Weight: %f kg", &wagon->current_weight);
+    }
+    else if (strncmp(line, "    -", 5) == 0)
+    {
+        // Allocate a new material
+        LoadedMaterial *new_material = (LoadedMaterial *)tracked_malloc(MEM_LOADED_MATERIAL, sizeof(LoadedMaterial));
+        new_material->next = NULL;
+        new_material->prev = NULL;
+
+        // Units loaded for a station end in ", station N"
+        char material_name[50] = "";
+        float material_weight = 0;
+        int destination = 0;
+        sscanf(line, "    - %49[^:]: %f kg, station %d", material_name, &material_weight, &destination);
+
+        // Units share the catalog's MaterialType so loaded counts stay right
+        int index = range_material(range, material_name, material_weight);
+        range->materials[index].units++;
+        MaterialType *material_type = range->materials[index].material;
+        new_material->type = material_type;
+        if (material_type)
+        {
+            wagon->current_volume += material_type->volume;
+            wagon->used_slots += material_type->slots;
+        }
+        else
+        {
+            if (range->pending_unit_count == range->pending_unit_capacity)
+                range->pending_units = grow_array(range->pending_units, &range->pending_unit_capacity,
+                                                  sizeof(PendingUnit));
+            range->pending_units[range->pending_unit_count++] = (PendingUnit){wagon, new_material, index};
+        }
+
+        new_material->destination = destination > 0 && destination <= MAX_STATION_ID ? destination : 0;
+        if (new_material->destination &&
+            (range->station_wagon_count == 0 || range->station_wagons[range->station_wagon_count - 1] != wagon))
+        {
+            if (range->station_wagon_count == range->station_wagon_capacity)
+                range->station_wagons = grow_array(range->station_wagons, &range->station_wagon_capacity,
+                                                   sizeof(Wagon *));
+            range->station_wagons[range->station_wagon_count++] = wagon;
+        }
+
+        // Insert material at the end of the wagon
+        if (range->last_unit == NULL)
+        {
+            wagon->loaded_materials = new_material;
+        }
+        else
+        {
+            range->last_unit->next = new_material;
+            new_material->prev = range->last_unit;
+        }
+        range->last_unit = new_material;
+    }
+}
+
+static void *parse_range(void *argument)
+{
+    LoadRange *range = (LoadRange *)argument;
+    char line[FILE_LINE_SIZE];
+    const char *position = range->start;
+
+    while (position < range->end)
+    {
+        // What fgets() returned: up to the end of the line, at most FILE_LINE_SIZE - 1 bytes
+        size_t length = range->end - position;
+        if (length > FILE_LINE_SIZE - 1)
+            length = FILE_LINE_SIZE - 1;
+        const char *newline = (const char *)memchr(position, '\n', length);
+        if (newline)
+            length = newline - position + 1;
+        memcpy(line, position, length);
+        line[length] = '\0';
+        position += length;
+
+        // Remove trailing newline
+        line[strcspn(line, "\n")] = 0;
+        parse_line(range, line);
+    }
+
+    copy_memory_stats(range->memory);
+    return NULL;
+}
+
+// Cut text into at most count ranges of whole wagons of about the same size. Returns the number of ranges
+static int split_ranges(const char *text, size_t length, LoadRange ranges[], int count)
+{
+    const char *start = text, *end = text + length;
+    int made = 0;
+
+    for (int i = 1; i < count; i++)
+    {
+        const char *cut = text + (size_t)((double)length * i / count);
+        if (cut < start)
+            cut = start;
+
+        // The next line that starts a wagon
+        const char *found = NULL;
+        while (cut < end && (cut = (const char *)memchr(cut, '\n', end - cut)) != NULL)
+        {
+            cut++;
+            if (end - cut >= 9 && memcmp(cut, "Wagon ID:", 9) == 0)
+            {
+                found = cut;
+                break;
+            }
+        }
+        if (!found)
+            break;
+        ranges[made].start = start;
+        ranges[made].end = found;
+        made++;
+        start = found;
+    }
+    ranges[made].start = start;
+    ranges[made].end = end;
+    return made + 1;
+}
+
+// Apply one parsed range to the train and the catalog, in file order
+static void merge_range(Train *train, MaterialCatalog *catalog, LoadRange *range)
+{
+    if (range->has_train_id)
+        strcpy(train->train_id, range->train_id);
+    if (range->has_total_wagons)
+        train->wagon_count = range->total_wagons;
+
+    if (range->first_wagon != NULL)
+    {
+        range->first_wagon->prev = train->last_wagon;
+        if (train->last_wagon != NULL)
+            train->last_wagon->next = range->first_wagon;
+        else
+            train->first_wagon = range->first_wagon;
+        train->last_wagon = range->last_wagon;
+    }
+
+    for (int i = 0; i < range->pending_class_count; i++)
+    {
+        PendingClass *pending = &range->pending_classes[i];
+        WagonClass *wagon_class = add_wagon_class(train->wagon_classes, pending->name, pending->max_weight);
+        if (pending->assign)
+            pending->wagon->wagon_class = wagon_class;
+    }
+
+    // New materials get their IDs, and materials their in-use slots, in the order they first appear
+    for (int i = 0; i < range->material_count; i++)
+    {
+        RangeMaterial *entry = &range->materials[i];
+        if (entry->material == NULL)
+            entry->material = resolve_material(catalog, entry->name, entry->weight);
+        adjust_loaded_quantity(entry->material, entry->units);
+    }
+    for (int i = 0; i < range->pending_unit_count; i++)
+    {
+        PendingUnit *pending = &range->pending_units[i];
+        MaterialType *material_type = range->materials[pending->material].material;
+        pending->unit->type = material_type;
+        pending->wagon->current_volume += material_type->volume;
+        pending->wagon->used_slots += material_type->slots;
+    }
+
+    free(range->material_index);
+    free(range->materials);
+    free(range->pending_units);
+    free(range->pending_classes);
+}
+
+// Cargo entries of a parsed wagon, one run of units of the same material at a time
+static void index_wagon_cargo(Wagon *wagon)
+{
+    LoadedMaterial *unit = wagon->loaded_materials;
+    while (unit != NULL)
+    {
+        MaterialType *material = unit->type;
+        int run = 0;
+        for (; unit != NULL && unit->type == material; unit = unit->next)
+            run++;
+        adjust_wagon_cargo(wagon, material, run);
+    }
+}
+
+// Station entries of the range's wagons, once the wagons are indexed
+static void index_range_stations(LoadRange *range)
+{
+    for (int i = 0; i < range->station_wagon_count; i++)
+    {
+        Wagon *wagon = range->station_wagons[i];
+        for (LoadedMaterial *unit = wagon->loaded_materials; unit != NULL; unit = unit->next)
+        {
+            if (unit->destination)
+                station_index_add(wagon, unit->destination, 1);
+        }
+    }
+    free(range->station_wagons);
+}
+
+// The whole file in one buffer
+static char *read_file(FILE *file, size_t *length)
+{
+    size_t capacity = 1 << 16;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        long size = ftell(file);
+        if (size > 0)
+            capacity = (size_t)size + 1;
+        rewind(file);
+    }
+
+    char *text = (char *)malloc(capacity);
+    size_t read;
+    *length = 0;
+    while (text && (read = fread(text + *length, 1, capacity - *length, file)) > 0)
+    {
+        *length += read;
+        if (*length == capacity)
+        {
+            capacity *= 2;
+            text = (char *)realloc(text, capacity);
+        }
+    }
+    if (!text)
+    {
+        log_message("\n==========\nError: Memory allocation failed while reading the train file.\n==========\n\n");
+        exit(1);
+    }
+    return text;
+}
 
 // 1
-void load_train_status_from_file(Train *train, const char *filename)
+void load_train_status_from_file(Train *train, const char *filename, MaterialCatalog *catalog)
 {
     FILE *file = fopen(filename, "r");
     if (file == NULL)
     {
-        printf("\n==========\nError: Unable to open file %s for reading.\n==========\n\n", filename);
+        log_message("\n==========\nError: Unable to open file %s for reading.\n==========\n\n", filename);
         return;
     }
 
+    METRIC_START(timer);
+
+    // Operations and reservations so far refer to the wagons that are about to be freed
+    clear_history(train);
+    rollback_all_reservations(train);
+
+    // Wagons are about to be freed and rebuilt outside the usual wagon functions
+    free_capacity_index(train);
+    free_station_index(train);
+
     // Empty the train before loading new data
     if (train->first_wagon != NULL)
     {
@@ -31,182 +542,264 @@ void load_train_status_from_file(Train *train, const char *filename)
             while (current_material != NULL)
             {
                 LoadedMaterial *to_free = current_material;
+                adjust_loaded_quantity(current_material->type, -1);
+                adjust_wagon_cargo(current_wagon, current_material->type, -1);
                 current_material = current_material->next;
-                free(to_free);
+                tracked_free(MEM_LOADED_MATERIAL, to_free, sizeof(LoadedMaterial));
             }
             Wagon *to_free = current_wagon;
             current_wagon = current_wagon->next;
-            free(to_free);
+            tracked_free(MEM_WAGON, to_free, sizeof(Wagon));
         }
         train->first_wagon = NULL;
+        train->last_wagon = NULL;
         train->wagon_count = 0;
     }
 
-    char line[256];
-    Wagon *last_wagon = NULL;
+    METRIC_START(parse_timer);
+    size_t length;
+    char *text = read_file(file, &length);
+    fclose(file);
 
-    while (fgets(line, sizeof(line), file))
+    LoadRange ranges[FILE_MAX_THREADS];
+    pthread_t threads[FILE_MAX_THREADS];
+    memset(ranges, 0, sizeof(ranges));
+    int count = split_ranges(text, length, ranges, range_count_for((long)(length / FILE_WAGON_BYTES)));
+    for (int i = 0; i < count; i++)
     {
-        // Remove trailing newline
-        line[strcspn(line, "\n")] = 0;
-
-        if (strncmp(line, "Train ID:", 9) == 0)
+        ranges[i].train = train;
+        ranges[i].catalog = catalog;
+        ranges[i].material_index = (int *)malloc(sizeof(int) * (catalog->count + 1));
+        if (!ranges[i].material_index)
         {
-            sscanf(line, "Train ID: %s", train->train_id);
+            log_message("\n==========\nError: Memory allocation failed while reading the train file.\n==========\n\n");
+            exit(1);
         }
-        else if (strncmp(line, "Total Wagons:", 13) == 0)
+        for (int m = 0; m < catalog->count; m++)
+            ranges[i].material_index[m] = -1;
+    }
+
+    int started = run_ranges(parse_range, ranges, sizeof(LoadRange), count, threads);
+    for (int i = 0; i < count; i++)
+        merge_range(train, catalog, &ranges[i]);
+    // The calling thread counted its own allocations already
+    for (int i = 1; i < started; i++)
+        merge_memory_stats(ranges[i].memory);
+    free(text);
+
+    METRIC_STOP(METRIC_FILE_PARSE, parse_timer);
+
+    // Files written before wagon classes existed have no Class lines, and wagons
+    // without volume or slot limits have no lines for them: both come from the class
+    for (Wagon *wagon = train->first_wagon; wagon != NULL; wagon = wagon->next)
+    {
+        if (wagon->wagon_class == NULL)
         {
-            int total_wagons;
-            sscanf(line, "Total Wagons: %d", &total_wagons);
-            train->wagon_count = total_wagons;
+            wagon->wagon_class = class_for_capacity(train->wagon_classes, wagon->max_weight);
         }
-        else if (strncmp(line, "Wagon ID:", 9) == 0)
+        if (wagon->max_volume < 0)
         {
-            // Allocate a new wagon
-            Wagon *new_wagon = (Wagon *)malloc(sizeof(Wagon));
-            if (!new_wagon)
-            {
-                printf("\n==========\nError: Memory allocation failed for wagon.\n==========\n\n");
-                fclose(file);
-                return;
-            }
-            sscanf(line, "Wagon ID: %d", &new_wagon->wagon_id);
-            new_wagon->next = NULL;
-            new_wagon->prev = last_wagon;
-            new_wagon->loaded_materials = NULL;
-            if (last_wagon != NULL)
-            {
-                last_wagon->next = new_wagon;
-            }
-            else
-            {
-                train->first_wagon = new_wagon;
-            }
-            last_wagon = new_wagon;
+            wagon->max_volume = wagon->wagon_class->max_volume;
         }
-        else if (strncmp(line, "  Max Weight:", 13) == 0)
+        if (wagon->max_slots < 0)
         {
-            sscanf(line, "  Max Weight: %f kg", &last_wagon->max_weight);
+            wagon->max_slots = wagon->wagon_class->max_slots;
         }
-        else if (strncmp(line, "  Current Weight:", 17) == 0)
+        index_wagon_cargo(wagon);
+    }
+
+    // The wagons get their IDs, and then their train, from the index
+    capacity_index_rebuild(train);
+    for (int i = 0; i < count; i++)
+        index_range_stations(&ranges[i]);
+
+    event_train_reloaded(train);
+    METRIC_STOP(METRIC_LOAD_FROM_FILE, timer);
+    log_message("\n==========\nTrain status loaded from file: %s\n==========\n\n", filename);
+}
+
+static void *format_range(void *argument)
+{
+    SaveRange *range = (SaveRange *)argument;
+    FILE *file = range->stream;
+    int wagon_id = range->first_wagon != range->end ? get_wagon_id(range->first_wagon) : 0;
+
+    for (Wagon *current_wagon = range->first_wagon; current_wagon != range->end; current_wagon = current_wagon->next)
+    {
+        fprintf(file, "\nWagon ID: %d\n", wagon_id++);
+        fprintf(file, "  Max Weight: %.2f kg\n", current_wagon->max_weight);
+        fprintf(file, "  Class: %s\n", current_wagon->wagon_class ? current_wagon->wagon_class->name : DEFAULT_WAGON_CLASS);
+        if (current_wagon->max_volume > 0)
         {
-            sscanf(line, "  Current Weight: %f kg", &last_wagon->current_weight);
+            fprintf(file, "  Max Volume: %.2f m3\n", current_wagon->max_volume);
         }
-        else if (strncmp(line, "    -", 5) == 0)
+        if (current_wagon->max_slots > 0)
         {
-            // Allocate a new material
-            LoadedMaterial *new_material = (LoadedMaterial *)malloc(sizeof(LoadedMaterial));
-            if (!new_material)
-            {
-                printf("\n==========\nError: Memory allocation failed for material.\n==========\n\n");
-                fclose(file);
-                return;
-            }
-            new_material->next = NULL;
-            new_material->prev = NULL;
-
-            char material_name[50];
-            float material_weight;
-            sscanf(line, "    - %49[^:]: %f kg", material_name, &material_weight);
-
-            // Create a MaterialType for this material
-            MaterialType *material_type = (MaterialType *)malloc(sizeof(MaterialType));
-            if (!material_type)
-            {
-                printf("\n==========\nError: Memory allocation failed for material type.\n==========\n\n");
-                free(new_material);
-                fclose(file);
-                return;
-            }
-            strcpy(material_type->name, material_name);
-            material_type->weight = material_weight;
+            fprintf(file, "  Max Slots: %d\n", current_wagon->max_slots);
+        }
+        fprintf(file, "  Current Weight: %.2f kg\n", current_wagon->current_weight);
 
-            new_material->type = material_type;
+        if (current_wagon->loaded_materials == NULL)
+        {
+            fprintf(file, "  No materials loaded.\n");
+        }
+        else
+        {
+            fprintf(file, "  Loaded Materials:\n");
 
-            // Insert material into the wagon
-            if (last_wagon->loaded_materials == NULL)
-            {
-                last_wagon->loaded_materials = new_material;
-            }
-            else
+            // Traverse materials
+            LoadedMaterial *current_material = current_wagon->loaded_materials;
+            while (current_material != NULL)
             {
-                LoadedMaterial *last_material = last_wagon->loaded_materials;
-                while (last_material->next != NULL)
+                if (current_material->destination)
                 {
-                    last_material = last_material->next;
+                    fprintf(file, "    - %s: %.2f kg, station %d\n",
+                                current_material->type->name,
+                                current_material->type->weight,
+                                current_material->destination);
                 }
-                last_material->next = new_material;
-                new_material->prev = last_material;
+                else
+                {
+                    fprintf(file, "    - %s: %.2f kg\n",
+                                current_material->type->name,
+                                current_material->type->weight);
+                }
+                current_material = current_material->next;
             }
         }
     }
+    if (ferror(file))
+        range->failed = 1;
+    if (fclose(file) != 0)
+        range->failed = 1;
+    return NULL;
+}
 
-    fclose(file);
-    printf("\n==========\nTrain status loaded from file: %s\n==========\n\n", filename);
+static void *write_range(void *argument)
+{
+    SaveRange *range = (SaveRange *)argument;
+    size_t done = 0;
+
+    while (done < range->length)
+    {
+        ssize_t written = pwrite(range->file, range->text + done, range->length - done, range->offset + done);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            range->failed = 1;
+            break;
+        }
+        done += written;
+    }
+    return NULL;
 }
 
 // 9
+// The text goes to <filename>.tmp, which replaces the file once it is complete and on disk,
+// so a failed save leaves the previous one as it was
 void save_train_status_to_file(Train *train, const char *filename)
 {
     if (train == NULL)
     {
-        printf("\n==========\nError: Train is missing. Nothing to save.\n==========\n\n");
+        log_message("\n==========\nError: Train is missing. Nothing to save.\n==========\n\n");
         return;
     }
 
-    FILE *file = fopen(filename, "w");
-    if (file == NULL)
+    METRIC_START(timer);
+
+    SaveRange ranges[FILE_MAX_THREADS];
+    pthread_t threads[FILE_MAX_THREADS];
+    memset(ranges, 0, sizeof(ranges));
+    int count = train->first_wagon ? range_count_for(train->wagon_count) : 1;
+    for (int i = 0; i < count; i++)
     {
-        printf("\n==========\nError: Unable to open file %s for writing.\n==========\n\n", filename);
-        return;
+        ranges[i].stream = open_memstream(&ranges[i].text, &ranges[i].length);
+        if (!ranges[i].stream)
+        {
+            log_message("\n==========\nError: Memory allocation failed while saving the train.\n==========\n\n");
+            exit(1);
+        }
     }
 
     // Write train ID
-    fprintf(file, "Train ID: %s\n", train->train_id);
+    fprintf(ranges[0].stream, "Train ID: %s\n", train->train_id);
 
     // Check if the train is empty
     if (train->first_wagon == NULL)
     {
-        fprintf(file, "Total Wagons: 0\n");
-        fprintf(file, "The train is empty.\n");
-        fclose(file);
-        printf("\n==========\nTrain status saved to file: %s\n==========\n\n", filename);
-        return;
+        fprintf(ranges[0].stream, "Total Wagons: 0\n");
+        fprintf(ranges[0].stream, "The train is empty.\n");
+    }
+    else
+    {
+        // Write total wagons
+        fprintf(ranges[0].stream, "Total Wagons: %d\n", train->wagon_count);
     }
 
-    // Write total wagons
-    fprintf(file, "Total Wagons: %d\n", train->wagon_count);
+    // Cut the wagons into ranges of about the same number of wagons
+    METRIC_START(write_timer);
+    Wagon *wagon = train->first_wagon;
+    for (int i = 0; i < count; i++)
+    {
+        ranges[i].first_wagon = wagon;
+        long wagons = (long)train->wagon_count * (i + 1) / count - (long)train->wagon_count * i / count;
+        for (long w = 0; wagon != NULL && (w < wagons || i == count - 1); w++)
+            wagon = wagon->next;
+        ranges[i].end = wagon;
+    }
+    run_ranges(format_range, ranges, sizeof(SaveRange), count, threads);
 
-    // Traverse wagons
-    Wagon *current_wagon = train->first_wagon;
-    while (current_wagon != NULL)
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+        failed |= ranges[i].failed;
+
+    size_t name_length = strlen(filename);
+    char *temporary = (char *)malloc(name_length + sizeof(".tmp"));
+    if (!temporary)
     {
-        fprintf(file, "\nWagon ID: %d\n", current_wagon->wagon_id);
-        fprintf(file, "  Max Weight: %.2f kg\n", current_wagon->max_weight);
-        fprintf(file, "  Current Weight: %.2f kg\n", current_wagon->current_weight);
+        log_message("\n==========\nError: Memory allocation failed while saving the train.\n==========\n\n");
+        exit(1);
+    }
+    memcpy(temporary, filename, name_length);
+    memcpy(temporary + name_length, ".tmp", sizeof(".tmp"));
 
-        if (current_wagon->loaded_materials == NULL)
+    int file = failed ? -1 : open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (file >= 0)
+    {
+        off_t offset = 0;
+        for (int i = 0; i < count; i++)
         {
-            fprintf(file, "  No materials loaded.\n");
+            ranges[i].file = file;
+            ranges[i].offset = offset;
+            offset += ranges[i].length;
         }
-        else
-        {
-            fprintf(file, "  Loaded Materials:\n");
+        run_ranges(write_range, ranges, sizeof(SaveRange), count, threads);
+        for (int i = 0; i < count; i++)
+            failed |= ranges[i].failed;
 
-            // Traverse materials
-            LoadedMaterial *current_material = current_wagon->loaded_materials;
-            while (current_material != NULL)
-            {
-                fprintf(file, "    - %s: %.2f kg\n",
-                        current_material->type->name,
-                        current_material->type->weight);
-                current_material = current_material->next;
-            }
-        }
-
-        current_wagon = current_wagon->next;
+        failed |= fsync(file) != 0;
+        failed |= close(file) != 0;
+        failed |= !failed && rename(temporary, filename) != 0;
+        if (failed)
+            unlink(temporary);
     }
+    METRIC_STOP(METRIC_FILE_WRITE, write_timer);
 
-    fclose(file);
-    printf("\n==========\nTrain status saved to file: %s\n==========\n\n", filename);
-}
\ No newline at end of file
+    for (int i = 0; i < count; i++)
+        free(ranges[i].text);
+    free(temporary);
+    METRIC_STOP(METRIC_SAVE_TO_FILE, timer);
+
+    if (file < 0 && !failed)
+    {
+        log_message("\n==========\nError: Unable to open file %s.tmp for writing.\n==========\n\n", filename);
+        return;
+    }
+    if (failed)
+    {
+        log_message("\n==========\nError: Unable to write file %s.\n==========\n\n", filename);
+        return;
+    }
+    log_message("\n==========\nTrain status saved to file: %s\n==========\n\n", filename);
+}
@@ -0,0 +1,311 @@
+// history.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/history.h"
+#include "../include/wagon.h"
+#include "../include/train.h"
+#include "../include/material.h"
+#include "../include/utils.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/reservation.h"
+
+/*
+ * Undo/redo log. Each mutating operation is recorded as a list of changes
+ * (units added or removed per wagon and material, wagons created or
+ * deleted). Undo applies the inverse of the changes in reverse order, redo
+ * applies them again in order, so both cost the size of the operation.
+ *
+ * Deleted wagons are not freed while an operation can still bring them
+ * back: the history keeps them unlinked and relinks the same Wagon, so
+ * older changes that point to it stay valid.
+ */
+
+static History *history_of(Train *train)
+{
+    return train ? train->history : NULL;
+}
+
+static int is_recording(History *history)
+{
+    return history && history->current && !history->replaying;
+}
+
+static void free_operation(Operation *operation)
+{
+    tracked_free(MEM_HISTORY, operation->changes, sizeof(Change) * operation->change_capacity);
+    tracked_free(MEM_HISTORY, operation, sizeof(Operation));
+}
+
+// Free wagons that only the history still references
+static void release_undo_operation(Operation *operation)
+{
+    for (int i = 0; i < operation->change_count; i++)
+    {
+        if (operation->changes[i].type == CHANGE_WAGON_DELETED)
+            tracked_free(MEM_WAGON, operation->changes[i].wagon, sizeof(Wagon));
+    }
+    free_operation(operation);
+}
+
+static void release_redo_operation(Operation *operation)
+{
+    for (int i = 0; i < operation->change_count; i++)
+    {
+        if (operation->changes[i].type == CHANGE_WAGON_CREATED)
+            tracked_free(MEM_WAGON, operation->changes[i].wagon, sizeof(Wagon));
+    }
+    free_operation(operation);
+}
+
+static void clear_redo(History *history)
+{
+    while (history->redo_count > 0)
+        release_redo_operation(history->redo[--history->redo_count]);
+}
+
+static Change *append_change(History *history)
+{
+    Operation *operation = history->current;
+
+    if (operation->change_count == operation->change_capacity)
+    {
+        int capacity = operation->change_capacity ? operation->change_capacity * 2 : 8;
+        operation->changes = (Change *)tracked_realloc(MEM_HISTORY, operation->changes,
+                                                       sizeof(Change) * operation->change_capacity,
+                                                       sizeof(Change) * capacity);
+        operation->change_capacity = capacity;
+    }
+    return &operation->changes[operation->change_count++];
+}
+
+// Start recording on this train
+void enable_history(Train *train)
+{
+    if (!train || train->history)
+        return;
+
+    train->history = (History *)tracked_calloc(MEM_HISTORY, 1, sizeof(History));
+}
+
+// Stop recording and free the history
+void free_history(Train *train)
+{
+    if (!train || !train->history)
+        return;
+
+    clear_history(train);
+    tracked_free(MEM_HISTORY, train->history, sizeof(History));
+    train->history = NULL;
+}
+
+// Forget every operation, e.g. after the train was reloaded from file
+void clear_history(Train *train)
+{
+    History *history = history_of(train);
+    if (!history)
+        return;
+
+    while (history->undo_count > 0)
+        release_undo_operation(history->undo[--history->undo_count]);
+    clear_redo(history);
+    if (history->current)
+    {
+        release_undo_operation(history->current);
+        history->current = NULL;
+        history->nesting = 0;
+    }
+}
+
+void begin_operation(Train *train, const char *label)
+{
+    History *history = history_of(train);
+    if (!history || history->replaying)
+        return;
+
+    if (history->nesting++ > 0)
+        return;
+
+    history->current = (Operation *)tracked_calloc(MEM_HISTORY, 1, sizeof(Operation));
+    snprintf(history->current->label, sizeof(history->current->label), "%s", label);
+}
+
+void end_operation(Train *train)
+{
+    History *history = history_of(train);
+    if (!history || history->replaying || history->nesting == 0)
+        return;
+
+    if (--history->nesting > 0)
+        return;
+
+    Operation *operation = history->current;
+    history->current = NULL;
+
+    if (operation->change_count == 0)
+    {
+        free_operation(operation);
+        return;
+    }
+
+    clear_redo(history);
+    if (history->undo_count == HISTORY_DEPTH)
+    {
+        release_undo_operation(history->undo[0]);
+        memmove(&history->undo[0], &history->undo[1], sizeof(Operation *) * (HISTORY_DEPTH - 1));
+        history->undo_count--;
+    }
+    history->undo[history->undo_count++] = operation;
+}
+
+// count > 0 units were added, count < 0 units were removed, the first of them at position from the top
+void history_record_units(Wagon *wagon, MaterialType *material, int count, int destination, int position)
+{
+    History *history = history_of(get_wagon_train(wagon));
+    if (!is_recording(history) || count == 0)
+        return;
+
+    ChangeType type = count > 0 ? CHANGE_UNITS_ADDED : CHANGE_UNITS_REMOVED;
+    Operation *operation = history->current;
+
+    // Consecutive units of the same kind next to each other become one change: units added go
+    // below the last ones, units removed come from the place the last ones left
+    if (operation->change_count > 0)
+    {
+        Change *last = &operation->changes[operation->change_count - 1];
+        if (last->type == type && last->wagon == wagon && last->material == material &&
+            last->destination == destination &&
+            position == (type == CHANGE_UNITS_ADDED ? last->position + last->count : last->position))
+        {
+            last->count += abs(count);
+            return;
+        }
+    }
+
+    Change *change = append_change(history);
+    change->type = type;
+    change->wagon = wagon;
+    change->prev = NULL;
+    change->material = material;
+    change->count = abs(count);
+    change->destination = destination;
+    change->position = position;
+}
+
+void history_record_wagon_created(Wagon *wagon)
+{
+    History *history = history_of(get_wagon_train(wagon));
+    if (!is_recording(history))
+        return;
+
+    Change *change = append_change(history);
+    change->type = CHANGE_WAGON_CREATED;
+    change->wagon = wagon;
+    change->prev = wagon->prev;
+    change->material = NULL;
+    change->count = 0;
+    change->destination = 0;
+    change->position = 0;
+}
+
+// Returns 1 if the history keeps the unlinked wagon, so the caller must not free it
+int history_record_wagon_deleted(Train *train, Wagon *wagon, Wagon *prev)
+{
+    History *history = history_of(train);
+    if (!is_recording(history))
+        return 0;
+
+    Change *change = append_change(history);
+    change->type = CHANGE_WAGON_DELETED;
+    change->wagon = wagon;
+    change->prev = prev;
+    change->material = NULL;
+    change->count = 0;
+    change->destination = 0;
+    change->position = 0;
+    return 1;
+}
+
+static void apply_change(Train *train, const Change *change, int inverse)
+{
+    ChangeType type = change->type;
+
+    if (inverse)
+    {
+        switch (type)
+        {
+        case CHANGE_UNITS_ADDED: type = CHANGE_UNITS_REMOVED; break;
+        case CHANGE_UNITS_REMOVED: type = CHANGE_UNITS_ADDED; break;
+        case CHANGE_WAGON_CREATED: type = CHANGE_WAGON_DELETED; break;
+        case CHANGE_WAGON_DELETED: type = CHANGE_WAGON_CREATED; break;
+        }
+    }
+
+    switch (type)
+    {
+    case CHANGE_UNITS_ADDED:
+        add_materials_at(change->wagon, change->material, change->count, change->destination, change->position);
+        break;
+    case CHANGE_UNITS_REMOVED:
+        remove_materials_at(change->wagon, change->count, change->position);
+        break;
+    case CHANGE_WAGON_CREATED:
+        link_wagon_after(train, change->wagon, change->prev);
+        break;
+    case CHANGE_WAGON_DELETED:
+        unlink_wagon(train, change->wagon);
+        break;
+    }
+}
+
+// Replaying over held capacity could overbook it or take away reserved wagons
+static int reservations_open(Train *train)
+{
+    if (!train->reservations)
+        return 0;
+    log_message("\n==========\nCommit or roll back the open reservations first.\n==========\n\n");
+    return 1;
+}
+
+// Undo the most recent operation, returns 0 if there is nothing to undo
+int undo_last_operation(Train *train)
+{
+    History *history = history_of(train);
+    if (!history || history->undo_count == 0 || history->current || reservations_open(train))
+        return 0;
+
+    METRIC_START(timer);
+    Operation *operation = history->undo[--history->undo_count];
+
+    history->replaying = 1;
+    for (int i = operation->change_count - 1; i >= 0; i--)
+        apply_change(train, &operation->changes[i], 1);
+    history->replaying = 0;
+
+    history->redo[history->redo_count++] = operation;
+    METRIC_STOP(METRIC_UNDO, timer);
+    log_message("\n==========\nUndone: %s\n==========\n\n", operation->label);
+    return 1;
+}
+
+// Redo the most recently undone operation, returns 0 if there is nothing to redo
+int redo_last_operation(Train *train)
+{
+    History *history = history_of(train);
+    if (!history || history->redo_count == 0 || history->current || reservations_open(train))
+        return 0;
+
+    METRIC_START(timer);
+    Operation *operation = history->redo[--history->redo_count];
+
+    history->replaying = 1;
+    for (int i = 0; i < operation->change_count; i++)
+        apply_change(train, &operation->changes[i], 0);
+    history->replaying = 0;
+
+    history->undo[history->undo_count++] = operation;
+    METRIC_STOP(METRIC_REDO, timer);
+    log_message("\n==========\nRedone: %s\n==========\n\n", operation->label);
+    return 1;
+}
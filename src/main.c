@@ -1,11 +1,29 @@
 // main.c
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../include/wagon.h"
 #include "../include/train.h"
 #include "../include/material.h"
+#include "../include/catalog.h"
 #include "../include/file_ops.h"
 #include "../include/utils.h"
+#include "../include/server.h"
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/weight_distribution.h"
+#include "../include/compaction.h"
+#include "../include/reservation.h"
+#include "../include/estimate.h"
+#include "../include/export.h"
+#include "../include/snapshot_diff.h"
+#include "../include/events.h"
+#include "../include/train_view.h"
+#include "../include/coupling.h"
+#include "../include/station.h"
+#include "../include/dock_sim.h"
+#include "../include/trace.h"
 
 
 void display_menu()
@@ -21,22 +39,91 @@ void display_menu()
     printf("8. Empty train\n");
     printf("9. Save train status to file\n");
     printf("10. Exit\n");
+    printf("11. Undo last operation\n");
+    printf("12. Redo last undone operation\n");
+    printf("13. Display operation metrics\n");
+    printf("14. Dump operation metrics to file\n");
+    printf("15. Display memory usage\n");
+    printf("16. Display materials in use\n");
+    printf("17. Display wagon classes\n");
+    printf("18. Display weight distribution\n");
+    printf("19. Compact train\n");
+    printf("20. Reserve an order\n");
+    printf("21. Estimate an order\n");
+    printf("22. Export train status\n");
+    printf("23. Compare two saved trains\n");
+    printf("24. Display changes since last view\n");
+    printf("25. Display wagon summary, range or filter\n");
+    printf("26. Split or couple the train\n");
+    printf("27. Load material for a station\n");
+    printf("28. Station stop\n");
+    printf("29. Select loading strategy\n");
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    Train *train = create_train();
+    // program --diff <before> <after>: exit status 0 same, 1 different, 2 error, like diff
+    if (argc == 4 && strcmp(argv[1], "--diff") == 0)
+    {
+        int result = diff_snapshots(argv[2], argv[3], stdout);
+        return result < 0 ? 2 : result;
+    }
+
+    atexit(report_memory_at_exit);
+
+    // program --simulate [options]: loading-dock simulation, see dock_sim.h
+    if (argc > 1 && strcmp(argv[1], "--simulate") == 0)
+    {
+        return dock_sim_main(argc, argv);
+    }
 
-    MaterialType materials[] = {
-        {"Large Box", 200.0, 50, 0},
-        {"Medium Box", 150.0, 50, 0},
-        {"Small Box", 100.0, 50, 0}};
-    int material_count = sizeof(materials) / sizeof(MaterialType);
+    WagonClassTable *wagon_classes = load_wagon_classes_from_file(WAGON_CLASS_FILE);
+    if (!wagon_classes)
+    {
+        wagon_classes = create_default_wagon_classes();
+    }
+
+    Train *train = create_train(wagon_classes);
+    enable_history(train);
+    enable_events(train);
+
+    MaterialCatalog *catalog = load_catalog_from_file(CATALOG_FILE);
+    if (!catalog)
+    {
+        catalog = create_default_catalog();
+    }
+
+    // Wagons split off the train wait here until they are coupled back
+    Train *siding = create_train(wagon_classes);
+    strcpy(siding->train_id, "Siding");
 
     int choice = 0;
     char input[50]; // take as string to handle errors
 
-    load_train_status_from_file(train, "FasterThanLight.txt");
+    load_train_status_from_file(train, "FasterThanLight.txt", catalog);
+
+    // program --server [socket path | tcp:port] [--trace file]
+    if (argc > 1 && strcmp(argv[1], "--server") == 0)
+    {
+        const char *address = DEFAULT_SERVER_ADDRESS;
+        TraceWriter *trace = NULL;
+        for (int i = 2; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+                trace = open_trace(argv[++i], train);
+            else
+                address = argv[i];
+        }
+        int status = run_server(train, catalog, "FasterThanLight.txt", address, trace);
+        close_trace(trace);
+        save_train_status_to_file(train, "FasterThanLight.txt");
+        destroy_train(siding);
+        destroy_train(train);
+        destroy_catalog(catalog);
+        destroy_wagon_class_table(wagon_classes);
+        return status;
+    }
+
     while (1)
     {
         display_menu();
@@ -50,7 +137,7 @@ int main()
             continue;
         }
 
-        if (choice < 1 || choice > 10)
+        if (choice < 1 || choice > 29)
         {
             printf("\n==========\nOption unavailable.\n==========\n\n");
             continue;
@@ -59,25 +146,25 @@ int main()
         switch (choice)
         {
         case 1:
-            load_train_status_from_file(train, "FasterThanLight.txt");
+            load_train_status_from_file(train, "FasterThanLight.txt", catalog);
             break;
         case 2:
-            load_specified_material_to_train_main(train, materials, material_count);
+            load_specified_material_to_train_main(train, catalog);
             break;
         case 3:
-            load_material_to_wagon_main(train, materials, material_count);
+            load_material_to_wagon_main(train, catalog);
             break;
         case 4:
-            unload_material_from_tail(train, materials, material_count);
+            unload_material_from_tail(train, catalog);
             break;
         case 5:
-            unload_material_from_wagon_main(train, materials, material_count);
+            unload_material_from_wagon_main(train, catalog);
             break;
         case 6:
             display_train_status(train);
             break;
         case 7:
-            display_material_status(materials, material_count, train);
+            display_material_status(catalog, 0);
             break;
         case 8:
             empty_train_or_wagon(train);
@@ -86,9 +173,78 @@ int main()
             save_train_status_to_file(train, "FasterThanLight.txt");
             break;
         case 10:
+            // The file only has room for one train
+            if (siding->first_wagon)
+                couple_trains(train, siding);
             save_train_status_to_file(train, "FasterThanLight.txt");
             printf("\n==========\nExiting\n==========\n\n");
+            destroy_train(siding);
+            destroy_train(train);
+            destroy_catalog(catalog);
+            destroy_wagon_class_table(wagon_classes);
             exit(0);
+        case 11:
+            if (!undo_last_operation(train))
+                printf("\n==========\nNothing to undo.\n==========\n\n");
+            break;
+        case 12:
+            if (!redo_last_operation(train))
+                printf("\n==========\nNothing to redo.\n==========\n\n");
+            break;
+        case 13:
+            display_metrics();
+            break;
+        case 14:
+            if (dump_metrics_to_file(METRICS_FILE))
+                printf("\n==========\nMetrics written to file: %s\n==========\n\n", METRICS_FILE);
+            break;
+        case 15:
+            display_memory_report();
+            break;
+        case 16:
+            display_material_status(catalog, 1);
+            break;
+        case 17:
+            printf("\n==========\nWagon Classes\n==========\n");
+            display_wagon_classes(wagon_classes);
+            printf("\n");
+            break;
+        case 18:
+            display_weight_distribution_main(train);
+            break;
+        case 19:
+            compact_train_main(train);
+            break;
+        case 20:
+            reserve_order_main(train, catalog);
+            break;
+        case 21:
+            estimate_load_main(train, catalog);
+            break;
+        case 22:
+            export_train_main(train, catalog);
+            break;
+        case 23:
+            diff_snapshots_main();
+            break;
+        case 24:
+            display_changes_main(train, catalog);
+            break;
+        case 25:
+            display_train_view_main(train, catalog);
+            break;
+        case 26:
+            coupling_main(train, siding);
+            break;
+        case 27:
+            load_material_for_station_main(train, catalog);
+            break;
+        case 28:
+            station_stop_main(train);
+            break;
+        case 29:
+            select_load_strategy_main(train);
+            break;
         default:
             printf("\n==========\nOption unavailable.\n==========\n\n");
         }
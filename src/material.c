@@ -4,48 +4,112 @@
 #include "../include/wagon.h"
 #include "../include/train.h"
 #include "../include/material.h"
+#include "../include/catalog.h"
 #include "../include/file_ops.h"
 #include "../include/utils.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
 
 
 
-void display_material_status(MaterialType *materials, int material_count, Train *train) {
-    if (materials == NULL || material_count == 0) {
-        printf("\n==========\nNo materials available.\n==========\n\n");
+// Change the loaded quantity of a material and keep the catalog's in-use set up to date
+void adjust_loaded_quantity(MaterialType *material, int delta) {
+    int was_loaded = material->loaded > 0;
+    material->loaded += delta;
+
+    MaterialCatalog *catalog = material->catalog;
+    if (catalog == NULL || was_loaded == (material->loaded > 0)) {
         return;
     }
 
-    // Reset loaded quantities to 0 before recalculating
-    for (int i = 0; i < material_count; i++) {
-        materials[i].loaded = 0;
+    if (!was_loaded) {
+        material->in_use_slot = catalog->in_use_count;
+        catalog->in_use[catalog->in_use_count++] = material->id;
+    } else {
+        // Swap the last in-use material into the freed slot
+        int last_id = catalog->in_use[--catalog->in_use_count];
+        catalog->in_use[material->in_use_slot] = last_id;
+        catalog->materials[last_id - 1]->in_use_slot = material->in_use_slot;
+        material->in_use_slot = -1;
+    }
+}
+
+// units > 0 units of the material came into the wagon, units < 0 left it. Keeps the
+// material's list of carriers, so views by material read those wagons only
+void adjust_wagon_cargo(Wagon *wagon, MaterialType *material, int units) {
+    WagonCargo **link = &wagon->cargo;
+    while (*link && (*link)->material != material) {
+        link = &(*link)->next_in_wagon;
     }
 
-    // Traverse the train to count loaded quantities
-    if (train != NULL && train->first_wagon != NULL) {
-        Wagon *current_wagon = train->first_wagon;
-        while (current_wagon != NULL) {
-            LoadedMaterial *current_material = current_wagon->loaded_materials;
-            while (current_material != NULL) {
-                for (int i = 0; i < material_count; i++) {
-                    if (strcmp(current_material->type->name, materials[i].name) == 0) {
-                        materials[i].loaded++;
-                        break;
-                    }
-                }
-                current_material = current_material->next;
-            }
-            current_wagon = current_wagon->next;
+    WagonCargo *cargo = *link;
+    if (!cargo) {
+        cargo = (WagonCargo *)tracked_malloc(MEM_WAGON_CARGO, sizeof(WagonCargo));
+        cargo->wagon = wagon;
+        cargo->material = material;
+        cargo->units = 0;
+        cargo->next_in_wagon = wagon->cargo;
+        wagon->cargo = cargo;
+        link = &wagon->cargo;
+
+        cargo->prev_carrier = NULL;
+        cargo->next_carrier = material->carriers;
+        if (material->carriers) {
+            material->carriers->prev_carrier = cargo;
         }
+        material->carriers = cargo;
+        material->carrier_count++;
     }
 
-    // Display the material status
-    printf("\n==========\nMaterial Status\n==========\n");
-    for (int i = 0; i < material_count; i++) {
-        printf("Material: %s\n", materials[i].name);
-        printf("  Weight: %.2f kg\n", materials[i].weight);
-        printf("  Total Quantity: %d\n", materials[i].quantity);
-        printf("  Loaded Quantity: %d\n", materials[i].loaded);
-        printf("\n");
+    cargo->units += units;
+    if (cargo->units == 0) {
+        *link = cargo->next_in_wagon;
+        if (cargo->prev_carrier) {
+            cargo->prev_carrier->next_carrier = cargo->next_carrier;
+        } else {
+            material->carriers = cargo->next_carrier;
+        }
+        if (cargo->next_carrier) {
+            cargo->next_carrier->prev_carrier = cargo->prev_carrier;
+        }
+        material->carrier_count--;
+        tracked_free(MEM_WAGON_CARGO, cargo, sizeof(WagonCargo));
     }
 }
 
+static void print_material(const MaterialType *material) {
+    printf("Material: %s\n", material->name);
+    printf("  ID: %d\n", material->id);
+    printf("  Weight: %.2f kg\n", material->weight);
+    if (material->volume > 0)
+        printf("  Volume: %.2f m3\n", material->volume);
+    if (material->slots > 0)
+        printf("  Slots: %d\n", material->slots);
+    printf("  Total Quantity: %d\n", material->quantity);
+    printf("  Loaded Quantity: %d\n", material->loaded);
+    if (material->reserved > 0)
+        printf("  Reserved Quantity: %d\n", material->reserved);
+    printf("\n");
+}
+
+// Show every material, or only the ones currently on the train
+void display_material_status(MaterialCatalog *catalog, int only_in_use) {
+    if (catalog == NULL || catalog->count == 0) {
+        printf("\n==========\nNo materials available.\n==========\n\n");
+        return;
+    }
+
+    METRIC_START(timer);
+    if (only_in_use) {
+        printf("\n==========\nMaterial Status (%d of %d in use)\n==========\n", catalog->in_use_count, catalog->count);
+        for (int i = 0; i < catalog->in_use_count; i++) {
+            print_material(catalog->materials[catalog->in_use[i] - 1]);
+        }
+    } else {
+        printf("\n==========\nMaterial Status\n==========\n");
+        for (int i = 0; i < catalog->count; i++) {
+            print_material(catalog->materials[i]);
+        }
+    }
+    METRIC_STOP(METRIC_DISPLAY_MATERIALS, timer);
+}
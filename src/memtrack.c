@@ -0,0 +1,207 @@
+// memtrack.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/memtrack.h"
+
+/*
+ * Allocation accounting per object type. The engine allocates its
+ * objects through tracked_malloc()/tracked_free() with the object size, so
+ * live objects, bytes, peaks and allocation rates are known at any time
+ * and whatever is still live at exit is reported as a leak.
+ *
+ * Every thread counts its own allocations, so threads that each drive an
+ * engine of their own need no locking. Such a thread copies its counts
+ * out before it ends and the main thread merges them into its own.
+ */
+
+static _Thread_local MemoryStats memory_stats[MEM_TYPE_COUNT];
+
+static const char *memory_type_names[MEM_TYPE_COUNT] = {
+    "Train",
+    "Wagon",
+    "LoadedMaterial",
+    "MaterialType",
+    "History",
+    "WagonClass",
+    "CapacityIndex",
+    "Reservation",
+    "EventFeed",
+    "StationIndex",
+    "WagonCargo"};
+
+static _Thread_local double start_time = -1;
+static _Thread_local long allocations_at_last_report[MEM_TYPE_COUNT];
+static _Thread_local double last_report_time = -1;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void account_allocation(MemoryType type, size_t size)
+{
+    MemoryStats *stats = &memory_stats[type];
+
+    if (start_time < 0)
+        start_time = now_seconds();
+
+    stats->allocations++;
+    stats->live_objects++;
+    stats->live_bytes += (long)size;
+    if (stats->live_objects > stats->peak_objects)
+        stats->peak_objects = stats->live_objects;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+}
+
+static void account_free(MemoryType type, size_t size)
+{
+    MemoryStats *stats = &memory_stats[type];
+
+    stats->frees++;
+    stats->live_objects--;
+    stats->live_bytes -= (long)size;
+}
+
+static void allocation_failed(MemoryType type)
+{
+    printf("\n==========\nError: Memory allocation failed for %s.\n==========\n\n", memory_type_names[type]);
+    exit(1);
+}
+
+void *tracked_malloc(MemoryType type, size_t size)
+{
+    void *ptr = malloc(size);
+    if (!ptr)
+        allocation_failed(type);
+    account_allocation(type, size);
+    return ptr;
+}
+
+void *tracked_calloc(MemoryType type, size_t count, size_t size)
+{
+    void *ptr = calloc(count, size);
+    if (!ptr)
+        allocation_failed(type);
+    account_allocation(type, count * size);
+    return ptr;
+}
+
+// Grow or shrink a tracked block. Counted as one object whatever its size
+void *tracked_realloc(MemoryType type, void *ptr, size_t old_size, size_t new_size)
+{
+    void *new_ptr = realloc(ptr, new_size);
+    if (!new_ptr)
+        allocation_failed(type);
+
+    if (!ptr)
+    {
+        account_allocation(type, new_size);
+    }
+    else
+    {
+        MemoryStats *stats = &memory_stats[type];
+        stats->live_bytes += (long)new_size - (long)old_size;
+        if (stats->live_bytes > stats->peak_bytes)
+            stats->peak_bytes = stats->live_bytes;
+    }
+    return new_ptr;
+}
+
+void tracked_free(MemoryType type, void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+    account_free(type, size);
+    free(ptr);
+}
+
+const MemoryStats *get_memory_stats(MemoryType type)
+{
+    return &memory_stats[type];
+}
+
+// Counts of the calling thread, for a thread that is about to end
+void copy_memory_stats(MemoryStats stats[MEM_TYPE_COUNT])
+{
+    memcpy(stats, memory_stats, sizeof(memory_stats));
+}
+
+// Add another thread's counts. Its peak came on top of what this thread holds, so the combined
+// peak is at most the live count plus that peak. Adding the peaks would grow it on every merge
+void merge_memory_stats(const MemoryStats stats[MEM_TYPE_COUNT])
+{
+    for (int i = 0; i < MEM_TYPE_COUNT; i++)
+    {
+        MemoryStats *merged = &memory_stats[i];
+        if (merged->live_objects + stats[i].peak_objects > merged->peak_objects)
+            merged->peak_objects = merged->live_objects + stats[i].peak_objects;
+        if (merged->live_bytes + stats[i].peak_bytes > merged->peak_bytes)
+            merged->peak_bytes = merged->live_bytes + stats[i].peak_bytes;
+        merged->live_objects += stats[i].live_objects;
+        merged->live_bytes += stats[i].live_bytes;
+        merged->allocations += stats[i].allocations;
+        merged->frees += stats[i].frees;
+    }
+}
+
+void display_memory_report(void)
+{
+    double now = now_seconds();
+    double elapsed = start_time < 0 ? 0 : now - start_time;
+    double since_report = last_report_time < 0 ? elapsed : now - last_report_time;
+    long total_live = 0, total_peak = 0;
+
+    printf("\n==========\nMemory Usage\n==========\n");
+    printf("%-16s %10s %12s %10s %12s %12s %12s %12s\n", "Type", "Live", "Live bytes", "Peak", "Peak bytes",
+           "Allocations", "Allocs/s", "Recent/s");
+
+    for (int i = 0; i < MEM_TYPE_COUNT; i++)
+    {
+        const MemoryStats *stats = &memory_stats[i];
+        long recent = stats->allocations - allocations_at_last_report[i];
+
+        printf("%-16s %10ld %12ld %10ld %12ld %12ld %12.1f %12.1f\n", memory_type_names[i], stats->live_objects,
+               stats->live_bytes, stats->peak_objects, stats->peak_bytes, stats->allocations,
+               elapsed > 0 ? stats->allocations / elapsed : 0.0, since_report > 0 ? recent / since_report : 0.0);
+
+        allocations_at_last_report[i] = stats->allocations;
+        total_live += stats->live_bytes;
+        total_peak += stats->peak_bytes;
+    }
+    printf("Total live bytes: %ld, sum of peaks: %ld\n\n", total_live, total_peak);
+    last_report_time = now;
+}
+
+// atexit() handler: full report and whatever was never freed
+void report_memory_at_exit(void)
+{
+    long leaked_objects = 0, leaked_bytes = 0;
+
+    display_memory_report();
+
+    for (int i = 0; i < MEM_TYPE_COUNT; i++)
+    {
+        leaked_objects += memory_stats[i].live_objects;
+        leaked_bytes += memory_stats[i].live_bytes;
+    }
+
+    if (leaked_objects == 0)
+    {
+        printf("Leak summary: no leaks.\n\n");
+        return;
+    }
+
+    printf("Leak summary: %ld objects (%ld bytes) still allocated at exit\n", leaked_objects, leaked_bytes);
+    for (int i = 0; i < MEM_TYPE_COUNT; i++)
+    {
+        if (memory_stats[i].live_objects != 0)
+            printf("  %s: %ld objects, %ld bytes\n", memory_type_names[i], memory_stats[i].live_objects,
+                   memory_stats[i].live_bytes);
+    }
+    printf("\n");
+}
@@ -0,0 +1,186 @@
+// metrics.c
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../include/metrics.h"
+
+/*
+ * Counters, cumulative time and log2-bucketed latency histograms per
+ * operation. Recording is a clock read, a count-leading-zeros and a few
+ * increments, cheap enough to stay on in production. Each thread records
+ * into its own table, see merge_metrics().
+ */
+
+static _Thread_local Metric metrics[METRIC_COUNT];
+
+static const char *metric_names[METRIC_COUNT] = {
+    "load_from_file",
+    "load_from_head",
+    "load_to_wagon",
+    "unload_from_tail",
+    "unload_from_wagon",
+    "display_train",
+    "display_materials",
+    "empty_train",
+    "empty_wagon",
+    "save_to_file",
+    "undo",
+    "redo",
+    "weight_distribution",
+    "compact",
+    "reserve",
+    "commit_reservation",
+    "estimate",
+    "export",
+    "train_view",
+    "split",
+    "couple",
+    "station_stop",
+    "load_balanced",
+    "load_best_fit",
+    "wagon_lookup",
+    "capacity_search",
+    "lightest_search",
+    "list_insert",
+    "delete_empty_wagons",
+    "file_parse",
+    "file_write"};
+
+unsigned long long metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void metrics_record(MetricId id, unsigned long long elapsed_ns)
+{
+    Metric *metric = &metrics[id];
+    int bucket = elapsed_ns ? 64 - __builtin_clzll(elapsed_ns) : 0;
+
+    if (bucket >= METRIC_BUCKETS)
+        bucket = METRIC_BUCKETS - 1;
+
+    metric->count++;
+    metric->total_ns += elapsed_ns;
+    if (elapsed_ns > metric->max_ns)
+        metric->max_ns = elapsed_ns;
+    metric->buckets[bucket]++;
+}
+
+const Metric *get_metric(MetricId id)
+{
+    return &metrics[id];
+}
+
+const char *metric_name(MetricId id)
+{
+    return metric_names[id];
+}
+
+void reset_metrics(void)
+{
+    memset(metrics, 0, sizeof(metrics));
+}
+
+// Metrics of the calling thread, for a thread that is about to end
+void copy_metrics(Metric table[METRIC_COUNT])
+{
+    memcpy(table, metrics, sizeof(metrics));
+}
+
+// Add another thread's metrics to the calling thread's
+void merge_metrics(const Metric table[METRIC_COUNT])
+{
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        metrics[i].count += table[i].count;
+        metrics[i].total_ns += table[i].total_ns;
+        if (table[i].max_ns > metrics[i].max_ns)
+            metrics[i].max_ns = table[i].max_ns;
+        for (int b = 0; b < METRIC_BUCKETS; b++)
+            metrics[i].buckets[b] += table[i].buckets[b];
+    }
+}
+
+// Upper bound of a bucket in nanoseconds
+static unsigned long long bucket_limit(int bucket)
+{
+    return 1ULL << bucket;
+}
+
+// Approximate percentile: upper bound of the bucket that holds it
+static unsigned long long metric_percentile(const Metric *metric, double p)
+{
+    unsigned long long rank = (unsigned long long)(p * metric->count + 0.5);
+    unsigned long long seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+    for (int i = 0; i < METRIC_BUCKETS; i++)
+    {
+        seen += metric->buckets[i];
+        if (seen >= rank)
+            return (i == METRIC_BUCKETS - 1 || bucket_limit(i) > metric->max_ns) ? metric->max_ns : bucket_limit(i);
+    }
+    return metric->max_ns;
+}
+
+void display_metrics(void)
+{
+    printf("\n==========\nOperation Metrics\n==========\n");
+    printf("%-20s %10s %12s %10s %10s %10s %10s\n", "Operation", "Count", "Total ms", "Avg us", "p50 us", "p99 us",
+           "Max us");
+
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        const Metric *metric = &metrics[i];
+        if (metric->count == 0)
+            continue;
+
+        printf("%-20s %10llu %12.3f %10.2f %10.2f %10.2f %10.2f\n", metric_names[i], metric->count,
+               metric->total_ns / 1e6, metric->total_ns / 1e3 / metric->count,
+               metric_percentile(metric, 0.50) / 1e3, metric_percentile(metric, 0.99) / 1e3,
+               metric->max_ns / 1e3);
+    }
+    printf("\n");
+}
+
+// Write all metrics in the Prometheus text format
+int dump_metrics_to_file(const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        printf("\n==========\nError: Unable to open file %s for writing.\n==========\n\n", filename);
+        return 0;
+    }
+
+    fprintf(file, "# HELP train_operation_total Number of times the operation ran.\n");
+    fprintf(file, "# TYPE train_operation_total counter\n");
+    for (int i = 0; i < METRIC_COUNT; i++)
+        fprintf(file, "train_operation_total{op=\"%s\"} %llu\n", metric_names[i], metrics[i].count);
+
+    fprintf(file, "# HELP train_operation_duration_seconds Time spent in the operation.\n");
+    fprintf(file, "# TYPE train_operation_duration_seconds histogram\n");
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        const Metric *metric = &metrics[i];
+        unsigned long long cumulative = 0;
+
+        for (int b = 0; b < METRIC_BUCKETS - 1; b++)
+        {
+            cumulative += metric->buckets[b];
+            fprintf(file, "train_operation_duration_seconds_bucket{op=\"%s\",le=\"%.9g\"} %llu\n", metric_names[i],
+                    bucket_limit(b) / 1e9, cumulative);
+        }
+        fprintf(file, "train_operation_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", metric_names[i],
+                metric->count);
+        fprintf(file, "train_operation_duration_seconds_sum{op=\"%s\"} %.9f\n", metric_names[i],
+                metric->total_ns / 1e9);
+        fprintf(file, "train_operation_duration_seconds_count{op=\"%s\"} %llu\n", metric_names[i], metric->count);
+    }
+
+    fclose(file);
+    return 1;
+}
@@ -0,0 +1,341 @@
+// reservation.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/reservation.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/catalog.h"
+#include "../include/capacity_index.h"
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/utils.h"
+
+/*
+ * Reservations plan a whole order before anything is loaded. Reserving a
+ * material holds stock (material->reserved) and capacity in the wagons the
+ * units will go to (wagon->reserved_*). Held capacity is not free to
+ * anyone else, so loads and other open reservations never book it twice.
+ * Units that do not fit in the train are planned into new wagons, which
+ * are only added on commit.
+ *
+ * Commit releases the holds and loads every entry with one bulk insert,
+ * as a single undo step. Rollback only releases the holds. Both cost the
+ * number of entries, not the number of units.
+ *
+ * Reserved wagons are never deleted. Undo and redo are refused while a
+ * reservation is open, and emptying or reloading the whole train rolls
+ * back every open reservation first.
+ */
+
+static void hold_capacity(Wagon *wagon, MaterialType *material, int count, int sign)
+{
+    wagon->reserved_units += sign * count;
+    if (wagon->reserved_units == 0)
+    {
+        // Exactly zero again, whatever the rounding of the sums
+        wagon->reserved_weight = 0;
+        wagon->reserved_volume = 0;
+        wagon->reserved_slots = 0;
+    }
+    else
+    {
+        wagon->reserved_weight += sign * count * material->weight;
+        wagon->reserved_volume += sign * count * material->volume;
+        wagon->reserved_slots += sign * count * material->slots;
+    }
+    capacity_index_update(wagon);
+}
+
+// Entries before merge_from belong to earlier reservation calls and are kept apart
+static void append_entry(Reservation *reservation, int merge_from, Wagon *wagon, int new_wagon,
+                         MaterialType *material, int count)
+{
+    // Consecutive units for the same wagon and material become one entry
+    if (reservation->entry_count > merge_from)
+    {
+        ReservedUnits *last = &reservation->entries[reservation->entry_count - 1];
+        if (last->wagon == wagon && last->new_wagon == new_wagon && last->material == material)
+        {
+            last->count += count;
+            return;
+        }
+    }
+
+    if (reservation->entry_count == reservation->entry_capacity)
+    {
+        int capacity = reservation->entry_capacity ? reservation->entry_capacity * 2 : 8;
+        reservation->entries = (ReservedUnits *)tracked_realloc(MEM_RESERVATION, reservation->entries,
+                                                                sizeof(ReservedUnits) * reservation->entry_capacity,
+                                                                sizeof(ReservedUnits) * capacity);
+        reservation->entry_capacity = capacity;
+    }
+
+    ReservedUnits *entry = &reservation->entries[reservation->entry_count++];
+    entry->wagon = wagon;
+    entry->new_wagon = new_wagon;
+    entry->material = material;
+    entry->count = count;
+}
+
+static PlannedWagon *plan_new_wagon(Reservation *reservation, WagonClass *wagon_class)
+{
+    if (reservation->new_wagon_count == reservation->new_wagon_capacity)
+    {
+        int capacity = reservation->new_wagon_capacity ? reservation->new_wagon_capacity * 2 : 4;
+        reservation->new_wagons = (PlannedWagon *)tracked_realloc(MEM_RESERVATION, reservation->new_wagons,
+                                                                  sizeof(PlannedWagon) * reservation->new_wagon_capacity,
+                                                                  sizeof(PlannedWagon) * capacity);
+        reservation->new_wagon_capacity = capacity;
+    }
+
+    PlannedWagon *planned = &reservation->new_wagons[reservation->new_wagon_count++];
+    planned->wagon_class = wagon_class;
+    wagon_class_capacity(wagon_class, planned->free);
+    return planned;
+}
+
+// Release the holds of the entries from the given one on and forget them
+static void release_entries(Reservation *reservation, int from)
+{
+    for (int i = reservation->entry_count - 1; i >= from; i--)
+    {
+        ReservedUnits *entry = &reservation->entries[i];
+        if (entry->wagon)
+        {
+            hold_capacity(entry->wagon, entry->material, entry->count, -1);
+        }
+        else
+        {
+            float demand[DIMENSION_COUNT];
+            material_demand(entry->material, demand);
+            for (int d = 0; d < DIMENSION_COUNT; d++)
+                reservation->new_wagons[entry->new_wagon].free[d] += entry->count * demand[d];
+        }
+    }
+    reservation->entry_count = from;
+}
+
+static void close_reservation(Reservation *reservation)
+{
+    Train *train = reservation->train;
+    Reservation **link = &train->reservations;
+
+    while (*link != reservation)
+        link = &(*link)->next;
+    *link = reservation->next;
+
+    tracked_free(MEM_RESERVATION, reservation->entries, sizeof(ReservedUnits) * reservation->entry_capacity);
+    tracked_free(MEM_RESERVATION, reservation->new_wagons, sizeof(PlannedWagon) * reservation->new_wagon_capacity);
+    tracked_free(MEM_RESERVATION, reservation, sizeof(Reservation));
+}
+
+// Start an empty reservation on the train
+Reservation *open_reservation(Train *train)
+{
+    Reservation *reservation = (Reservation *)tracked_calloc(MEM_RESERVATION, 1, sizeof(Reservation));
+
+    reservation->id = train->next_reservation_id++;
+    reservation->train = train;
+    reservation->next = train->reservations;
+    train->reservations = reservation;
+    return reservation;
+}
+
+Reservation *find_reservation(Train *train, int id)
+{
+    for (Reservation *reservation = train->reservations; reservation; reservation = reservation->next)
+    {
+        if (reservation->id == id)
+            return reservation;
+    }
+    return NULL;
+}
+
+// Hold stock and capacity for quantity units, in wagons of wagon_class when one is given.
+// All or nothing: returns 1 if every unit was reserved, else 0 and nothing is held
+int reserve_material(Reservation *reservation, MaterialType *material, int quantity, WagonClass *wagon_class)
+{
+    Train *train = reservation->train;
+
+    if (!check_material_availability(material, quantity))
+    {
+        log_message("\n==========\nInvalid quantity. Available quantity: %d\n==========\n\n", available_quantity(material));
+        return 0;
+    }
+
+    METRIC_START(timer);
+    int first_entry = reservation->entry_count;
+    int first_new_wagon = reservation->new_wagon_count;
+    int remaining = quantity;
+    float demand[DIMENSION_COUNT];
+    material_demand(material, demand);
+
+    while (remaining > 0)
+    {
+        // Room in the train first, the index already leaves out held capacity
+        Wagon *wagon = find_first_wagon_with_room(train, wagon_class, demand);
+        if (wagon)
+        {
+            int count = wagon_units_that_fit(wagon, material);
+            if (count > remaining)
+                count = remaining;
+            hold_capacity(wagon, material, count, 1);
+            append_entry(reservation, first_entry, wagon, -1, material, count);
+            remaining -= count;
+            continue;
+        }
+
+        // Then room in the wagons this reservation adds
+        PlannedWagon *planned = NULL;
+        int count = 0;
+        for (int i = 0; i < reservation->new_wagon_count && count == 0; i++)
+        {
+            planned = &reservation->new_wagons[i];
+            if (!wagon_class || planned->wagon_class == wagon_class)
+                count = max_units_that_fit(planned->free, demand);
+        }
+
+        // Else one more wagon, of the class asked for or the default one
+        if (count == 0)
+        {
+            WagonClass *new_class = wagon_class ? wagon_class : default_wagon_class(train->wagon_classes);
+            planned = plan_new_wagon(reservation, new_class);
+            count = max_units_that_fit(planned->free, demand);
+            if (count == 0)
+            {
+                log_message("\n==========\nA %s does not fit in a %s wagon. Nothing reserved.\n==========\n\n",
+                            material->name, new_class->name);
+                release_entries(reservation, first_entry);
+                reservation->new_wagon_count = first_new_wagon;
+                METRIC_STOP(METRIC_RESERVE, timer);
+                return 0;
+            }
+        }
+
+        if (count > remaining)
+            count = remaining;
+        for (int d = 0; d < DIMENSION_COUNT; d++)
+            planned->free[d] -= count * demand[d];
+        append_entry(reservation, first_entry, NULL, (int)(planned - reservation->new_wagons), material, count);
+        remaining -= count;
+    }
+
+    material->reserved += quantity;
+    reservation->units += quantity;
+    METRIC_STOP(METRIC_RESERVE, timer);
+    return 1;
+}
+
+// Load everything the reservation holds as one operation and close it. Returns the units loaded
+int commit_reservation(Reservation *reservation)
+{
+    Train *train = reservation->train;
+    int units = reservation->units;
+
+    METRIC_START(timer);
+    begin_operation(train, "Commit reservation");
+
+    for (int i = 0; i < reservation->entry_count; i++)
+    {
+        ReservedUnits *entry = &reservation->entries[i];
+        if (!entry->wagon)
+            continue;
+        hold_capacity(entry->wagon, entry->material, entry->count, -1);
+        entry->material->reserved -= entry->count;
+        add_materials_to_wagon(entry->wagon, entry->material, entry->count);
+    }
+
+    if (reservation->new_wagon_count > 0)
+    {
+        Wagon **new_wagons = (Wagon **)malloc(sizeof(Wagon *) * reservation->new_wagon_count);
+        if (!new_wagons)
+        {
+            log_message("\n==========\nError: Memory allocation failed for reservation.\n==========\n\n");
+            exit(1);
+        }
+        for (int i = 0; i < reservation->new_wagon_count; i++)
+            new_wagons[i] = create_wagon_of_class(train, reservation->new_wagons[i].wagon_class);
+
+        for (int i = 0; i < reservation->entry_count; i++)
+        {
+            ReservedUnits *entry = &reservation->entries[i];
+            if (entry->wagon)
+                continue;
+            entry->material->reserved -= entry->count;
+            add_materials_to_wagon(new_wagons[entry->new_wagon], entry->material, entry->count);
+        }
+        free(new_wagons);
+    }
+
+    end_operation(train);
+    METRIC_STOP(METRIC_COMMIT_RESERVATION, timer);
+
+    log_message("\n==========\nReservation %d committed: %d units loaded.\n==========\n\n", reservation->id, units);
+    close_reservation(reservation);
+    return units;
+}
+
+// Release everything the reservation holds and close it. Returns the units released
+int rollback_reservation(Reservation *reservation)
+{
+    int units = reservation->units;
+
+    for (int i = 0; i < reservation->entry_count; i++)
+        reservation->entries[i].material->reserved -= reservation->entries[i].count;
+    release_entries(reservation, 0);
+
+    log_message("\n==========\nReservation %d rolled back: %d units released.\n==========\n\n", reservation->id, units);
+    close_reservation(reservation);
+    return units;
+}
+
+// Before the wagons the reservations point to go away
+void rollback_all_reservations(Train *train)
+{
+    while (train->reservations)
+        rollback_reservation(train->reservations);
+}
+
+void reserve_order_main(Train *train, MaterialCatalog *catalog)
+{
+    char input[50];
+    int quantity;
+    Reservation *reservation = open_reservation(train);
+
+    printf("\n==========\nReservation %d opened. Add the lines of the order, then commit or roll back.\n==========\n\n",
+           reservation->id);
+
+    do
+    {
+        MaterialType *material = select_material(catalog, "\nSelect material to reserve:");
+        if (!material)
+            break;
+
+        printf("Enter the quantity to reserve: ");
+        fgets(input, sizeof(input), stdin);
+        if (sscanf(input, "%d", &quantity) != 1 || quantity <= 0)
+            printf("\n==========\nInvalid quantity. \n==========\n\n");
+        else if (reserve_material(reservation, material, quantity, NULL))
+            printf("\nReserved %d %s.\n", quantity, material->name);
+
+        printf("Reserve another material? (y/n): ");
+    } while (fgets(input, sizeof(input), stdin) && (input[0] == 'y' || input[0] == 'Y'));
+
+    if (reservation->units == 0)
+    {
+        rollback_reservation(reservation);
+        return;
+    }
+
+    printf("\nReservation %d holds %d units, %d new wagons would be added.\n", reservation->id,
+           reservation->units, reservation->new_wagon_count);
+    printf("Commit the reservation? (y/n): ");
+    fgets(input, sizeof(input), stdin);
+
+    if (input[0] == 'y' || input[0] == 'Y')
+        commit_reservation(reservation);
+    else
+        rollback_reservation(reservation);
+}
@@ -0,0 +1,377 @@
+// server.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../include/server.h"
+#include "../include/command.h"
+#include "../include/file_ops.h"
+#include "../include/metrics.h"
+#include "../include/trace.h"
+#include "../include/utils.h"
+
+#define MAX_EVENTS 64
+#define MAX_LINE 256
+#define INPUT_BUFFER_SIZE 16384
+#define REPLY_SIZE 4096
+#define OUTPUT_BACKLOG_LIMIT (256 * 1024) // stop reading from clients that do not read their replies
+
+/*
+ * Single threaded epoll loop. Every connection has an input buffer of
+ * unprocessed bytes and an output buffer of pending replies. All complete
+ * lines in the input are executed in order before anything is written, so
+ * a pipelining client gets its replies back in one write. With a trace,
+ * every executed command is recorded with its timing.
+ */
+typedef struct Connection {
+    int fd;
+    char input[INPUT_BUFFER_SIZE];
+    size_t input_length;
+    char *output;
+    size_t output_length, output_sent, output_capacity;
+    int closing; // QUIT received or protocol error, close after flushing
+    struct Connection *prev, *next;
+} Connection;
+
+static volatile sig_atomic_t server_running = 1;
+static Connection *open_connections; // freed when the server stops
+
+static void stop_server(int signal_number)
+{
+    (void)signal_number;
+    server_running = 0;
+}
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int open_listen_socket(const char *address)
+{
+    int fd;
+
+    if (strncmp(address, "tcp:", 4) == 0)
+    {
+        struct sockaddr_in addr;
+        int one = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)atoi(address + 4));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_un addr;
+
+        if (strlen(address) >= sizeof(addr.sun_path))
+            return -1;
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address);
+        unlink(address);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, SOMAXCONN) < 0 || set_nonblocking(fd) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void append_reply(Connection *connection, const char *reply)
+{
+    size_t length = strlen(reply);
+
+    if (connection->output_length + length + 1 > connection->output_capacity)
+    {
+        size_t capacity = connection->output_capacity ? connection->output_capacity : REPLY_SIZE;
+        while (connection->output_length + length + 1 > capacity)
+            capacity *= 2;
+
+        char *output = (char *)realloc(connection->output, capacity);
+        if (!output)
+        {
+            printf("\n==========\nError: Memory allocation failed for reply buffer.\n==========\n\n");
+            exit(1);
+        }
+        connection->output = output;
+        connection->output_capacity = capacity;
+    }
+
+    memcpy(connection->output + connection->output_length, reply, length);
+    connection->output_length += length;
+    connection->output[connection->output_length++] = '\n';
+}
+
+// Execute every complete line in the input buffer
+static void process_input(Connection *connection, Train *train, MaterialCatalog *catalog,
+                          const char *filename, TraceWriter *trace)
+{
+    char reply[REPLY_SIZE];
+    size_t start = 0;
+
+    while (!connection->closing)
+    {
+        char *newline = memchr(connection->input + start, '\n', connection->input_length - start);
+        if (!newline)
+            break;
+
+        *newline = '\0';
+        if (newline > connection->input + start && newline[-1] == '\r')
+            newline[-1] = '\0';
+
+        Command command;
+        if (!parse_command(connection->input + start, &command))
+        {
+            append_reply(connection, "ERR bad request");
+        }
+        else
+        {
+            unsigned long long start_ns = trace ? metrics_now() : 0;
+            int ok = execute_command(train, catalog, filename, &command, reply, sizeof(reply));
+            if (trace)
+                trace_command(trace, &command, start_ns, metrics_now() - start_ns, ok);
+            append_reply(connection, reply);
+            if (command.type == CMD_QUIT)
+                connection->closing = 1;
+        }
+        start = (size_t)(newline - connection->input) + 1;
+    }
+
+    memmove(connection->input, connection->input + start, connection->input_length - start);
+    connection->input_length -= start;
+
+    if (connection->input_length == sizeof(connection->input) || connection->input_length > MAX_LINE)
+    {
+        // No newline within a reasonable length
+        append_reply(connection, "ERR line too long");
+        connection->closing = 1;
+    }
+}
+
+// Write as much pending output as the socket accepts. Returns -1 on a broken connection
+static int flush_output(Connection *connection)
+{
+    while (connection->output_sent < connection->output_length)
+    {
+        ssize_t sent = send(connection->fd, connection->output + connection->output_sent,
+                            connection->output_length - connection->output_sent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        connection->output_sent += (size_t)sent;
+    }
+    connection->output_length = 0;
+    connection->output_sent = 0;
+    return 0;
+}
+
+static void close_connection(int epoll_fd, Connection *connection)
+{
+    if (connection->prev)
+        connection->prev->next = connection->next;
+    else
+        open_connections = connection->next;
+    if (connection->next)
+        connection->next->prev = connection->prev;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    free(connection->output);
+    free(connection);
+}
+
+static void accept_connections(int epoll_fd, int listen_fd)
+{
+    while (1)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on Unix sockets
+        set_nonblocking(fd);
+
+        Connection *connection = (Connection *)calloc(1, sizeof(Connection));
+        if (!connection)
+        {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            close(fd);
+            free(connection);
+            continue;
+        }
+        connection->next = open_connections;
+        if (open_connections)
+            open_connections->prev = connection;
+        open_connections = connection;
+    }
+}
+
+// Read, execute and reply. Returns -1 when the connection should be closed
+static int handle_connection(int epoll_fd, Connection *connection, unsigned int events, Train *train,
+                             MaterialCatalog *catalog, const char *filename, TraceWriter *trace)
+{
+    if (events & EPOLLERR)
+        return -1;
+
+    // A client may write its last commands and hang up: read them up to end of file first
+    if (events & (EPOLLIN | EPOLLHUP))
+    {
+        while (!connection->closing && connection->output_length < OUTPUT_BACKLOG_LIMIT)
+        {
+            ssize_t received = recv(connection->fd, connection->input + connection->input_length,
+                                    sizeof(connection->input) - connection->input_length, 0);
+            if (received == 0)
+            {
+                connection->closing = 1;
+                break;
+            }
+            if (received < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                return -1;
+            }
+            connection->input_length += (size_t)received;
+            process_input(connection, train, catalog, filename, trace);
+        }
+    }
+
+    if (flush_output(connection) < 0)
+        return -1;
+
+    int pending = connection->output_length > 0;
+    if (!pending && connection->closing)
+        return -1;
+
+    // Only wait for EPOLLOUT while replies are queued, and stop reading while the backlog is full
+    struct epoll_event event;
+    if (!pending)
+        event.events = EPOLLIN;
+    else if (connection->closing || connection->output_length >= OUTPUT_BACKLOG_LIMIT)
+        event.events = EPOLLOUT;
+    else
+        event.events = EPOLLIN | EPOLLOUT;
+    event.data.ptr = connection;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    return 0;
+}
+
+int run_server(Train *train, MaterialCatalog *catalog, const char *filename, const char *address,
+               TraceWriter *trace)
+{
+    int listen_fd = open_listen_socket(address);
+    if (listen_fd < 0)
+    {
+        printf("\n==========\nError: Unable to listen on %s.\n==========\n\n", address);
+        return 1;
+    }
+
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+    {
+        printf("\n==========\nError: Unable to create epoll instance.\n==========\n\n");
+        close(listen_fd);
+        return 1;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // NULL marks the listening socket
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+
+    printf("\n==========\nServer listening on %s\n==========\n\n", address);
+    fflush(stdout);
+    quiet_output = 1;
+
+    struct epoll_event events[MAX_EVENTS];
+    while (server_running)
+    {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                accept_connections(epoll_fd, listen_fd);
+                continue;
+            }
+
+            Connection *connection = (Connection *)events[i].data.ptr;
+            if (handle_connection(epoll_fd, connection, events[i].events, train, catalog,
+                                  filename, trace) < 0)
+            {
+                close_connection(epoll_fd, connection);
+            }
+        }
+    }
+
+    while (open_connections)
+        close_connection(epoll_fd, open_connections);
+    quiet_output = 0;
+    close(epoll_fd);
+    close(listen_fd);
+    if (strncmp(address, "tcp:", 4) != 0)
+        unlink(address);
+
+    printf("\n==========\nServer stopped\n==========\n\n");
+    return 0;
+}
@@ -0,0 +1,414 @@
+// snapshot_diff.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/snapshot_diff.h"
+#include "../include/catalog.h"
+#include "../include/wagon_class.h"
+#include "../include/utils.h"
+
+/*
+ * Diff of two files written by save_train_status_to_file(), read in one
+ * pass, one wagon at a time. Only DIFF_WINDOW wagons of the old train and
+ * one wagon of the new train are held at once, plus one counter per
+ * material name, so the size of the files does not matter.
+ *
+ * Wagon IDs are not compared: delete_empty_wagons() and compaction
+ * renumber every wagon behind a deleted one. Wagons are matched in train
+ * order instead. A new-train wagon is matched with the first old-train
+ * wagon in the window that has the same class and the same load, and the
+ * old wagons before it count as removed. With no such wagon, it is taken
+ * as the next old wagon with a changed load. New-train wagons left after
+ * the old train ran out were added at the tail.
+ */
+
+static void diff_error(const char *message, const char *filename)
+{
+    log_message("\n==========\nError: %s %s.\n==========\n\n", message, filename);
+}
+
+// weight_text is only parsed for a name not seen before
+static void add_units(SnapshotReader *reader, WagonSnapshot *wagon, const char *name, const char *weight_text)
+{
+    // Units of a material are stacked together, so the last material is the usual hit
+    MaterialType *material = NULL;
+    if (wagon->material_count > 0)
+    {
+        MaterialCount *last = &wagon->materials[wagon->material_count - 1];
+        MaterialType *last_material = get_material(reader->names, last->material);
+        if (strcmp(last_material->name, name) == 0)
+            material = last_material;
+    }
+    if (!material)
+    {
+        material = find_material(reader->names, name);
+        if (!material)
+            material = add_material(reader->names, name, strtof(weight_text, NULL), 0);
+    }
+
+    wagon->units++;
+    for (int i = wagon->material_count - 1; i >= 0; i--)
+    {
+        if (wagon->materials[i].material == material->id)
+        {
+            wagon->materials[i].count++;
+            return;
+        }
+    }
+
+    if (wagon->material_count == wagon->material_capacity)
+    {
+        int capacity = wagon->material_capacity ? wagon->material_capacity * 2 : 4;
+        MaterialCount *materials = (MaterialCount *)realloc(wagon->materials, sizeof(MaterialCount) * capacity);
+        if (!materials)
+        {
+            log_message("\n==========\nError: Memory allocation failed for the diff.\n==========\n\n");
+            exit(1);
+        }
+        wagon->materials = materials;
+        wagon->material_capacity = capacity;
+    }
+    wagon->materials[wagon->material_count].material = material->id;
+    wagon->materials[wagon->material_count].count = 1;
+    wagon->material_count++;
+}
+
+static int read_line(SnapshotReader *reader)
+{
+    if (reader->has_line)
+    {
+        reader->has_line = 0;
+        return 1;
+    }
+    if (!fgets(reader->line, sizeof(reader->line), reader->file))
+        return 0;
+    reader->line[strcspn(reader->line, "\r\n")] = 0;
+    return 1;
+}
+
+// next_wagon of the text format written by save_train_status_to_file()
+static int read_text_wagon(SnapshotReader *reader, WagonSnapshot *wagon)
+{
+    // Skip to the next wagon
+    while (read_line(reader) && strncmp(reader->line, "Wagon ID:", 9) != 0)
+        ;
+    if (strncmp(reader->line, "Wagon ID:", 9) != 0)
+        return 0;
+
+    // strtol/strtof instead of sscanf: these lines come once per wagon of very large files
+    wagon->wagon_id = (int)strtol(reader->line + 9, NULL, 10);
+    strcpy(wagon->class_name, DEFAULT_WAGON_CLASS);
+    wagon->max_weight = DEFAULT_WAGON_CAPACITY;
+    wagon->current_weight = 0;
+    wagon->units = 0;
+    wagon->material_count = 0;
+
+    while (read_line(reader))
+    {
+        char *line = reader->line;
+        if (strncmp(line, "Wagon ID:", 9) == 0)
+        {
+            reader->has_line = 1; // first line of the next wagon
+            break;
+        }
+        if (strncmp(line, "    - ", 6) == 0)
+        {
+            // "    - <name>: <weight> kg", the name may contain ':'
+            char *separator = strrchr(line, ':');
+            if (!separator || separator == line + 6)
+                continue;
+            *separator = 0;
+            add_units(reader, wagon, line + 6, separator + 1);
+        }
+        else if (strncmp(line, "  Max Weight:", 13) == 0)
+        {
+            wagon->max_weight = strtof(line + 13, NULL);
+        }
+        else if (strncmp(line, "  Class:", 8) == 0)
+        {
+            snprintf(wagon->class_name, sizeof(wagon->class_name), "%s", line + 9);
+        }
+        else if (strncmp(line, "  Current Weight:", 17) == 0)
+        {
+            wagon->current_weight = strtof(line + 17, NULL);
+        }
+    }
+    return 1;
+}
+
+// Open a snapshot and read its header. Returns 0 if the file cannot be read
+int open_snapshot(SnapshotReader *reader, const char *filename, MaterialCatalog *names)
+{
+    memset(reader, 0, sizeof(SnapshotReader));
+    reader->file = fopen(filename, "r");
+    if (!reader->file)
+        return 0;
+    setvbuf(reader->file, NULL, _IOFBF, 1 << 20);
+
+    reader->names = names;
+    reader->next_wagon = read_text_wagon;
+    strcpy(reader->train_id, "?");
+
+    while (read_line(reader))
+    {
+        if (strncmp(reader->line, "Wagon ID:", 9) == 0)
+        {
+            reader->has_line = 1;
+            break;
+        }
+        if (strncmp(reader->line, "Train ID:", 9) == 0)
+            sscanf(reader->line, "Train ID: %19s", reader->train_id);
+        else if (strncmp(reader->line, "Total Wagons:", 13) == 0)
+            sscanf(reader->line, "Total Wagons: %d", &reader->total_wagons);
+    }
+    return 1;
+}
+
+void close_snapshot(SnapshotReader *reader)
+{
+    if (reader->file)
+        fclose(reader->file);
+    reader->file = NULL;
+}
+
+// Units per material ID over the whole train, before and after
+typedef struct DiffTotals {
+    long *before, *after;
+    int capacity;
+} DiffTotals;
+
+typedef struct DiffCounts {
+    int matched, renumbered, changed, removed, added;
+} DiffCounts;
+
+static void count_units(DiffTotals *totals, const WagonSnapshot *wagon, int after)
+{
+    for (int i = 0; i < wagon->material_count; i++)
+    {
+        int id = wagon->materials[i].material;
+        if (id >= totals->capacity)
+        {
+            int capacity = totals->capacity ? totals->capacity : 16;
+            while (capacity <= id)
+                capacity *= 2;
+            totals->before = (long *)realloc(totals->before, sizeof(long) * capacity);
+            totals->after = (long *)realloc(totals->after, sizeof(long) * capacity);
+            if (!totals->before || !totals->after)
+            {
+                log_message("\n==========\nError: Memory allocation failed for the diff.\n==========\n\n");
+                exit(1);
+            }
+            memset(totals->before + totals->capacity, 0, sizeof(long) * (capacity - totals->capacity));
+            memset(totals->after + totals->capacity, 0, sizeof(long) * (capacity - totals->capacity));
+            totals->capacity = capacity;
+        }
+        if (after)
+            totals->after[id] += wagon->materials[i].count;
+        else
+            totals->before[id] += wagon->materials[i].count;
+    }
+}
+
+static int units_of(const WagonSnapshot *wagon, int material)
+{
+    for (int i = 0; i < wagon->material_count; i++)
+    {
+        if (wagon->materials[i].material == material)
+            return wagon->materials[i].count;
+    }
+    return 0;
+}
+
+static int same_load(const WagonSnapshot *a, const WagonSnapshot *b)
+{
+    if (strcmp(a->class_name, b->class_name) != 0 || a->units != b->units || a->material_count != b->material_count)
+        return 0;
+    for (int i = 0; i < a->material_count; i++)
+    {
+        if (units_of(b, a->materials[i].material) != a->materials[i].count)
+            return 0;
+    }
+    return 1;
+}
+
+static void print_wagon_summary(FILE *out, const char *what, const WagonSnapshot *wagon)
+{
+    fprintf(out, "Wagon %d %s: %s, %d units, %.2f kg\n", wagon->wagon_id, what, wagon->class_name, wagon->units,
+            wagon->current_weight);
+}
+
+// Per-material changes between two wagons matched with each other
+static void print_wagon_change(FILE *out, MaterialCatalog *names, const WagonSnapshot *before, const WagonSnapshot *after)
+{
+    if (before->wagon_id == after->wagon_id)
+        fprintf(out, "Wagon %d changed: %.2f -> %.2f kg", before->wagon_id, before->current_weight, after->current_weight);
+    else
+        fprintf(out, "Wagon %d (now %d) changed: %.2f -> %.2f kg", before->wagon_id, after->wagon_id,
+                before->current_weight, after->current_weight);
+
+    for (int i = 0; i < before->material_count; i++)
+    {
+        int delta = units_of(after, before->materials[i].material) - before->materials[i].count;
+        if (delta != 0)
+            fprintf(out, ", %s %+d", get_material(names, before->materials[i].material)->name, delta);
+    }
+    for (int i = 0; i < after->material_count; i++)
+    {
+        if (units_of(before, after->materials[i].material) == 0)
+            fprintf(out, ", %s %+d", get_material(names, after->materials[i].material)->name, after->materials[i].count);
+    }
+    if (strcmp(before->class_name, after->class_name) != 0)
+        fprintf(out, ", class %s -> %s", before->class_name, after->class_name);
+    fprintf(out, "\n");
+}
+
+static void free_wagon_snapshot(WagonSnapshot *wagon)
+{
+    free(wagon->materials);
+    memset(wagon, 0, sizeof(WagonSnapshot));
+}
+
+// Compare two saved trains and print the differences. Returns 0 when they carry the same
+// loads in the same wagons, 1 when they differ, -1 if a file cannot be read
+int diff_snapshots(const char *before_file, const char *after_file, FILE *out)
+{
+    SnapshotReader before, after;
+    MaterialCatalog *names = create_catalog();
+
+    if (!open_snapshot(&before, before_file, names))
+    {
+        diff_error("Unable to open file", before_file);
+        destroy_catalog(names);
+        return -1;
+    }
+    if (!open_snapshot(&after, after_file, names))
+    {
+        diff_error("Unable to open file", after_file);
+        close_snapshot(&before);
+        destroy_catalog(names);
+        return -1;
+    }
+
+    // Old wagons not matched yet, window[(first + i) % DIFF_WINDOW] in train order
+    WagonSnapshot window[DIFF_WINDOW], current;
+    int first = 0, count = 0, before_done = 0;
+    DiffTotals totals = {NULL, NULL, 0};
+    DiffCounts counts = {0, 0, 0, 0, 0};
+
+    memset(window, 0, sizeof(window));
+    memset(&current, 0, sizeof(current));
+
+    while (1)
+    {
+        while (!before_done && count < DIFF_WINDOW)
+        {
+            WagonSnapshot *slot = &window[(first + count) % DIFF_WINDOW];
+            if (!before.next_wagon(&before, slot))
+            {
+                before_done = 1;
+                break;
+            }
+            count_units(&totals, slot, 0);
+            count++;
+        }
+
+        if (!after.next_wagon(&after, &current))
+            break;
+        count_units(&totals, &current, 1);
+
+        if (count == 0)
+        {
+            print_wagon_summary(out, "added", &current);
+            counts.added++;
+            continue;
+        }
+
+        int match = -1;
+        for (int i = 0; i < count && match < 0; i++)
+        {
+            if (same_load(&window[(first + i) % DIFF_WINDOW], &current))
+                match = i;
+        }
+
+        // Old wagons passed over were deleted
+        for (int i = 0; i < match; i++)
+        {
+            print_wagon_summary(out, "removed", &window[first]);
+            counts.removed++;
+            first = (first + 1) % DIFF_WINDOW;
+            count--;
+        }
+
+        WagonSnapshot *old_wagon = &window[first];
+        if (match >= 0)
+        {
+            counts.matched++;
+            if (old_wagon->wagon_id != current.wagon_id)
+                counts.renumbered++;
+        }
+        else
+        {
+            print_wagon_change(out, names, old_wagon, &current);
+            counts.changed++;
+        }
+        first = (first + 1) % DIFF_WINDOW;
+        count--;
+    }
+
+    // Old wagons left over, in the window and still in the file
+    while (count > 0 || !before_done)
+    {
+        if (count == 0)
+        {
+            if (!before.next_wagon(&before, &window[first]))
+                break;
+            count_units(&totals, &window[first], 0);
+            count = 1;
+        }
+        print_wagon_summary(out, "removed", &window[first]);
+        counts.removed++;
+        first = (first + 1) % DIFF_WINDOW;
+        count--;
+    }
+
+    for (int id = 1; id <= names->count && id < totals.capacity; id++)
+    {
+        if (totals.before[id] != totals.after[id])
+            fprintf(out, "Material %s: %ld -> %ld (%+ld)\n", get_material(names, id)->name, totals.before[id],
+                    totals.after[id], totals.after[id] - totals.before[id]);
+    }
+
+    int wagons_before = counts.matched + counts.changed + counts.removed;
+    int wagons_after = counts.matched + counts.changed + counts.added;
+    fprintf(out, "Wagons: %d -> %d, %d unchanged (%d renumbered), %d changed, %d removed, %d added\n",
+            wagons_before, wagons_after, counts.matched, counts.renumbered, counts.changed, counts.removed, counts.added);
+
+    int differ = counts.changed + counts.removed + counts.added > 0;
+    for (int i = 0; i < DIFF_WINDOW; i++)
+        free_wagon_snapshot(&window[i]);
+    free_wagon_snapshot(&current);
+    free(totals.before);
+    free(totals.after);
+    close_snapshot(&before);
+    close_snapshot(&after);
+    destroy_catalog(names);
+    return differ;
+}
+
+void diff_snapshots_main(void)
+{
+    char before_file[256], after_file[256];
+
+    printf("Enter the file of the earlier train: ");
+    fgets(before_file, sizeof(before_file), stdin);
+    before_file[strcspn(before_file, "\r\n")] = 0;
+    printf("Enter the file of the later train: ");
+    fgets(after_file, sizeof(after_file), stdin);
+    after_file[strcspn(after_file, "\r\n")] = 0;
+
+    printf("\n==========\n");
+    int result = diff_snapshots(before_file, after_file, stdout);
+    if (result == 0)
+        printf("The trains carry the same loads.\n");
+    printf("==========\n\n");
+}
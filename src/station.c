@@ -0,0 +1,269 @@
+// station.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/station.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/catalog.h"
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/utils.h"
+
+/*
+ * Units can be loaded for a station. The unit keeps the station as its
+ * destination, and the train keeps an index of which wagons hold units
+ * for which station: one WagonStop per wagon and station with units for
+ * it, linked into the station's list and into the wagon's. The wagon
+ * functions keep the index up to date for every unit that comes or goes,
+ * so undo, compaction and unloading by material need nothing special.
+ *
+ * A station stop walks the station's list only. Each of those wagons is
+ * read from the top until its units for the station are off, and they
+ * leave the way any unloaded unit does. Wagons emptied at a stop stay in
+ * the train, since deleting them would renumber every wagon behind.
+ * Compaction or emptying removes them later.
+ */
+
+static StationIndex *station_index_of(Train *train)
+{
+    if (!train->stations)
+        train->stations = (StationIndex *)tracked_calloc(MEM_STATION_INDEX, 1, sizeof(StationIndex));
+    return train->stations;
+}
+
+static Station *get_station(Train *train, int station)
+{
+    StationIndex *index = station_index_of(train);
+
+    if (station >= index->capacity)
+    {
+        int capacity = index->capacity ? index->capacity : 16;
+        while (capacity <= station)
+            capacity *= 2;
+        index->stations = (Station *)tracked_realloc(MEM_STATION_INDEX, index->stations,
+                                                     sizeof(Station) * index->capacity, sizeof(Station) * capacity);
+        memset(index->stations + index->capacity, 0, sizeof(Station) * (capacity - index->capacity));
+        index->capacity = capacity;
+    }
+    return &index->stations[station];
+}
+
+static void link_at_station(Station *station, WagonStop *stop)
+{
+    stop->prev_at_station = NULL;
+    stop->next_at_station = station->wagons;
+    if (station->wagons)
+        station->wagons->prev_at_station = stop;
+    station->wagons = stop;
+    station->wagon_count++;
+    station->units += stop->units;
+}
+
+static void unlink_at_station(Station *station, WagonStop *stop)
+{
+    if (stop->prev_at_station)
+        stop->prev_at_station->next_at_station = stop->next_at_station;
+    else
+        station->wagons = stop->next_at_station;
+    if (stop->next_at_station)
+        stop->next_at_station->prev_at_station = stop->prev_at_station;
+    station->wagon_count--;
+    station->units -= stop->units;
+}
+
+// units > 0 units for the station came into the wagon, units < 0 left it
+void station_index_add(Wagon *wagon, int station, int units)
+{
+    Station *entry = get_station(get_wagon_train(wagon), station);
+    WagonStop **link = &wagon->stops;
+
+    while (*link && (*link)->station != station)
+        link = &(*link)->next_in_wagon;
+
+    WagonStop *stop = *link;
+    if (!stop)
+    {
+        stop = (WagonStop *)tracked_malloc(MEM_STATION_INDEX, sizeof(WagonStop));
+        stop->wagon = wagon;
+        stop->station = station;
+        stop->units = 0;
+        stop->next_in_wagon = wagon->stops;
+        wagon->stops = stop;
+        link = &wagon->stops;
+        link_at_station(entry, stop);
+    }
+
+    stop->units += units;
+    entry->units += units;
+    if (stop->units == 0)
+    {
+        *link = stop->next_in_wagon;
+        unlink_at_station(entry, stop);
+        tracked_free(MEM_STATION_INDEX, stop, sizeof(WagonStop));
+    }
+}
+
+// Move the entries of the wagons that went from one train to the other to the index of
+// their new train. Costs one step per entry of 'from', not per wagon moved
+void station_index_move_wagons(Train *from, Train *to)
+{
+    StationIndex *index = from->stations;
+    if (!index)
+        return;
+
+    for (int station = 0; station < index->capacity; station++)
+    {
+        WagonStop *stop = index->stations[station].wagons;
+        while (stop)
+        {
+            WagonStop *next = stop->next_at_station;
+            if (get_wagon_train(stop->wagon) == to)
+            {
+                unlink_at_station(&index->stations[station], stop);
+                link_at_station(get_station(to, station), stop);
+            }
+            stop = next;
+        }
+    }
+}
+
+// Free the index together with the entries of every wagon, for when the wagons go away without unloading
+void free_station_index(Train *train)
+{
+    StationIndex *index = train->stations;
+    if (!index)
+        return;
+
+    for (int station = 0; station < index->capacity; station++)
+    {
+        WagonStop *stop = index->stations[station].wagons;
+        while (stop)
+        {
+            WagonStop *next = stop->next_at_station;
+            stop->wagon->stops = NULL;
+            tracked_free(MEM_STATION_INDEX, stop, sizeof(WagonStop));
+            stop = next;
+        }
+    }
+    tracked_free(MEM_STATION_INDEX, index->stations, sizeof(Station) * index->capacity);
+    tracked_free(MEM_STATION_INDEX, index, sizeof(StationIndex));
+    train->stations = NULL;
+}
+
+long station_units(Train *train, int station)
+{
+    StationIndex *index = train->stations;
+    if (!index || station < 1 || station >= index->capacity)
+        return 0;
+    return index->stations[station].units;
+}
+
+// Load from the head of the train as usual, with every unit marked for the station
+int load_material_for_station(Train *train, MaterialType *material, int quantity, int station)
+{
+    if (station < 1 || station > MAX_STATION_ID)
+    {
+        log_message("\n==========\nInvalid station %d.\n==========\n\n", station);
+        return 0;
+    }
+
+    train->load_destination = station;
+    int loaded = load_specified_material_to_train(train, material, quantity);
+    train->load_destination = 0;
+    return loaded;
+}
+
+// Unload every unit for the station as one operation. Returns the units unloaded
+int station_stop(Train *train, int station, int *wagons_touched)
+{
+    *wagons_touched = 0;
+    if (station_units(train, station) == 0)
+        return 0;
+
+    METRIC_START(timer);
+    begin_operation(train, "Station stop");
+
+    Station *entry = get_station(train, station);
+    long unloaded = 0;
+    while (entry->wagons)
+    {
+        // Removing the units frees the stop and takes it off the list
+        WagonStop *stop = entry->wagons;
+        unloaded += remove_materials_for_destination(stop->wagon, NULL, stop->units, station);
+        (*wagons_touched)++;
+    }
+
+    end_operation(train);
+    METRIC_STOP(METRIC_STATION_STOP, timer);
+
+    log_message("\n==========\nStation %d: %ld units unloaded from %d wagons.\n==========\n\n", station, unloaded,
+                *wagons_touched);
+    return (int)unloaded;
+}
+
+void display_stations(Train *train)
+{
+    StationIndex *index = train->stations;
+    int shown = 0;
+
+    printf("\n==========\nStations\n==========\n");
+    for (int station = 1; index && station < index->capacity; station++)
+    {
+        if (index->stations[station].units == 0)
+            continue;
+        printf("Station %d: %ld units in %d wagons\n", station, index->stations[station].units,
+               index->stations[station].wagon_count);
+        shown++;
+    }
+    if (shown == 0)
+        printf("No units are loaded for a station.\n");
+    printf("\n");
+}
+
+void load_material_for_station_main(Train *train, MaterialCatalog *catalog)
+{
+    char input[50];
+    int station, quantity;
+
+    printf("Enter the station the units are for (1-%d): ", MAX_STATION_ID);
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &station) != 1 || station < 1 || station > MAX_STATION_ID)
+    {
+        printf("\n==========\nInvalid station. \n==========\n\n");
+        return;
+    }
+
+    MaterialType *material = select_material(catalog, "\nSelect material to load:");
+    if (!material)
+        return;
+
+    printf("Enter the quantity to load: ");
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &quantity) != 1 || quantity <= 0)
+    {
+        printf("\n==========\nInvalid quantity. \n==========\n\n");
+        return;
+    }
+
+    load_material_for_station(train, material, quantity, station);
+}
+
+void station_stop_main(Train *train)
+{
+    char input[50];
+    int station, wagons_touched;
+
+    display_stations(train);
+    printf("Enter the station to stop at: ");
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &station) != 1 || station < 1 || station > MAX_STATION_ID)
+    {
+        printf("\n==========\nInvalid station. \n==========\n\n");
+        return;
+    }
+
+    if (station_stop(train, station, &wagons_touched) == 0)
+        printf("\n==========\nNothing to unload at station %d.\n==========\n\n", station);
+}
@@ -0,0 +1,196 @@
+// trace.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/trace.h"
+#include "../include/file_ops.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+/*
+ * Binary trace of the commands a server executed, for replaying a real
+ * workload later (tools/replay.c). The file starts with TRACE_MAGIC and a
+ * version byte. Every record is a run of LEB128 varints: the command type
+ * shifted left by one with the result in the low bit, the nanoseconds
+ * from the start of the previous record, the duration, and the command's
+ * protocol arguments zigzag encoded, except the cursor of EVENTS, which is
+ * an unsigned long and written as it is. A typical record takes 6 to 10
+ * bytes.
+ *
+ * Opening a trace saves the train status next to it, so a replay starts
+ * from the same train. Records go through a large stdio buffer and reach
+ * the disk when the buffer fills or the trace is closed.
+ */
+
+#define TRACE_BUFFER_SIZE (256 * 1024)
+
+static void write_varint(FILE *file, unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        putc((int)(value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    putc((int)value, file);
+}
+
+// 1 on success, 0 at the end of the file or on a varint longer than 64 bits
+static int read_varint(FILE *file, unsigned long long *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = getc(file);
+        if (byte == EOF)
+            return 0;
+        *value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+// Zigzag: small negative numbers stay small
+static unsigned long long zigzag(int value)
+{
+    return value < 0 ? ((unsigned long long)(-(long long)value) << 1) - 1 : (unsigned long long)value << 1;
+}
+
+static int unzigzag(unsigned long long value)
+{
+    return value & 1 ? (int)(-(long long)(value >> 1) - 1) : (int)(value >> 1);
+}
+
+// Start a trace, saving the train status to <filename>.start. Returns NULL if the file cannot be written
+TraceWriter *open_trace(const char *filename, Train *train)
+{
+    char start_file[512];
+    snprintf(start_file, sizeof(start_file), "%s%s", filename, TRACE_START_SUFFIX);
+
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        log_message("\n==========\nError: Unable to open trace file %s for writing.\n==========\n\n", filename);
+        return NULL;
+    }
+
+    TraceWriter *trace = (TraceWriter *)malloc(sizeof(TraceWriter));
+    if (!trace)
+    {
+        log_message("\n==========\nError: Memory allocation failed for the trace.\n==========\n\n");
+        exit(1);
+    }
+    setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), file);
+    putc(TRACE_VERSION, file);
+
+    save_train_status_to_file(train, start_file);
+
+    trace->file = file;
+    trace->opened_ns = metrics_now();
+    trace->last_start_ns = trace->opened_ns;
+    trace->records = 0;
+    return trace;
+}
+
+// Append one executed command. start_ns is a metrics_now() reading
+void trace_command(TraceWriter *trace, const Command *command, unsigned long long start_ns,
+                   unsigned long long duration_ns, int ok)
+{
+    int arguments[MAX_COMMAND_ARGUMENTS];
+    int count = command_arguments(command, arguments);
+    if (count < 0)
+        return;
+
+    write_varint(trace->file, ((unsigned long long)command->type << 1) | (ok ? 1 : 0));
+    write_varint(trace->file, start_ns > trace->last_start_ns ? start_ns - trace->last_start_ns : 0);
+    write_varint(trace->file, duration_ns);
+    if (command->type == CMD_EVENTS)
+        write_varint(trace->file, command->cursor);
+    else
+        for (int i = 0; i < count; i++)
+            write_varint(trace->file, zigzag(arguments[i]));
+
+    if (start_ns > trace->last_start_ns)
+        trace->last_start_ns = start_ns;
+    trace->records++;
+}
+
+void close_trace(TraceWriter *trace)
+{
+    if (!trace)
+        return;
+    fclose(trace->file);
+    log_message("\n==========\nTrace closed: %ld commands recorded.\n==========\n\n", trace->records);
+    free(trace);
+}
+
+// Returns 0 if the file cannot be read or is not a trace of this version
+int open_trace_reader(TraceReader *reader, const char *filename)
+{
+    char magic[sizeof(TRACE_MAGIC)];
+    size_t magic_length = strlen(TRACE_MAGIC);
+
+    reader->file = fopen(filename, "rb");
+    reader->last_start_ns = 0;
+    reader->records = 0;
+    if (!reader->file)
+        return 0;
+
+    if (fread(magic, 1, magic_length, reader->file) != magic_length || memcmp(magic, TRACE_MAGIC, magic_length) != 0 ||
+        getc(reader->file) != TRACE_VERSION)
+    {
+        fclose(reader->file);
+        reader->file = NULL;
+        return 0;
+    }
+    setvbuf(reader->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    return 1;
+}
+
+// Returns 1 for a record, 0 at the end of the trace, -1 if the trace is damaged
+int read_trace_record(TraceReader *reader, TraceRecord *record)
+{
+    unsigned long long head, delta, duration, value;
+    int arguments[MAX_COMMAND_ARGUMENTS] = {0, 0, 0};
+
+    int byte = getc(reader->file);
+    if (byte == EOF)
+        return 0;
+    ungetc(byte, reader->file);
+
+    if (!read_varint(reader->file, &head) || !read_varint(reader->file, &delta) ||
+        !read_varint(reader->file, &duration))
+        return -1;
+
+    CommandType type = (CommandType)(head >> 1);
+    int count = (head >> 1) < CMD_TYPE_COUNT ? command_argument_count(type) : -1;
+    if (count < 0)
+        return -1;
+    unsigned long cursor = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (!read_varint(reader->file, &value))
+            return -1;
+        if (type == CMD_EVENTS)
+            cursor = (unsigned long)value;
+        else
+            arguments[i] = unzigzag(value);
+    }
+
+    build_command(&record->command, type, arguments);
+    record->command.cursor = cursor;
+    record->ok = (int)(head & 1);
+    reader->last_start_ns += delta;
+    record->start_ns = reader->last_start_ns;
+    record->duration_ns = duration;
+    reader->records++;
+    return 1;
+}
+
+void close_trace_reader(TraceReader *reader)
+{
+    if (reader->file)
+        fclose(reader->file);
+    reader->file = NULL;
+}
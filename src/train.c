@@ -1,26 +1,59 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "../include/train.h"
 #include "../include/wagon.h"
 #include "../include/material.h"
+#include "../include/catalog.h"
 #include "../include/file_ops.h"
 #include "../include/utils.h"
-
-// Create a new train
-Train *create_train() {
-    Train *train = (Train *)malloc(sizeof(Train));
-    if (!train) {
-        printf("\nError: Memory allocation failed for Train.\n");
-        exit(1);
-    }
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/capacity_index.h"
+#include "../include/reservation.h"
+#include "../include/events.h"
+#include "../include/station.h"
+
+// Create a new train whose wagons are built from the given classes
+Train *create_train(WagonClassTable *wagon_classes) {
+    Train *train = (Train *)tracked_malloc(MEM_TRAIN, sizeof(Train));
     strcpy(train->train_id, "FasterThanLight");
     train->first_wagon = NULL;
+    train->last_wagon = NULL;
     train->wagon_count = 0;
+    train->history = NULL;
+    train->wagon_classes = wagon_classes;
+    train->capacity_index = NULL;
+    train->reservations = NULL;
+    train->next_reservation_id = 1;
+    train->events = NULL;
+    train->stations = NULL;
+    train->load_destination = 0;
+    train->load_strategy = LOAD_HEAD_FIRST;
     return train;
 }
 
+// Free the train with all its wagons, materials and history
+void destroy_train(Train *train) {
+    if (!train) {
+        return;
+    }
+
+    int was_quiet = quiet_output;
+    quiet_output = 1;
+    free_history(train);
+    free_events(train);
+    empty_entire_train(train);
+    quiet_output = was_quiet;
+    free_capacity_index(train);
+    free_station_index(train);
+
+    tracked_free(MEM_TRAIN, train, sizeof(Train));
+}
+
 // Display the train's status
 void display_train_status(Train *train) {
     if (!train || !train->first_wagon) {
@@ -28,6 +61,7 @@ void display_train_status(Train *train) {
         return;
     }
 
+    METRIC_START(timer);
     printf("\n==========\nTrain ID: %s\nTotal Wagons: %d\n==========\n", train->train_id, train->wagon_count);
 
     Wagon *current_wagon = train->first_wagon;
@@ -35,6 +69,7 @@ void display_train_status(Train *train) {
         display_wagon_status(current_wagon);
         current_wagon = current_wagon->next;
     }
+    METRIC_STOP(METRIC_DISPLAY_TRAIN, timer);
 }
 
 // Load materials into the train
@@ -44,7 +79,7 @@ void load_material_to_train(Train *train, MaterialType *material) {
         return;
     }
 
-    int remaining_quantity = material->quantity - material->loaded;
+    int remaining_quantity = available_quantity(material);
     if (remaining_quantity <= 0) {
         printf("\n==========\nNo more %s available to load.\n==========\n\n", material->name);
         return;
@@ -57,9 +92,7 @@ void load_material_to_train(Train *train, MaterialType *material) {
         }
 
         while (remaining_quantity > 0 && check_wagon_space(current_wagon, material)) {
-            insert_material_into_wagon(current_wagon, material);
-            current_wagon->current_weight += material->weight;
-            material->loaded++;
+            add_materials_to_wagon(current_wagon, material, 1);
             remaining_quantity--;
         }
 
@@ -69,67 +102,380 @@ void load_material_to_train(Train *train, MaterialType *material) {
     printf("\n==========\nMaterial loading completed.\n==========\n\n");
 }
 
-// Load specified quantity of material into the train
-void load_specified_material_to_train(Train *train, MaterialType *material, int quantity) {
+// Add a wagon of wagon_class, or of the default class when no class is named.
+// Returns NULL if not even one unit would fit in it
+static Wagon *add_wagon_for_order(Train *train, MaterialType *material, int quantity, WagonClass *wagon_class) {
+    float demand[DIMENSION_COUNT], capacity[DIMENSION_COUNT];
+    material_demand(material, demand);
+
+    if (!wagon_class) {
+        wagon_class = default_wagon_class(train->wagon_classes);
+    }
+
+    wagon_class_capacity(wagon_class, capacity);
+    if (max_units_that_fit(capacity, demand) == 0) {
+        log_message("\n==========\nA %s does not fit in a %s wagon. %d %s not loaded.\n==========\n\n",
+                    material->name, wagon_class->name, quantity, material->name);
+        return NULL;
+    }
+    return create_wagon_of_class(train, wagon_class);
+}
+
+// Load as many of the remaining units as the wagon takes, in one batch
+static void load_what_fits(Wagon *wagon, MaterialType *material, int *remaining_quantity) {
+    int units = wagon_units_that_fit(wagon, material);
+    if (units > *remaining_quantity) {
+        units = *remaining_quantity;
+    }
+    add_materials_to_wagon(wagon, material, units);
+    *remaining_quantity -= units;
+}
+
+// Fill wagons from the head, only wagons of wagon_class when one is given. New wagons are
+// of wagon_class, or of the default class
+static int load_from_head(Train *train, MaterialType *material, int quantity, WagonClass *wagon_class) {
     if (!train || !material) {
-        printf("\n==========\nError: Train or material data is missing.\n==========\n\n");
-        return;
+        log_message("\n==========\nError: Train or material data is missing.\n==========\n\n");
+        return 0;
     }
 
     if (!check_material_availability(material, quantity)) {
-        printf("\n==========\nInvalid quantity. Available quantity: %d\n==========\n\n", material->quantity - material->loaded);
-        return;
+        log_message("\n==========\nInvalid quantity. Available quantity: %d\n==========\n\n", available_quantity(material));
+        return 0;
     }
 
+    METRIC_START(timer);
+    begin_operation(train, wagon_class ? "Load material into wagon class" : "Load material from head");
+
     int remaining_quantity = quantity;
-    Wagon *current_wagon = train->first_wagon;
+    float demand[DIMENSION_COUNT];
+    material_demand(material, demand);
 
     while (remaining_quantity > 0) {
+        // First wagon with room for one more unit
+        METRIC_START(search_timer);
+        Wagon *current_wagon = find_first_wagon_with_room(train, wagon_class, demand);
+        METRIC_STOP(METRIC_CAPACITY_SEARCH, search_timer);
+
         if (!current_wagon) {
-            current_wagon = create_new_wagon(train);
+            current_wagon = add_wagon_for_order(train, material, remaining_quantity, wagon_class);
+            if (!current_wagon) {
+                break;
+            }
         }
 
-        while (remaining_quantity > 0 && check_wagon_space(current_wagon, material)) {
-            insert_material_into_wagon(current_wagon, material);
-            current_wagon->current_weight += material->weight;
-            material->loaded++;
-            remaining_quantity--;
+        load_what_fits(current_wagon, material, &remaining_quantity);
+    }
+
+    end_operation(train);
+    METRIC_STOP(METRIC_LOAD_FROM_HEAD, timer);
+
+    if (remaining_quantity == 0) {
+        log_message("\n==========\nMaterial loading completed.\n==========\n\n");
+    }
+    return quantity - remaining_quantity;
+}
+
+// A wagon the balanced strategy may load, with its load in units of the material
+typedef struct LevelCandidate {
+    Wagon *wagon;
+    double height;
+    int room;
+} LevelCandidate;
+
+// Loading order of the balanced strategy: lighter first, nearer the head on ties
+static int loads_before(const Wagon *wagon, const Wagon *other) {
+    return wagon->current_weight < other->current_weight ||
+           (wagon->current_weight == other->current_weight && wagon_ahead_of(wagon, other));
+}
+
+// Whether the wagon, at the weight given, still loads before other
+static int ahead_at(const Wagon *wagon, float weight, const Wagon *other) {
+    return weight < other->current_weight || (weight == other->current_weight && wagon_ahead_of(wagon, other));
+}
+
+// Units of the room the lightest wagon takes before it no longer loads before next, in closed
+// form. The quotient can be one off after rounding, so the boundary is checked once
+static int units_while_lightest(const Wagon *lightest, const Wagon *next, const MaterialType *material, int room) {
+    if (!next) {
+        return room;
+    }
+    if (material->weight <= 0) {
+        return ahead_at(lightest, lightest->current_weight, next) ? room : 0;
+    }
+
+    double gap = ((double)next->current_weight - lightest->current_weight) / material->weight;
+    int units = gap <= 0 ? 0 : gap >= room ? room : (int)ceil(gap);
+    if (units < room && ahead_at(lightest, sum_after_units(lightest->current_weight, material->weight, units), next)) {
+        units++;
+    } else if (units > 0 &&
+               !ahead_at(lightest, sum_after_units(lightest->current_weight, material->weight, units - 1), next)) {
+        units--;
+    }
+    return units;
+}
+
+static void sift_candidate_down(LevelCandidate *heap, int count, int slot) {
+    LevelCandidate candidate = heap[slot];
+    for (;;) {
+        int child = 2 * slot + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && loads_before(heap[child + 1].wagon, heap[child].wagon)) {
+            child++;
+        }
+        if (!loads_before(heap[child].wagon, candidate.wagon)) {
+            break;
+        }
+        heap[slot] = heap[child];
+        slot = child;
+    }
+    heap[slot] = candidate;
+}
+
+// Load up to quantity units as if each went into the lightest wagon with room, in batches.
+// The wagons come from one walk over the lightest-wagon heap, from the lightest up until
+// raising them all to the next one (the bound) takes the whole order. First each of them is
+// raised in one batch to two units short of the level the order brings them to, which loading
+// unit by unit would also do whatever the rounding. The last units then go one batch per wagon
+// until it passes the next lightest, through a heap of the walked wagons. Returns the number of
+// units loaded, which falls short of quantity when the walked wagons reach the bound or fill up
+static int load_lightest_wagons(Train *train, MaterialType *material, int quantity, WagonClass *wagon_class,
+                                const float demand[DIMENSION_COUNT]) {
+    double unit = material->weight > 0 ? material->weight : 1;
+    LevelCandidate *candidates = NULL;
+    int count = 0, capacity = 0;
+    double heights = 0;
+
+    METRIC_START(search_timer);
+    LightestWagons walk;
+    start_lightest_wagons(&walk, train);
+    Wagon *bound;
+    while ((bound = next_lightest_wagon(&walk, wagon_class, demand))) {
+        double height = bound->current_weight / unit;
+        if (count > 0 && (count >= quantity || count * height - heights >= quantity)) {
+            break;
+        }
+        if (count == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 16;
+            candidates = (LevelCandidate *)tracked_realloc(MEM_CAPACITY_INDEX, candidates, sizeof(LevelCandidate) * capacity,
+                                                           sizeof(LevelCandidate) * new_capacity);
+            capacity = new_capacity;
         }
 
-        current_wagon = current_wagon->next;
+        candidates[count].wagon = bound;
+        candidates[count].height = height;
+        candidates[count].room = wagon_units_that_fit(bound, material);
+        heights += height;
+        count++;
+    }
+    end_lightest_wagons(&walk);
+    METRIC_STOP(METRIC_LIGHTEST_SEARCH, search_timer);
+
+    int loaded = 0;
+    if (material->weight > 0) { // weightless units all go to the lightest wagon
+        double level = count > 0 ? (heights + quantity) / count : 0;
+        for (int i = 0; i < count; i++) {
+            int units = (int)floor(level - candidates[i].height) - 2;
+            if (units > candidates[i].room) {
+                units = candidates[i].room;
+            }
+            if (units > 0) {
+                add_materials_to_wagon(candidates[i].wagon, material, units);
+                loaded += units;
+            }
+        }
     }
 
-    printf("\n==========\nMaterial loading completed.\n==========\n\n");
+    // The walk gave the candidates in loading order, the bulk batches may have changed it
+    for (int slot = count / 2 - 1; slot >= 0; slot--) {
+        sift_candidate_down(candidates, count, slot);
+    }
+    while (loaded < quantity && count > 0) {
+        Wagon *lightest = candidates[0].wagon;
+        Wagon *next = bound;
+        for (int child = 1; child <= 2 && child < count; child++) {
+            if (!next || loads_before(candidates[child].wagon, next)) {
+                next = candidates[child].wagon;
+            }
+        }
+
+        int room = wagon_units_that_fit(lightest, material);
+        if (room > quantity - loaded) {
+            room = quantity - loaded;
+        }
+
+        int units = units_while_lightest(lightest, next, material, room);
+        if (units == 0 && room > 0) {
+            break; // past the bound
+        }
+        add_materials_to_wagon(lightest, material, units);
+        loaded += units;
+
+        if (!check_wagon_space(lightest, material)) {
+            candidates[0] = candidates[--count];
+        }
+        sift_candidate_down(candidates, count, 0);
+    }
+    tracked_free(MEM_CAPACITY_INDEX, candidates, sizeof(LevelCandidate) * capacity);
+    return loaded;
 }
 
+// Spread the order over the wagons with room, each unit into the lightest one, nearest the head on
+// ties, only wagons of wagon_class when one is given. When none has room, the wagons
+// load_from_head() would add for the rest are added first and the rest is spread over them
+static int load_balanced(Train *train, MaterialType *material, int quantity, WagonClass *wagon_class) {
+    if (!train || !material) {
+        log_message("\n==========\nError: Train or material data is missing.\n==========\n\n");
+        return 0;
+    }
 
-void unload_material_from_tail(Train *train, MaterialType *materials, int material_count) {
-    if (!train || !train->first_wagon) {
-        printf("\n==========\nError: Train or wagons are missing.\n==========\n\n");
-        return;
+    if (!check_material_availability(material, quantity)) {
+        log_message("\n==========\nInvalid quantity. Available quantity: %d\n==========\n\n", available_quantity(material));
+        return 0;
     }
 
+    METRIC_START(timer);
+    begin_operation(train, wagon_class ? "Load material balanced into wagon class" : "Load material balanced");
+
+    int remaining_quantity = quantity;
+    float demand[DIMENSION_COUNT];
+    material_demand(material, demand);
+
+    while (remaining_quantity > 0) {
+        int loaded = load_lightest_wagons(train, material, remaining_quantity, wagon_class, demand);
+        if (loaded > 0) {
+            remaining_quantity -= loaded;
+            continue;
+        }
+
+        // No wagon has room
+        int room = 0;
+        while (room < remaining_quantity) {
+            Wagon *wagon = add_wagon_for_order(train, material, remaining_quantity - room, wagon_class);
+            if (!wagon) {
+                break;
+            }
+            int fit = wagon_units_that_fit(wagon, material);
+            room = fit < remaining_quantity - room ? room + fit : remaining_quantity;
+        }
+        if (room == 0) {
+            break;
+        }
+    }
+
+    end_operation(train);
+    METRIC_STOP(METRIC_LOAD_BALANCED, timer);
+
+    if (remaining_quantity == 0) {
+        log_message("\n==========\nMaterial loading completed.\n==========\n\n");
+    }
+    return quantity - remaining_quantity;
+}
+
+// Load specified quantity of material into the train, returns the number of units loaded
+int load_specified_material_to_train(Train *train, MaterialType *material, int quantity) {
+    if (train && train->load_strategy == LOAD_BALANCED) {
+        return load_balanced(train, material, quantity, NULL);
+    }
+    return load_from_head(train, material, quantity, NULL);
+}
+
+// Load into wagons of one class only, adding wagons of that class as needed
+int load_material_to_class(Train *train, MaterialType *material, int quantity, WagonClass *wagon_class) {
+    if (train && train->load_strategy == LOAD_BALANCED) {
+        return load_balanced(train, material, quantity, wagon_class);
+    }
+    return load_from_head(train, material, quantity, wagon_class);
+}
+
+static const char *load_strategy_names[LOAD_STRATEGY_COUNT] = {"head-first", "balanced"};
+
+const char *load_strategy_name(LoadStrategy strategy) {
+    return strategy >= 0 && strategy < LOAD_STRATEGY_COUNT ? load_strategy_names[strategy] : "unknown";
+}
+
+void select_load_strategy_main(Train *train) {
     char input[50];
-    int material_choice, quantity_to_unload;
+    int strategy;
+
+    printf("\nCurrent loading strategy: %s\n", load_strategy_name(train->load_strategy));
+    printf("1. Head first: fill wagons from the head of the train\n");
+    printf("2. Balanced: spread each order over the least-loaded wagons\n");
+    printf("Select loading strategy: ");
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &strategy) != 1 || strategy < 1 || strategy > LOAD_STRATEGY_COUNT) {
+        printf("\n==========\nInvalid strategy. \n==========\n\n");
+        return;
+    }
 
-    // Ask the user to select the material type
-    printf("\nSelect material to unload:\n");
-    for (int i = 0; i < material_count; i++) {
-        printf("%d. %s\n", i + 1, materials[i].name);
+    train->load_strategy = (LoadStrategy)(strategy - 1);
+    printf("\n==========\nLoading strategy: %s\n==========\n\n", load_strategy_name(train->load_strategy));
+}
+
+// Put the order into the smallest wagon that can take all of it, adding a wagon of the
+// smallest class that fits when none can. Orders larger than any wagon are split
+int load_order_best_fit(Train *train, MaterialType *material, int quantity) {
+    if (!train || !material) {
+        log_message("\n==========\nError: Train or material data is missing.\n==========\n\n");
+        return 0;
     }
 
-    while (1) {
-        printf("Enter your choice: ");
-        fgets(input, sizeof(input), stdin);
+    if (!check_material_availability(material, quantity)) {
+        log_message("\n==========\nInvalid quantity. Available quantity: %d\n==========\n\n", available_quantity(material));
+        return 0;
+    }
 
-        if (sscanf(input, "%d", &material_choice) != 1 || material_choice < 1 || material_choice > material_count) {
-            printf("\n==========\nInvalid material choice. \n==========\n\n");
-            continue;
+    METRIC_START(timer);
+    begin_operation(train, "Load order best fit");
+
+    int remaining_quantity = quantity;
+    float demand[DIMENSION_COUNT], order[DIMENSION_COUNT];
+    material_demand(material, demand);
+
+    while (remaining_quantity > 0) {
+        for (int d = 0; d < DIMENSION_COUNT; d++) {
+            order[d] = remaining_quantity * demand[d];
         }
-        break;
+
+        METRIC_START(search_timer);
+        Wagon *current_wagon = find_smallest_wagon_that_fits(train, order);
+        METRIC_STOP(METRIC_CAPACITY_SEARCH, search_timer);
+
+        if (!current_wagon) {
+            WagonClass *wagon_class = smallest_class_that_fits(train->wagon_classes, order);
+            current_wagon = add_wagon_for_order(train, material, remaining_quantity, wagon_class);
+            if (!current_wagon) {
+                break;
+            }
+        }
+
+        load_what_fits(current_wagon, material, &remaining_quantity);
+        log_message("\nLoaded %s into Wagon %d (%s).\n", material->name, get_wagon_id(current_wagon),
+                    current_wagon->wagon_class ? current_wagon->wagon_class->name : DEFAULT_WAGON_CLASS);
     }
 
-    MaterialType *selected_material = &materials[material_choice - 1];
+    end_operation(train);
+    METRIC_STOP(METRIC_LOAD_BEST_FIT, timer);
+    return quantity - remaining_quantity;
+}
+
+
+void unload_material_from_tail(Train *train, MaterialCatalog *catalog) {
+    if (!train || !train->first_wagon) {
+        printf("\n==========\nError: Train or wagons are missing.\n==========\n\n");
+        return;
+    }
+
+    char input[50];
+    int quantity_to_unload;
+
+    // Ask the user to select the material type
+    MaterialType *selected_material = select_material(catalog, "\nSelect material to unload:");
+    if (!selected_material) {
+        return;
+    }
 
     // Ask the user to enter the quantity to unload
     while (1) {
@@ -143,84 +489,72 @@ void unload_material_from_tail(Train *train, MaterialType *materials, int materi
         break;
     }
 
-    int remaining_quantity = quantity_to_unload;
-    Wagon *current_wagon = train->first_wagon;
+    unload_material_quantity_from_tail(train, selected_material, quantity_to_unload);
+}
 
-    // Move to the last wagon
-    while (current_wagon->next) {
-        current_wagon = current_wagon->next;
+// Unload up to quantity units of material starting from the tail and delete the wagons that leaves empty.
+// Returns the number of units unloaded
+int unload_material_quantity_from_tail(Train *train, MaterialType *material, int quantity) {
+    if (!train || !train->first_wagon || !material) {
+        log_message("\n==========\nError: Train or wagons are missing.\n==========\n\n");
+        return 0;
     }
 
-    // Start unloading from the tail
-    while (current_wagon && remaining_quantity > 0) {
-        LoadedMaterial *current_material = current_wagon->loaded_materials;
-
-        while (current_material && remaining_quantity > 0) {
-            if (strcmp(current_material->type->name, selected_material->name) == 0) {
-                // Unload one unit of material
-                current_wagon->current_weight -= current_material->type->weight;
-                current_material->type->loaded--;
-                remaining_quantity--;
-
-                // Remove the material node if needed
-                if (current_material->prev) {
-                    current_material->prev->next = current_material->next;
-                } else {
-                    current_wagon->loaded_materials = current_material->next;
-                }
-
-                if (current_material->next) {
-                    current_material->next->prev = current_material->prev;
-                }
+    METRIC_START(timer);
+    int remaining_quantity = quantity;
+    int deleted = 0;
+    Wagon *current_wagon = train->last_wagon;
 
-                LoadedMaterial *to_free = current_material;
-                current_material = current_material->next;
-                free(to_free);
+    begin_operation(train, "Unload material from tail");
 
-                printf("\nUnloaded 1 %s from Wagon %d.\n", selected_material->name, current_wagon->wagon_id);
-            } else {
-                current_material = current_material->next;
+    // Start unloading from the tail. Only the wagons this empties are deleted, each as it empties,
+    // so the rest of the train is not scanned
+    while (current_wagon && remaining_quantity > 0) {
+        Wagon *prev = current_wagon->prev;
+        int unloaded = remove_materials_from_wagon(current_wagon, material, remaining_quantity);
+        if (unloaded > 0) {
+            remaining_quantity -= unloaded;
+            log_message("\nUnloaded %d %s from Wagon %d.\n", unloaded, material->name, get_wagon_id(current_wagon));
+            if (current_wagon->current_weight == 0 && current_wagon->loaded_materials == NULL &&
+                current_wagon->reserved_units == 0) {
+                unlink_wagon(train, current_wagon);
+                if (!history_record_wagon_deleted(train, current_wagon, prev)) {
+                    tracked_free(MEM_WAGON, current_wagon, sizeof(Wagon));
+                }
+                deleted++;
             }
         }
 
         // Move to the previous wagon
-        current_wagon = current_wagon->prev;
+        current_wagon = prev;
     }
 
     // Inform the user if not enough materials were available
     if (remaining_quantity > 0) {
-        printf("\n==========\nCould not unload the requested amount. %d %s remaining.\n==========\n\n",
-               remaining_quantity, selected_material->name);
+        log_message("\n==========\nCould not unload the requested amount. %d %s remaining.\n==========\n\n",
+                    remaining_quantity, material->name);
     } else {
-        printf("\n==========\nUnloading completed.\n==========\n\n");
+        log_message("\n==========\nUnloading completed.\n==========\n\n");
     }
 
-    // Delete empty wagons and renumber the remaining wagons
-    delete_empty_wagons(train);
+    if (deleted > 0) {
+        log_message("\n==========\n%d emptied wagons deleted.\n==========\n\n", deleted);
+    }
+    end_operation(train);
+    METRIC_STOP(METRIC_UNLOAD_FROM_TAIL, timer);
+    return quantity - remaining_quantity;
 }
 
 
 
 
-void load_specified_material_to_train_main(Train *train, MaterialType *materials, int material_count) {
+void load_specified_material_to_train_main(Train *train, MaterialCatalog *catalog) {
     char input[50];
-    int material_choice;
     int quantity;
 
-    printf("Select material to load:\n");
-    for (int i = 0; i < material_count; i++) {
-        printf("%d. %s\n", i + 1, materials[i].name);
-    }
-
-    while (1) {
-        printf("Enter your choice: ");
-        fgets(input, sizeof(input), stdin);
-
-        if (sscanf(input, "%d", &material_choice) != 1 || material_choice < 1 || material_choice > material_count) {
-            printf("\nInvalid material choice.\n");
-            continue;
-        }
-        break;
+    MaterialType *material = select_material(catalog, "Select material to load:");
+    if (!material) {
+        return;
     }
 
     while (1) {
@@ -234,7 +568,21 @@ void load_specified_material_to_train_main(Train *train, MaterialType *materials
         break;
     }
 
-    load_specified_material_to_train(train, &materials[material_choice - 1], quantity);
+    // With several classes in the fleet, let the user restrict the load to one of them
+    WagonClass *wagon_class = NULL;
+    if (train->wagon_classes->count > 1) {
+        int canceled;
+        wagon_class = select_wagon_class(train->wagon_classes, "Select wagon class to load into:", &canceled);
+        if (canceled) {
+            return;
+        }
+    }
+
+    if (wagon_class) {
+        load_material_to_class(train, material, quantity, wagon_class);
+    } else {
+        load_specified_material_to_train(train, material, quantity);
+    }
 }
 
 
@@ -258,27 +606,7 @@ void empty_train_or_wagon(Train *train) {
     clear_stdin();
 
     if (choice == 1) {
-        // Empty the entire train
-        Wagon *current_wagon = train->first_wagon;
-
-        while (current_wagon) {
-            LoadedMaterial *current_material = current_wagon->loaded_materials;
-            while (current_material) {
-                current_material->type->loaded -= 1; // Update material quantity
-                LoadedMaterial *to_free = current_material;
-                current_material = current_material->next;
-                free(to_free);
-            }
-
-            Wagon *to_free = current_wagon;
-            current_wagon = current_wagon->next;
-            free(to_free);
-        }
-
-        train->first_wagon = NULL;
-        train->wagon_count = 0;
-
-        printf("\n==========\nThe train has been emptied.\n==========\n\n");
+        empty_entire_train(train);
     } else if (choice == 2) {
         // Empty a specific wagon
         printf("Enter the Wagon ID to empty: ");
@@ -290,36 +618,65 @@ void empty_train_or_wagon(Train *train) {
         }
         clear_stdin();
 
-        Wagon *current_wagon = train->first_wagon;
+        empty_wagon_by_id(train, wagon_id);
+    } else {
+        printf("\n==========\nInvalid choice. Operation canceled.\n==========\n\n");
+    }
+}
 
-        // Find the wagon with the specified ID
-        while (current_wagon && current_wagon->wagon_id != wagon_id) {
-            current_wagon = current_wagon->next;
-        }
+// Remove every wagon and its materials from the train
+void empty_entire_train(Train *train) {
+    if (!train) {
+        return;
+    }
 
-        if (!current_wagon) {
-            printf("\n==========\nError: Wagon ID %d does not exist.\n==========\n\n", wagon_id);
-            return;
-        }
+    METRIC_START(timer);
+    rollback_all_reservations(train);
+    begin_operation(train, "Empty train");
+
+    // Work from the tail so no wagon has to be renumbered
+    Wagon *current_wagon = train->first_wagon;
+    while (current_wagon && current_wagon->next) {
+        current_wagon = current_wagon->next;
+    }
+
+    while (current_wagon) {
+        Wagon *prev = current_wagon->prev;
 
-        // Empty the specific wagon
-        LoadedMaterial *current_material = current_wagon->loaded_materials;
-        while (current_material) {
-            current_material->type->loaded -= 1; // Update material quantity
-            LoadedMaterial *to_free = current_material;
-            current_material = current_material->next;
-            free(to_free);
+        remove_all_materials_from_wagon(current_wagon);
+        unlink_wagon(train, current_wagon);
+        if (!history_record_wagon_deleted(train, current_wagon, prev)) {
+            tracked_free(MEM_WAGON, current_wagon, sizeof(Wagon));
         }
+        current_wagon = prev;
+    }
 
-        current_wagon->loaded_materials = NULL;
-        current_wagon->current_weight = 0;
+    end_operation(train);
 
-        printf("\n==========\nWagon %d has been emptied.\n==========\n\n", wagon_id);
+    train->first_wagon = NULL;
+    train->last_wagon = NULL;
+    train->wagon_count = 0;
+    METRIC_STOP(METRIC_EMPTY_TRAIN, timer);
 
-        // Delete empty wagons and renumber
-        delete_empty_wagons(train);
-    } else {
-        printf("\n==========\nInvalid choice. Operation canceled.\n==========\n\n");
-    }
+    log_message("\n==========\nThe train has been emptied.\n==========\n\n");
 }
 
+// Empty one wagon, then delete empty wagons and renumber. Returns 0 if the wagon does not exist
+int empty_wagon_by_id(Train *train, int wagon_id) {
+    METRIC_START(timer);
+    Wagon *current_wagon = find_wagon_by_id(train, wagon_id);
+
+    if (!current_wagon) {
+        log_message("\n==========\nError: Wagon ID %d does not exist.\n==========\n\n", wagon_id);
+        return 0;
+    }
+
+    begin_operation(train, "Empty wagon");
+    empty_specific_wagon(current_wagon);
+
+    // Delete empty wagons and renumber
+    delete_empty_wagons(train);
+    end_operation(train);
+    METRIC_STOP(METRIC_EMPTY_WAGON, timer);
+    return 1;
+}
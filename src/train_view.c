@@ -0,0 +1,301 @@
+// train_view.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/train_view.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/catalog.h"
+#include "../include/capacity_index.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+/*
+ * Views of long trains that cost what they print. Every wagon takes one
+ * line: ID, class, weight, fill level and its units as runs of the same
+ * material in stacking order. Ranges start at the wagon the capacity index
+ * finds by position instead of walking from the head.
+ *
+ * Filters print a page at a time and say where the next page starts. The
+ * fill filter asks the capacity index of each wagon class for the next
+ * wagon with enough free weight, so wagons that do not match are never
+ * visited. Capacity held by open reservations counts as used. The material
+ * filter reads the material's list of carriers only, keeping the page's
+ * first wagons from the start on in a heap, so wagons without the material
+ * are never visited either.
+ */
+
+// "Wagon 12 [Standard] 750.00/1000.00 kg 75%: 3 Large Box, 2 Small Box"
+void display_wagon_summary(Wagon *wagon)
+{
+    if (!wagon)
+        return;
+
+    int fill = wagon->max_weight > 0 ? (int)(wagon->current_weight * 100 / wagon->max_weight + 0.5f) : 0;
+    printf("Wagon %d [%s] %.2f/%.2f kg %d%%:", get_wagon_id(wagon),
+           wagon->wagon_class ? wagon->wagon_class->name : DEFAULT_WAGON_CLASS, wagon->current_weight,
+           wagon->max_weight, fill);
+
+    if (!wagon->loaded_materials)
+    {
+        printf(" empty\n");
+        return;
+    }
+
+    const char *separator = " ";
+    LoadedMaterial *unit = wagon->loaded_materials;
+    while (unit)
+    {
+        MaterialType *material = unit->type;
+        int run = 0;
+        for (; unit && unit->type == material; unit = unit->next)
+            run++;
+        printf("%s%d %s", separator, run, material->name);
+        separator = ", ";
+    }
+    printf("\n");
+}
+
+// Summary lines of wagons first_wagon_id..last_wagon_id, clamped to the train. Returns the number printed
+int display_wagon_range(Train *train, int first_wagon_id, int last_wagon_id)
+{
+    if (first_wagon_id < 1)
+        first_wagon_id = 1;
+    if (last_wagon_id > train->wagon_count)
+        last_wagon_id = train->wagon_count;
+    if (first_wagon_id > last_wagon_id)
+    {
+        printf("\n==========\nNo wagons in that range.\n==========\n\n");
+        return 0;
+    }
+
+    METRIC_START(timer);
+    printf("\n==========\nTrain ID: %s\nWagons %d-%d of %d\n==========\n", train->train_id, first_wagon_id,
+           last_wagon_id, train->wagon_count);
+
+    int shown = 0;
+    Wagon *wagon = wagon_at_position(train, first_wagon_id - 1);
+    for (; wagon && shown <= last_wagon_id - first_wagon_id; wagon = wagon->next, shown++)
+        display_wagon_summary(wagon);
+    METRIC_STOP(METRIC_TRAIN_VIEW, timer);
+    return shown;
+}
+
+// Max-heap of wagons by position, the rearmost on top
+static void sift_down(Wagon **heap, int count, int slot)
+{
+    while (1)
+    {
+        int rearmost = slot, child = 2 * slot + 1;
+        for (int i = child; i < child + 2 && i < count; i++)
+        {
+            if (wagon_ahead_of(heap[rearmost], heap[i]))
+                rearmost = i;
+        }
+        if (rearmost == slot)
+            return;
+        Wagon *wagon = heap[slot];
+        heap[slot] = heap[rearmost];
+        heap[rearmost] = wagon;
+        slot = rearmost;
+    }
+}
+
+int display_wagons_with_material(Train *train, MaterialType *material, int first_wagon_id, int max_wagons)
+{
+    if (first_wagon_id < 1)
+        first_wagon_id = 1;
+    if (material->carrier_count == 0 || first_wagon_id > train->wagon_count)
+        return 0;
+
+    METRIC_START(timer);
+    Wagon *start = wagon_at_position(train, first_wagon_id - 1);
+    // The page and the wagon after it, where the next page starts
+    int size = max_wagons < material->carrier_count ? max_wagons + 1 : material->carrier_count;
+    Wagon **page = (Wagon **)malloc(sizeof(Wagon *) * size);
+    if (!page)
+    {
+        log_message("\n==========\nError: Memory allocation failed for the train view.\n==========\n\n");
+        exit(1);
+    }
+
+    int count = 0;
+    for (WagonCargo *cargo = material->carriers; cargo; cargo = cargo->next_carrier)
+    {
+        Wagon *wagon = cargo->wagon;
+        if (get_wagon_train(wagon) != train || wagon_ahead_of(wagon, start))
+            continue;
+        if (count < size)
+        {
+            // Sift up
+            int slot = count++;
+            for (; slot > 0 && wagon_ahead_of(page[(slot - 1) / 2], wagon); slot = (slot - 1) / 2)
+                page[slot] = page[(slot - 1) / 2];
+            page[slot] = wagon;
+        }
+        else if (wagon_ahead_of(wagon, page[0]))
+        {
+            page[0] = wagon;
+            sift_down(page, count, 0);
+        }
+    }
+    // Into train order
+    for (int end = count - 1; end > 0; end--)
+    {
+        Wagon *wagon = page[0];
+        page[0] = page[end];
+        page[end] = wagon;
+        sift_down(page, end, 0);
+    }
+
+    int shown = count < max_wagons ? count : max_wagons;
+    for (int i = 0; i < shown; i++)
+        display_wagon_summary(page[i]);
+    int resume = count > shown ? get_wagon_id(page[shown]) : 0;
+    free(page);
+    METRIC_STOP(METRIC_TRAIN_VIEW, timer);
+    return resume;
+}
+
+static int fill_at_most(const Wagon *wagon, int max_fill_percent)
+{
+    return (wagon->current_weight + wagon->reserved_weight) * 100 <= max_fill_percent * wagon->max_weight;
+}
+
+int display_wagons_with_room(Train *train, int max_fill_percent, int first_wagon_id, int max_wagons)
+{
+    WagonClassTable *table = train->wagon_classes;
+    int position = first_wagon_id < 1 ? 0 : first_wagon_id - 1;
+
+    if (!table || table->count == 0 || position >= train->wagon_count)
+        return 0;
+
+    METRIC_START(timer);
+    // Next candidate position per class, the smallest one is the next wagon to look at
+    int *next = (int *)malloc(sizeof(int) * table->count);
+    float (*demand)[DIMENSION_COUNT] = malloc(sizeof(*demand) * table->count);
+    if (!next || !demand)
+    {
+        log_message("\n==========\nError: Memory allocation failed for the train view.\n==========\n\n");
+        exit(1);
+    }
+    for (int i = 0; i < table->count; i++)
+    {
+        // A little under the exact free weight so rounding cannot hide a wagon right at the level
+        demand[i][DIM_WEIGHT] = table->classes[i]->max_weight * (100 - max_fill_percent) / 100.0f - 0.005f;
+        demand[i][DIM_VOLUME] = 0;
+        demand[i][DIM_SLOTS] = 0;
+        next[i] = find_next_position_with_room(train, table->classes[i], demand[i], position);
+    }
+
+    int shown = 0, resume = 0;
+    while (1)
+    {
+        int best = -1;
+        for (int i = 0; i < table->count; i++)
+        {
+            if (next[i] >= 0 && (best < 0 || next[i] < next[best]))
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        Wagon *wagon = wagon_at_position(train, next[best]);
+        if (shown == max_wagons)
+        {
+            resume = next[best] + 1;
+            break;
+        }
+        // The class capacity only narrows the search, the wagon's own decides
+        if (fill_at_most(wagon, max_fill_percent))
+        {
+            display_wagon_summary(wagon);
+            shown++;
+        }
+        next[best] = find_next_position_with_room(train, table->classes[best], demand[best], next[best] + 1);
+    }
+
+    free(next);
+    free(demand);
+    METRIC_STOP(METRIC_TRAIN_VIEW, timer);
+    return resume;
+}
+
+static int read_number(const char *prompt, int *value)
+{
+    char input[50];
+
+    printf("%s", prompt);
+    if (!fgets(input, sizeof(input), stdin) || sscanf(input, "%d", value) != 1)
+    {
+        printf("\n==========\nInvalid input. Operation canceled.\n==========\n\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int show_more(int next_wagon_id)
+{
+    char input[50];
+
+    if (next_wagon_id == 0)
+        return 0;
+    printf("More from wagon %d. Show the next page? (y/n): ", next_wagon_id);
+    return fgets(input, sizeof(input), stdin) && (input[0] == 'y' || input[0] == 'Y');
+}
+
+void display_train_view_main(Train *train, MaterialCatalog *catalog)
+{
+    int choice, first, last, percent;
+
+    if (!train->first_wagon)
+    {
+        printf("\n==========\nNo wagons in the train.\n==========\n\n");
+        return;
+    }
+
+    printf("\nView:\n1. One line per wagon\n2. Wagons in a range\n3. Wagons carrying a material\n"
+           "4. Wagons filled at most to a level\n");
+    if (!read_number("Enter your choice: ", &choice))
+        return;
+
+    switch (choice)
+    {
+    case 1:
+        display_wagon_range(train, 1, train->wagon_count);
+        break;
+    case 2:
+        if (read_number("Enter the first wagon ID: ", &first) && read_number("Enter the last wagon ID: ", &last))
+            display_wagon_range(train, first, last);
+        break;
+    case 3:
+    {
+        MaterialType *material = select_material(catalog, "\nSelect material:");
+        if (!material)
+            break;
+        int next = 1;
+        printf("\n==========\nWagons carrying %s (%d units on the train)\n==========\n", material->name,
+               material->loaded);
+        do
+            next = display_wagons_with_material(train, material, next, VIEW_PAGE_SIZE);
+        while (show_more(next));
+        break;
+    }
+    case 4:
+        if (!read_number("Enter the highest fill level in percent: ", &percent))
+            break;
+        if (percent < 0 || percent > 100)
+        {
+            printf("\n==========\nInvalid fill level.\n==========\n\n");
+            break;
+        }
+        first = 1;
+        printf("\n==========\nWagons at most %d%% full by weight\n==========\n", percent);
+        do
+            first = display_wagons_with_room(train, percent, first, VIEW_PAGE_SIZE);
+        while (show_more(first));
+        break;
+    default:
+        printf("\n==========\nOption unavailable.\n==========\n\n");
+    }
+}
@@ -1,27 +1,129 @@
 // utils.c
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 #include "../include/wagon.h"
 #include "../include/train.h"
 #include "../include/material.h"
 #include "../include/file_ops.h"
 #include "../include/utils.h"
 
+_Thread_local int quiet_output = 0;
 
 
-
+// Units neither loaded nor held by a reservation
+int available_quantity(const MaterialType *material)
+{
+    return material->quantity - material->loaded - material->reserved;
+}
 
 int check_material_availability(MaterialType *material, int quantity)
 {
-    return (quantity > 0 && quantity <= (material->quantity - material->loaded));
+    return (quantity > 0 && quantity <= available_quantity(material));
 }
 
+// Room for one more unit in every dimension. Reserved capacity is not free
 int check_wagon_space(Wagon *wagon, MaterialType *material)
 {
-    return (wagon->max_weight - wagon->current_weight >= material->weight);
+    return wagon_units_that_fit(wagon, material) > 0;
+}
+
+// sum after count units of per_unit are added, with one multiply in double. Every batch of
+// units loaded or planned is summed this way, so a load and its estimate round alike
+float sum_after_units(float sum, float per_unit, int count)
+{
+    return (float)(sum + (double)per_unit * count);
+}
+
+// Free capacity per dimension, FLT_MAX where the wagon has no limit. Reserved capacity is not free
+void wagon_free_capacity(const Wagon *wagon, float free[DIMENSION_COUNT])
+{
+    free[DIM_WEIGHT] = wagon->max_weight - wagon->current_weight - wagon->reserved_weight;
+    free[DIM_VOLUME] = wagon->max_volume == 0 ? FLT_MAX : wagon->max_volume - wagon->current_volume - wagon->reserved_volume;
+    free[DIM_SLOTS] = wagon->max_slots == 0 ? FLT_MAX : (float)(wagon->max_slots - wagon->used_slots - wagon->reserved_slots);
+}
+
+// Capacity one unit takes per dimension
+void material_demand(const MaterialType *material, float demand[DIMENSION_COUNT])
+{
+    demand[DIM_WEIGHT] = material->weight;
+    demand[DIM_VOLUME] = material->volume;
+    demand[DIM_SLOTS] = (float)material->slots;
+}
+
+// Most units n with n * demand <= free + FIT_EPSILON. The quotient can be one off after
+// rounding, so the boundary is checked once
+static int units_within(double free, double demand)
+{
+    double units = floor((free + FIT_EPSILON) / demand);
+    if (units <= 0)
+        return 0;
+    if (units >= INT_MAX)
+        return INT_MAX;
+
+    int n = (int)units;
+    if (n * demand > free + FIT_EPSILON)
+        n--;
+    else if ((n + 1.0) * demand <= free + FIT_EPSILON && n < INT_MAX - 1)
+        n++;
+    return n;
+}
+
+// Units of the given demand that fit in the free capacity: the tightest dimension decides
+int max_units_that_fit(const float free[DIMENSION_COUNT], const float demand[DIMENSION_COUNT])
+{
+    int units = INT_MAX;
+
+    for (int d = 0; d < DIMENSION_COUNT; d++)
+    {
+        if (demand[d] <= 0 || free[d] == FLT_MAX)
+            continue;
+        int fit = units_within(free[d], demand[d]);
+        if (fit < units)
+            units = fit;
+    }
+    return units;
+}
+
+// Units the wagon takes of the material, in closed form with the free capacity taken in double
+int wagon_units_that_fit(const Wagon *wagon, const MaterialType *material)
+{
+    int units = INT_MAX;
+
+    if (material->weight > 0)
+        units = units_within((double)wagon->max_weight - wagon->current_weight - wagon->reserved_weight, material->weight);
+    if (wagon->max_volume != 0 && material->volume > 0)
+    {
+        int fit = units_within((double)wagon->max_volume - wagon->current_volume - wagon->reserved_volume, material->volume);
+        if (fit < units)
+            units = fit;
+    }
+    if (wagon->max_slots != 0 && material->slots > 0)
+    {
+        int fit = (wagon->max_slots - wagon->used_slots - wagon->reserved_slots) / material->slots;
+        if (fit < units)
+            units = fit < 0 ? 0 : fit;
+    }
+    return units;
 }
 
 void clear_stdin() {
     int c;
     while ((c = getchar()) != '\n' && c != EOF);
 }
+
+// printf() for status messages of the core operations, silenced by quiet_output
+void log_message(const char *format, ...)
+{
+    if (quiet_output)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
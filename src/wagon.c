@@ -5,24 +5,43 @@
 #include "../include/wagon.h"
 #include "../include/train.h"
 #include "../include/material.h"
+#include "../include/catalog.h"
 #include "../include/utils.h"
-
-// Create a new wagon
+#include "../include/history.h"
+#include "../include/metrics.h"
+#include "../include/memtrack.h"
+#include "../include/capacity_index.h"
+#include "../include/events.h"
+#include "../include/station.h"
+
+// Create a new wagon of the train's default class
 Wagon *create_new_wagon(Train *train)
 {
-    Wagon *new_wagon = (Wagon *)malloc(sizeof(Wagon));
-    if (!new_wagon)
-    {
-        printf("\n==========\nError: Memory allocation failed for new wagon.\n==========\n\n");
-        exit(1);
-    }
+    return create_wagon_of_class(train, default_wagon_class(train->wagon_classes));
+}
 
-    new_wagon->wagon_id = train->wagon_count + 1;
-    new_wagon->max_weight = 1000.0;
+// Create a new wagon of the given class at the tail of the train
+Wagon *create_wagon_of_class(Train *train, WagonClass *wagon_class)
+{
+    Wagon *new_wagon = (Wagon *)tracked_malloc(MEM_WAGON, sizeof(Wagon));
+
+    new_wagon->max_weight = wagon_class->max_weight;
+    new_wagon->wagon_class = wagon_class;
+    new_wagon->max_volume = wagon_class->max_volume;
+    new_wagon->current_volume = 0;
+    new_wagon->max_slots = wagon_class->max_slots;
+    new_wagon->used_slots = 0;
     new_wagon->current_weight = 0.0;
     new_wagon->loaded_materials = NULL;
     new_wagon->next = NULL;
     new_wagon->prev = NULL;
+    new_wagon->block = NULL;
+    new_wagon->reserved_weight = 0;
+    new_wagon->reserved_volume = 0;
+    new_wagon->reserved_slots = 0;
+    new_wagon->reserved_units = 0;
+    new_wagon->stops = NULL;
+    new_wagon->cargo = NULL;
 
     if (!train->first_wagon)
     {
@@ -30,70 +49,340 @@ Wagon *create_new_wagon(Train *train)
     }
     else
     {
-        Wagon *last_wagon = train->first_wagon;
-        while (last_wagon->next)
-        {
-            last_wagon = last_wagon->next;
-        }
-        last_wagon->next = new_wagon;
-        new_wagon->prev = last_wagon;
+        train->last_wagon->next = new_wagon;
+        new_wagon->prev = train->last_wagon;
     }
+    train->last_wagon = new_wagon;
 
     train->wagon_count++;
+    capacity_index_append(train, new_wagon);
+    history_record_wagon_created(new_wagon);
+    event_wagon_created(train, train->wagon_count);
     return new_wagon;
 }
 
-// Insert material into the wagon (small on top then medium then large)
-void insert_material_into_wagon(Wagon *wagon, MaterialType *material)
+// Link a detached wagon after prev (NULL = at the head), the wagons behind it move back one
+void link_wagon_after(Train *train, Wagon *wagon, Wagon *prev)
 {
-    LoadedMaterial *new_material = (LoadedMaterial *)malloc(sizeof(LoadedMaterial));
-    if (!new_material)
+    wagon->prev = prev;
+    if (prev)
+    {
+        wagon->next = prev->next;
+        prev->next = wagon;
+    }
+    else
     {
-        printf("\n==========\nError: Memory allocation failed for new material.\n==========\n\n");
-        exit(1);
+        wagon->next = train->first_wagon;
+        train->first_wagon = wagon;
     }
+    if (wagon->next)
+    {
+        wagon->next->prev = wagon;
+    }
+    else
+    {
+        train->last_wagon = wagon;
+    }
+
+    train->wagon_count++;
+    capacity_index_insert(train, wagon);
 
-    new_material->type = material;
-    new_material->next = NULL;
-    new_material->prev = NULL;
+    int wagon_id = get_wagon_id(wagon);
+    event_wagon_created(train, wagon_id);
+    event_wagons_renumbered(train, wagon_id, train->wagon_count - wagon_id + 1);
+}
 
-    if (!wagon->loaded_materials)
+// Detach a wagon from the train without freeing it, the wagons behind it move up one
+void unlink_wagon(Train *train, Wagon *wagon)
+{
+    int wagon_id = get_wagon_id(wagon);
+
+    event_wagon_deleted(train, wagon_id);
+    if (wagon->prev)
     {
-        wagon->loaded_materials = new_material;
+        wagon->prev->next = wagon->next;
     }
     else
     {
-        LoadedMaterial *current = wagon->loaded_materials;
-        while (current && current->type->weight <= material->weight)
+        train->first_wagon = wagon->next;
+    }
+    if (wagon->next)
+    {
+        wagon->next->prev = wagon->prev;
+    }
+    else
+    {
+        train->last_wagon = wagon->prev;
+    }
+
+    capacity_index_remove(train, wagon);
+    wagon->next = NULL;
+    wagon->prev = NULL;
+    train->wagon_count--;
+    event_wagons_renumbered(train, wagon_id, train->wagon_count - wagon_id + 1);
+}
+
+// Find a wagon by its ID, NULL if it does not exist
+Wagon *find_wagon_by_id(Train *train, int wagon_id)
+{
+    if (!train)
+        return NULL;
+
+    METRIC_START(timer);
+    // IDs are positions
+    Wagon *current_wagon = wagon_at_position(train, wagon_id - 1);
+    METRIC_STOP(METRIC_WAGON_LOOKUP, timer);
+    return current_wagon;
+}
+
+// Link count new units after prev (NULL = on top)
+static void link_units(Wagon *wagon, LoadedMaterial *prev, MaterialType *material, int count, int destination)
+{
+    LoadedMaterial *current = prev ? prev->next : wagon->loaded_materials;
+
+    for (int i = 0; i < count; i++)
+    {
+        LoadedMaterial *new_material = (LoadedMaterial *)tracked_malloc(MEM_LOADED_MATERIAL, sizeof(LoadedMaterial));
+
+        new_material->type = material;
+        new_material->destination = destination;
+        new_material->prev = prev;
+        new_material->next = current;
+        if (prev)
         {
-            current = current->next;
+            prev->next = new_material;
+        }
+        else
+        {
+            wagon->loaded_materials = new_material;
+        }
+        if (current)
+        {
+            current->prev = new_material;
         }
+        prev = new_material;
+    }
+}
+
+// Insert count units of material into the wagon (small on top then medium then large).
+// The units go together after every unit that is not heavier, so the insertion
+// point is searched once for the whole batch. Returns the position of the first one from the top
+static int insert_materials_into_wagon(Wagon *wagon, MaterialType *material, int count, int destination)
+{
+    METRIC_START(timer);
+    LoadedMaterial *prev = NULL;
+    LoadedMaterial *current = wagon->loaded_materials;
+    int position = 0;
+    while (current && current->type->weight <= material->weight)
+    {
+        prev = current;
+        current = current->next;
+        position++;
+    }
+
+    link_units(wagon, prev, material, count, destination);
+    METRIC_STOP(METRIC_LIST_INSERT, timer);
+    return position;
+}
+
+// The unit at position from the top, NULL past the last one
+static LoadedMaterial *unit_at(Wagon *wagon, int position)
+{
+    LoadedMaterial *unit = wagon->loaded_materials;
+    for (int i = 0; i < position && unit; i++)
+        unit = unit->next;
+    return unit;
+}
+
+// Insert material into the wagon (small on top then medium then large)
+void insert_material_into_wagon(Wagon *wagon, MaterialType *material)
+{
+    insert_materials_into_wagon(wagon, material, 1, 0);
+}
+
+// Load count units into the wagon for the station the train is loading for, see station.h
+void add_materials_to_wagon(Wagon *wagon, MaterialType *material, int count)
+{
+    add_materials_for_destination(wagon, material, count, get_wagon_train(wagon)->load_destination);
+}
+
+// Update weight, material counts and indexes for count units linked in at position
+static void count_added_units(Wagon *wagon, MaterialType *material, int count, int destination, int position)
+{
+    wagon->current_weight = sum_after_units(wagon->current_weight, material->weight, count);
+    wagon->current_volume = sum_after_units(wagon->current_volume, material->volume, count);
+    wagon->used_slots += count * material->slots;
+    adjust_loaded_quantity(material, count);
+    adjust_wagon_cargo(wagon, material, count);
+    capacity_index_update(wagon);
+    if (destination)
+        station_index_add(wagon, destination, count);
+    history_record_units(wagon, material, count, destination, position);
+    event_units_changed(wagon, material, count);
+}
 
-        if (!current)
+// Load count units for a station (0 = none) into the wagon, updating weight and material counts.
+// Every unit added to a wagon goes through here so the change is recorded
+void add_materials_for_destination(Wagon *wagon, MaterialType *material, int count, int destination)
+{
+    if (count <= 0)
+        return;
+
+    int position = insert_materials_into_wagon(wagon, material, count, destination);
+    count_added_units(wagon, material, count, destination, position);
+}
+
+// Put count units at position from the top, where undo and redo found them
+void add_materials_at(Wagon *wagon, MaterialType *material, int count, int destination, int position)
+{
+    if (count <= 0)
+        return;
+
+    METRIC_START(timer);
+    link_units(wagon, position > 0 ? unit_at(wagon, position - 1) : NULL, material, count, destination);
+    METRIC_STOP(METRIC_LIST_INSERT, timer);
+    count_added_units(wagon, material, count, destination, position);
+}
+
+// Unlink and free the unit at position from the top. The caller refreshes the capacity index once it is done
+static void remove_loaded_material(Wagon *wagon, LoadedMaterial *loaded_material, int position)
+{
+    if (loaded_material->prev)
+    {
+        loaded_material->prev->next = loaded_material->next;
+    }
+    else
+    {
+        wagon->loaded_materials = loaded_material->next;
+    }
+    if (loaded_material->next)
+    {
+        loaded_material->next->prev = loaded_material->prev;
+    }
+
+    wagon->current_weight -= loaded_material->type->weight;
+    wagon->current_volume -= loaded_material->type->volume;
+    wagon->used_slots -= loaded_material->type->slots;
+    adjust_loaded_quantity(loaded_material->type, -1);
+    adjust_wagon_cargo(wagon, loaded_material->type, -1);
+    if (loaded_material->destination)
+        station_index_add(wagon, loaded_material->destination, -1);
+    history_record_units(wagon, loaded_material->type, -1, loaded_material->destination, position);
+    tracked_free(MEM_LOADED_MATERIAL, loaded_material, sizeof(LoadedMaterial));
+}
+
+// Remove up to count units from the top of the wagon down that are of the material (NULL = any)
+// and for the destination (ANY_DESTINATION = any), returns the number removed.
+// Every unit removed from a wagon goes through here so the change is recorded
+static int remove_matching_units(Wagon *wagon, MaterialType *material, int destination, int count)
+{
+    LoadedMaterial *current_material = wagon->loaded_materials;
+    MaterialType *run_material = NULL;
+    int removed = 0, run = 0, position = 0;
+
+    while (current_material && removed < count)
+    {
+        LoadedMaterial *next = current_material->next;
+        if ((!material || current_material->type == material) &&
+            (destination == ANY_DESTINATION || current_material->destination == destination))
         {
-            LoadedMaterial *last = wagon->loaded_materials;
-            while (last->next)
+            // One event per run of units of the same material
+            if (current_material->type != run_material)
             {
-                last = last->next;
+                if (run > 0)
+                    event_units_changed(wagon, run_material, -run);
+                run_material = current_material->type;
+                run = 0;
             }
-            last->next = new_material;
-            new_material->prev = last;
+            remove_loaded_material(wagon, current_material, position);
+            removed++;
+            run++;
         }
         else
         {
-            new_material->next = current;
-            new_material->prev = current->prev;
-            if (current->prev)
-            {
-                current->prev->next = new_material;
-            }
-            else
-            {
-                wagon->loaded_materials = new_material;
-            }
-            current->prev = new_material;
+            position++;
+        }
+        current_material = next;
+    }
+    if (removed > 0)
+    {
+        capacity_index_update(wagon);
+        event_units_changed(wagon, run_material, -run);
+    }
+    return removed;
+}
+
+// Remove up to count units of material from the wagon, whatever they are for. Returns the number removed
+int remove_materials_from_wagon(Wagon *wagon, MaterialType *material, int count)
+{
+    return remove_matching_units(wagon, material, ANY_DESTINATION, count);
+}
+
+// Remove up to count units of material (NULL = any) for exactly that destination, returns the number removed
+int remove_materials_for_destination(Wagon *wagon, MaterialType *material, int count, int destination)
+{
+    return remove_matching_units(wagon, material, destination, count);
+}
+
+// Remove the count units from position from the top down, where undo and redo found them.
+// Returns the number removed
+int remove_materials_at(Wagon *wagon, int count, int position)
+{
+    LoadedMaterial *unit = unit_at(wagon, position);
+    MaterialType *run_material = NULL;
+    int removed = 0, run = 0;
+
+    // One event per run of units of the same material
+    while (unit && removed < count)
+    {
+        LoadedMaterial *next = unit->next;
+        if (unit->type != run_material)
+        {
+            if (run > 0)
+                event_units_changed(wagon, run_material, -run);
+            run_material = unit->type;
+            run = 0;
         }
+        remove_loaded_material(wagon, unit, position);
+        removed++;
+        run++;
+        unit = next;
+    }
+    if (removed > 0)
+    {
+        capacity_index_update(wagon);
+        event_units_changed(wagon, run_material, -run);
     }
+    return removed;
+}
+
+// Remove every unit from the wagon, returns the number removed
+int remove_all_materials_from_wagon(Wagon *wagon)
+{
+    int removed = 0, run = 0;
+    MaterialType *run_material = NULL;
+
+    // One event per run of units of the same material
+    while (wagon->loaded_materials)
+    {
+        if (wagon->loaded_materials->type != run_material)
+        {
+            if (run > 0)
+                event_units_changed(wagon, run_material, -run);
+            run_material = wagon->loaded_materials->type;
+            run = 0;
+        }
+        remove_loaded_material(wagon, wagon->loaded_materials, 0);
+        removed++;
+        run++;
+    }
+    if (run > 0)
+        event_units_changed(wagon, run_material, -run);
+    wagon->current_weight = 0;
+    wagon->current_volume = 0;
+    wagon->used_slots = 0;
+    capacity_index_update(wagon);
+    return removed;
 }
 
 // Empty a specific wagon
@@ -101,31 +390,27 @@ void empty_specific_wagon(Wagon *wagon)
 {
     if (!wagon)
     {
-        printf("\n==========\nError: Wagon is missing.\n==========\n\n");
+        log_message("\n==========\nError: Wagon is missing.\n==========\n\n");
         return;
     }
 
-    LoadedMaterial *current_material = wagon->loaded_materials;
-    while (current_material)
-    {
-        LoadedMaterial *to_free = current_material;
-        current_material = current_material->next;
-        free(to_free);
-    }
+    remove_all_materials_from_wagon(wagon);
 
-    wagon->loaded_materials = NULL;
-    wagon->current_weight = 0;
-
-    printf("\n==========\nWagon %d has been emptied.\n==========\n\n", wagon->wagon_id);
+    log_message("\n==========\nWagon %d has been emptied.\n==========\n\n", get_wagon_id(wagon));
 }
 
 void display_wagon_status(Wagon *wagon)
 {
     if (!wagon)
         return;
-    printf("Wagon ID: %d\n", wagon->wagon_id);
+    printf("Wagon ID: %d\n", get_wagon_id(wagon));
     printf("  Max Weight: %.2f kg\n", wagon->max_weight);
+    printf("  Class: %s\n", wagon->wagon_class ? wagon->wagon_class->name : DEFAULT_WAGON_CLASS);
     printf("  Current Weight: %.2f kg\n", wagon->current_weight);
+    if (wagon->max_volume > 0)
+        printf("  Volume: %.2f of %.2f m3\n", wagon->current_volume, wagon->max_volume);
+    if (wagon->max_slots > 0)
+        printf("  Slots: %d of %d\n", wagon->used_slots, wagon->max_slots);
     if (!wagon->loaded_materials)
     {
         printf("  No materials loaded.\n");
@@ -136,13 +421,17 @@ void display_wagon_status(Wagon *wagon)
         LoadedMaterial *current = wagon->loaded_materials;
         while (current)
         {
-            printf("    - %s: %.2f kg\n", current->type->name, current->type->weight);
+            if (current->destination)
+                printf("    - %s: %.2f kg, station %d\n", current->type->name, current->type->weight,
+                       current->destination);
+            else
+                printf("    - %s: %.2f kg\n", current->type->name, current->type->weight);
             current = current->next;
         }
     }
 }
 
-void load_material_to_wagon_main(Train *train, MaterialType *materials, int material_count)
+void load_material_to_wagon_main(Train *train, MaterialCatalog *catalog)
 {
     char input[50];
     int wagon_id;
@@ -156,11 +445,7 @@ void load_material_to_wagon_main(Train *train, MaterialType *materials, int mate
         return;
     }
 
-    Wagon *current_wagon = train->first_wagon;
-    while (current_wagon && current_wagon->wagon_id != wagon_id)
-    {
-        current_wagon = current_wagon->next;
-    }
+    Wagon *current_wagon = find_wagon_by_id(train, wagon_id);
 
     if (!current_wagon)
     {
@@ -168,25 +453,21 @@ void load_material_to_wagon_main(Train *train, MaterialType *materials, int mate
         return;
     }
 
-    printf("Select material to load:\n");
-    for (int i = 0; i < material_count; i++)
+    MaterialType *material = select_material(catalog, "Select material to load:");
+    if (!material)
     {
-        printf("%d. %s\n", i + 1, materials[i].name);
+        return;
     }
 
-    int material_choice, quantity;
-    printf("Enter material choice: ");
-    fgets(input, sizeof(input), stdin);
-    sscanf(input, "%d", &material_choice);
-
+    int quantity;
     printf("Enter quantity: ");
     fgets(input, sizeof(input), stdin);
     sscanf(input, "%d", &quantity);
 
-    load_material_to_wagon(train, &materials[material_choice - 1], wagon_id, quantity);
+    load_material_to_wagon(train, material, wagon_id, quantity);
 }
 
-void unload_material_from_wagon_main(Train *train, MaterialType *materials, int material_count)
+void unload_material_from_wagon_main(Train *train, MaterialCatalog *catalog)
 {
     char input[50];
     int wagon_id;
@@ -195,11 +476,7 @@ void unload_material_from_wagon_main(Train *train, MaterialType *materials, int
     fgets(input, sizeof(input), stdin);
     sscanf(input, "%d", &wagon_id);
 
-    Wagon *current_wagon = train->first_wagon;
-    while (current_wagon && current_wagon->wagon_id != wagon_id)
-    {
-        current_wagon = current_wagon->next;
-    }
+    Wagon *current_wagon = find_wagon_by_id(train, wagon_id);
 
     if (!current_wagon)
     {
@@ -207,156 +484,120 @@ void unload_material_from_wagon_main(Train *train, MaterialType *materials, int
         return;
     }
 
-    printf("Select material to unload:\n");
-    for (int i = 0; i < material_count; i++)
+    MaterialType *material = select_material(catalog, "Select material to unload:");
+    if (!material)
     {
-        printf("%d. %s\n", i + 1, materials[i].name);
+        return;
     }
 
-    int material_choice, quantity;
-    printf("Enter material choice: ");
-    fgets(input, sizeof(input), stdin);
-    sscanf(input, "%d", &material_choice);
-
+    int quantity;
     printf("Enter quantity: ");
     fgets(input, sizeof(input), stdin);
     sscanf(input, "%d", &quantity);
 
-    unload_material_from_wagon(current_wagon, &materials[material_choice - 1], quantity);
+    begin_operation(train, "Unload material from wagon");
+    unload_material_from_wagon(current_wagon, material, quantity);
     delete_empty_wagons(train);
+    end_operation(train);
 }
 
-void load_material_to_wagon(Train *train, MaterialType *material, int wagon_id, int quantity)
+// Load up to quantity units into one wagon, returns the number of units loaded
+int load_material_to_wagon(Train *train, MaterialType *material, int wagon_id, int quantity)
 {
     if (!train || !material)
     {
-        printf("\nError: Train or material data is missing.\n");
-        return;
+        log_message("\nError: Train or material data is missing.\n");
+        return 0;
     }
 
-    Wagon *current_wagon = train->first_wagon;
-
     // Find the wagon by its ID
-    while (current_wagon && current_wagon->wagon_id != wagon_id)
-    {
-        current_wagon = current_wagon->next;
-    }
+    Wagon *current_wagon = find_wagon_by_id(train, wagon_id);
 
     if (!current_wagon)
     {
-        printf("\nError: Wagon ID %d does not exist.\n", wagon_id);
-        return;
+        log_message("\nError: Wagon ID %d does not exist.\n", wagon_id);
+        return 0;
     }
 
-    int remaining_quantity = quantity;
-    while (remaining_quantity > 0)
-    {
-        // Calculate available space in the wagon
-        float available_space = current_wagon->max_weight - current_wagon->current_weight;
-
-        // Check if the wagon can accommodate more materials
-        if (available_space < material->weight)
-        {
-            printf("\nError: Wagon %d is full or cannot accommodate more %s materials.\n", wagon_id, material->name);
-            break;
-        }
+    METRIC_START(timer);
+    begin_operation(train, "Load material to wagon");
 
-        // Calculate how many materials can be loaded
-        int max_loadable = (int)(available_space / material->weight);
+    int remaining_quantity = quantity;
 
+    // Calculate how many materials can be loaded, the tightest dimension decides
+    int max_loadable = wagon_units_that_fit(current_wagon, material);
+    if (max_loadable == 0)
+    {
+        log_message("\nError: Wagon %d is full or cannot accommodate more %s materials.\n", wagon_id, material->name);
+    }
+    else
+    {
         // Load as many materials as possible, up to the requested quantity
         int to_load = (remaining_quantity < max_loadable) ? remaining_quantity : max_loadable;
 
-        for (int i = 0; i < to_load; i++)
-        {
-            insert_material_into_wagon(current_wagon, material);
-            current_wagon->current_weight += material->weight;
-            material->loaded++;
-            remaining_quantity--;
-        }
+        add_materials_to_wagon(current_wagon, material, to_load);
+        remaining_quantity -= to_load;
 
-        printf("\nLoaded %d %s into Wagon %d.\n", to_load, material->name, wagon_id);
+        log_message("\nLoaded %d %s into Wagon %d.\n", to_load, material->name, wagon_id);
 
-        // Check if there's remaining quantity but the wagon cannot accommodate more
-        if (remaining_quantity > 0 && (current_wagon->max_weight - current_wagon->current_weight) < material->weight)
+        if (remaining_quantity > 0)
         {
-            printf("\nWagon %d is full. Cannot load remaining %d materials.\n", wagon_id, remaining_quantity);
-            break;
+            log_message("\nWagon %d is full. Cannot load remaining %d materials.\n", wagon_id, remaining_quantity);
         }
     }
 
     if (remaining_quantity > 0)
     {
-        printf("\nCould not load %d materials due to insufficient space in Wagon %d.\n", remaining_quantity, wagon_id);
+        log_message("\nCould not load %d materials due to insufficient space in Wagon %d.\n", remaining_quantity, wagon_id);
     }
     else
     {
-        printf("\nMaterial loading completed for Wagon %d.\n", wagon_id);
+        log_message("\nMaterial loading completed for Wagon %d.\n", wagon_id);
     }
+
+    end_operation(train);
+    METRIC_STOP(METRIC_LOAD_TO_WAGON, timer);
+    return quantity - remaining_quantity;
 }
 
-void unload_material_from_wagon(Wagon *wagon, MaterialType *material, int quantity)
+// Unload up to quantity units from one wagon, returns the number of units unloaded
+int unload_material_from_wagon(Wagon *wagon, MaterialType *material, int quantity)
 {
     if (!wagon || !material)
     {
-        printf("\nError: Wagon or material data is missing.\n");
-        return;
+        log_message("\nError: Wagon or material data is missing.\n");
+        return 0;
     }
 
-    LoadedMaterial *current_material = wagon->loaded_materials;
-    int unloaded_count = 0;
-
-    while (current_material && quantity > 0)
-    {
-        if (strcmp(current_material->type->name, material->name) == 0)
-        {
-            wagon->current_weight -= material->weight;
-            material->loaded--;
-            quantity--;
-            unloaded_count++;
+    METRIC_START(timer);
+    begin_operation(get_wagon_train(wagon), "Unload material from wagon");
+    int unloaded_count = remove_materials_from_wagon(wagon, material, quantity);
+    end_operation(get_wagon_train(wagon));
+    METRIC_STOP(METRIC_UNLOAD_FROM_WAGON, timer);
 
-            if (current_material->prev)
-            {
-                current_material->prev->next = current_material->next;
-            }
-            else
-            {
-                wagon->loaded_materials = current_material->next;
-            }
-            if (current_material->next)
-            {
-                current_material->next->prev = current_material->prev;
-            }
-
-            LoadedMaterial *to_free = current_material;
-            current_material = current_material->next;
-            free(to_free);
-        }
-        else
-        {
-            current_material = current_material->next;
-        }
-    }
-
-    printf("\nUnloaded %d %s from Wagon %d.\n", unloaded_count, material->name, wagon->wagon_id);
+    log_message("\nUnloaded %d %s from Wagon %d.\n", unloaded_count, material->name, get_wagon_id(wagon));
+    return unloaded_count;
 }
 
 void delete_empty_wagons(Train *train)
 {
     if (!train || !train->first_wagon)
     {
-        printf("\n==========\nTrain or wagons are missing.\n==========\n\n");
+        log_message("\n==========\nTrain or wagons are missing.\n==========\n\n");
         return;
     }
 
+    METRIC_START(timer);
     Wagon *current_wagon = train->first_wagon;
     Wagon *previous_wagon = NULL;
-    int new_wagon_id = 1; // Start renumbering from 1
+    int new_wagon_id = 1; // ID the next kept wagon ends up with
+    int first_renumbered = 0; // position of the first deleted wagon, the ones behind get new IDs
 
     while (current_wagon != NULL)
     {
-        // Check if the wagon is empty
-        if (current_wagon->current_weight == 0 && current_wagon->loaded_materials == NULL)
+        // Check if the wagon is empty, wagons an open reservation holds capacity in stay
+        if (current_wagon->current_weight == 0 && current_wagon->loaded_materials == NULL &&
+            current_wagon->reserved_units == 0)
         {
             // Remove the empty wagon
             Wagon *to_free = current_wagon;
@@ -378,17 +619,29 @@ void delete_empty_wagons(Train *train)
             }
 
             current_wagon = current_wagon->next;
-            free(to_free);
+            event_wagon_deleted(train, new_wagon_id);
+            if (!first_renumbered)
+                first_renumbered = new_wagon_id;
+            capacity_index_remove(train, to_free);
+            if (!history_record_wagon_deleted(train, to_free, previous_wagon))
+            {
+                tracked_free(MEM_WAGON, to_free, sizeof(Wagon));
+            }
             train->wagon_count--;
         }
         else
         {
-            // If the wagon is not empty, renumber it
-            current_wagon->wagon_id = new_wagon_id++;
+            // If the wagon is not empty, keep it
+            new_wagon_id++;
             previous_wagon = current_wagon;
             current_wagon = current_wagon->next;
         }
     }
 
-    printf("\n==========\nEmpty wagons deleted and remaining wagons renumbered.\n==========\n\n");
+    train->last_wagon = previous_wagon;
+    if (first_renumbered)
+        event_wagons_renumbered(train, first_renumbered, new_wagon_id - first_renumbered);
+    METRIC_STOP(METRIC_DELETE_EMPTY_WAGONS, timer);
+
+    log_message("\n==========\nEmpty wagons deleted and remaining wagons renumbered.\n==========\n\n");
 }
@@ -0,0 +1,262 @@
+// wagon_class.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "../include/wagon_class.h"
+#include "../include/memtrack.h"
+#include "../include/utils.h"
+
+/*
+ * Wagon class file format, one class per line, '#' starts a comment:
+ *
+ *   Standard;1000;10;4
+ *   <name>;<max weight in kg>[;<max volume in m3>;<pallet slots>]
+ *
+ * A missing or 0 volume or slot limit means the class has no such limit.
+ * The first class is the default one, used for wagons whose class is not
+ * chosen. Classes are few, so name lookups are linear; best-fit selection
+ * is a binary search over the classes ordered by capacity.
+ */
+
+WagonClassTable *create_wagon_class_table(void)
+{
+    WagonClassTable *table = (WagonClassTable *)calloc(1, sizeof(WagonClassTable));
+    if (!table)
+    {
+        printf("\n==========\nError: Memory allocation failed for wagon classes.\n==========\n\n");
+        exit(1);
+    }
+    return table;
+}
+
+void destroy_wagon_class_table(WagonClassTable *table)
+{
+    if (!table)
+        return;
+
+    for (int i = 0; i < table->count; i++)
+        tracked_free(MEM_WAGON_CLASS, table->classes[i], sizeof(WagonClass));
+    free(table->classes);
+    free(table->by_capacity);
+    free(table);
+}
+
+WagonClass *find_wagon_class(WagonClassTable *table, const char *name)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        if (strcmp(table->classes[i]->name, name) == 0)
+            return table->classes[i];
+    }
+    return NULL;
+}
+
+WagonClass *get_wagon_class(WagonClassTable *table, int id)
+{
+    if (id < 1 || id > table->count)
+        return NULL;
+    return table->classes[id - 1];
+}
+
+WagonClass *default_wagon_class(WagonClassTable *table)
+{
+    return table->classes[0];
+}
+
+// Add a class, or return the existing one with that name
+WagonClass *add_wagon_class(WagonClassTable *table, const char *name, float max_weight)
+{
+    WagonClass *wagon_class = find_wagon_class(table, name);
+    if (wagon_class)
+        return wagon_class;
+
+    if (table->count == table->capacity)
+    {
+        int capacity = table->capacity ? table->capacity * 2 : 8;
+        WagonClass **classes = (WagonClass **)realloc(table->classes, sizeof(WagonClass *) * capacity);
+        int *by_capacity = (int *)realloc(table->by_capacity, sizeof(int) * capacity);
+        if (!classes || !by_capacity)
+        {
+            printf("\n==========\nError: Memory allocation failed for wagon classes.\n==========\n\n");
+            exit(1);
+        }
+        table->classes = classes;
+        table->by_capacity = by_capacity;
+        table->capacity = capacity;
+    }
+
+    wagon_class = (WagonClass *)tracked_malloc(MEM_WAGON_CLASS, sizeof(WagonClass));
+    snprintf(wagon_class->name, sizeof(wagon_class->name), "%s", name);
+    wagon_class->max_weight = max_weight;
+    wagon_class->max_volume = 0;
+    wagon_class->max_slots = 0;
+    wagon_class->id = table->count + 1;
+    table->classes[table->count] = wagon_class;
+
+    // Insertion step keeps by_capacity sorted, ties stay in ID order
+    int position = table->count++;
+    while (position > 0 && table->classes[table->by_capacity[position - 1] - 1]->max_weight > max_weight)
+    {
+        table->by_capacity[position] = table->by_capacity[position - 1];
+        position--;
+    }
+    table->by_capacity[position] = wagon_class->id;
+    return wagon_class;
+}
+
+// The single class wagons always had, used when there is no class file
+WagonClassTable *create_default_wagon_classes(void)
+{
+    WagonClassTable *table = create_wagon_class_table();
+    add_wagon_class(table, DEFAULT_WAGON_CLASS, DEFAULT_WAGON_CAPACITY);
+    return table;
+}
+
+// Returns NULL if the file cannot be opened or defines no class
+WagonClassTable *load_wagon_classes_from_file(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    WagonClassTable *table = create_wagon_class_table();
+    char line[256];
+    int line_number = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        char name[32];
+        float max_weight, max_volume = 0;
+        int max_slots = 0;
+
+        line_number++;
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+
+        int fields = sscanf(line, " %31[^;];%f;%f;%d", name, &max_weight, &max_volume, &max_slots);
+        if ((fields != 2 && fields != 4) || max_weight <= 0 || max_volume < 0 || max_slots < 0)
+        {
+            log_message("\nWarning: %s line %d ignored: %s\n", filename, line_number, line);
+            continue;
+        }
+        WagonClass *wagon_class = add_wagon_class(table, name, max_weight);
+        wagon_class->max_volume = max_volume;
+        wagon_class->max_slots = max_slots;
+    }
+    fclose(file);
+
+    if (table->count == 0)
+    {
+        destroy_wagon_class_table(table);
+        return NULL;
+    }
+
+    log_message("\n==========\nWagon classes loaded from file: %s (%d classes)\n==========\n\n", filename,
+                table->count);
+    return table;
+}
+
+// Capacity per dimension of an empty wagon of the class, FLT_MAX where it has no limit
+void wagon_class_capacity(const WagonClass *wagon_class, float capacity[DIMENSION_COUNT])
+{
+    capacity[DIM_WEIGHT] = wagon_class->max_weight;
+    capacity[DIM_VOLUME] = wagon_class->max_volume == 0 ? FLT_MAX : wagon_class->max_volume;
+    capacity[DIM_SLOTS] = wagon_class->max_slots == 0 ? FLT_MAX : (float)wagon_class->max_slots;
+}
+
+static int class_fits(const WagonClass *wagon_class, const float demand[DIMENSION_COUNT])
+{
+    float capacity[DIMENSION_COUNT];
+    wagon_class_capacity(wagon_class, capacity);
+    for (int d = 0; d < DIMENSION_COUNT; d++)
+    {
+        if (capacity[d] < demand[d])
+            return 0;
+    }
+    return 1;
+}
+
+// Smallest class by weight that can carry the demand in every dimension, or the
+// largest class if none can. Binary search on weight, then the first class from
+// there that also has the volume and slots
+WagonClass *smallest_class_that_fits(WagonClassTable *table, const float demand[DIMENSION_COUNT])
+{
+    int low = 0, high = table->count - 1;
+
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (table->classes[table->by_capacity[middle] - 1]->max_weight >= demand[DIM_WEIGHT])
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    for (int i = low; i < table->count; i++)
+    {
+        WagonClass *wagon_class = table->classes[table->by_capacity[i] - 1];
+        if (class_fits(wagon_class, demand))
+            return wagon_class;
+    }
+    return table->classes[table->by_capacity[table->count - 1] - 1];
+}
+
+void display_wagon_classes(WagonClassTable *table)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        WagonClass *wagon_class = table->classes[i];
+        printf("%d. %s (%.2f kg", i + 1, wagon_class->name, wagon_class->max_weight);
+        if (wagon_class->max_volume > 0)
+            printf(", %.2f m3", wagon_class->max_volume);
+        if (wagon_class->max_slots > 0)
+            printf(", %d slots", wagon_class->max_slots);
+        printf(")\n");
+    }
+}
+
+// Ask for a class by ID or name. An empty answer or 0 returns NULL (no particular
+// class); *canceled is set at end of input
+WagonClass *select_wagon_class(WagonClassTable *table, const char *prompt, int *canceled)
+{
+    char input[80];
+
+    *canceled = 0;
+    printf("%s\n", prompt);
+    printf("0. Any class\n");
+    display_wagon_classes(table);
+
+    while (1)
+    {
+        printf("Enter your choice: ");
+        if (!fgets(input, sizeof(input), stdin))
+        {
+            *canceled = 1;
+            return NULL;
+        }
+        input[strcspn(input, "\r\n")] = 0;
+        if (input[0] == '\0')
+            return NULL;
+
+        int id;
+        char extra;
+        WagonClass *wagon_class;
+        if (sscanf(input, "%d %c", &id, &extra) == 1)
+        {
+            if (id == 0)
+                return NULL;
+            wagon_class = get_wagon_class(table, id);
+        }
+        else
+        {
+            wagon_class = find_wagon_class(table, input);
+        }
+
+        if (wagon_class)
+            return wagon_class;
+        printf("\n==========\nInvalid wagon class choice. \n==========\n\n");
+    }
+}
@@ -0,0 +1,602 @@
+// weight_distribution.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/weight_distribution.h"
+#include "../include/capacity_index.h"
+#include "../include/train.h"
+#include "../include/wagon.h"
+#include "../include/memtrack.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+/*
+ * Balance queries over the load of the wagons, kept in the blocks of the
+ * capacity index so they share its rebuilds, splits and couplings:
+ *
+ *   - a Fenwick tree over the block loads, plus a scan of one block, gives
+ *     the weight of any range of wagons in O(log n + CAPACITY_BLOCK). The
+ *     sum of (position + 1) * weight over the train is kept as it changes,
+ *     a wagon that comes or goes moving the load behind it by one, so the
+ *     centre of mass costs O(log n);
+ *   - for the last window size asked for, a max-tree over the loads of
+ *     every k consecutive wagons, where a load change is a range add over
+ *     the k windows covering the wagon, gives the heaviest window in
+ *     O(log n). Asking for another k, or adding or removing wagons, builds
+ *     a new tree in O(n) at the next query.
+ *
+ * The centre of mass counts the load only and assumes wagons of equal
+ * length, so it is a fractional wagon position from the head.
+ *
+ * The balanced loading strategy uses a min-heap of the wagons by weight,
+ * ties to the head, in two levels: each block keeps a heap of its slots,
+ * and the index a heap of the blocks by their lightest wagon. A load
+ * change sifts one slot and then its block. The walk over the lightest
+ * wagons with room is a best-first search over both levels with a small
+ * heap of the entries still to visit, so the j lightest wagons cost
+ * O(j log j) without touching the index. Lighter wagons without room for
+ * the demand are walked past; the walk ends at the first wagon without
+ * weight room under the largest max_weight of the train, since every
+ * wagon after it is as heavy.
+ */
+
+void weight_index_allocate(CapacityIndex *index)
+{
+    index->weight_sum = (double *)tracked_malloc(MEM_CAPACITY_INDEX, sizeof(double) * (index->leaves + 1));
+    index->lightest = (WagonBlock **)tracked_malloc(MEM_CAPACITY_INDEX, sizeof(WagonBlock *) * index->leaves);
+    index->window = 0;
+}
+
+void weight_index_free(CapacityIndex *index)
+{
+    tracked_free(MEM_CAPACITY_INDEX, index->weight_sum, sizeof(double) * (index->leaves + 1));
+    tracked_free(MEM_CAPACITY_INDEX, index->lightest, sizeof(WagonBlock *) * index->leaves);
+    tracked_free(MEM_CAPACITY_INDEX, index->window_max, sizeof(double) * 2 * index->window_leaves);
+    tracked_free(MEM_CAPACITY_INDEX, index->window_add, sizeof(double) * 2 * index->window_leaves);
+    index->window_max = index->window_add = NULL;
+    index->window_leaves = 0;
+    index->window = 0;
+}
+
+static void fenwick_add(double *tree, int size, int number, double delta)
+{
+    for (int i = number + 1; i <= size; i += i & (-i))
+        tree[i] += delta;
+}
+
+// Sum of blocks [0, end)
+static double fenwick_prefix(const double *tree, int end)
+{
+    double sum = 0;
+    for (int i = end; i > 0; i -= i & (-i))
+        sum += tree[i];
+    return sum;
+}
+
+// Load of the wagons ahead of the slot of the block
+static double weight_before(const CapacityIndex *index, const WagonBlock *block, int slot)
+{
+    double sum = fenwick_prefix(index->weight_sum, block->number);
+    for (int s = 0; s < slot; s++)
+        sum += block->weight[s];
+    return sum;
+}
+
+// Load of positions [0, end)
+static double prefix_weight(const CapacityIndex *index, int end)
+{
+    if (end >= index->count)
+        return fenwick_prefix(index->weight_sum, index->leaves);
+    if (end <= 0)
+        return 0;
+
+    int slot;
+    const WagonBlock *block = block_at_position(index, end, &slot);
+    return weight_before(index, block, slot);
+}
+
+// Heap of the slots in a block
+
+static int slot_lighter(const WagonBlock *block, int slot, int other)
+{
+    double weight = block->weight[slot], other_weight = block->weight[other];
+    return weight < other_weight || (weight == other_weight && slot < other);
+}
+
+static void slot_place(WagonBlock *block, int heap_slot, int slot)
+{
+    block->lightest[heap_slot] = (unsigned char)slot;
+    block->heap_slot[slot] = (unsigned char)heap_slot;
+}
+
+static void slot_sift_up(WagonBlock *block, int heap_slot)
+{
+    int slot = block->lightest[heap_slot];
+    while (heap_slot > 0)
+    {
+        int parent = (heap_slot - 1) / 2;
+        if (!slot_lighter(block, slot, block->lightest[parent]))
+            break;
+        slot_place(block, heap_slot, block->lightest[parent]);
+        heap_slot = parent;
+    }
+    slot_place(block, heap_slot, slot);
+}
+
+static void slot_sift_down(WagonBlock *block, int heap_slot)
+{
+    int slot = block->lightest[heap_slot];
+    for (;;)
+    {
+        int child = 2 * heap_slot + 1;
+        if (child >= block->count)
+            break;
+        if (child + 1 < block->count && slot_lighter(block, block->lightest[child + 1], block->lightest[child]))
+            child++;
+        if (!slot_lighter(block, block->lightest[child], slot))
+            break;
+        slot_place(block, heap_slot, block->lightest[child]);
+        heap_slot = child;
+    }
+    slot_place(block, heap_slot, slot);
+}
+
+// Sums and heap of a block from its weights
+void weight_block_build(WagonBlock *block)
+{
+    block->weight_sum = 0;
+    block->moment_sum = 0;
+    for (int slot = 0; slot < block->count; slot++)
+    {
+        block->weight_sum += block->weight[slot];
+        block->moment_sum += (slot + 1) * block->weight[slot];
+        slot_place(block, slot, slot);
+    }
+    for (int heap_slot = block->count / 2 - 1; heap_slot >= 0; heap_slot--)
+        slot_sift_down(block, heap_slot);
+}
+
+// Heap of the blocks by their lightest wagon
+
+static double lightest_weight(const WagonBlock *block)
+{
+    return block->weight[block->lightest[0]];
+}
+
+static int block_lighter(const WagonBlock *block, const WagonBlock *other)
+{
+    double weight = lightest_weight(block), other_weight = lightest_weight(other);
+    return weight < other_weight || (weight == other_weight && block->number < other->number);
+}
+
+static void block_place(CapacityIndex *index, int top_slot, WagonBlock *block)
+{
+    index->lightest[top_slot] = block;
+    block->top_slot = top_slot;
+}
+
+static void block_sift_up(CapacityIndex *index, int top_slot)
+{
+    WagonBlock *block = index->lightest[top_slot];
+    while (top_slot > 0)
+    {
+        int parent = (top_slot - 1) / 2;
+        if (!block_lighter(block, index->lightest[parent]))
+            break;
+        block_place(index, top_slot, index->lightest[parent]);
+        top_slot = parent;
+    }
+    block_place(index, top_slot, block);
+}
+
+static void block_sift_down(CapacityIndex *index, int top_slot)
+{
+    WagonBlock *block = index->lightest[top_slot];
+    for (;;)
+    {
+        int child = 2 * top_slot + 1;
+        if (child >= index->heap_count)
+            break;
+        if (child + 1 < index->heap_count && block_lighter(index->lightest[child + 1], index->lightest[child]))
+            child++;
+        if (!block_lighter(index->lightest[child], block))
+            break;
+        block_place(index, top_slot, index->lightest[child]);
+        top_slot = child;
+    }
+    block_place(index, top_slot, block);
+}
+
+// The lightest wagon of the block changed: push, move or drop the block in the heap of blocks
+static void block_resift(CapacityIndex *index, WagonBlock *block)
+{
+    if (block->count == 0)
+    {
+        if (block->top_slot >= 0)
+        {
+            int top_slot = block->top_slot;
+            WagonBlock *last = index->lightest[--index->heap_count];
+            block->top_slot = -1;
+            if (last != block)
+            {
+                block_place(index, top_slot, last);
+                block_sift_up(index, top_slot);
+                block_sift_down(index, last->top_slot);
+            }
+        }
+        return;
+    }
+
+    if (block->top_slot < 0)
+        block_place(index, index->heap_count++, block);
+    block_sift_up(index, block->top_slot);
+    block_sift_down(index, block->top_slot);
+}
+
+// Fenwick tree, moment and heap of blocks from the block sums in O(blocks)
+void weight_index_build(CapacityIndex *index)
+{
+    int leaves = index->leaves;
+    int position = 0;
+
+    index->weight_sum[0] = 0;
+    index->moment = 0;
+    index->heap_count = 0;
+    for (int i = 1; i <= leaves; i++)
+    {
+        WagonBlock *block = i <= index->block_count ? index->blocks[i - 1] : NULL;
+        index->weight_sum[i] = block ? block->weight_sum : 0;
+        if (!block)
+            continue;
+
+        index->moment += position * block->weight_sum + block->moment_sum;
+        position += block->count;
+        block->top_slot = -1;
+        if (block->count > 0)
+            block_place(index, index->heap_count++, block);
+    }
+    for (int i = 1; i <= leaves; i++)
+    {
+        int parent = i + (i & (-i));
+        if (parent <= leaves)
+            index->weight_sum[parent] += index->weight_sum[i];
+    }
+    for (int top_slot = index->heap_count / 2 - 1; top_slot >= 0; top_slot--)
+        block_sift_down(index, top_slot);
+    index->window = 0;
+}
+
+// Add delta to the windows starting in [first, last]. A node holds the max of its
+// children plus everything added to the whole node
+static void window_add(CapacityIndex *index, int node, int low, int high, int first, int last, double delta)
+{
+    if (last < low || high < first)
+        return;
+    if (first <= low && high <= last)
+    {
+        index->window_max[node] += delta;
+        index->window_add[node] += delta;
+        return;
+    }
+
+    int middle = (low + high) / 2;
+    window_add(index, 2 * node, low, middle, first, last, delta);
+    window_add(index, 2 * node + 1, middle + 1, high, first, last, delta);
+    double left = index->window_max[2 * node], right = index->window_max[2 * node + 1];
+    index->window_max[node] = (left > right ? left : right) + index->window_add[node];
+}
+
+// The load of the wagon in the slot changed
+void weight_index_set(CapacityIndex *index, WagonBlock *block, int slot, double weight)
+{
+    double delta = weight - block->weight[slot];
+    if (delta == 0)
+        return;
+
+    int position = block_first_position(index, block) + slot;
+    block->weight[slot] = weight;
+    block->weight_sum += delta;
+    block->moment_sum += (slot + 1) * delta;
+    fenwick_add(index->weight_sum, index->leaves, block->number, delta);
+    index->moment += (position + 1) * delta;
+
+    if (index->window > 0)
+    {
+        int first = position - index->window + 1;
+        int last = position < index->count - index->window ? position : index->count - index->window;
+        if (first < 0)
+            first = 0;
+        if (first <= last)
+            window_add(index, 1, 0, index->window_leaves - 1, first, last, delta);
+    }
+
+    if (delta < 0)
+        slot_sift_up(block, block->heap_slot[slot]);
+    else
+        slot_sift_down(block, block->heap_slot[slot]);
+    block_resift(index, block);
+}
+
+// A wagon was put into the slot, which holds its weight, the wagons behind moved back one
+void weight_index_inserted(CapacityIndex *index, WagonBlock *block, int slot)
+{
+    double weight = block->weight[slot];
+    double total = fenwick_prefix(index->weight_sum, index->leaves);
+    double before = weight_before(index, block, slot);
+    int position = block_first_position(index, block) + slot;
+
+    index->moment += (position + 1) * weight + (total - before);
+    weight_block_build(block);
+    fenwick_add(index->weight_sum, index->leaves, block->number, weight);
+    if (block->wagons[slot]->max_weight > index->weight_limit)
+        index->weight_limit = block->wagons[slot]->max_weight;
+    block_resift(index, block);
+    index->window = 0; // the windows moved: rebuilt at the next query
+}
+
+// A wagon of the given weight left the slot, the wagons behind moved up one
+void weight_index_removed(CapacityIndex *index, WagonBlock *block, int slot, double weight)
+{
+    double total = fenwick_prefix(index->weight_sum, index->leaves);
+    double before = weight_before(index, block, slot);
+    int position = block_first_position(index, block) + slot;
+
+    index->moment -= (position + 1) * weight + (total - before - weight);
+    weight_block_build(block);
+    fenwick_add(index->weight_sum, index->leaves, block->number, -weight);
+    block_resift(index, block);
+    index->window = 0;
+}
+
+static void build_windows(CapacityIndex *index, int window)
+{
+    int leaves = 1;
+    while (leaves < index->count)
+        leaves *= 2;
+    if (leaves != index->window_leaves)
+    {
+        tracked_free(MEM_CAPACITY_INDEX, index->window_max, sizeof(double) * 2 * index->window_leaves);
+        tracked_free(MEM_CAPACITY_INDEX, index->window_add, sizeof(double) * 2 * index->window_leaves);
+        index->window_max = (double *)tracked_malloc(MEM_CAPACITY_INDEX, sizeof(double) * 2 * leaves);
+        index->window_add = (double *)tracked_malloc(MEM_CAPACITY_INDEX, sizeof(double) * 2 * leaves);
+        index->window_leaves = leaves;
+    }
+
+    // Slide the window over the blocks: the load at each wagon, then the one k wagons back
+    double *leaf = index->window_max + leaves;
+    int position = 0;
+    for (int b = 0; b < index->block_count; b++)
+    {
+        const WagonBlock *block = index->blocks[b];
+        for (int slot = 0; slot < block->count; slot++)
+            leaf[position++] = block->weight[slot];
+    }
+    double load = 0;
+    for (int i = 0; i < window; i++)
+        load += leaf[i];
+    for (int i = 0; i < leaves; i++)
+    {
+        double next = i + window < index->count ? leaf[i + window] : 0;
+        double first = i < index->count ? leaf[i] : 0;
+        leaf[i] = i + window <= index->count ? load : -HUGE_VAL;
+        load += next - first;
+        index->window_add[leaves + i] = 0;
+    }
+    for (int node = leaves - 1; node > 0; node--)
+    {
+        double left = index->window_max[2 * node], right = index->window_max[2 * node + 1];
+        index->window_max[node] = left > right ? left : right;
+        index->window_add[node] = 0;
+    }
+    index->window = window;
+}
+
+// Load of wagons first_wagon_id..last_wagon_id, both included
+double range_weight(Train *train, int first_wagon_id, int last_wagon_id)
+{
+    CapacityIndex *index = get_capacity_index(train);
+
+    if (first_wagon_id < 1)
+        first_wagon_id = 1;
+    if (last_wagon_id > index->count)
+        last_wagon_id = index->count;
+    if (first_wagon_id > last_wagon_id)
+        return 0;
+    return prefix_weight(index, last_wagon_id) - prefix_weight(index, first_wagon_id - 1);
+}
+
+// Load-weighted mean wagon position (1 = head). Returns 0 if the train carries nothing
+int centre_of_mass(Train *train, double *position)
+{
+    CapacityIndex *index = get_capacity_index(train);
+    double total = fenwick_prefix(index->weight_sum, index->leaves);
+
+    if (total <= 0)
+        return 0;
+    *position = index->moment / total;
+    return 1;
+}
+
+// Heaviest run of window consecutive wagons, the first one from the head on ties.
+// Returns 0 if the train has fewer wagons than that
+int heaviest_window(Train *train, int window, int *first_wagon_id, double *weight)
+{
+    CapacityIndex *index = get_capacity_index(train);
+
+    if (window < 1 || window > index->count)
+        return 0;
+    if (index->window != window)
+        build_windows(index, window);
+
+    // Walk down towards the larger child, the left one on ties
+    int leaves = index->window_leaves;
+    int node = 1;
+    while (node < leaves)
+        node = index->window_max[2 * node] >= index->window_max[2 * node + 1] ? 2 * node : 2 * node + 1;
+
+    *first_wagon_id = node - leaves + 1;
+    *weight = range_weight(train, *first_wagon_id, *first_wagon_id + window - 1);
+    return 1;
+}
+
+// Walk over both heaps
+
+static double entry_weight(LightestEntry entry)
+{
+    return entry.block->weight[entry.block->lightest[entry.heap_slot]];
+}
+
+static int entry_lighter(LightestEntry entry, LightestEntry other)
+{
+    double weight = entry_weight(entry), other_weight = entry_weight(other);
+    if (weight != other_weight)
+        return weight < other_weight;
+    if (entry.block != other.block)
+        return entry.block->number < other.block->number;
+    return entry.block->lightest[entry.heap_slot] < other.block->lightest[other.heap_slot];
+}
+
+static void frontier_push(LightestWagons *walk, WagonBlock *block, int heap_slot)
+{
+    if (walk->count == walk->capacity)
+    {
+        int capacity = walk->capacity ? walk->capacity * 2 : 64;
+        walk->frontier = (LightestEntry *)tracked_realloc(MEM_CAPACITY_INDEX, walk->frontier,
+                                                          sizeof(LightestEntry) * walk->capacity,
+                                                          sizeof(LightestEntry) * capacity);
+        walk->capacity = capacity;
+    }
+
+    LightestEntry entry = {block, heap_slot};
+    int child = walk->count++;
+    while (child > 0 && entry_lighter(entry, walk->frontier[(child - 1) / 2]))
+    {
+        walk->frontier[child] = walk->frontier[(child - 1) / 2];
+        child = (child - 1) / 2;
+    }
+    walk->frontier[child] = entry;
+}
+
+static LightestEntry frontier_pop(LightestWagons *walk)
+{
+    LightestEntry top = walk->frontier[0];
+    LightestEntry last = walk->frontier[--walk->count];
+    int slot = 0;
+    for (;;)
+    {
+        int child = 2 * slot + 1;
+        if (child >= walk->count)
+            break;
+        if (child + 1 < walk->count && entry_lighter(walk->frontier[child + 1], walk->frontier[child]))
+            child++;
+        if (!entry_lighter(walk->frontier[child], last))
+            break;
+        walk->frontier[slot] = walk->frontier[child];
+        slot = child;
+    }
+    if (walk->count > 0)
+        walk->frontier[slot] = last;
+    return top;
+}
+
+void start_lightest_wagons(LightestWagons *walk, Train *train)
+{
+    walk->index = get_capacity_index(train);
+    walk->frontier = NULL;
+    walk->count = walk->capacity = 0;
+    if (walk->index->heap_count > 0)
+        frontier_push(walk, walk->index->lightest[0], 0);
+}
+
+// Next lightest wagon of wagon_class (any class if NULL) with room for the demand, NULL when there is none
+Wagon *next_lightest_wagon(LightestWagons *walk, const WagonClass *wagon_class, const float demand[DIMENSION_COUNT])
+{
+    const CapacityIndex *index = walk->index;
+
+    while (walk->count > 0)
+    {
+        LightestEntry entry = frontier_pop(walk);
+        WagonBlock *block = entry.block;
+        for (int child = 2 * entry.heap_slot + 1; child <= 2 * entry.heap_slot + 2 && child < block->count; child++)
+            frontier_push(walk, block, child);
+        if (entry.heap_slot == 0)
+        {
+            // The block's lightest wagon: the blocks below it in the heap of blocks come next
+            for (int child = 2 * block->top_slot + 1; child <= 2 * block->top_slot + 2 && child < index->heap_count;
+                 child++)
+                frontier_push(walk, index->lightest[child], 0);
+        }
+
+        int slot = block->lightest[entry.heap_slot];
+        Wagon *wagon = block->wagons[slot];
+        if (index->weight_limit - wagon->current_weight < demand[DIM_WEIGHT])
+        {
+            walk->count = 0;
+            return NULL;
+        }
+        int fits = !wagon_class || wagon->wagon_class == wagon_class;
+        for (int d = 0; d < DIMENSION_COUNT; d++)
+            fits &= block->free[d][slot] >= demand[d];
+        if (fits)
+            return wagon;
+    }
+    return NULL;
+}
+
+void end_lightest_wagons(LightestWagons *walk)
+{
+    tracked_free(MEM_CAPACITY_INDEX, walk->frontier, sizeof(LightestEntry) * walk->capacity);
+    walk->frontier = NULL;
+    walk->count = walk->capacity = 0;
+}
+
+void display_weight_distribution(Train *train, int first_wagon_id, int last_wagon_id, int window)
+{
+    if (!train || !train->first_wagon)
+    {
+        printf("\n==========\nNo wagons in the train.\n==========\n\n");
+        return;
+    }
+
+    METRIC_START(timer);
+    double position, weight;
+    int first;
+
+    printf("\n==========\nWeight Distribution\n==========\n");
+    printf("Total Load: %.2f kg in %d wagons\n", range_weight(train, 1, train->wagon_count), train->wagon_count);
+    printf("Wagons %d-%d: %.2f kg\n", first_wagon_id, last_wagon_id, range_weight(train, first_wagon_id, last_wagon_id));
+    if (centre_of_mass(train, &position))
+        printf("Centre of Mass: wagon %.2f\n", position);
+    else
+        printf("Centre of Mass: the train carries no load\n");
+    if (heaviest_window(train, window, &first, &weight))
+        printf("Heaviest %d wagons: %d-%d, %.2f kg\n", window, first, first + window - 1, weight);
+    else
+        printf("Heaviest %d wagons: the train has fewer wagons\n", window);
+    printf("\n");
+    METRIC_STOP(METRIC_WEIGHT_DISTRIBUTION, timer);
+}
+
+void display_weight_distribution_main(Train *train)
+{
+    char input[50];
+    int first_wagon_id, last_wagon_id, window;
+
+    printf("Enter the first and last wagon ID of the range: ");
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d %d", &first_wagon_id, &last_wagon_id) != 2 || first_wagon_id > last_wagon_id)
+    {
+        printf("\n==========\nInvalid range. \n==========\n\n");
+        return;
+    }
+
+    printf("Enter the number of consecutive wagons to check: ");
+    fgets(input, sizeof(input), stdin);
+    if (sscanf(input, "%d", &window) != 1 || window < 1)
+    {
+        printf("\n==========\nInvalid number of wagons. \n==========\n\n");
+        return;
+    }
+
+    display_weight_distribution(train, first_wagon_id, last_wagon_id, window);
+}
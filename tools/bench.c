@@ -0,0 +1,342 @@
+// bench.c - benchmark suite for the core train operations
+//
+// usage: train_bench [--sizes 1000,10000,...] [--seed N] [--budget seconds]
+//        train_bench --generate <wagons> <file> [--seed N]
+//
+// For every size a synthetic train manifest with mixed materials is
+// generated, then each operation is timed on random orders. Results are
+// written to stdout as JSON Lines, one line per (operation, size):
+//
+//   {"version":1,"op":"head_load","wagons":1000,"iterations":1000,"seconds":0.0123,
+//    "ops_per_sec":81234.5,"p50_us":11.2,"p99_us":30.1,"peak_rss_kb":5120}
+//
+// Keys and their order are stable so runs can be compared line by line.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "../include/wagon.h"
+#include "../include/train.h"
+#include "../include/material.h"
+#include "../include/catalog.h"
+#include "../include/file_ops.h"
+#include "../include/history.h"
+#include "../include/utils.h"
+#include "../include/estimate.h"
+#include "../include/export.h"
+#include "../include/coupling.h"
+
+#define BENCH_MAX_ITERATIONS 1000
+#define BENCH_MIN_ITERATIONS 3
+#define BENCH_MAX_ORDER 20
+
+// Same catalog as the program, with unlimited stock so orders never run out
+#define BENCH_STOCK (1 << 30)
+static MaterialType materials[] = {
+    {.name = "Large Box", .weight = 200.0, .quantity = BENCH_STOCK},
+    {.name = "Medium Box", .weight = 150.0, .quantity = BENCH_STOCK},
+    {.name = "Small Box", .weight = 100.0, .quantity = BENCH_STOCK}};
+static const int material_count = sizeof(materials) / sizeof(MaterialType);
+static MaterialCatalog *catalog; // the same materials, as the program looks them up
+
+static unsigned long long rng_state = 88172645463325252ULL;
+static double time_budget = 1.0; // seconds per operation and size
+static FILE *results;            // the real stdout, stdout itself goes to /dev/null
+
+static unsigned long long next_random(void)
+{
+    // xorshift64
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int random_between(int low, int high)
+{
+    return low + (int)(next_random() % (unsigned long long)(high - low + 1));
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Write a manifest in the save_train_status_to_file format: wagons with a random
+// fill of mixed materials, stacked light to heavy like insert_material_into_wagon
+static int generate_train_file(const char *filename, int wagon_count)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return 0;
+
+    fprintf(file, "Train ID: Synthetic\n");
+    fprintf(file, "Total Wagons: %d\n", wagon_count);
+
+    for (int wagon_id = 1; wagon_id <= wagon_count; wagon_id++)
+    {
+        int units[3] = {0, 0, 0}; // Large, Medium, Small
+        float weight = 0;
+        float target = (float)random_between(100, 1000);
+
+        while (weight < target)
+        {
+            int m = random_between(0, material_count - 1);
+            if (weight + materials[m].weight > 1000.0f)
+                break;
+            units[m]++;
+            weight += materials[m].weight;
+        }
+        if (weight == 0)
+        {
+            units[2] = 1;
+            weight = materials[2].weight;
+        }
+
+        fprintf(file, "\nWagon ID: %d\n", wagon_id);
+        fprintf(file, "  Max Weight: %.2f kg\n", 1000.0);
+        fprintf(file, "  Class: Standard\n");
+        fprintf(file, "  Current Weight: %.2f kg\n", weight);
+        fprintf(file, "  Loaded Materials:\n");
+        for (int m = material_count - 1; m >= 0; m--)
+        {
+            for (int i = 0; i < units[m]; i++)
+                fprintf(file, "    - %s: %.2f kg\n", materials[m].name, materials[m].weight);
+        }
+    }
+
+    fclose(file);
+    return 1;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p)
+{
+    return sorted[(int)(p * (count - 1) + 0.5)];
+}
+
+static void report(const char *op, int wagon_count, double *samples, int count, double seconds)
+{
+    qsort(samples, count, sizeof(double), compare_doubles);
+    fprintf(results,
+            "{\"version\":1,\"op\":\"%s\",\"wagons\":%d,\"iterations\":%d,\"seconds\":%.6f,"
+            "\"ops_per_sec\":%.1f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"peak_rss_kb\":%ld}\n",
+            op, wagon_count, count, seconds, count / seconds, percentile(samples, count, 0.50) * 1e6,
+            percentile(samples, count, 0.99) * 1e6, peak_rss_kb());
+    fflush(results);
+}
+
+typedef enum BenchOp {
+    BENCH_LOAD_FILE,
+    BENCH_SAVE_FILE,
+    BENCH_HEAD_LOAD,
+    BENCH_BALANCED_LOAD,
+    BENCH_WAGON_LOAD,
+    BENCH_TAIL_UNLOAD,
+    BENCH_DELETE_EMPTY_WAGONS,
+    BENCH_MATERIAL_STATUS,
+    BENCH_ESTIMATE,
+    BENCH_EXPORT,
+    BENCH_SPLIT_COUPLE,
+    BENCH_OP_COUNT
+} BenchOp;
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {
+    "load_file", "save_file", "head_load", "balanced_load", "wagon_load", "tail_unload", "delete_empty_wagons", "material_status",
+    "estimate", "export", "split_couple"};
+
+// Order of the current iteration, drawn before the timer starts
+static MaterialType *order_material;
+static int order_quantity, order_wagon;
+static LoadEstimate estimate; // reused by every estimate, as the server does
+static Train *siding;         // split_couple uncouples the tail to here and couples it back
+
+// Untimed preparation for one iteration
+static void prepare(BenchOp op, Train *train)
+{
+    order_material = get_material(catalog, random_between(1, material_count));
+    order_quantity = random_between(1, BENCH_MAX_ORDER);
+    order_wagon = train->wagon_count > 0 ? random_between(1, train->wagon_count) : 0;
+
+    switch (op)
+    {
+    case BENCH_WAGON_LOAD:
+        order_quantity = random_between(1, 5);
+        break;
+    case BENCH_TAIL_UNLOAD:
+        // Put the order on first so the train does not run empty
+        load_specified_material_to_train(train, order_material, order_quantity);
+        break;
+    case BENCH_DELETE_EMPTY_WAGONS:
+        if (order_wagon > 0)
+            remove_all_materials_from_wagon(find_wagon_by_id(train, order_wagon));
+        break;
+    default:
+        break;
+    }
+}
+
+static void run_once(BenchOp op, Train *train, const char *manifest, const char *scratch)
+{
+    switch (op)
+    {
+    case BENCH_LOAD_FILE:
+        load_train_status_from_file(train, manifest, catalog);
+        break;
+    case BENCH_SAVE_FILE:
+        save_train_status_to_file(train, scratch);
+        break;
+    case BENCH_HEAD_LOAD:
+    case BENCH_BALANCED_LOAD:
+        load_specified_material_to_train(train, order_material, order_quantity);
+        break;
+    case BENCH_WAGON_LOAD:
+        if (order_wagon > 0)
+            load_material_to_wagon(train, order_material, order_wagon, order_quantity);
+        break;
+    case BENCH_TAIL_UNLOAD:
+        unload_material_quantity_from_tail(train, order_material, order_quantity);
+        break;
+    case BENCH_DELETE_EMPTY_WAGONS:
+        delete_empty_wagons(train);
+        break;
+    case BENCH_MATERIAL_STATUS:
+        display_material_status(catalog, 0);
+        break;
+    case BENCH_ESTIMATE:
+        reset_load_estimate(&estimate);
+        estimate_load(train, &estimate, order_material, order_quantity, NULL);
+        break;
+    case BENCH_EXPORT:
+        export_train_to_file(train, catalog, EXPORT_WAGON_MATERIALS, EXPORT_CSV, scratch);
+        break;
+    case BENCH_SPLIT_COUPLE:
+        if (order_wagon > 0 && split_train(train, order_wagon, siding) >= 0)
+            couple_trains(train, siding);
+        break;
+    default:
+        break;
+    }
+}
+
+static void bench_size(int wagon_count)
+{
+    char manifest[64], scratch[64];
+    snprintf(manifest, sizeof(manifest), "/tmp/train_bench_%d_manifest.txt", (int)getpid());
+    snprintf(scratch, sizeof(scratch), "/tmp/train_bench_%d_scratch.txt", (int)getpid());
+
+    if (!generate_train_file(manifest, wagon_count))
+    {
+        fprintf(stderr, "cannot write %s\n", manifest);
+        exit(1);
+    }
+
+    WagonClassTable *wagon_classes = create_default_wagon_classes();
+    Train *train = create_train(wagon_classes);
+    enable_history(train); // as in the program
+    siding = create_train(wagon_classes);
+    double *samples = (double *)malloc(sizeof(double) * BENCH_MAX_ITERATIONS);
+
+    for (int op = 0; op < BENCH_OP_COUNT; op++)
+    {
+        // Every operation starts from the same generated train
+        load_train_status_from_file(train, manifest, catalog);
+        train->load_strategy = op == BENCH_BALANCED_LOAD ? LOAD_BALANCED : LOAD_HEAD_FIRST;
+
+        int count = 0;
+        double total = 0;
+        while (count < BENCH_MAX_ITERATIONS && (count < BENCH_MIN_ITERATIONS || total < time_budget))
+        {
+            prepare((BenchOp)op, train);
+            double start = now_seconds();
+            run_once((BenchOp)op, train, manifest, scratch);
+            samples[count] = now_seconds() - start;
+            total += samples[count];
+            count++;
+        }
+        report(bench_op_names[op], wagon_count, samples, count, total);
+    }
+
+    destroy_train(siding);
+    destroy_train(train);
+    destroy_wagon_class_table(wagon_classes);
+    free_load_estimate(&estimate);
+    free(samples);
+    unlink(manifest);
+    unlink(scratch);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *sizes = "1000,10000,100000";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc)
+            sizes = argv[++i];
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            rng_state = strtoull(argv[++i], NULL, 10) * 2 + 1;
+        else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+            time_budget = atof(argv[++i]);
+        else if (strcmp(argv[i], "--generate") == 0 && i + 2 < argc)
+        {
+            int wagon_count = atoi(argv[i + 1]);
+            const char *filename = argv[i + 2];
+            for (int j = i + 3; j + 1 < argc; j++)
+                if (strcmp(argv[j], "--seed") == 0)
+                    rng_state = strtoull(argv[j + 1], NULL, 10) * 2 + 1;
+            return generate_train_file(filename, wagon_count) ? 0 : 1;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--sizes N,N,...] [--seed N] [--budget seconds]\n"
+                            "       %s --generate <wagons> <file> [--seed N]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    // Keep the results on stdout and send everything the operations print to /dev/null
+    results = fdopen(dup(fileno(stdout)), "w");
+    if (!results || !freopen("/dev/null", "w", stdout))
+    {
+        fprintf(stderr, "cannot redirect stdout\n");
+        return 1;
+    }
+    quiet_output = 1;
+
+    catalog = create_catalog();
+    for (int m = 0; m < material_count; m++)
+        add_material(catalog, materials[m].name, materials[m].weight, materials[m].quantity);
+
+    const char *cursor = sizes;
+    while (*cursor)
+    {
+        int wagon_count = (int)strtol(cursor, (char **)&cursor, 10);
+        if (wagon_count > 0)
+            bench_size(wagon_count);
+        while (*cursor == ',' || *cursor == ' ')
+            cursor++;
+        if (*cursor && (*cursor < '0' || *cursor > '9'))
+            break;
+    }
+
+    destroy_catalog(catalog);
+    fclose(results);
+    return 0;
+}
@@ -0,0 +1,1162 @@
+// difftest.c - randomized differential driver: reference engine vs. the real engine
+//
+// usage: train_difftest [--steps N] [--seed N] [--save-every N] [--verbose]
+//
+// Generates a long random sequence of operations, applies each one to the
+// reference engine (tools/reference_engine.c) and to the real engine
+// (src/train.c, src/wagon.c, ...), and after every step compares the train
+// state: wagon IDs, weights, the exact stacking order of the units and the
+// material counts. Every --save-every steps the bytes written by
+// save_train_status_to_file are compared as well, and must come out the same
+// when the file is loaded in ranges on several threads and saved again, without the peak memory
+// counts growing when it is loaded again, and so are the weight
+// distribution queries against sums over the reference train, the unit
+// counts rebuilt from the change-event feed alone and the lightest-wagon heap. Loads from the head
+// and balanced loads must place the units a load estimate made just before them places, and so must
+// loads in wagons with volume and slot limits in a final round. Loads for stations are
+// checked against the station index and unloaded again. Another round undoes and redoes each
+// operation and compares the files saved around it. Stops at the first
+// difference. Reports the time spent in each engine and the relative throughput.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include "reference_engine.h"
+#include "../include/wagon.h"
+#include "../include/train.h"
+#include "../include/material.h"
+#include "../include/file_ops.h"
+#include "../include/history.h"
+#include "../include/utils.h"
+#include "../include/weight_distribution.h"
+#include "../include/events.h"
+#include "../include/coupling.h"
+#include "../include/capacity_index.h"
+#include "../include/station.h"
+#include "../include/estimate.h"
+#include "../include/memtrack.h"
+
+// Equal weights and non-round weights exercise the stacking order
+static MaterialType materials[] = {
+    {.name = "Large Box", .weight = 200.0, .quantity = 400},
+    {.name = "Medium Box", .weight = 150.0, .quantity = 400},
+    {.name = "Small Box", .weight = 100.0, .quantity = 400},
+    {.name = "Sack", .weight = 100.0, .quantity = 400},
+    {.name = "Drum", .weight = 275.5, .quantity = 400},
+    {.name = "Crate", .weight = 120.25, .quantity = 400}};
+#define MATERIAL_COUNT ((int)(sizeof(materials) / sizeof(MaterialType)))
+
+static RefMaterial ref_materials[MATERIAL_COUNT];
+
+typedef enum DiffOp {
+    OP_LOAD_HEAD,
+    OP_LOAD_BALANCED,
+    OP_LOAD_WAGON,
+    OP_UNLOAD_TAIL,
+    OP_UNLOAD_WAGON,
+    OP_EMPTY_WAGON,
+    OP_EMPTY_TRAIN,
+    OP_SPLIT_COUPLE, // split at a wagon and couple back, the train must come out unchanged
+    OP_STATIONS,     // load for two stations and stop at both, the train must come out unchanged
+    OP_COUNT
+} DiffOp;
+
+static const char *op_names[OP_COUNT] = {"load_head", "load_balanced", "load_wagon", "unload_tail", "unload_wagon", "empty_wagon",
+                                         "empty_train", "split_couple", "stations"};
+
+// Relative frequencies of the operations
+static const int op_weights[OP_COUNT] = {30, 10, 20, 20, 20, 9, 1, 2, 2};
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned long long next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int random_between(int low, int high)
+{
+    return low + (int)(next_random() % (unsigned long long)(high - low + 1));
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct Step {
+    DiffOp op;
+    int material, wagon_id, quantity;
+} Step;
+
+static Step random_step(int wagon_count)
+{
+    Step step;
+    int total = 0, pick;
+
+    for (int i = 0; i < OP_COUNT; i++)
+        total += op_weights[i];
+    pick = random_between(0, total - 1);
+    for (step.op = 0; pick >= op_weights[step.op]; step.op++)
+        pick -= op_weights[step.op];
+
+    step.material = random_between(0, MATERIAL_COUNT - 1);
+    step.quantity = random_between(1, 25);
+    if (step.op == OP_LOAD_BALANCED)
+        step.quantity *= 4; // enough to level several wagons in bulk
+    // Sometimes one past the tail, to exercise the missing-wagon paths
+    step.wagon_id = random_between(1, wagon_count + 1);
+    return step;
+}
+
+static Train *siding; // where split_couple puts the wagons in between
+
+// Every wagon's stops must match its units, and every station's totals its stops
+static int check_station_index(Train *train, int station)
+{
+    long units_for_station = 0;
+    int wagons_for_station = 0;
+
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next)
+    {
+        int indexed = 0, marked = 0;
+        for (WagonStop *stop = wagon->stops; stop; stop = stop->next_in_wagon)
+        {
+            int units = 0;
+            for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+                units += unit->destination == stop->station;
+            if (stop->wagon != wagon || stop->units != units || units == 0)
+            {
+                fprintf(stderr, "station index: wagon %d has %d units for station %d, %d indexed\n",
+                        get_wagon_id(wagon), units, stop->station, stop->units);
+                return 0;
+            }
+            indexed += units;
+            if (stop->station == station)
+            {
+                units_for_station += units;
+                wagons_for_station++;
+            }
+        }
+        for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+            marked += unit->destination != 0;
+        if (indexed != marked)
+        {
+            fprintf(stderr, "station index: wagon %d has %d units for stations, %d indexed\n", get_wagon_id(wagon),
+                    marked, indexed);
+            return 0;
+        }
+    }
+
+    Station *entry = &train->stations->stations[station];
+    if (entry->units != units_for_station || entry->wagon_count != wagons_for_station)
+    {
+        fprintf(stderr, "station index: station %d has %ld units in %d wagons, %ld in %d indexed\n", station,
+                units_for_station, wagons_for_station, entry->units, entry->wagon_count);
+        return 0;
+    }
+    return 1;
+}
+
+// Returns 0 like the reference when the train comes out unchanged and the index was right throughout
+static int stations_round_trip(Train *train, const Step *step)
+{
+    int first = step->quantity % 3 + 1, second = first + 3, wagons_touched;
+    int loaded = load_material_for_station(train, &materials[step->material], step->quantity, first);
+    loaded += load_material_for_station(train, &materials[(step->material + 1) % MATERIAL_COUNT], step->quantity,
+                                        second);
+    if (loaded == 0)
+        return 0;
+    if (!check_station_index(train, first) || !check_station_index(train, second))
+        return -1;
+
+    int unloaded = station_stop(train, first, &wagons_touched);
+    if (!check_station_index(train, first) || !check_station_index(train, second))
+        return -1;
+    unloaded += station_stop(train, second, &wagons_touched);
+    if (unloaded != loaded || station_units(train, first) != 0 || station_units(train, second) != 0)
+    {
+        fprintf(stderr, "station stops: %d units loaded, %d unloaded\n", loaded, unloaded);
+        return -1;
+    }
+
+    // Wagons emptied at a stop stay until deleted
+    begin_operation(train, "Delete empty wagons");
+    delete_empty_wagons(train);
+    end_operation(train);
+    return 0;
+}
+
+static int apply_real(Train *train, const Step *step)
+{
+    MaterialType *material = &materials[step->material];
+    Wagon *wagon;
+    int count = 0;
+
+    switch (step->op)
+    {
+    case OP_LOAD_HEAD:
+        count = load_specified_material_to_train(train, material, step->quantity);
+        break;
+    case OP_LOAD_BALANCED:
+        train->load_strategy = LOAD_BALANCED;
+        count = load_specified_material_to_train(train, material, step->quantity);
+        train->load_strategy = LOAD_HEAD_FIRST;
+        break;
+    case OP_LOAD_WAGON:
+        count = load_material_to_wagon(train, material, step->wagon_id, step->quantity);
+        break;
+    case OP_UNLOAD_TAIL:
+        if (train->first_wagon)
+            count = unload_material_quantity_from_tail(train, material, step->quantity);
+        break;
+    case OP_UNLOAD_WAGON:
+        wagon = find_wagon_by_id(train, step->wagon_id);
+        if (wagon)
+        {
+            begin_operation(train, "Unload material from wagon");
+            count = unload_material_from_wagon(wagon, material, step->quantity);
+            delete_empty_wagons(train);
+            end_operation(train);
+        }
+        break;
+    case OP_EMPTY_WAGON:
+        count = empty_wagon_by_id(train, step->wagon_id);
+        break;
+    case OP_EMPTY_TRAIN:
+        empty_entire_train(train);
+        break;
+    case OP_SPLIT_COUPLE:
+        if (split_train(train, step->wagon_id, siding) >= 0)
+            couple_trains(train, siding);
+        break;
+    case OP_STATIONS:
+        count = stations_round_trip(train, step);
+        break;
+    default:
+        break;
+    }
+    return count;
+}
+
+static int apply_reference(RefTrain *train, const Step *step)
+{
+    RefMaterial *material = &ref_materials[step->material];
+
+    switch (step->op)
+    {
+    case OP_LOAD_HEAD:
+        return ref_load_from_head(train, material, step->quantity);
+    case OP_LOAD_BALANCED:
+        return ref_load_balanced(train, material, step->quantity);
+    case OP_LOAD_WAGON:
+        return ref_load_to_wagon(train, material, step->wagon_id, step->quantity);
+    case OP_UNLOAD_TAIL:
+        return ref_unload_from_tail(train, material, step->quantity);
+    case OP_UNLOAD_WAGON:
+        return ref_unload_from_wagon(train, material, step->wagon_id, step->quantity);
+    case OP_EMPTY_WAGON:
+        return ref_empty_wagon(train, step->wagon_id);
+    case OP_EMPTY_TRAIN:
+        ref_empty_train(train);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static int block_heap_ordered(const WagonBlock *block, int heap_slot)
+{
+    int slot = block->lightest[heap_slot], parent = block->lightest[(heap_slot - 1) / 2];
+    return heap_slot == 0 || block->weight[parent] < block->weight[slot] ||
+           (block->weight[parent] == block->weight[slot] && parent < slot);
+}
+
+static double block_lightest(const WagonBlock *block)
+{
+    return block->weight[block->lightest[0]];
+}
+
+// The capacity index must hold every wagon of the list once, in order, with its current load,
+// and both levels of the lightest-wagon heap must be in heap order
+static int check_lightest_heap(Train *train)
+{
+    CapacityIndex *index = train->capacity_index;
+    if (!index)
+        return 1;
+
+    int position = 0;
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next, position++)
+    {
+        const WagonBlock *block = wagon->block;
+        if (!block || block->train != train || block->wagons[wagon->slot] != wagon ||
+            get_wagon_id(wagon) != position + 1 || block->weight[wagon->slot] != wagon->current_weight)
+        {
+            fprintf(stderr, "capacity index: wagon %d out of place\n", position + 1);
+            return 0;
+        }
+    }
+    if (position != index->count)
+    {
+        fprintf(stderr, "capacity index: %d wagons for %d in the train\n", index->count, position);
+        return 0;
+    }
+
+    int filled = 0;
+    for (int b = 0; b < index->block_count; b++)
+    {
+        const WagonBlock *block = index->blocks[b];
+        if (block->number != b || (block->count > 0) != (block->top_slot >= 0))
+        {
+            fprintf(stderr, "capacity index: block %d out of place\n", b);
+            return 0;
+        }
+        filled += block->count > 0;
+        for (int heap_slot = 0; heap_slot < block->count; heap_slot++)
+        {
+            if (block->heap_slot[block->lightest[heap_slot]] != heap_slot || !block_heap_ordered(block, heap_slot))
+            {
+                fprintf(stderr, "lightest heap: block %d out of order at slot %d\n", b, heap_slot);
+                return 0;
+            }
+        }
+    }
+    if (index->heap_count != filled)
+    {
+        fprintf(stderr, "lightest heap: %d blocks for %d with wagons\n", index->heap_count, filled);
+        return 0;
+    }
+    for (int top_slot = 0; top_slot < index->heap_count; top_slot++)
+    {
+        const WagonBlock *block = index->lightest[top_slot], *parent = index->lightest[(top_slot - 1) / 2];
+        if (block->top_slot != top_slot ||
+            (top_slot > 0 && (block_lightest(parent) > block_lightest(block) ||
+                              (block_lightest(parent) == block_lightest(block) && parent->number > block->number))))
+        {
+            fprintf(stderr, "lightest heap: block %d out of place at slot %d\n", block->number, top_slot);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Units of the material in every wagon, by position. Returns the number of wagons
+static int units_per_wagon(Train *train, const MaterialType *material, int **units, int *capacity)
+{
+    int count = 0;
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next, count++)
+    {
+        if (count == *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            *units = (int *)realloc(*units, sizeof(int) * *capacity);
+        }
+        (*units)[count] = 0;
+        for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+            (*units)[count] += unit->type == material;
+    }
+    return count;
+}
+
+// A load must place the units the estimate made before it said and add as many wagons. From the
+// head, every wagon must also get the units the estimate put into it
+static int compare_estimate(Train *train, const LoadEstimate *estimate, const MaterialType *material, int loaded,
+                            const int *before, int wagons_before, int head_first)
+{
+    if (estimate->units_placed != loaded || train->wagon_count - wagons_before != estimate->new_wagons)
+    {
+        fprintf(stderr, "estimate: %d units, %d new wagons; load: %d units, %d new wagons\n", estimate->units_placed,
+                estimate->new_wagons, loaded, train->wagon_count - wagons_before);
+        return 0;
+    }
+    if (!head_first)
+        return 1;
+
+    static int *after = NULL, capacity = 0;
+    int wagons = units_per_wagon(train, material, &after, &capacity);
+    for (int i = 0; i < wagons_before; i++)
+        after[i] -= before[i];
+    for (int p = 0; p < estimate->placement_count; p++)
+    {
+        const Placement *placement = &estimate->placements[p];
+        int units = 0;
+        for (int i = placement->first_wagon_id - 1; i < placement->first_wagon_id - 1 + placement->wagon_count && i < wagons; i++)
+        {
+            units += after[i];
+            after[i] = 0;
+        }
+        if (units != placement->units)
+        {
+            fprintf(stderr, "estimate: %d units into wagon %d (%d wagons), load: %d\n", placement->units,
+                    placement->first_wagon_id, placement->wagon_count, units);
+            return 0;
+        }
+    }
+    for (int i = 0; i < wagons; i++)
+    {
+        if (after[i] != 0)
+        {
+            fprintf(stderr, "estimate: no units into wagon %d, load: %d\n", i + 1, after[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Materials and wagon classes of the program's files, with volume and pallet slots, and a weight
+// that is not a binary fraction: the batch sums round, so units may fill a wagon up to
+// FIT_EPSILON past its capacity
+static MaterialType volume_materials[] = {
+    {.name = "Large Box", .weight = 200.0, .volume = 1.2f, .quantity = 1000000},
+    {.name = "Medium Box", .weight = 150.0, .volume = 0.8f, .quantity = 1000000},
+    {.name = "Small Box", .weight = 100.0, .volume = 0.4f, .quantity = 1000000},
+    {.name = "Foam Panels", .weight = 20.0, .volume = 0.8f, .quantity = 1000000},
+    {.name = "Pallet", .weight = 400.0, .volume = 1.5f, .slots = 1, .quantity = 1000000},
+    {.name = "Bale", .weight = 33.3f, .volume = 0.3f, .quantity = 1000000}};
+#define VOLUME_MATERIAL_COUNT ((int)(sizeof(volume_materials) / sizeof(MaterialType)))
+
+static int within_capacity(Train *train)
+{
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next)
+    {
+        if (wagon->current_weight > wagon->max_weight + FIT_EPSILON ||
+            (wagon->max_volume > 0 && wagon->current_volume > wagon->max_volume + FIT_EPSILON) ||
+            (wagon->max_slots > 0 && wagon->used_slots > wagon->max_slots))
+        {
+            fprintf(stderr, "wagon %d over capacity: %.6f/%.2f kg, %.6f/%.2f m3, %d/%d slots\n", get_wagon_id(wagon),
+                    wagon->current_weight, wagon->max_weight, wagon->current_volume, wagon->max_volume,
+                    wagon->used_slots, wagon->max_slots);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Loads from the head and into a class in wagons with volume and slot limits: they must place the
+// units the estimate made before them placed and fill no wagon past its capacity. A load into one
+// wagon that stops short must leave no room for another unit. Returns 0 at the first difference
+static int volume_round(long steps)
+{
+    static const struct {
+        const char *name;
+        float max_weight, max_volume;
+        int max_slots;
+    } fleet[] = {{"Standard", 1000, 10, 2}, {"Light", 500, 6, 1}, {"Heavy", 2000, 16, 4}};
+
+    WagonClassTable *wagon_classes = create_wagon_class_table();
+    for (int i = 0; i < (int)(sizeof(fleet) / sizeof(fleet[0])); i++)
+    {
+        WagonClass *wagon_class = add_wagon_class(wagon_classes, fleet[i].name, fleet[i].max_weight);
+        wagon_class->max_volume = fleet[i].max_volume;
+        wagon_class->max_slots = fleet[i].max_slots;
+    }
+    Train *train = create_train(wagon_classes);
+    LoadEstimate estimate;
+    init_load_estimate(&estimate);
+    int *before = NULL, capacity = 0;
+    int ok = 1;
+
+    for (long step = 1; step <= steps && ok; step++)
+    {
+        MaterialType *material = &volume_materials[random_between(0, VOLUME_MATERIAL_COUNT - 1)];
+        int quantity = random_between(1, 40);
+        int op = random_between(0, 99);
+
+        if (op < 50)
+        {
+            WagonClass *wagon_class = op < 15 ? wagon_classes->classes[random_between(0, wagon_classes->count - 1)] : NULL;
+            reset_load_estimate(&estimate);
+            estimate_load(train, &estimate, material, quantity, wagon_class);
+            int wagons_before = train->wagon_count;
+            units_per_wagon(train, material, &before, &capacity);
+            int loaded = wagon_class ? load_material_to_class(train, material, quantity, wagon_class)
+                                     : load_specified_material_to_train(train, material, quantity);
+            ok = compare_estimate(train, &estimate, material, loaded, before, wagons_before, 1);
+        }
+        else if (op < 70 && train->wagon_count > 0)
+        {
+            int wagon_id = random_between(1, train->wagon_count);
+            int loaded = load_material_to_wagon(train, material, wagon_id, quantity);
+            Wagon *wagon = find_wagon_by_id(train, wagon_id);
+            if (loaded < quantity && check_wagon_space(wagon, material))
+            {
+                fprintf(stderr, "wagon %d stopped at %d of %d %s with room for more\n", wagon_id, loaded, quantity,
+                        material->name);
+                ok = 0;
+            }
+        }
+        else if (op < 99 && train->wagon_count > 0)
+        {
+            Wagon *wagon = find_wagon_by_id(train, random_between(1, train->wagon_count));
+            if (wagon->loaded_materials)
+                unload_material_from_wagon(wagon, wagon->loaded_materials->type, quantity);
+        }
+        else
+        {
+            empty_entire_train(train);
+        }
+
+        if (ok && !within_capacity(train))
+            ok = 0;
+        if (!ok)
+            fprintf(stderr, "MISMATCH at volume step %ld: %s quantity=%d\n", step, material->name, quantity);
+    }
+
+    free_load_estimate(&estimate);
+    free(before);
+    destroy_train(train);
+    destroy_wagon_class_table(wagon_classes);
+    return ok;
+}
+
+static char *read_file(const char *filename, size_t *length);
+
+// Saves the train and returns the bytes, freed by the caller
+static char *saved_bytes(Train *train, const char *scratch, size_t *length)
+{
+    save_train_status_to_file(train, scratch);
+    return read_file(scratch, length);
+}
+
+static int same_bytes(const char *a, size_t a_length, const char *b, size_t b_length)
+{
+    return a && b && a_length == b_length && memcmp(a, b, a_length) == 0;
+}
+
+// Loads for stations, loads from the head and into one wagon, emptied wagons, station stops,
+// unloads from a wagon and emptied trains, each undone and redone: the file saved after the undo must be the one saved
+// before the operation and the file saved after the redo the one saved after it, so the units must
+// come back in their places among units of the same weight. Returns 0 at the first difference
+static int undo_round(long steps, const char *scratch, WagonClassTable *wagon_classes)
+{
+    static const char *names[] = {"station_load", "load_head", "load_wagon", "empty_wagon", "station_stop",
+                                  "unload_wagon", "empty_train"};
+    // Stock of its own, the first rounds keep the shared materials loaded
+    MaterialType stock[MATERIAL_COUNT];
+    memcpy(stock, materials, sizeof(stock));
+    for (int i = 0; i < MATERIAL_COUNT; i++)
+    {
+        stock[i].quantity = 1000000;
+        stock[i].loaded = 0;
+    }
+    Train *train = create_train(wagon_classes);
+    enable_history(train);
+    int ok = 1;
+
+    for (long step = 1; step <= steps && ok; step++)
+    {
+        MaterialType *material = &stock[random_between(0, MATERIAL_COUNT - 1)];
+        int quantity = random_between(1, 60);
+        int station = random_between(1, 4), wagons_touched;
+        int wagon_id = train->wagon_count > 0 ? random_between(1, train->wagon_count) : 1;
+        int op = random_between(0, 99);
+        op = op < 35 ? 0 : op < 50 ? 1 : op < 65 ? 2 : op < 75 ? 3 : op < 85 ? 4 : 5;
+        if (train->wagon_count > 30) // keeps the saves short
+            op = 6;
+
+        size_t before_length = 0, after_length = 0, length = 0;
+        char *before = saved_bytes(train, scratch, &before_length);
+        switch (op)
+        {
+        case 0:
+            load_material_for_station(train, material, quantity, station);
+            break;
+        case 1:
+            load_specified_material_to_train(train, material, quantity);
+            break;
+        case 2:
+            load_material_to_wagon(train, material, wagon_id, quantity);
+            break;
+        case 3:
+            empty_wagon_by_id(train, wagon_id);
+            break;
+        case 4:
+            station_stop(train, station, &wagons_touched);
+            break;
+        case 5:
+            if (train->wagon_count > 0)
+            {
+                Wagon *wagon = find_wagon_by_id(train, wagon_id);
+                begin_operation(train, "Unload material from wagon");
+                unload_material_from_wagon(wagon, material, quantity);
+                delete_empty_wagons(train);
+                end_operation(train);
+            }
+            break;
+        default:
+            empty_entire_train(train);
+            break;
+        }
+        char *after = saved_bytes(train, scratch, &after_length);
+
+        // Operations that changed nothing may record nothing
+        if (!same_bytes(before, before_length, after, after_length))
+        {
+            int undone = undo_last_operation(train);
+            char *bytes = saved_bytes(train, scratch, &length);
+            if (!undone || !same_bytes(bytes, length, before, before_length))
+            {
+                fprintf(stderr, "undo of %s does not give back the train saved before it\n", names[op]);
+                ok = 0;
+            }
+            free(bytes);
+            if (ok)
+            {
+                int redone = redo_last_operation(train);
+                bytes = saved_bytes(train, scratch, &length);
+                if (!redone || !same_bytes(bytes, length, after, after_length))
+                {
+                    fprintf(stderr, "redo of %s does not give back the train saved after it\n", names[op]);
+                    ok = 0;
+                }
+                free(bytes);
+            }
+        }
+        if (!ok)
+            fprintf(stderr, "MISMATCH at undo step %ld: %s material=%s wagon=%d station=%d quantity=%d\n", step,
+                    names[op], material->name, wagon_id, station, quantity);
+        free(before);
+        free(after);
+    }
+
+    destroy_train(train);
+    return ok;
+}
+
+static int close_enough(double a, double b)
+{
+    return fabs(a - b) <= 1e-6 * (fabs(a) + fabs(b)) + 1e-3;
+}
+
+// Range weight, centre of mass and heaviest window against sums over the reference
+static int compare_weight_distribution(Train *train, RefTrain *ref)
+{
+    int count = ref->wagon_count;
+    if (count == 0)
+        return 1;
+
+    int first = random_between(1, count), last = random_between(first, count);
+    int window = random_between(1, count);
+    double range = 0, total = 0, moment = 0, best = -1;
+    int best_first = 0;
+    double *loads = (double *)malloc(sizeof(double) * count);
+
+    int position = 0;
+    for (RefWagon *wagon = ref->first_wagon; wagon; wagon = wagon->next, position++)
+    {
+        loads[position] = wagon->current_weight;
+        total += wagon->current_weight;
+        moment += (position + 1) * (double)wagon->current_weight;
+        if (position + 1 >= first && position + 1 <= last)
+            range += wagon->current_weight;
+    }
+    for (int start = 0; start + window <= count; start++)
+    {
+        double sum = 0;
+        for (int i = start; i < start + window; i++)
+            sum += loads[i];
+        if (sum > best + 1e-6)
+        {
+            best = sum;
+            best_first = start + 1;
+        }
+    }
+    free(loads);
+
+    double centre, heaviest;
+    int heaviest_first;
+    int has_centre = centre_of_mass(train, &centre);
+    if (!close_enough(range_weight(train, first, last), range) || has_centre != (total > 0) ||
+        (has_centre && !close_enough(centre, moment / total)) ||
+        !heaviest_window(train, window, &heaviest_first, &heaviest) || !close_enough(heaviest, best))
+    {
+        fprintf(stderr, "weight distribution: range %d-%d %.2f, centre %.4f, heaviest %d -> %d %.2f; engine %.2f, %.4f, %d %.2f\n",
+                first, last, range, total > 0 ? moment / total : 0, window, best_first, best,
+                range_weight(train, first, last), has_centre ? centre : 0, heaviest_first, heaviest);
+        return 0;
+    }
+    return 1;
+}
+
+// Compare the two trains, print the first difference. Returns 1 if they match
+static int compare_state(Train *train, RefTrain *ref)
+{
+    if (train->wagon_count != ref->wagon_count)
+    {
+        fprintf(stderr, "wagon count: engine %d, reference %d\n", train->wagon_count, ref->wagon_count);
+        return 0;
+    }
+
+    int carriers[MATERIAL_COUNT] = {0};
+    Wagon *wagon = train->first_wagon;
+    RefWagon *ref_wagon = ref->first_wagon;
+    for (; wagon && ref_wagon; wagon = wagon->next, ref_wagon = ref_wagon->next)
+    {
+        if (get_wagon_id(wagon) != ref_wagon->wagon_id || wagon->max_weight != ref_wagon->max_weight ||
+            wagon->current_weight != ref_wagon->current_weight)
+        {
+            fprintf(stderr, "wagon %d: engine id %d weight %.4f/%.2f, reference id %d weight %.4f/%.2f\n",
+                    ref_wagon->wagon_id, get_wagon_id(wagon), wagon->current_weight, wagon->max_weight,
+                    ref_wagon->wagon_id, ref_wagon->current_weight, ref_wagon->max_weight);
+            return 0;
+        }
+
+        LoadedMaterial *unit = wagon->loaded_materials;
+        RefUnit *ref_unit = ref_wagon->units;
+        int position = 0;
+        for (; unit && ref_unit; unit = unit->next, ref_unit = ref_unit->next, position++)
+        {
+            if (strcmp(unit->type->name, ref_unit->type->name) != 0)
+            {
+                fprintf(stderr, "wagon %d unit %d: engine %s, reference %s\n", get_wagon_id(wagon), position,
+                        unit->type->name, ref_unit->type->name);
+                return 0;
+            }
+        }
+        if (unit || ref_unit)
+        {
+            fprintf(stderr, "wagon %d: different number of units\n", get_wagon_id(wagon));
+            return 0;
+        }
+
+        // Every material in the wagon has one cargo entry with its units
+        int units[MATERIAL_COUNT] = {0}, indexed = 0;
+        for (unit = wagon->loaded_materials; unit; unit = unit->next)
+            units[unit->type - materials]++;
+        for (WagonCargo *cargo = wagon->cargo; cargo; cargo = cargo->next_in_wagon)
+        {
+            int m = cargo->material - materials;
+            if (cargo->wagon != wagon || cargo->units != units[m] || units[m] == 0)
+            {
+                fprintf(stderr, "wagon %d has %d units of %s, %d indexed\n", get_wagon_id(wagon), units[m],
+                        cargo->material->name, cargo->units);
+                return 0;
+            }
+            indexed++;
+            carriers[m]++;
+        }
+        for (int i = 0; i < MATERIAL_COUNT; i++)
+            indexed -= units[i] > 0;
+        if (indexed != 0)
+        {
+            fprintf(stderr, "wagon %d: materials missing from its cargo\n", get_wagon_id(wagon));
+            return 0;
+        }
+        if (!wagon->next && train->last_wagon != wagon)
+        {
+            fprintf(stderr, "wagon %d is the tail but not the train's last wagon\n", get_wagon_id(wagon));
+            return 0;
+        }
+    }
+    if (wagon || ref_wagon)
+    {
+        fprintf(stderr, "wagon lists have different lengths\n");
+        return 0;
+    }
+    if (!train->first_wagon && train->last_wagon)
+    {
+        fprintf(stderr, "empty train with a last wagon\n");
+        return 0;
+    }
+
+    for (int i = 0; i < MATERIAL_COUNT; i++)
+    {
+        if (materials[i].loaded != ref_materials[i].loaded)
+        {
+            fprintf(stderr, "%s loaded: engine %d, reference %d\n", materials[i].name, materials[i].loaded,
+                    ref_materials[i].loaded);
+            return 0;
+        }
+        if (materials[i].carrier_count != carriers[i])
+        {
+            fprintf(stderr, "%s carried by %d wagons, %d indexed\n", materials[i].name, carriers[i],
+                    materials[i].carrier_count);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static char *read_file(const char *filename, size_t *length)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = (char *)malloc(size + 1);
+    *length = fread(data, 1, size, file);
+    fclose(file);
+    return data;
+}
+
+// Compare save_train_status_to_file with the reference writer byte for byte
+static int compare_saved_bytes(Train *train, RefTrain *ref, const char *scratch)
+{
+    char *ref_bytes = NULL;
+    size_t ref_length = 0, length = 0;
+
+    FILE *stream = open_memstream(&ref_bytes, &ref_length);
+    ref_save(ref, stream);
+    fclose(stream);
+
+    save_train_status_to_file(train, scratch);
+    char *bytes = read_file(scratch, &length);
+
+    int same = bytes && length == ref_length && memcmp(bytes, ref_bytes, length) == 0;
+    if (!same)
+    {
+        size_t offset = 0;
+        while (bytes && offset < length && offset < ref_length && bytes[offset] == ref_bytes[offset])
+            offset++;
+        fprintf(stderr, "saved file differs at byte %zu (engine %zu bytes, reference %zu bytes)\n", offset, length,
+                ref_length);
+    }
+    free(bytes);
+    free(ref_bytes);
+    return same;
+}
+
+// Load the saved file in many small ranges on several threads into a fresh train and catalog,
+// save it again and compare the bytes and the loaded counts
+static int compare_reloaded(const char *scratch, WagonClassTable *wagon_classes)
+{
+    char reloaded[80];
+    snprintf(reloaded, sizeof(reloaded), "%s.reload", scratch);
+
+    int saved_threads = file_threads, saved_range_wagons = file_range_wagons;
+    file_threads = 4;
+    file_range_wagons = 1;
+    MaterialCatalog *catalog = create_catalog();
+    Train *train = create_train(wagon_classes);
+    load_train_status_from_file(train, scratch, catalog);
+    save_train_status_to_file(train, reloaded);
+    file_threads = saved_threads;
+    file_range_wagons = saved_range_wagons;
+
+    size_t length = 0, reloaded_length = 0;
+    char *bytes = read_file(scratch, &length);
+    char *reloaded_bytes = read_file(reloaded, &reloaded_length);
+    int same = bytes && reloaded_bytes && length == reloaded_length && memcmp(bytes, reloaded_bytes, length) == 0;
+    if (!same)
+        fprintf(stderr, "reloaded file differs (saved %zu bytes, reloaded %zu bytes)\n", length, reloaded_length);
+
+    for (int i = 0; same && i < MATERIAL_COUNT; i++)
+    {
+        MaterialType *material = find_material(catalog, materials[i].name);
+        int loaded = material ? material->loaded : 0;
+        if (loaded != ref_materials[i].loaded)
+        {
+            fprintf(stderr, "%s loaded after reload: engine %d, reference %d\n", materials[i].name, loaded,
+                    ref_materials[i].loaded);
+            same = 0;
+        }
+    }
+
+    destroy_train(train);
+    destroy_catalog(catalog);
+    free(bytes);
+    free(reloaded_bytes);
+    unlink(reloaded);
+    return same;
+}
+
+// Load the saved file into the same train several times in ranges on several threads: the peak
+// counts of units and wagons the worker threads add to must not grow from one load to the next
+static int reload_peak_stable(const char *scratch, WagonClassTable *wagon_classes, int loads)
+{
+    int saved_threads = file_threads, saved_range_wagons = file_range_wagons;
+    file_threads = 4;
+    file_range_wagons = 1;
+    MaterialCatalog *catalog = create_catalog();
+    Train *train = create_train(wagon_classes);
+    long peak_units = 0, peak_wagons = 0;
+    int stable = 1;
+
+    for (int load = 1; load <= loads && stable; load++)
+    {
+        load_train_status_from_file(train, scratch, catalog);
+        long units = get_memory_stats(MEM_LOADED_MATERIAL)->peak_objects;
+        long wagons = get_memory_stats(MEM_WAGON)->peak_objects;
+        if (load > 1 && (units != peak_units || wagons != peak_wagons))
+        {
+            fprintf(stderr, "peak after load %d: %ld units, %ld wagons, after the one before: %ld units, %ld wagons\n",
+                    load, units, wagons, peak_units, peak_wagons);
+            stable = 0;
+        }
+        peak_units = units;
+        peak_wagons = wagons;
+    }
+    file_threads = saved_threads;
+    file_range_wagons = saved_range_wagons;
+
+    destroy_train(train);
+    destroy_catalog(catalog);
+    return stable;
+}
+
+// Units per wagon position, kept up to date from the change events only
+typedef struct EventMirror {
+    Train *train; // read for the units of attached wagons
+    int *units;
+    int count, capacity;
+    int broken; // an event that does not fit the mirrored train
+} EventMirror;
+
+static void mirror_event(const TrainEvent *event, void *context)
+{
+    EventMirror *mirror = (EventMirror *)context;
+    int position = event->wagon_id - 1;
+
+    switch (event->type)
+    {
+    case EVENT_WAGON_CREATED:
+        if (position < 0 || position > mirror->count)
+        {
+            mirror->broken = 1;
+            return;
+        }
+        if (mirror->count == mirror->capacity)
+        {
+            mirror->capacity = mirror->capacity ? mirror->capacity * 2 : 64;
+            mirror->units = (int *)realloc(mirror->units, sizeof(int) * mirror->capacity);
+        }
+        memmove(&mirror->units[position + 1], &mirror->units[position], sizeof(int) * (mirror->count - position));
+        mirror->units[position] = 0;
+        mirror->count++;
+        break;
+    case EVENT_WAGON_DELETED:
+        // Units leave a wagon before the wagon does
+        if (position < 0 || position >= mirror->count || mirror->units[position] != 0)
+        {
+            mirror->broken = 1;
+            return;
+        }
+        memmove(&mirror->units[position], &mirror->units[position + 1], sizeof(int) * (mirror->count - position - 1));
+        mirror->count--;
+        break;
+    case EVENT_UNITS_ADDED:
+    case EVENT_UNITS_REMOVED:
+        if (position < 0 || position >= mirror->count)
+        {
+            mirror->broken = 1;
+            return;
+        }
+        mirror->units[position] += event->type == EVENT_UNITS_ADDED ? event->count : -event->count;
+        if (mirror->units[position] < 0)
+            mirror->broken = 1;
+        break;
+    case EVENT_WAGONS_RENUMBERED:
+        if (position < 0 || position + event->count != mirror->count)
+            mirror->broken = 1;
+        break;
+    case EVENT_TRAIN_RELOADED:
+        mirror->broken = 1; // never reloaded here
+        break;
+    case EVENT_WAGONS_DETACHED:
+        if (position < 0 || position + event->count != mirror->count)
+            mirror->broken = 1;
+        else
+            mirror->count = position;
+        break;
+    case EVENT_WAGONS_ATTACHED:
+    {
+        if (position != mirror->count)
+        {
+            mirror->broken = 1;
+            return;
+        }
+        int *units = (int *)realloc(mirror->units, sizeof(int) * (mirror->count + event->count));
+        mirror->units = units;
+        mirror->capacity = mirror->count + event->count;
+        Wagon *wagon = wagon_at_position(mirror->train, position);
+        for (int i = 0; i < event->count; i++, wagon = wagon->next)
+        {
+            units[position + i] = 0;
+            for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+                units[position + i]++;
+        }
+        mirror->count += event->count;
+        break;
+    }
+    }
+}
+
+static int compare_event_mirror(Train *train, const EventMirror *mirror)
+{
+    if (mirror->broken || mirror->count != train->wagon_count)
+    {
+        fprintf(stderr, "event feed: %s, %d wagons from events, %d in the train\n",
+                mirror->broken ? "inconsistent event" : "wagon count", mirror->count, train->wagon_count);
+        return 0;
+    }
+
+    int position = 0;
+    for (Wagon *wagon = train->first_wagon; wagon; wagon = wagon->next, position++)
+    {
+        int units = 0;
+        for (LoadedMaterial *unit = wagon->loaded_materials; unit; unit = unit->next)
+            units++;
+        if (units != mirror->units[position])
+        {
+            fprintf(stderr, "event feed: wagon %d has %d units, %d from events\n", get_wagon_id(wagon), units,
+                    mirror->units[position]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    long steps = 20000;
+    int save_every = 100, verbose = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+            steps = atol(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            rng_state = strtoull(argv[++i], NULL, 10) * 2 + 1;
+        else if (strcmp(argv[i], "--save-every") == 0 && i + 1 < argc)
+            save_every = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--verbose") == 0)
+            verbose = 1;
+        else
+        {
+            fprintf(stderr, "usage: %s [--steps N] [--seed N] [--save-every N] [--verbose]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char scratch[64];
+    snprintf(scratch, sizeof(scratch), "/tmp/train_difftest_%d.txt", (int)getpid());
+
+    for (int i = 0; i < MATERIAL_COUNT; i++)
+    {
+        strcpy(ref_materials[i].name, materials[i].name);
+        ref_materials[i].weight = materials[i].weight;
+        ref_materials[i].quantity = materials[i].quantity;
+        ref_materials[i].loaded = 0;
+    }
+
+    quiet_output = 1;
+    WagonClassTable *wagon_classes = create_default_wagon_classes();
+    Train *train = create_train(wagon_classes);
+    enable_history(train); // as in the program
+    enable_events(train);
+    EventMirror mirror = {train, NULL, 0, 0, 0};
+    subscribe_events(train, mirror_event, &mirror);
+    RefTrain *ref = ref_create_train(train->train_id);
+    siding = create_train(wagon_classes);
+
+    LoadEstimate estimate;
+    init_load_estimate(&estimate);
+    int *units_before = NULL, units_capacity = 0;
+
+    double engine_time = 0, reference_time = 0;
+    long op_counts[OP_COUNT] = {0};
+    int failed = 0;
+    long step_number;
+
+    for (step_number = 1; step_number <= steps; step_number++)
+    {
+        Step step = random_step(ref->wagon_count);
+        op_counts[step.op]++;
+
+        // Estimated before the load, from the state it starts from
+        int estimated = step.op == OP_LOAD_HEAD || step.op == OP_LOAD_BALANCED;
+        int wagons_before = train->wagon_count;
+        if (estimated)
+        {
+            reset_load_estimate(&estimate);
+            estimate_load(train, &estimate, &materials[step.material], step.quantity, NULL);
+            units_per_wagon(train, &materials[step.material], &units_before, &units_capacity);
+        }
+
+        double start = now_seconds();
+        int count = apply_real(train, &step);
+        double middle = now_seconds();
+        int ref_count = apply_reference(ref, &step);
+        double end = now_seconds();
+
+        engine_time += middle - start;
+        reference_time += end - middle;
+
+        if (verbose)
+            fprintf(stderr, "%ld: %s material=%d wagon=%d quantity=%d -> %d\n", step_number, op_names[step.op],
+                    step.material, step.wagon_id, step.quantity, count);
+
+        if (count != ref_count)
+        {
+            fprintf(stderr, "result: engine %d, reference %d\n", count, ref_count);
+            failed = 1;
+        }
+        else if (!compare_state(train, ref) || !compare_event_mirror(train, &mirror) || !check_lightest_heap(train) ||
+                 (estimated && !compare_estimate(train, &estimate, &materials[step.material], count, units_before,
+                                                 wagons_before, step.op == OP_LOAD_HEAD)))
+        {
+            failed = 1;
+        }
+        else if (save_every > 0 && (step_number % save_every == 0 || step_number == steps) &&
+                 (!compare_saved_bytes(train, ref, scratch) || !compare_reloaded(scratch, wagon_classes) ||
+                  !compare_weight_distribution(train, ref)))
+        {
+            failed = 1;
+        }
+
+        if (failed)
+        {
+            fprintf(stderr, "MISMATCH at step %ld: %s material=%s wagon=%d quantity=%d\n", step_number,
+                    op_names[step.op], materials[step.material].name, step.wagon_id, step.quantity);
+            break;
+        }
+    }
+
+    printf("steps=%ld result=%s\n", failed ? step_number : steps, failed ? "MISMATCH" : "OK");
+    // The last step saved the train
+    if (!failed && save_every > 0)
+    {
+        int reload_ok = reload_peak_stable(scratch, wagon_classes, 5);
+        printf("reloads=5 result=%s\n", reload_ok ? "OK" : "MISMATCH");
+        failed = !reload_ok;
+    }
+    if (!failed)
+    {
+        int volume_ok = volume_round(steps / 4);
+        printf("volume_steps=%ld result=%s\n", steps / 4, volume_ok ? "OK" : "MISMATCH");
+        failed = !volume_ok;
+    }
+    if (!failed)
+    {
+        int undo_ok = undo_round(steps / 4, scratch, wagon_classes);
+        printf("undo_steps=%ld result=%s\n", steps / 4, undo_ok ? "OK" : "MISMATCH");
+        failed = !undo_ok;
+    }
+    printf("operations:");
+    for (int i = 0; i < OP_COUNT; i++)
+        printf(" %s=%ld", op_names[i], op_counts[i]);
+    printf("\n");
+    printf("engine_seconds=%.6f reference_seconds=%.6f speedup=%.2fx\n", engine_time, reference_time,
+           engine_time > 0 ? reference_time / engine_time : 0.0);
+
+    destroy_train(siding);
+    destroy_train(train);
+    destroy_wagon_class_table(wagon_classes);
+    free(mirror.units);
+    free_load_estimate(&estimate);
+    free(units_before);
+    ref_destroy_train(ref);
+    unlink(scratch);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+// loadgen.c - load generator for program --server
+//
+// usage: loadgen [-a address] [-c connections] [-n requests] [-d depth]
+//
+// Opens the given number of connections and keeps up to depth requests in
+// flight on each (pipelining). Reports requests/sec and latency percentiles.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_EVENTS 64
+#define MAX_DEPTH 1024
+
+// Request mix, sent round robin. Loads and unloads cancel out
+static const char *request_mix[] = {"LOAD 1 1", "STATUS", "UNLOAD 1 1", "WAGON 1", "LOAD 3 2", "MATERIALS",
+                                    "UNLOAD 3 2", "PING"};
+#define REQUEST_MIX_COUNT (sizeof(request_mix) / sizeof(request_mix[0]))
+
+typedef struct Client {
+    int fd;
+    long sent, received, quota;
+    double send_times[MAX_DEPTH]; // ring of send timestamps of requests in flight
+    char output[MAX_DEPTH * 16];
+    size_t output_length;
+    char input[65536];
+    size_t input_length;
+} Client;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(const char *address)
+{
+    int fd;
+
+    if (strncmp(address, "tcp:", 4) == 0)
+    {
+        struct sockaddr_in addr;
+        int one = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)atoi(address + 4));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            return -1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    else
+    {
+        struct sockaddr_un addr;
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, long count, double p)
+{
+    if (count == 0)
+        return 0;
+    long index = (long)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+// Queue requests until depth are in flight, then write what the socket accepts
+static int fill_and_send(Client *client, int depth)
+{
+    while (client->sent < client->quota && client->sent - client->received < depth)
+    {
+        const char *request = request_mix[client->sent % REQUEST_MIX_COUNT];
+        size_t length = strlen(request);
+        if (client->output_length + length + 1 > sizeof(client->output))
+            break;
+
+        memcpy(client->output + client->output_length, request, length);
+        client->output_length += length;
+        client->output[client->output_length++] = '\n';
+        client->send_times[client->sent % MAX_DEPTH] = now_seconds();
+        client->sent++;
+    }
+
+    size_t written = 0;
+    while (written < client->output_length)
+    {
+        ssize_t n = send(client->fd, client->output + written, client->output_length - written, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        written += (size_t)n;
+    }
+    memmove(client->output, client->output + written, client->output_length - written);
+    client->output_length -= written;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *address = "train.sock";
+    int connections = 4, depth = 16;
+    long total_requests = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:c:n:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a': address = optarg; break;
+        case 'c': connections = atoi(optarg); break;
+        case 'n': total_requests = atol(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-a address] [-c connections] [-n requests] [-d depth]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (connections < 1 || depth < 1 || depth > MAX_DEPTH || total_requests < connections)
+    {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    double *latencies = (double *)malloc(sizeof(double) * total_requests);
+    Client *clients = (Client *)calloc(connections, sizeof(Client));
+    int epoll_fd = epoll_create1(0);
+    if (!latencies || !clients || epoll_fd < 0)
+    {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+
+    for (int i = 0; i < connections; i++)
+    {
+        clients[i].fd = connect_to(address);
+        if (clients[i].fd < 0)
+        {
+            fprintf(stderr, "cannot connect to %s: %s\n", address, strerror(errno));
+            return 1;
+        }
+        clients[i].quota = total_requests / connections + (i < total_requests % connections ? 1 : 0);
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.ptr = &clients[i];
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].fd, &event);
+    }
+
+    long completed = 0, errors = 0;
+    double start = now_seconds();
+
+    for (int i = 0; i < connections; i++)
+        fill_and_send(&clients[i], depth);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (completed < total_requests)
+    {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, 5000);
+        if (ready <= 0)
+        {
+            if (ready < 0 && errno == EINTR)
+                continue;
+            fprintf(stderr, "server stopped responding\n");
+            return 1;
+        }
+
+        for (int e = 0; e < ready; e++)
+        {
+            Client *client = (Client *)events[e].data.ptr;
+
+            if (events[e].events & EPOLLIN)
+            {
+                ssize_t n = recv(client->fd, client->input + client->input_length,
+                                 sizeof(client->input) - client->input_length, 0);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+                {
+                    fprintf(stderr, "connection closed by server\n");
+                    return 1;
+                }
+                if (n > 0)
+                    client->input_length += (size_t)n;
+
+                double received_at = now_seconds();
+                size_t start_of_line = 0;
+                char *newline;
+                while ((newline = memchr(client->input + start_of_line, '\n',
+                                         client->input_length - start_of_line)) != NULL)
+                {
+                    if (strncmp(client->input + start_of_line, "ERR", 3) == 0)
+                        errors++;
+                    latencies[completed++] = received_at - client->send_times[client->received % MAX_DEPTH];
+                    client->received++;
+                    start_of_line = (size_t)(newline - client->input) + 1;
+                }
+                memmove(client->input, client->input + start_of_line, client->input_length - start_of_line);
+                client->input_length -= start_of_line;
+            }
+
+            if (fill_and_send(client, depth) < 0)
+            {
+                fprintf(stderr, "send failed: %s\n", strerror(errno));
+                return 1;
+            }
+
+            struct epoll_event event;
+            event.events = client->output_length > 0 ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            event.data.ptr = client;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+    qsort(latencies, completed, sizeof(double), compare_doubles);
+
+    printf("requests=%ld connections=%d depth=%d seconds=%.3f requests_per_sec=%.0f errors=%ld\n",
+           completed, connections, depth, elapsed, completed / elapsed, errors);
+    printf("latency_us p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+           percentile(latencies, completed, 0.50) * 1e6, percentile(latencies, completed, 0.90) * 1e6,
+           percentile(latencies, completed, 0.99) * 1e6, percentile(latencies, completed, 0.999) * 1e6,
+           latencies[completed - 1] * 1e6);
+
+    for (int i = 0; i < connections; i++)
+    {
+        send(clients[i].fd, "QUIT\n", 5, MSG_NOSIGNAL);
+        close(clients[i].fd);
+    }
+    free(clients);
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,312 @@
+// reference_engine.c - see reference_engine.h
+#include <stdlib.h>
+#include <string.h>
+#include "reference_engine.h"
+
+static void *ref_alloc(size_t size)
+{
+    void *ptr = calloc(1, size);
+    if (!ptr)
+    {
+        fprintf(stderr, "reference engine: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+RefTrain *ref_create_train(const char *train_id)
+{
+    RefTrain *train = (RefTrain *)ref_alloc(sizeof(RefTrain));
+    snprintf(train->train_id, sizeof(train->train_id), "%s", train_id);
+    return train;
+}
+
+void ref_destroy_train(RefTrain *train)
+{
+    ref_empty_train(train);
+    free(train);
+}
+
+static RefWagon *ref_create_wagon(RefTrain *train)
+{
+    RefWagon *wagon = (RefWagon *)ref_alloc(sizeof(RefWagon));
+    wagon->wagon_id = train->wagon_count + 1;
+    wagon->max_weight = 1000.0;
+
+    if (!train->first_wagon)
+    {
+        train->first_wagon = wagon;
+    }
+    else
+    {
+        RefWagon *last = train->first_wagon;
+        while (last->next)
+            last = last->next;
+        last->next = wagon;
+        wagon->prev = last;
+    }
+    train->wagon_count++;
+    return wagon;
+}
+
+RefWagon *ref_find_wagon(RefTrain *train, int wagon_id)
+{
+    RefWagon *wagon = train->first_wagon;
+    while (wagon && wagon->wagon_id != wagon_id)
+        wagon = wagon->next;
+    return wagon;
+}
+
+// Light units on top: insert before the first heavier unit
+static void ref_insert(RefWagon *wagon, RefMaterial *material)
+{
+    RefUnit *unit = (RefUnit *)ref_alloc(sizeof(RefUnit));
+    unit->type = material;
+
+    RefUnit *current = wagon->units, *last = NULL;
+    while (current && current->type->weight <= material->weight)
+    {
+        last = current;
+        current = current->next;
+    }
+
+    unit->prev = last;
+    unit->next = current;
+    if (last)
+        last->next = unit;
+    else
+        wagon->units = unit;
+    if (current)
+        current->prev = unit;
+
+    wagon->current_weight += material->weight;
+    material->loaded++;
+}
+
+static void ref_remove(RefWagon *wagon, RefUnit *unit)
+{
+    if (unit->prev)
+        unit->prev->next = unit->next;
+    else
+        wagon->units = unit->next;
+    if (unit->next)
+        unit->next->prev = unit->prev;
+
+    wagon->current_weight -= unit->type->weight;
+    unit->type->loaded--;
+    free(unit);
+}
+
+static int ref_remove_matching(RefWagon *wagon, RefMaterial *material, int quantity)
+{
+    int removed = 0;
+    RefUnit *unit = wagon->units;
+
+    while (unit && removed < quantity)
+    {
+        RefUnit *next = unit->next;
+        if (strcmp(unit->type->name, material->name) == 0)
+        {
+            ref_remove(wagon, unit);
+            removed++;
+        }
+        unit = next;
+    }
+    return removed;
+}
+
+int ref_load_from_head(RefTrain *train, RefMaterial *material, int quantity)
+{
+    if (quantity <= 0 || quantity > material->quantity - material->loaded)
+        return 0;
+
+    int remaining = quantity;
+    RefWagon *wagon = train->first_wagon;
+    while (remaining > 0)
+    {
+        if (!wagon)
+            wagon = ref_create_wagon(train);
+        while (remaining > 0 && wagon->max_weight - wagon->current_weight >= material->weight)
+        {
+            ref_insert(wagon, material);
+            remaining--;
+        }
+        wagon = wagon->next;
+    }
+    return quantity;
+}
+
+// Each unit into the lightest wagon with room, the first one on ties. When no wagon has room,
+// wagons are added until they take the rest
+int ref_load_balanced(RefTrain *train, RefMaterial *material, int quantity)
+{
+    if (quantity <= 0 || quantity > material->quantity - material->loaded)
+        return 0;
+
+    for (int remaining = quantity; remaining > 0; remaining--)
+    {
+        RefWagon *lightest = NULL;
+        for (RefWagon *wagon = train->first_wagon; wagon; wagon = wagon->next)
+        {
+            if (wagon->max_weight - wagon->current_weight >= material->weight &&
+                (!lightest || wagon->current_weight < lightest->current_weight))
+                lightest = wagon;
+        }
+
+        if (!lightest)
+        {
+            lightest = ref_create_wagon(train);
+            for (int room = (int)(lightest->max_weight / material->weight); room < remaining;)
+                room += (int)(ref_create_wagon(train)->max_weight / material->weight);
+        }
+        ref_insert(lightest, material);
+    }
+    return quantity;
+}
+
+int ref_load_to_wagon(RefTrain *train, RefMaterial *material, int wagon_id, int quantity)
+{
+    RefWagon *wagon = ref_find_wagon(train, wagon_id);
+    if (!wagon)
+        return 0;
+
+    int remaining = quantity;
+    while (remaining > 0 && wagon->max_weight - wagon->current_weight >= material->weight)
+    {
+        ref_insert(wagon, material);
+        remaining--;
+    }
+    return quantity - remaining;
+}
+
+void ref_delete_empty_wagons(RefTrain *train)
+{
+    RefWagon *wagon = train->first_wagon, *previous = NULL;
+    int wagon_id = 1;
+
+    while (wagon)
+    {
+        RefWagon *next = wagon->next;
+        if (wagon->current_weight == 0 && wagon->units == NULL)
+        {
+            if (previous)
+                previous->next = next;
+            else
+                train->first_wagon = next;
+            if (next)
+                next->prev = previous;
+            free(wagon);
+            train->wagon_count--;
+        }
+        else
+        {
+            wagon->wagon_id = wagon_id++;
+            previous = wagon;
+        }
+        wagon = next;
+    }
+}
+
+int ref_unload_from_tail(RefTrain *train, RefMaterial *material, int quantity)
+{
+    if (!train->first_wagon)
+        return 0;
+
+    RefWagon *wagon = train->first_wagon;
+    while (wagon->next)
+        wagon = wagon->next;
+
+    // Only the wagons this empties are deleted
+    int remaining = quantity;
+    while (wagon && remaining > 0)
+    {
+        RefWagon *previous = wagon->prev;
+        int removed = ref_remove_matching(wagon, material, remaining);
+        remaining -= removed;
+        if (removed > 0 && wagon->current_weight == 0 && wagon->units == NULL)
+        {
+            if (previous)
+                previous->next = wagon->next;
+            else
+                train->first_wagon = wagon->next;
+            if (wagon->next)
+                wagon->next->prev = previous;
+            free(wagon);
+            train->wagon_count--;
+        }
+        wagon = previous;
+    }
+
+    int wagon_id = 1;
+    for (wagon = train->first_wagon; wagon; wagon = wagon->next)
+        wagon->wagon_id = wagon_id++;
+    return quantity - remaining;
+}
+
+int ref_unload_from_wagon(RefTrain *train, RefMaterial *material, int wagon_id, int quantity)
+{
+    RefWagon *wagon = ref_find_wagon(train, wagon_id);
+    if (!wagon)
+        return 0;
+
+    int removed = ref_remove_matching(wagon, material, quantity);
+    ref_delete_empty_wagons(train);
+    return removed;
+}
+
+int ref_empty_wagon(RefTrain *train, int wagon_id)
+{
+    RefWagon *wagon = ref_find_wagon(train, wagon_id);
+    if (!wagon)
+        return 0;
+
+    while (wagon->units)
+        ref_remove(wagon, wagon->units);
+    wagon->current_weight = 0;
+    ref_delete_empty_wagons(train);
+    return 1;
+}
+
+void ref_empty_train(RefTrain *train)
+{
+    RefWagon *wagon = train->first_wagon;
+    while (wagon)
+    {
+        RefWagon *next = wagon->next;
+        while (wagon->units)
+            ref_remove(wagon, wagon->units);
+        free(wagon);
+        wagon = next;
+    }
+    train->first_wagon = NULL;
+    train->wagon_count = 0;
+}
+
+// Same bytes as save_train_status_to_file
+void ref_save(RefTrain *train, FILE *file)
+{
+    fprintf(file, "Train ID: %s\n", train->train_id);
+    if (!train->first_wagon)
+    {
+        fprintf(file, "Total Wagons: 0\n");
+        fprintf(file, "The train is empty.\n");
+        return;
+    }
+
+    fprintf(file, "Total Wagons: %d\n", train->wagon_count);
+    for (RefWagon *wagon = train->first_wagon; wagon; wagon = wagon->next)
+    {
+        fprintf(file, "\nWagon ID: %d\n", wagon->wagon_id);
+        fprintf(file, "  Max Weight: %.2f kg\n", wagon->max_weight);
+        fprintf(file, "  Class: %s\n", "Standard"); // the engine's default class
+        fprintf(file, "  Current Weight: %.2f kg\n", wagon->current_weight);
+        if (!wagon->units)
+        {
+            fprintf(file, "  No materials loaded.\n");
+            continue;
+        }
+        fprintf(file, "  Loaded Materials:\n");
+        for (RefUnit *unit = wagon->units; unit; unit = unit->next)
+            fprintf(file, "    - %s: %.2f kg\n", unit->type->name, unit->type->weight);
+    }
+}
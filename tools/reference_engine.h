@@ -0,0 +1,53 @@
+#ifndef REFERENCE_ENGINE_H
+#define REFERENCE_ENGINE_H
+
+#include <stdio.h>
+
+/*
+ * Reference engine: the original per-unit linked list implementation of
+ * train.c/wagon.c, kept deliberately simple. tools/difftest.c runs the same
+ * random operations on it and on the real engine and compares the results.
+ */
+
+typedef struct RefMaterial {
+    char name[50];
+    float weight;
+    int quantity;
+    int loaded;
+} RefMaterial;
+
+typedef struct RefUnit {
+    RefMaterial *type;
+    struct RefUnit *next, *prev;
+} RefUnit;
+
+typedef struct RefWagon {
+    int wagon_id;
+    float max_weight;
+    float current_weight;
+    RefUnit *units;
+    struct RefWagon *next, *prev;
+} RefWagon;
+
+typedef struct RefTrain {
+    char train_id[20];
+    RefWagon *first_wagon;
+    int wagon_count;
+} RefTrain;
+
+RefTrain *ref_create_train(const char *train_id);
+void ref_destroy_train(RefTrain *train);
+RefWagon *ref_find_wagon(RefTrain *train, int wagon_id);
+
+int ref_load_from_head(RefTrain *train, RefMaterial *material, int quantity);
+int ref_load_balanced(RefTrain *train, RefMaterial *material, int quantity);
+int ref_load_to_wagon(RefTrain *train, RefMaterial *material, int wagon_id, int quantity);
+int ref_unload_from_tail(RefTrain *train, RefMaterial *material, int quantity);
+int ref_unload_from_wagon(RefTrain *train, RefMaterial *material, int wagon_id, int quantity);
+int ref_empty_wagon(RefTrain *train, int wagon_id);
+void ref_empty_train(RefTrain *train);
+void ref_delete_empty_wagons(RefTrain *train);
+
+void ref_save(RefTrain *train, FILE *file);
+
+#endif
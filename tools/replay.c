@@ -0,0 +1,233 @@
+// replay.c - replays a command trace recorded by program --server --trace
+//
+// usage: train_replay <trace> [--start <train file>] [--repeat N] [--verbose]
+//
+// Loads the train status saved when the trace was opened (<trace>.start
+// unless --start says otherwise) into a fresh engine with the catalog and
+// wagon classes of the current directory, then executes every recorded
+// command back to back, as fast as possible. Reports per command the
+// replay latency next to the latency recorded in production, and counts
+// the commands whose result differs from the recorded one. With --repeat
+// the whole trace runs again from a fresh engine each time. SAVE and
+// RELOAD use a scratch file, EXPORT and METRICS write to the current
+// directory as the server did. Exit status 0 same results, 1 divergent
+// results, 2 error or a trace damaged before its end.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/wagon.h"
+#include "../include/train.h"
+#include "../include/catalog.h"
+#include "../include/file_ops.h"
+#include "../include/history.h"
+#include "../include/events.h"
+#include "../include/command.h"
+#include "../include/trace.h"
+#include "../include/metrics.h"
+#include "../include/utils.h"
+
+#define REPLY_SIZE 4096 // as the server
+
+typedef struct Samples {
+    unsigned long long *values;
+    long count, capacity;
+} Samples;
+
+// Latencies of one command type
+typedef struct CommandStats {
+    Samples replayed, recorded;
+    long divergent;
+} CommandStats;
+
+static void add_sample(Samples *samples, unsigned long long value)
+{
+    if (samples->count == samples->capacity)
+    {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 256;
+        samples->values = realloc(samples->values, sizeof(unsigned long long) * samples->capacity);
+        if (!samples->values)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank, in microseconds. Sorts the samples
+static double percentile_us(Samples *samples, double p)
+{
+    if (samples->count == 0)
+        return 0;
+    qsort(samples->values, samples->count, sizeof(unsigned long long), compare_samples);
+    long rank = (long)(p * samples->count + 0.999999);
+    return samples->values[rank > 0 ? rank - 1 : 0] / 1e3;
+}
+
+static double total_ms(const Samples *samples)
+{
+    unsigned long long total = 0;
+    for (long i = 0; i < samples->count; i++)
+        total += samples->values[i];
+    return total / 1e6;
+}
+
+// One pass over the trace on a fresh engine. Returns the number of records replayed, -1 if it is not a trace.
+// A damaged trace, such as the tail of a server that was killed, is replayed up to the damage
+static long replay_once(const char *trace_file, const char *start_file, const char *scratch, CommandStats *stats,
+                        long *divergent, int *damaged, int verbose)
+{
+    TraceReader reader;
+    TraceRecord record;
+    char reply[REPLY_SIZE];
+
+    if (!open_trace_reader(&reader, trace_file))
+    {
+        fprintf(stderr, "%s is not a trace\n", trace_file);
+        return -1;
+    }
+
+    WagonClassTable *wagon_classes = load_wagon_classes_from_file(WAGON_CLASS_FILE);
+    if (!wagon_classes)
+        wagon_classes = create_default_wagon_classes();
+    MaterialCatalog *catalog = load_catalog_from_file(CATALOG_FILE);
+    if (!catalog)
+        catalog = create_default_catalog();
+
+    // As the program sets it up
+    Train *train = create_train(wagon_classes);
+    enable_history(train);
+    enable_events(train);
+    load_train_status_from_file(train, start_file, catalog);
+    save_train_status_to_file(train, scratch);
+
+    int result;
+    while ((result = read_trace_record(&reader, &record)) == 1)
+    {
+        unsigned long long start = metrics_now();
+        int ok = execute_command(train, catalog, scratch, &record.command, reply, sizeof(reply));
+        unsigned long long elapsed = metrics_now() - start;
+
+        CommandStats *entry = &stats[record.command.type];
+        add_sample(&entry->replayed, elapsed);
+        add_sample(&entry->recorded, record.duration_ns);
+        if (ok != record.ok)
+        {
+            entry->divergent++;
+            (*divergent)++;
+            if (verbose)
+                fprintf(stderr, "command %ld %s: %s, recorded %s\n", reader.records,
+                        command_name(record.command.type), reply, record.ok ? "OK" : "ERR");
+        }
+    }
+    long records = reader.records;
+    if (result < 0)
+    {
+        fprintf(stderr, "%s is damaged after %ld commands\n", trace_file, records);
+        *damaged = 1;
+    }
+
+    close_trace_reader(&reader);
+    destroy_train(train);
+    destroy_catalog(catalog);
+    destroy_wagon_class_table(wagon_classes);
+    return records;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *trace_file = NULL, *start_file = NULL;
+    char default_start[512];
+    int repeat = 1, verbose = 0, usage = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)
+            start_file = argv[++i];
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--verbose") == 0)
+            verbose = 1;
+        else if (!trace_file && argv[i][0] != '-')
+            trace_file = argv[i];
+        else
+            usage = 1;
+    }
+    if (usage || !trace_file || repeat < 1)
+    {
+        fprintf(stderr, "usage: %s <trace> [--start <train file>] [--repeat N] [--verbose]\n", argv[0]);
+        return 2;
+    }
+    if (!start_file)
+    {
+        snprintf(default_start, sizeof(default_start), "%s%s", trace_file, TRACE_START_SUFFIX);
+        start_file = default_start;
+    }
+    if (access(start_file, R_OK) != 0)
+    {
+        fprintf(stderr, "cannot read the starting train %s\n", start_file);
+        return 2;
+    }
+
+    char scratch[64];
+    snprintf(scratch, sizeof(scratch), "/tmp/train_replay_%d.txt", (int)getpid());
+
+    // Keep the report on stdout and send everything the commands print to /dev/null
+    FILE *out = fdopen(dup(fileno(stdout)), "w");
+    if (!out || !freopen("/dev/null", "w", stdout))
+    {
+        fprintf(stderr, "cannot redirect stdout\n");
+        return 2;
+    }
+    quiet_output = 1;
+
+    CommandStats stats[CMD_TYPE_COUNT];
+    memset(stats, 0, sizeof(stats));
+    long records = 0, divergent = 0;
+    int damaged = 0;
+
+    unsigned long long start = metrics_now();
+    for (int r = 0; r < repeat; r++)
+    {
+        long count = replay_once(trace_file, start_file, scratch, stats, &divergent, &damaged, verbose);
+        if (count < 0)
+        {
+            unlink(scratch);
+            return 2;
+        }
+        records += count;
+    }
+    double seconds = (metrics_now() - start) / 1e9;
+    unlink(scratch);
+
+    fprintf(out, "\n==========\nReplay of %s: %ld commands", trace_file, records);
+    if (repeat > 1)
+        fprintf(out, " in %d passes", repeat);
+    fprintf(out, ", %.3f s, %.0f commands/s\n==========\n", seconds, seconds > 0 ? records / seconds : 0.0);
+    fprintf(out, "%-10s %9s %11s %10s %10s %10s %12s %12s %9s\n", "Command", "Count", "Total ms", "p50 us",
+            "p99 us", "Max us", "Rec p50 us", "Rec p99 us", "Diverged");
+    for (int type = 0; type < CMD_TYPE_COUNT; type++)
+    {
+        CommandStats *entry = &stats[type];
+        if (entry->replayed.count == 0)
+            continue;
+        fprintf(out, "%-10s %9ld %11.3f %10.2f %10.2f %10.2f %12.2f %12.2f %9ld\n", command_name((CommandType)type),
+                entry->replayed.count, total_ms(&entry->replayed), percentile_us(&entry->replayed, 0.50),
+                percentile_us(&entry->replayed, 0.99), percentile_us(&entry->replayed, 1.0),
+                percentile_us(&entry->recorded, 0.50), percentile_us(&entry->recorded, 0.99), entry->divergent);
+        free(entry->replayed.values);
+        free(entry->recorded.values);
+    }
+    fprintf(out, "\n");
+    if (divergent)
+        fprintf(out, "%ld commands had a different result than recorded.\n\n", divergent);
+    fclose(out);
+    return damaged ? 2 : divergent ? 1 : 0;
+}